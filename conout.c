@@ -208,8 +208,18 @@ static void con_enablecolor(void) {
  * arguments.  This colorizes for windows as well via translate
  * step.
  */
+/* where the output of this thread goes instead, see con_capture_begin */
+static GMQCC_THREAD_LOCAL con_capture_t *con_captured = NULL;
+
 static int con_write(FILE *handle, const char *fmt, va_list va) {
     int      ln;
+    if (con_captured) {
+        con_output_t output;
+        output.handle = handle;
+        if ((ln = util_vasprintf(&output.text, fmt, va)) >= 0)
+            vec_push(con_captured->output, output);
+        return ln;
+    }
     #ifndef _WIN32
     ln = vfprintf(handle, fmt, va);
     #else
@@ -390,9 +400,57 @@ void compile_show_werrors()
     con_cprintmsg(first_werror, LVL_ERROR, "first warning", "was here");
 }
 
+static int con_print(FILE *handle, const char *fmt, ...) {
+    va_list  va;
+    int      ln;
+    va_start(va, fmt);
+    ln = con_write(handle, fmt, va);
+    va_end  (va);
+    return   ln;
+}
+
+void con_capture_begin(con_capture_t *capture)
+{
+    capture->output   = NULL;
+    capture->errors   = 0;
+    capture->warnings = 0;
+    capture->Werrors  = 0;
+    con_captured = capture;
+}
+
+void con_capture_end()
+{
+    con_captured = NULL;
+}
+
+void con_capture_free(con_capture_t *capture)
+{
+    size_t i;
+    for (i = 0; i < vec_size(capture->output); ++i)
+        mem_d(capture->output[i].text);
+    vec_free(capture->output);
+}
+
+void con_capture_replay(con_capture_t *capture)
+{
+    size_t i;
+    for (i = 0; i < vec_size(capture->output); ++i)
+        con_print(capture->output[i].handle, "%s", capture->output[i].text);
+    con_capture_free(capture);
+
+    if (capture->Werrors && !compile_Werrors)
+        first_werror = capture->first_werror;
+    compile_errors   += capture->errors;
+    compile_warnings += capture->warnings;
+    compile_Werrors  += capture->Werrors;
+}
+
 void vcompile_error(lex_ctx_t ctx, const char *msg, va_list ap)
 {
-    ++compile_errors;
+    if (con_captured)
+        ++con_captured->errors;
+    else
+        ++compile_errors;
     con_cvprintmsg(ctx, LVL_ERROR, "error", msg, ap);
 }
 
@@ -417,17 +475,28 @@ bool GMQCC_WARN vcompile_warning(lex_ctx_t ctx, int warntype, const char *fmt, v
     warn_name[1] = 'W';
     (void)util_strtononcmd(opts_warn_list[warntype].name, warn_name+2, sizeof(warn_name)-2);
 
-    ++compile_warnings;
-    if (OPTS_WERROR(warntype)) {
-        if (!compile_Werrors)
-            first_werror = ctx;
-        ++compile_Werrors;
-        msgtype = "Werror";
-        if (OPTS_FLAG(BAIL_ON_WERROR)) {
-            msgtype = "error";
-            ++compile_errors;
+    if (con_captured) {
+        ++con_captured->warnings;
+        if (OPTS_WERROR(warntype)) {
+            if (!con_captured->Werrors)
+                con_captured->first_werror = ctx;
+            ++con_captured->Werrors;
+            if (OPTS_FLAG(BAIL_ON_WERROR))
+                ++con_captured->errors;
         }
-        lvl = LVL_ERROR;
+    } else {
+        ++compile_warnings;
+        if (OPTS_WERROR(warntype)) {
+            if (!compile_Werrors)
+                first_werror = ctx;
+            ++compile_Werrors;
+            if (OPTS_FLAG(BAIL_ON_WERROR))
+                ++compile_errors;
+        }
+    }
+    if (OPTS_WERROR(warntype)) {
+        msgtype = OPTS_FLAG(BAIL_ON_WERROR) ? "error" : "Werror";
+        lvl     = LVL_ERROR;
     }
 
     con_vprintmsg_c(lvl, ctx.file, ctx.line, ctx.column, msgtype, fmt, ap, warn_name);
@@ -30,7 +30,157 @@
 
 #include "gmqcc.h"
 
-opts_cmd_t   opts; /* command line options */
+/* the profiler's clock, see prog_profile_clock */
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <time.h>
+#endif
+
+/*
+ * The threaded dispatch engine relies on label addresses (computed goto)
+ * which only GNU compatible compilers provide. Everything else, or a build
+ * with QCVM_NO_THREADED defined, gets the portable switch loop only.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(QCVM_NO_THREADED)
+#   define QCVM_THREADED 1
+static qc_exec_instr_t *prog_exec_threaded(qc_program_t *prog, qc_exec_instr_t *ip, long maxjumps, size_t stackbase, long *budgetp);
+static qc_exec_instr_t *prog_exec_threaded_profile(qc_program_t *prog, qc_exec_instr_t *ip, long maxjumps, size_t stackbase, long *budgetp);
+static qc_exec_instr_t *prog_exec_threaded_sample(qc_program_t *prog, qc_exec_instr_t *ip, long maxjumps, size_t stackbase, long *budgetp, long *samplewaitp);
+#endif
+
+static void prog_closures(qc_program_t *prog);
+static void prog_closure_generic(qc_exec_instr_t *ip);
+
+/*
+ * The vector instructions have SIMD versions where the compiler targets
+ * SSE2 for its float math, which is any x86-64. They give the same
+ * results bit for bit as the scalar instructions: every component is
+ * rounded on its own, and a dot product adds up in the same order. Three
+ * components don't gain anything from wider registers, so there are no
+ * versions for those. Defining QCVM_NO_SIMD leaves them out.
+ */
+#if !defined(QCVM_NO_SIMD) && \
+    ((defined(__SSE2__) && (defined(__x86_64__) || defined(__SSE2_MATH__))) || defined(_M_X64))
+#   define QCVM_SSE2 1
+#   include <emmintrin.h>
+#else
+#   define QCVM_SSE2 0
+#endif
+
+/*
+ * Handlers of the decoded instructions which aren't instructions of the
+ * progs. Keep the labels in the threaded loop in the same order.
+ */
+enum {
+    QCVM_OP_ILLEGAL = VINSTR_END,
+
+    /* superinstructions, see prog_fuse */
+    QCVM_OP_LOAD_F_STORE_F,
+    QCVM_OP_ADDRESS_STOREP_F,
+    QCVM_OP_MUL_F_ADD_F,
+    QCVM_OP_EQ_F_IFNOT,
+    QCVM_OP_NE_F_IFNOT,
+    QCVM_OP_LE_IFNOT,
+    QCVM_OP_GE_IFNOT,
+    QCVM_OP_LT_IFNOT,
+    QCVM_OP_GT_IFNOT,
+
+    /* calls of intrinsics, see prog_intrinsics */
+    QCVM_OP_CALL_INTRINSIC,
+
+    /* calls with their target proven valid, see prog_verify */
+    QCVM_OP_CALL_VERIFIED,
+
+    /* SIMD vector instructions, see prog_vectorize */
+    QCVM_OP_MUL_V_SIMD,
+    QCVM_OP_MUL_FV_SIMD,
+    QCVM_OP_MUL_VF_SIMD,
+    QCVM_OP_ADD_V_SIMD,
+    QCVM_OP_SUB_V_SIMD,
+    QCVM_OP_EQ_V_SIMD,
+    QCVM_OP_NE_V_SIMD,
+    QCVM_OP_NOT_V_SIMD,
+    QCVM_OP_STORE_V_SIMD,
+
+    QCVM_OP_COUNT
+};
+
+#if QCVM_SSE2
+/*
+ * A vector is loaded as 8 and 4 bytes, so nothing past its three
+ * components is read, leaving zero in the fourth lane.
+ */
+static GMQCC_INLINE __m128 qcvm_vec_load(const qcany_t *v) {
+    __m128i lo = _mm_loadl_epi64((const __m128i*)v);
+    __m128i hi = _mm_cvtsi32_si128(v->ivector[2]);
+    return _mm_castsi128_ps(_mm_unpacklo_epi64(lo, hi));
+}
+
+static GMQCC_INLINE void qcvm_vec_store(qcany_t *v, __m128 x) {
+    _mm_storel_epi64((__m128i*)v, _mm_castps_si128(x));
+    _mm_store_ss(&v->vector[2], _mm_movehl_ps(x, x));
+}
+
+static GMQCC_INLINE qcfloat_t qcvm_vec_dot(const qcany_t *a, const qcany_t *b) {
+    __m128 m = _mm_mul_ps(qcvm_vec_load(a), qcvm_vec_load(b));
+    __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(m, m)));
+}
+#else
+#   define qcvm_vec_dot(a, b) ((a)->vector[0]*(b)->vector[0] + \
+                               (a)->vector[1]*(b)->vector[1] + \
+                               (a)->vector[2]*(b)->vector[2])
+#endif
+
+/*
+ * Tempstrings are kept in an arena apart from the strings section, with
+ * ids following right after it. The arena grows by chunks which never
+ * move, so the strings a builtin works with stay where they are.
+ *
+ * A tempstring lives as long as the function call it was made in: when
+ * the call returns its tempstrings are released newest first, except
+ * the one it returns, which goes to the caller. That's only safe while
+ * nothing outside of the frame can see them, so as soon as one is stored
+ * anywhere but the locals, the parameters or the return value the frames
+ * running at that point keep theirs (see prog_tempstring_escape). What's
+ * left is released by the next top-level prog_exec, apart from what was
+ * made since, like its parameters.
+ */
+#define QCVM_TEMPSTRING_CHUNK_SHIFT 16
+#define QCVM_TEMPSTRING_CHUNK       ((size_t)1 << QCVM_TEMPSTRING_CHUNK_SHIFT)
+#define QCVM_TEMPSTRING_MIN_SHIFT   4
+
+/*
+ * Entities are allocated in chunks of this many. The address of a field
+ * of an entity depends on the storage layout, see prog_entity_layout.
+ */
+#define QCVM_ENTITY_CHUNK_SHIFT 8
+#define QCVM_ENTITY_CHUNK       (1 << QCVM_ENTITY_CHUNK_SHIFT)
+
+/*
+ * The sampling profiler keeps this many samples before folding them into
+ * its counts, and by default takes one every QCVM_SAMPLE_INTERVAL
+ * instructions, see prog_sample.
+ */
+#define QCVM_SAMPLE_RING     1024
+#define QCVM_SAMPLE_INTERVAL 1000
+
+/* the call graph profile reads the clock every this many instructions */
+#define QCVM_PROFILE_TICK    256
+
+/* the coverage report lists this many of the hottest basic blocks */
+#define QCVM_COVERAGE_HOT 10
+
+#define PROG_ENTFIELD(prog, e, f)                                               \
+    ((prog)->entitychunks[(size_t)(e) >> QCVM_ENTITY_CHUNK_SHIFT]               \
+        + ((size_t)(e) & (QCVM_ENTITY_CHUNK - 1)) * (prog)->entitystride        \
+        + (size_t)(f) * (prog)->fieldstride)
+
+/* marks an entity dirty for the next snapshot, see prog_snapshot */
+#define PROG_ENTTOUCH(prog, e)                                                  \
+    do { if (!(prog)->entitydirty[(e)]) prog_entity_touch((prog), (e)); } while (0)
+
 static void loaderror(const char *fmt, ...)
 {
     int     err = errno;
@@ -41,18 +191,695 @@ static void loaderror(const char *fmt, ...)
     printf(": %s\n", util_strerror(err));
 }
 
+static void verifyerror(qc_program_t *prog, const char *fmt, ...)
+{
+    va_list ap;
+    printf("`%s` doesn't verify: ", prog->filename);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+    fflush(stdout);
+}
+
 static void qcvmerror(qc_program_t *prog, const char *fmt, ...)
 {
     va_list ap;
 
     prog->vmerror++;
 
+    if (prog->error) {
+        char *message = NULL;
+        va_start(ap, fmt);
+        util_vasprintf(&message, fmt, ap);
+        va_end(ap);
+        prog->error(prog, message ? message : fmt);
+        if (message)
+            mem_d(message);
+        return;
+    }
+
     va_start(ap, fmt);
     vprintf(fmt, ap);
     va_end(ap);
     putchar('\n');
 }
 
+/*
+ * Pairs of statements which get combined into one superinstruction. The
+ * superinstruction is stored in the first statement's instruction and
+ * executes the first statement before continuing with the second one
+ * without dispatching. The second instruction stays as it is, so jumps
+ * landing on it are fine.
+ */
+static const struct {
+    uint16_t first;
+    uint16_t second;
+    uint16_t fused;
+} prog_fusions[] = {
+    { INSTR_LOAD_F,  INSTR_STORE_F,  QCVM_OP_LOAD_F_STORE_F   },
+    { INSTR_ADDRESS, INSTR_STOREP_F, QCVM_OP_ADDRESS_STOREP_F },
+    { INSTR_MUL_F,   INSTR_ADD_F,    QCVM_OP_MUL_F_ADD_F      },
+    { INSTR_EQ_F,    INSTR_IFNOT,    QCVM_OP_EQ_F_IFNOT       },
+    { INSTR_NE_F,    INSTR_IFNOT,    QCVM_OP_NE_F_IFNOT       },
+    { INSTR_LE,      INSTR_IFNOT,    QCVM_OP_LE_IFNOT         },
+    { INSTR_GE,      INSTR_IFNOT,    QCVM_OP_GE_IFNOT         },
+    { INSTR_LT,      INSTR_IFNOT,    QCVM_OP_LT_IFNOT         },
+    { INSTR_GT,      INSTR_IFNOT,    QCVM_OP_GT_IFNOT         }
+};
+
+/*
+ * fills in the label of every instruction for the threaded engine and
+ * its handler for the closure engine
+ */
+static void prog_labels(qc_program_t *prog) {
+#ifdef QCVM_THREADED
+    prog_exec_threaded(prog, NULL, 0, 0, NULL);
+#endif
+    prog_closures(prog);
+}
+
+/*
+ * Which globals the code can change: those the statements write to, the
+ * locals the parameters are copied to, and the return value and the
+ * parameters, which every call, builtin and host writes. What's left
+ * keeps its value from the progs unless a builtin or the host changes
+ * it, which the instructions relying on it check for.
+ */
+static void prog_verify_operands(uint16_t opcode, size_t size[3]);
+
+static bool *prog_written(qc_program_t *prog) {
+    size_t  count   = prog->code_count;
+    size_t  globals = vec_size(prog->globals);
+    bool   *written = NULL;
+    size_t  size[3];
+    size_t  i, k;
+
+    memset(vec_add(written, globals), 0, globals * sizeof(written[0]));
+    for (k = OFS_RETURN; k < OFS_PARM7 + 3 && k < globals; ++k)
+        written[k] = true;
+    for (i = 0; i < count; ++i) {
+        prog_section_statement_t *st = prog->code + i;
+        size_t                    out, words;
+
+        prog_verify_operands(st->opcode, size);
+        switch (st->opcode) {
+            case INSTR_STORE_F:   case INSTR_STORE_V:   case INSTR_STORE_S:
+            case INSTR_STORE_ENT: case INSTR_STORE_FLD: case INSTR_STORE_FNC:
+                out   = st->o2.u1;
+                words = size[1];
+                break;
+            case INSTR_STOREP_F:   case INSTR_STOREP_V:   case INSTR_STOREP_S:
+            case INSTR_STOREP_ENT: case INSTR_STOREP_FLD: case INSTR_STOREP_FNC:
+            case INSTR_IF:         case INSTR_IFNOT:      case INSTR_GOTO:
+            case INSTR_DONE:       case INSTR_RETURN:     case INSTR_STATE:
+            case INSTR_CALL0: case INSTR_CALL1: case INSTR_CALL2:
+            case INSTR_CALL3: case INSTR_CALL4: case INSTR_CALL5:
+            case INSTR_CALL6: case INSTR_CALL7: case INSTR_CALL8:
+                continue;
+            default:
+                out   = st->o3.u1;
+                words = size[2];
+                break;
+        }
+        for (k = out; k < out + words && k < globals; ++k)
+            written[k] = true;
+    }
+    /* and the parameters are copied into the locals */
+    for (i = 0; i < prog->functions_count; ++i) {
+        prog_section_function_t *func = prog->functions + i;
+        for (k = func->firstlocal; k < (size_t)func->firstlocal + func->locals && k < globals; ++k)
+            written[k] = true;
+    }
+    return written;
+}
+
+/*
+ * Calls of a builtin which has an intrinsic are specialized to call the
+ * intrinsic directly, without looking up the builtin, setting argc or
+ * checking for errors. That's only done where the builtin is likely to
+ * be the one called: the call goes through a function global which no
+ * statement writes to, and passes the number of parameters the intrinsic
+ * was registered for. Since a builtin or the host may still change the
+ * global, the call checks it holds the same function, and turns back
+ * into a CALL for good if not. Everything else keeps calling the builtin.
+ */
+static void prog_intrinsics(qc_program_t *prog) {
+    size_t  count   = prog->code_count;
+    size_t  globals = vec_size(prog->globals);
+    bool   *written;
+    size_t  i;
+
+    for (i = 0; i < count; ++i) {
+        if (prog->decoded[i].op == QCVM_OP_CALL_INTRINSIC)
+            prog->decoded[i].op = prog->decoded[i].opcode;
+    }
+    if (!vec_size(prog->intrinsics))
+        return;
+
+    written = prog_written(prog);
+    for (i = 0; i < count; ++i) {
+        prog_section_statement_t *st = prog->code + i;
+        qcint_t                   function, number;
+        size_t                    argc;
+
+        if (st->opcode < INSTR_CALL0 || st->opcode > INSTR_CALL8)
+            continue;
+        if (st->o1.u1 >= globals || written[st->o1.u1])
+            continue;
+
+        function = prog->globals[st->o1.u1];
+        if (function <= 0 || function >= (qcint_t)prog->functions_count)
+            continue;
+        number = -prog->functions[function].entry;
+        argc   = st->opcode - INSTR_CALL0;
+        if (number <= 0 || number >= (qcint_t)vec_size(prog->intrinsics) ||
+            !prog->intrinsics[number].function || prog->intrinsics[number].argc != argc)
+        {
+            continue;
+        }
+
+        prog->decoded[i].op          = QCVM_OP_CALL_INTRINSIC;
+        prog->decoded[i].u.intrinsic = prog->intrinsics[number].function;
+        prog->decoded[i].function    = function;
+    }
+
+    vec_free(written);
+}
+
+/*
+ * The calls prog_verify proved get a handler which skips the checks: a
+ * call through a function global no statement writes to, which holds a
+ * QC function, goes straight into it. It only checks that the global
+ * still holds that function, since a builtin or the host may change it
+ * after all, and goes back to the checked CALL for good if it doesn't.
+ *
+ * Field accesses aren't specialized the same way: checking the field is
+ * still the same was proven costs as much as checking it's valid.
+ */
+static void prog_verified(qc_program_t *prog) {
+    size_t  count = prog->code_count;
+    bool   *written = prog_written(prog);
+    size_t  i;
+
+    for (i = 0; i < count; ++i) {
+        prog_section_statement_t *st = prog->code + i;
+        qc_exec_instr_t          *in = prog->decoded + i;
+        qcint_t                   value;
+
+        if (in->op != in->opcode)
+            continue;
+
+        switch (st->opcode) {
+            case INSTR_CALL0: case INSTR_CALL1: case INSTR_CALL2:
+            case INSTR_CALL3: case INSTR_CALL4: case INSTR_CALL5:
+            case INSTR_CALL6: case INSTR_CALL7: case INSTR_CALL8:
+                value = prog->globals[st->o1.u1];
+                if (written[st->o1.u1] || value <= 0 || value >= (qcint_t)prog->functions_count ||
+                    prog->functions[value].entry < 0)
+                {
+                    break;
+                }
+                in->op       = QCVM_OP_CALL_VERIFIED;
+                in->function = value;
+                break;
+        }
+    }
+
+    vec_free(written);
+}
+
+/* the vector instructions with SIMD versions */
+static const struct {
+    uint16_t opcode;
+    uint16_t simd;
+} prog_simd[] = {
+    { INSTR_MUL_V,   QCVM_OP_MUL_V_SIMD   },
+    { INSTR_MUL_FV,  QCVM_OP_MUL_FV_SIMD  },
+    { INSTR_MUL_VF,  QCVM_OP_MUL_VF_SIMD  },
+    { INSTR_ADD_V,   QCVM_OP_ADD_V_SIMD   },
+    { INSTR_SUB_V,   QCVM_OP_SUB_V_SIMD   },
+    { INSTR_EQ_V,    QCVM_OP_EQ_V_SIMD    },
+    { INSTR_NE_V,    QCVM_OP_NE_V_SIMD    },
+    { INSTR_NOT_V,   QCVM_OP_NOT_V_SIMD   },
+    { INSTR_STORE_V, QCVM_OP_STORE_V_SIMD }
+};
+
+/*
+ * Selects the superinstructions. With VMFUSE_STATIC every known pair is
+ * fused. With VMFUSE_PROFILE the counts in prog->profile (usually from
+ * prog_profile_load) decide: only the kinds of pairs making up at least
+ * 1% of the executed statements are used, and only where they actually
+ * ran. This keeps the number of live handlers down to those which pay.
+ * The vector instructions left get their SIMD versions, unless disabled
+ * with prog_vectorize.
+ */
+void prog_fuse(qc_program_t *prog, int mode) {
+    size_t  count = prog->code_count;
+    size_t  total = 0;
+    size_t  weight[GMQCC_ARRAY_COUNT(prog_fusions)];
+    size_t  i, k;
+
+    prog->fusemode = mode;
+    for (i = 0; i < count; ++i)
+        prog->decoded[i].op = prog->decoded[i].opcode;
+
+    memset(weight, 0, sizeof(weight));
+    if (mode == VMFUSE_PROFILE) {
+        for (i = 0; i < count; ++i)
+            total += prog->profile[i];
+        for (i = 0; i + 1 < count; ++i) {
+            for (k = 0; k < GMQCC_ARRAY_COUNT(prog_fusions); ++k) {
+                if (prog->code[i].opcode   == prog_fusions[k].first &&
+                    prog->code[i+1].opcode == prog_fusions[k].second)
+                {
+                    weight[k] += prog->profile[i];
+                }
+            }
+        }
+    }
+
+    for (i = 0; mode != VMFUSE_NONE && i + 1 < count; ++i) {
+        for (k = 0; k < GMQCC_ARRAY_COUNT(prog_fusions); ++k) {
+            if (prog->code[i].opcode   != prog_fusions[k].first ||
+                prog->code[i+1].opcode != prog_fusions[k].second)
+            {
+                continue;
+            }
+            if (mode == VMFUSE_PROFILE && (!prog->profile[i] || weight[k] * 100 < total))
+                break;
+            prog->decoded[i].op = prog_fusions[k].fused;
+            break;
+        }
+    }
+
+    if (!prog->scalar && QCVM_SSE2) {
+        for (i = 0; i < count; ++i) {
+            if (prog->decoded[i].op != prog->decoded[i].opcode)
+                continue;
+            for (k = 0; k < GMQCC_ARRAY_COUNT(prog_simd); ++k) {
+                if (prog->decoded[i].opcode == prog_simd[k].opcode) {
+                    prog->decoded[i].op = prog_simd[k].simd;
+                    break;
+                }
+            }
+        }
+    }
+
+    prog_intrinsics(prog);
+    if (prog->verified)
+        prog_verified(prog);
+    prog_labels(prog);
+}
+
+/*
+ * Selects whether the vector instructions use SIMD where it's compiled
+ * in, which they do by default. Their results are the same either way.
+ */
+void prog_vectorize(qc_program_t *prog, bool enable) {
+    prog->scalar = !enable;
+    prog_fuse(prog, prog->fusemode);
+}
+
+/* how many globals the operands of a statement use, 0 for none or a jump */
+static void prog_verify_operands(uint16_t opcode, size_t size[3]) {
+    size[0] = size[1] = size[2] = 1;
+    switch (opcode) {
+        case INSTR_MUL_V:   size[0] = size[1] = 3;           break;
+        case INSTR_MUL_FV:  size[1] = size[2] = 3;           break;
+        case INSTR_MUL_VF:  size[0] = size[2] = 3;           break;
+        case INSTR_ADD_V:
+        case INSTR_SUB_V:   size[0] = size[1] = size[2] = 3; break;
+        case INSTR_EQ_V:
+        case INSTR_NE_V:    size[0] = size[1] = 3;           break;
+        case INSTR_LOAD_V:  size[2] = 3;                     break;
+
+        case INSTR_STORE_V:  size[0] = size[1] = 3; size[2] = 0; break;
+        case INSTR_STOREP_V: size[0] = 3;           size[2] = 0; break;
+        case INSTR_STORE_F:   case INSTR_STORE_S:   case INSTR_STORE_ENT:
+        case INSTR_STORE_FLD: case INSTR_STORE_FNC:
+        case INSTR_STOREP_F:   case INSTR_STOREP_S:   case INSTR_STOREP_ENT:
+        case INSTR_STOREP_FLD: case INSTR_STOREP_FNC:
+        case INSTR_STATE:
+            size[2] = 0;
+            break;
+
+        case INSTR_NOT_V:  size[0] = 3; size[1] = 0;     break;
+        case INSTR_NOT_F:  case INSTR_NOT_S:  case INSTR_NOT_ENT:
+        case INSTR_NOT_FNC:
+            size[1] = 0;
+            break;
+
+        case INSTR_DONE:
+        case INSTR_RETURN:  size[0] = 3; size[1] = size[2] = 0; break;
+        case INSTR_IF:
+        case INSTR_IFNOT:   size[1] = size[2] = 0;           break;
+        case INSTR_GOTO:    size[0] = size[1] = size[2] = 0; break;
+        case INSTR_CALL0: case INSTR_CALL1: case INSTR_CALL2:
+        case INSTR_CALL3: case INSTR_CALL4: case INSTR_CALL5:
+        case INSTR_CALL6: case INSTR_CALL7: case INSTR_CALL8:
+            size[1] = size[2] = 0;
+            break;
+    }
+}
+
+static int prog_verify_entry_cmp(const void *a, const void *b) {
+    size_t x = *(const size_t*)a;
+    size_t y = *(const size_t*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * Checks the whole program once, after loading it: every statement is
+ * an instruction of the VM and its operands are inside the globals, the
+ * functions keep their locals inside the globals, and every jump lands
+ * inside the function it's in, which ends with a DONE, RETURN or GOTO so
+ * nothing runs into the next one. The calls whose target is known then
+ * have to go to an existing function.
+ *
+ * When all that holds, the instructions whose operands can be proven
+ * valid skip their checks from then on, see prog_verified. A program
+ * which doesn't verify runs with all checks, as before. The proofs
+ * assume the host doesn't change the field and function globals.
+ */
+bool prog_verify(qc_program_t *prog) {
+    size_t   count   = prog->code_count;
+    size_t   globals = vec_size(prog->globals);
+    size_t  *entries = NULL;
+    bool    *written = NULL;
+    bool     verified = false;
+    size_t   size[3];
+    size_t   i, k, end;
+
+    if (globals < OFS_PARM7 + 3) {
+        verifyerror(prog, "too few globals for the parameters");
+        return false;
+    }
+
+    for (i = 0; i < count; ++i) {
+        prog_section_statement_t *st = prog->code + i;
+        if (st->opcode >= VINSTR_END) {
+            verifyerror(prog, "illegal instruction at statement %lu", (unsigned long)i);
+            goto end;
+        }
+        prog_verify_operands(st->opcode, size);
+        if ((size[0] && st->o1.u1 + size[0] > globals) ||
+            (size[1] && st->o2.u1 + size[1] > globals) ||
+            (size[2] && st->o3.u1 + size[2] > globals))
+        {
+            verifyerror(prog, "operand outside the globals at statement %lu", (unsigned long)i);
+            goto end;
+        }
+    }
+
+    for (i = 1; i < prog->functions_count; ++i) {
+        prog_section_function_t *func = prog->functions + i;
+        if ((size_t)func->firstlocal + func->locals > globals || func->nargs > 8) {
+            verifyerror(prog, "bad locals or parameters of function %lu", (unsigned long)i);
+            goto end;
+        }
+        if (func->entry >= (qcint_t)count) {
+            verifyerror(prog, "function %lu starts outside the code", (unsigned long)i);
+            goto end;
+        }
+        if (func->entry >= 0)
+            vec_push(entries, (size_t)func->entry);
+    }
+    vec_push(entries, count);
+    qsort(entries, vec_size(entries), sizeof(entries[0]), &prog_verify_entry_cmp);
+
+    for (k = 0; k + 1 < vec_size(entries); ++k) {
+        if ((end = entries[k+1]) == entries[k])
+            continue;
+        for (i = entries[k]; i < end; ++i) {
+            prog_section_statement_t *st = prog->code + i;
+            qcint_t                   target;
+
+            if (st->opcode == INSTR_GOTO)
+                target = (qcint_t)i + st->o1.s1;
+            else if (st->opcode == INSTR_IF || st->opcode == INSTR_IFNOT)
+                target = (qcint_t)i + st->o2.s1;
+            else
+                continue;
+            if (target < (qcint_t)entries[k] || target >= (qcint_t)end) {
+                verifyerror(prog, "statement %lu jumps out of its function", (unsigned long)i);
+                goto end;
+            }
+        }
+        i = prog->code[end - 1].opcode;
+        if (i != INSTR_DONE && i != INSTR_RETURN && i != INSTR_GOTO) {
+            verifyerror(prog, "the function at statement %lu runs past its end", (unsigned long)entries[k]);
+            goto end;
+        }
+    }
+
+    written = prog_written(prog);
+    for (i = 0; i < count; ++i) {
+        prog_section_statement_t *st = prog->code + i;
+        qcint_t                   function;
+
+        if (st->opcode < INSTR_CALL0 || st->opcode > INSTR_CALL8 || written[st->o1.u1])
+            continue;
+        function = prog->globals[st->o1.u1];
+        if (function <= 0 || function >= (qcint_t)prog->functions_count) {
+            verifyerror(prog, "statement %lu calls a function which doesn't exist", (unsigned long)i);
+            goto end;
+        }
+    }
+    verified = true;
+
+end:
+    vec_free(entries);
+    vec_free(written);
+    prog->verified = verified;
+    prog_fuse(prog, prog->fusemode);
+    return verified;
+}
+
+/*
+ * Translates the statements into the instructions the VM loop executes:
+ * operands become pointers into the globals and jumps point directly at
+ * their target. One extra illegal instruction is appended which jumps
+ * outside of the code, and running past the end, end up at.
+ */
+static void prog_decode(qc_program_t *prog) {
+    size_t           count   = prog->code_count;
+    size_t           globals = vec_size(prog->globals);
+    qc_exec_instr_t *decoded = (qc_exec_instr_t*)vec_add(prog->decoded, count + 1);
+    size_t           i;
+
+#define DECODE_OPERAND(X) \
+    (((X) < globals) ? (qcany_t*)(prog->globals + (X)) : NULL)
+#define DECODE_TARGET(X) \
+    (((X) >= 0 && (X) < (qcint_t)count) ? decoded + (X) : decoded + count)
+
+    for (i = 0; i < count; ++i) {
+        prog_section_statement_t *st = prog->code + i;
+        qc_exec_instr_t          *in = decoded + i;
+
+        in->opcode = (st->opcode < VINSTR_END) ? st->opcode : QCVM_OP_ILLEGAL;
+        in->op     = in->opcode;
+        in->a      = DECODE_OPERAND(st->o1.u1);
+        in->b      = DECODE_OPERAND(st->o2.u1);
+        in->c      = DECODE_OPERAND(st->o3.u1);
+        in->u.jump = NULL;
+        in->function = 0;
+        in->label  = NULL;
+
+        switch (st->opcode) {
+            case INSTR_GOTO:
+                in->u.jump = DECODE_TARGET((qcint_t)i + st->o1.s1);
+                break;
+            case INSTR_IF:
+            case INSTR_IFNOT:
+                in->u.jump = DECODE_TARGET((qcint_t)i + st->o2.s1);
+                break;
+        }
+    }
+
+#undef DECODE_OPERAND
+#undef DECODE_TARGET
+
+    memset(decoded + count, 0, sizeof(*decoded));
+    decoded[count].opcode = QCVM_OP_ILLEGAL;
+    decoded[count].op     = QCVM_OP_ILLEGAL;
+
+    prog_fuse(prog, VMFUSE_STATIC);
+}
+
+typedef struct {
+    uint32_t first;
+    uint32_t end;
+    size_t   function;
+} prog_localrange_t;
+
+static int prog_localrange_cmp(const void *a, const void *b) {
+    const prog_localrange_t *ra = (const prog_localrange_t*)a;
+    const prog_localrange_t *rb = (const prog_localrange_t*)b;
+    if (ra->first != rb->first)
+        return (ra->first < rb->first) ? -1 : 1;
+    return (ra->end < rb->end) ? -1 : (ra->end > rb->end);
+}
+
+/*
+ * Prepares the call frames: finds the functions whose locals share globals
+ * with another function, only those have to back up their locals on every
+ * call, the rest only when re-entered. The stacks are allocated here once
+ * and kept over all calls to prog_exec.
+ */
+static void prog_frames(qc_program_t *prog) {
+    size_t             count  = prog->functions_count;
+    prog_localrange_t *ranges = NULL;
+    size_t             i;
+    size_t             top    = 0;
+
+    memset(vec_add(prog->frameinfo, count), 0, sizeof(prog->frameinfo[0]) * count);
+
+    for (i = 0; i < count; ++i) {
+        prog_section_function_t *func = prog->functions + i;
+        prog_localrange_t       *range;
+        if (!func->locals)
+            continue;
+        range           = (prog_localrange_t*)vec_add(ranges, 1);
+        range->first    = func->firstlocal;
+        range->end      = func->firstlocal + func->locals;
+        range->function = i;
+    }
+
+    /*
+     * Sweep the ranges ordered by their start: one overlaps something before
+     * it exactly when it starts before the furthest end seen so far, and the
+     * range reaching that far is the one it shares globals with.
+     */
+    if (vec_size(ranges))
+        qsort(ranges, vec_size(ranges), sizeof(ranges[0]), &prog_localrange_cmp);
+    for (i = 0; i < vec_size(ranges); ++i) {
+        if (i && ranges[i].first < ranges[top].end) {
+            prog->frameinfo[ranges[i].function].shared   = true;
+            prog->frameinfo[ranges[top].function].shared = true;
+        }
+        if (!i || ranges[i].end > ranges[top].end)
+            top = i;
+    }
+    vec_free(ranges);
+
+    (void)vec_add(prog->stack, 64);
+    (void)vec_add(prog->localstack, 1024);
+    vec_shrinkto(prog->stack, 0);
+    vec_shrinkto(prog->localstack, 0);
+}
+
+/*
+ * Builds the lookup tables: the defs and fields by offset for prog_getdef
+ * and prog_entfield, and the defs, fields and functions by name for the
+ * prog_find* functions. With duplicates the first one wins, just like a
+ * search from the start would find.
+ */
+static void prog_index_name(hash_table_t *index, const char *name, void *value) {
+    size_t hash = util_hthash(index, name);
+    if (!util_htgeth(index, name, hash))
+        util_htseth(index, name, hash, value);
+}
+
+static hash_table_t *prog_index_defs(qc_program_t *prog, prog_section_def_t *defs, size_t count,
+                                     prog_section_def_t ***by_offset)
+{
+    hash_table_t *index = util_htnew(count > 16 ? count : 16);
+    size_t        size  = 0;
+    size_t        i;
+
+    for (i = 0; i < count; ++i) {
+        if (defs[i].offset >= size)
+            size = defs[i].offset + 1;
+    }
+    memset(vec_add(*by_offset, size), 0, size * sizeof((*by_offset)[0]));
+
+    for (i = 0; i < count; ++i) {
+        if (!(*by_offset)[defs[i].offset])
+            (*by_offset)[defs[i].offset] = defs + i;
+        prog_index_name(index, prog_getstring(prog, defs[i].name), defs + i);
+    }
+    return index;
+}
+
+static void prog_index(qc_program_t *prog) {
+    size_t count = prog->functions_count;
+    size_t i;
+
+    prog->def_index   = prog_index_defs(prog, prog->defs,   prog->defs_count,   &prog->defs_by_offset);
+    prog->field_index = prog_index_defs(prog, prog->fields, prog->fields_count, &prog->fields_by_offset);
+
+    prog->function_index = util_htnew(count > 16 ? count : 16);
+    for (i = 1; i < count; ++i)
+        prog_index_name(prog->function_index, prog_getstring(prog, prog->functions[i].name), prog->functions + i);
+}
+
+/*
+ * Points the read-only sections straight into the mapped file instead of
+ * reading them, so that every VM loading the same file shares the pages.
+ * That only works when the data in the file can be used as is: it's
+ * little endian, each section is aligned for its type and in bounds, and
+ * the strings are terminated. Otherwise the sections are read.
+ */
+static bool prog_map(qc_program_t *prog, prog_header_t *header) {
+#if PLATFORM_BYTE_ORDER == GMQCC_BYTE_ORDER_LITTLE
+    char *data;
+
+    if (!(prog->map = fs_file_map(prog->filename, &prog->map_size)))
+        return false;
+    data = (char*)prog->map;
+
+#define map_data(hdrvar, progvar, type)                                     \
+    if (header->hdrvar.offset % sizeof(uint32_t)                         || \
+        header->hdrvar.offset > prog->map_size                           || \
+        header->hdrvar.length > (prog->map_size - header->hdrvar.offset)   \
+                              / sizeof(*prog->progvar))                     \
+    {                                                                       \
+        goto fallback;                                                      \
+    }                                                                       \
+    prog->progvar          = (type*)(data + header->hdrvar.offset);         \
+    prog->progvar##_count  = header->hdrvar.length
+
+    map_data(statements, code,      prog_section_statement_t);
+    map_data(defs,       defs,      prog_section_def_t);
+    map_data(fields,     fields,    prog_section_def_t);
+    map_data(functions,  functions, prog_section_function_t);
+    map_data(strings,    strings,   char);
+
+#undef map_data
+
+    if (prog->strings_count && prog->strings[prog->strings_count-1])
+        goto fallback;
+
+    return true;
+
+fallback:
+    fs_file_unmap(prog->map, prog->map_size);
+    prog->map             = NULL;
+    prog->code            = NULL;
+    prog->defs            = NULL;
+    prog->fields          = NULL;
+    prog->functions       = NULL;
+    prog->strings         = NULL;
+#else
+    (void)prog;
+    (void)header;
+#endif
+    return false;
+}
+
+static void prog_free_sections(qc_program_t *prog) {
+    if (prog->map) {
+        fs_file_unmap(prog->map, prog->map_size);
+        return;
+    }
+    vec_free(prog->code);
+    vec_free(prog->defs);
+    vec_free(prog->fields);
+    vec_free(prog->functions);
+    vec_free(prog->strings);
+}
+
 qc_program_t* prog_load(const char *filename, bool skipversion)
 {
     qc_program_t   *prog;
@@ -109,41 +936,60 @@ qc_program_t* prog_load(const char *filename, bool skipversion)
 #define read_data1(x)    read_data(x, x, 0)
 #define read_data2(x, y) read_data(x, x, y)
 
-    read_data (statements, code, 0);
-    read_data1(defs);
-    read_data1(fields);
-    read_data1(functions);
-    read_data1(strings);
+    if (!prog_map(prog, &header)) {
+        read_data (statements, code, 0);
+        read_data1(defs);
+        read_data1(fields);
+        read_data1(functions);
+        read_data2(strings, 1); /* terminate the last string */
+        prog->strings[header.strings.length] = 0;
+
+        prog->code_count      = header.statements.length;
+        prog->defs_count      = header.defs.length;
+        prog->fields_count    = header.fields.length;
+        prog->functions_count = header.functions.length;
+        prog->strings_count   = header.strings.length;
+    }
     read_data2(globals, 2); /* reserve more in case a RETURN using with the global at "the end" exists */
 
+#undef read_data
+#undef read_data1
+#undef read_data2
+
     fs_file_close(file);
 
     /* profile counters */
-    memset(vec_add(prog->profile, vec_size(prog->code)), 0, sizeof(prog->profile[0]) * vec_size(prog->code));
+    memset(vec_add(prog->profile, prog->code_count), 0, sizeof(prog->profile[0]) * prog->code_count);
+    memset(vec_add(prog->profile_taken, prog->code_count), 0, sizeof(prog->profile_taken[0]) * prog->code_count);
+    memset(vec_add(prog->profile_functions, prog->functions_count), 0, sizeof(prog->profile_functions[0]) * prog->functions_count);
+    memset(vec_add(prog->profile_nodes, 1), 0, sizeof(prog->profile_nodes[0]));
+    prog_sample_interval(prog, QCVM_SAMPLE_INTERVAL);
+
+    prog_decode(prog);
+    prog_frames(prog);
+
+    /* tempstrings get the ids after the strings section */
+    prog->tempstring_start = prog->strings_count;
+
+    prog_index(prog);
 
-    /* Add tempstring area */
-    prog->tempstring_start = vec_size(prog->strings);
-    prog->tempstring_at    = vec_size(prog->strings);
-    memset(vec_add(prog->strings, 16*1024), 0, 16*1024);
+    /* keep the initial globals around for prog_reset */
+    vec_append(prog->initglobals, vec_size(prog->globals), prog->globals);
 
     /* spawn the world entity */
-    vec_push(prog->entitypool, true);
-    memset(vec_add(prog->entitydata, prog->entityfields), 0, prog->entityfields * sizeof(prog->entitydata[0]));
-    prog->entities = 1;
+    while (((size_t)1 << prog->fieldshift) < prog->entityfields)
+        prog->fieldshift++;
+    prog->entitystride = prog->entityfields;
+    prog->fieldstride  = 1;
+    (void)prog_spawn_entity(prog);
 
     return prog;
 
 error:
     if (prog->filename)
         mem_d(prog->filename);
-    vec_free(prog->code);
-    vec_free(prog->defs);
-    vec_free(prog->fields);
-    vec_free(prog->functions);
-    vec_free(prog->strings);
+    prog_free_sections(prog);
     vec_free(prog->globals);
-    vec_free(prog->entitydata);
-    vec_free(prog->entitypool);
     mem_d(prog);
 
     fs_file_close(file);
@@ -152,513 +998,3540 @@ error:
 
 void prog_delete(qc_program_t *prog)
 {
+    size_t i;
+
     if (prog->filename) mem_d(prog->filename);
-    vec_free(prog->code);
-    vec_free(prog->defs);
-    vec_free(prog->fields);
-    vec_free(prog->functions);
-    vec_free(prog->strings);
+    prog_free_sections(prog);
+    for (i = 0; i < vec_size(prog->tempstring_blocks); ++i)
+        mem_d(prog->tempstring_blocks[i]);
+    for (i = 0; i < VM_TEMPSTRING_CLASSES; ++i)
+        vec_free(prog->tempstring_free[i]);
+    vec_free(prog->tempstring_blocks);
+    vec_free(prog->tempstring_chunks);
+    vec_free(prog->tempstring_live);
     vec_free(prog->globals);
-    vec_free(prog->entitydata);
+    vec_free(prog->initglobals);
+    for (i = 0; i < vec_size(prog->entitychunks); ++i)
+        mem_d(prog->entitychunks[i]);
+    vec_free(prog->entitychunks);
     vec_free(prog->entitypool);
+    vec_free(prog->entityfree);
+    vec_free(prog->entitydirty);
+    vec_free(prog->entitytouched);
+    vec_free(prog->tempstringdirty);
+    vec_free(prog->tempstringtouched);
+    vec_free(prog->builtins);
+    vec_free(prog->intrinsics);
+    vec_free(prog->natives);
     vec_free(prog->localstack);
     vec_free(prog->stack);
+    vec_free(prog->suspended);
+    vec_free(prog->frameinfo);
     vec_free(prog->profile);
+    vec_free(prog->profile_taken);
+    for (i = 0; i < vec_size(prog->profile_functions); ++i)
+        vec_free(prog->profile_functions[i].callees);
+    for (i = 0; i < vec_size(prog->profile_nodes); ++i)
+        vec_free(prog->profile_nodes[i].children);
+    vec_free(prog->profile_functions);
+    vec_free(prog->profile_nodes);
+    vec_free(prog->profile_frames);
+    if (prog->samples)
+        mem_d(prog->samples);
+    vec_free(prog->sample_statements);
+    vec_free(prog->sample_self);
+    vec_free(prog->sample_inclusive);
+    vec_free(prog->linenums);
+    vec_free(prog->decoded);
+    vec_free(prog->defs_by_offset);
+    vec_free(prog->fields_by_offset);
+    if (prog->def_index)
+        util_htdel(prog->def_index);
+    if (prog->field_index)
+        util_htdel(prog->field_index);
+    if (prog->function_index)
+        util_htdel(prog->function_index);
     mem_d(prog);
 }
 
-/***********************************************************************
- * VM code
- */
-
-const char* prog_getstring(qc_program_t *prog, qcint_t str) {
-    /* cast for return required for C++ */
-    if (str < 0 || str >= (qcint_t)vec_size(prog->strings))
-        return  "<<<invalid string>>>";
+/* the reports go to stdout when their file name is `-` */
+static FILE *prog_report_open(const char *filename) {
+    FILE *file = strcmp(filename, "-") ? fs_file_open(filename, "wb") : stdout;
+    if (!file)
+        loaderror("failed to open `%s` for writing", filename);
+    return file;
+}
 
-    return prog->strings + str;
+static void prog_report_close(FILE *file) {
+    if (file == stdout)
+        fflush(file);
+    else
+        fs_file_close(file);
 }
 
-prog_section_def_t* prog_entfield(qc_program_t *prog, qcint_t off) {
+/*
+ * The statement counts of a profiling run can be saved and loaded again
+ * later, to feed prog_fuse. The file is text: a header with the crc and
+ * the number of statements to make sure it belongs to the same progs,
+ * then one `statement count` line for every statement which ran.
+ */
+bool prog_profile_save(qc_program_t *prog, const char *filename) {
+    FILE  *file = prog_report_open(filename);
     size_t i;
-    for (i = 0; i < vec_size(prog->fields); ++i) {
-        if (prog->fields[i].offset == off)
-            return (prog->fields + i);
-    }
-    return NULL;
-}
 
-prog_section_def_t* prog_getdef(qc_program_t *prog, qcint_t off)
-{
-    size_t i;
-    for (i = 0; i < vec_size(prog->defs); ++i) {
-        if (prog->defs[i].offset == off)
-            return (prog->defs + i);
+    if (!file)
+        return false;
+
+    fs_file_printf(file, "QCVMPROFILE 1 %u %lu\n",
+                   (unsigned int)prog->crc16,
+                   (unsigned long)prog->code_count);
+    for (i = 0; i < prog->code_count; ++i) {
+        if (prog->profile[i])
+            fs_file_printf(file, "%lu %lu\n", (unsigned long)i, (unsigned long)prog->profile[i]);
     }
-    return NULL;
+
+    prog_report_close(file);
+    return true;
 }
 
-qcany_t* prog_getedict(qc_program_t *prog, qcint_t e) {
-    if (e >= (qcint_t)vec_size(prog->entitypool)) {
-        prog->vmerror++;
-        fprintf(stderr, "Accessing out of bounds edict %i\n", (int)e);
-        e = 0;
+bool prog_profile_load(qc_program_t *prog, const char *filename) {
+    FILE          *file = fs_file_open(filename, "rb");
+    char          *line = NULL;
+    size_t         size = 0;
+    unsigned int   version, crc;
+    unsigned long  statements, stmt, count;
+    bool           success = false;
+
+    if (!file) {
+        loaderror("failed to open `%s`", filename);
+        return false;
+    }
+
+    if (fs_file_getline(&line, &size, file) == EOF ||
+        sscanf(line, "QCVMPROFILE %u %u %lu", &version, &crc, &statements) != 3)
+    {
+        fprintf(stderr, "`%s` is not a qcvm profile\n", filename);
+        goto end;
+    }
+    if (version != 1 || crc != prog->crc16 || statements != prog->code_count) {
+        fprintf(stderr, "profile `%s` doesn't belong to `%s`\n", filename, prog->filename);
+        goto end;
     }
-    return (qcany_t*)(prog->entitydata + (prog->entityfields * e));
-}
 
-static qcint_t prog_spawn_entity(qc_program_t *prog) {
-    char  *data;
-    qcint_t  e;
-    for (e = 0; e < (qcint_t)vec_size(prog->entitypool); ++e) {
-        if (!prog->entitypool[e]) {
-            data = (char*)(prog->entitydata + (prog->entityfields * e));
-            memset(data, 0, prog->entityfields * sizeof(qcint_t));
-            return e;
+    memset(prog->profile, 0, sizeof(prog->profile[0]) * prog->code_count);
+    while (fs_file_getline(&line, &size, file) != EOF) {
+        if (sscanf(line, "%lu %lu", &stmt, &count) != 2 || stmt >= statements) {
+            fprintf(stderr, "malformed line in profile `%s`: %s", filename, line);
+            goto end;
         }
+        prog->profile[stmt] = count;
     }
-    vec_push(prog->entitypool, true);
-    prog->entities++;
-    data = (char*)vec_add(prog->entitydata, prog->entityfields);
-    memset(data, 0, prog->entityfields * sizeof(qcint_t));
-    return e;
+    success = true;
+
+end:
+    if (line)
+        mem_d(line);
+    fs_file_close(file);
+    return success;
 }
 
-static void prog_free_entity(qc_program_t *prog, qcint_t e) {
-    if (!e) {
-        prog->vmerror++;
-        fprintf(stderr, "Trying to free world entity\n");
-        return;
+/*
+ * The call graph profile. Every call, to a QC function or a builtin,
+ * pushes a frame recording the instruction count and the time; leaving
+ * it adds the difference to the function, minus what the callees took
+ * for the exclusive counts. The same counts go to the node of the call
+ * tree the stack leads to, which is what a flamegraph is drawn from.
+ *
+ * The time is prog->profile_clock, which the loop only reads from the
+ * clock every QCVM_PROFILE_TICK instructions, when a run starts and
+ * around builtins, where the time goes without instructions. Calls and
+ * returns in between take it as it is, so short functions are timed
+ * coarsely but reading the clock doesn't dominate the profile.
+ */
+static double prog_profile_clock(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+#endif
+}
+
+static size_t prog_profile_node(qc_program_t *prog, size_t parent, size_t function) {
+    qc_profile_node_t node;
+    size_t            i;
+
+    for (i = 0; i < vec_size(prog->profile_nodes[parent].children); ++i) {
+        size_t child = prog->profile_nodes[parent].children[i];
+        if (prog->profile_nodes[child].function == function)
+            return child;
     }
-    if (e >= (qcint_t)vec_size(prog->entitypool)) {
-        prog->vmerror++;
-        fprintf(stderr, "Trying to free out of bounds entity\n");
-        return;
+
+    node.function = function;
+    node.parent   = parent;
+    node.self     = 0;
+    node.children = NULL;
+    vec_push(prog->profile_nodes, node);
+    vec_push(prog->profile_nodes[parent].children, vec_size(prog->profile_nodes) - 1);
+    return vec_size(prog->profile_nodes) - 1;
+}
+
+static void prog_profile_enter(qc_program_t *prog, size_t function) {
+    qc_profile_frame_t frame;
+    size_t             parent = 0;
+    size_t             i;
+
+    if (vec_size(prog->profile_frames)) {
+        qc_profile_function_t *caller = prog->profile_functions + vec_last(prog->profile_frames).function;
+
+        for (i = 0; i < vec_size(caller->callees); ++i) {
+            if (caller->callees[i].callee == function)
+                break;
+        }
+        if (i == vec_size(caller->callees)) {
+            qc_profile_edge_t edge;
+            edge.callee = function;
+            edge.calls  = 0;
+            vec_push(caller->callees, edge);
+        }
+        caller->callees[i].calls++;
+        parent = vec_last(prog->profile_frames).node;
     }
-    if (!prog->entitypool[e]) {
-        prog->vmerror++;
-        fprintf(stderr, "Double free on entity\n");
+
+    prog->profile_functions[function].calls++;
+    prog->profile_functions[function].active++;
+
+    frame.function     = function;
+    frame.node         = prog_profile_node(prog, parent, function);
+    frame.instructions = prog->profile_instructions;
+    frame.childinstr   = 0;
+    frame.childtime    = 0;
+    frame.time         = prog->profile_clock;
+    vec_push(prog->profile_frames, frame);
+}
+
+static void prog_profile_leave(qc_program_t *prog) {
+    qc_profile_frame_t     frame;
+    qc_profile_function_t *func;
+    size_t                 instructions;
+    double                 time;
+
+    if (!vec_size(prog->profile_frames))
         return;
+
+    frame = vec_last(prog->profile_frames);
+    vec_pop(prog->profile_frames);
+
+    time         = prog->profile_clock - frame.time;
+    instructions = prog->profile_instructions - frame.instructions;
+    func         = prog->profile_functions + frame.function;
+
+    func->self     += instructions - frame.childinstr;
+    func->selftime += time - frame.childtime;
+    prog->profile_nodes[frame.node].self += instructions - frame.childinstr;
+
+    /* only the outermost frame of a recursion counts into the totals */
+    if (!--func->active) {
+        func->total     += instructions;
+        func->totaltime += time;
+    }
+
+    if (vec_size(prog->profile_frames)) {
+        vec_last(prog->profile_frames).childinstr += instructions;
+        vec_last(prog->profile_frames).childtime  += time;
     }
-    prog->entitypool[e] = false;
 }
 
-qcint_t prog_tempstring(qc_program_t *prog, const char *str) {
-    size_t len = strlen(str);
-    size_t at = prog->tempstring_at;
+/*
+ * Writes the call tree in the folded stack format flamegraph tools take:
+ * one `main;caller;callee count` line for every stack which executed
+ * instructions of its own.
+ */
+bool prog_profile_folded(qc_program_t *prog, const char *filename) {
+    FILE        *file = prog_report_open(filename);
+    const char **path = NULL;
+    size_t       i, n;
+
+    if (!file)
+        return false;
 
-    /* when we reach the end we start over */
-    if (at + len >= vec_size(prog->strings))
-        at = prog->tempstring_start;
+    for (i = 1; i < vec_size(prog->profile_nodes); ++i) {
+        if (!prog->profile_nodes[i].self)
+            continue;
 
-    /* when it doesn't fit, reallocate */
-    if (at + len >= vec_size(prog->strings))
-    {
-        (void)vec_add(prog->strings, len+1);
-        memcpy(prog->strings + at, str, len+1);
-        return at;
+        if (path)
+            vec_shrinkto(path, 0);
+        for (n = i; n; n = prog->profile_nodes[n].parent)
+            vec_push(path, prog_getstring(prog, prog->functions[prog->profile_nodes[n].function].name));
+
+        for (n = vec_size(path); n; --n) {
+            fs_file_puts(file, path[n-1]);
+            fs_file_puts(file, (n > 1) ? ";" : " ");
+        }
+        fs_file_printf(file, "%lu\n", (unsigned long)prog->profile_nodes[i].self);
     }
 
-    /* when it fits, just copy */
-    memcpy(prog->strings + at, str, len+1);
-    prog->tempstring_at += len+1;
-    return at;
+    vec_free(path);
+    prog_report_close(file);
+    return true;
 }
 
-static size_t print_escaped_string(const char *str, size_t maxlen) {
-    size_t len = 2;
-    putchar('"');
-    --maxlen; /* because we're lazy and have escape sequences */
-    while (*str) {
-        if (len >= maxlen) {
-            putchar('.');
-            putchar('.');
-            putchar('.');
-            len += 3;
-            break;
+static void prog_profile_json_string(FILE *file, const char *str) {
+    fs_file_puts(file, "\"");
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\')
+            fs_file_printf(file, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fs_file_printf(file, "\\u%04x", (unsigned int)(unsigned char)*str);
+        else
+            fs_file_printf(file, "%c", *str);
+    }
+    fs_file_puts(file, "\"");
+}
+
+/*
+ * Writes the profile of every function which was called as JSON, with
+ * the calls it made to other functions, for tools to pick apart.
+ */
+bool prog_profile_json(qc_program_t *prog, const char *filename) {
+    FILE  *file = prog_report_open(filename);
+    bool   first = true;
+    size_t i, k;
+
+    if (!file)
+        return false;
+
+    fs_file_puts(file, "{\n  \"program\": ");
+    prog_profile_json_string(file, prog->filename);
+    fs_file_printf(file, ",\n  \"instructions\": %lu,\n  \"functions\": [",
+                   (unsigned long)prog->profile_instructions);
+
+    for (i = 1; i < vec_size(prog->profile_functions); ++i) {
+        qc_profile_function_t *func = prog->profile_functions + i;
+        if (!func->calls)
+            continue;
+
+        fs_file_puts(file, first ? "\n    {\"name\": " : ",\n    {\"name\": ");
+        prog_profile_json_string(file, prog_getstring(prog, prog->functions[i].name));
+        fs_file_printf(file, ", \"builtin\": %s, \"calls\": %lu, \"self\": %lu, \"total\": %lu, "
+                             "\"selftime\": %.9f, \"totaltime\": %.9f, \"callees\": [",
+                       (prog->functions[i].entry < 0) ? "true" : "false",
+                       (unsigned long)func->calls,
+                       (unsigned long)func->self,
+                       (unsigned long)func->total,
+                       func->selftime,
+                       func->totaltime);
+        for (k = 0; k < vec_size(func->callees); ++k) {
+            fs_file_puts(file, k ? ", {\"name\": " : "{\"name\": ");
+            prog_profile_json_string(file, prog_getstring(prog, prog->functions[func->callees[k].callee].name));
+            fs_file_printf(file, ", \"calls\": %lu}", (unsigned long)func->callees[k].calls);
         }
-        switch (*str) {
-            case '\a': len += 2; putchar('\\'); putchar('a'); break;
-            case '\b': len += 2; putchar('\\'); putchar('b'); break;
-            case '\r': len += 2; putchar('\\'); putchar('r'); break;
-            case '\n': len += 2; putchar('\\'); putchar('n'); break;
-            case '\t': len += 2; putchar('\\'); putchar('t'); break;
-            case '\f': len += 2; putchar('\\'); putchar('f'); break;
-            case '\v': len += 2; putchar('\\'); putchar('v'); break;
-            case '\\': len += 2; putchar('\\'); putchar('\\'); break;
-            case '"':  len += 2; putchar('\\'); putchar('"'); break;
-            default:
-                ++len;
-                putchar(*str);
+        fs_file_puts(file, "]}");
+        first = false;
+    }
+
+    fs_file_puts(file, "\n  ]\n}\n");
+    prog_report_close(file);
+    return true;
+}
+
+/*
+ * The sampling profiler. Rather than counting every statement like
+ * VMXF_PROFILE, the loop only counts down sample_interval instructions
+ * and then records where it is: the statement and the functions on the
+ * stack go to a ring, which is folded into the counts by statement and
+ * function whenever it fills up, so the loop keeps the fused instructions
+ * and does next to no work in between. Time spent in builtins isn't seen,
+ * and the totals only include the innermost QCVM_SAMPLE_DEPTH different
+ * functions of a stack.
+ */
+typedef struct {
+    size_t index;
+    size_t count;
+    size_t function;
+} qc_sample_count_t;
+
+static int prog_sample_count_cmp(const void *a, const void *b) {
+    const qc_sample_count_t *x = (const qc_sample_count_t*)a;
+    const qc_sample_count_t *y = (const qc_sample_count_t*)b;
+    if (x->count != y->count)
+        return (x->count < y->count) ? 1 : -1;
+    return (x->index < y->index) ? -1 : (x->index > y->index);
+}
+
+void prog_sample_interval(qc_program_t *prog, size_t interval) {
+    prog->sample_interval  = interval ? interval : 1;
+    prog->sample_countdown = (long)prog->sample_interval;
+}
+
+static void prog_sample_flush(qc_program_t *prog) {
+    size_t i, k;
+
+    if (!prog->sample_statements) {
+        memset(vec_add(prog->sample_statements, prog->code_count),      0, sizeof(size_t) * prog->code_count);
+        memset(vec_add(prog->sample_self,       prog->functions_count), 0, sizeof(size_t) * prog->functions_count);
+        memset(vec_add(prog->sample_inclusive,  prog->functions_count), 0, sizeof(size_t) * prog->functions_count);
+    }
+
+    for (i = 0; i < prog->samples_used; ++i) {
+        qc_sample_t *sample = prog->samples + i;
+
+        prog->sample_statements[sample->statement]++;
+        if (sample->depth)
+            prog->sample_self[sample->functions[0]]++;
+        for (k = 0; k < sample->depth; ++k)
+            prog->sample_inclusive[sample->functions[k]]++;
+    }
+    prog->samples_used = 0;
+}
+
+static long prog_sample(qc_program_t *prog, size_t statement) {
+    qc_sample_t *sample;
+    size_t       i, k;
+
+    if (!prog->samples)
+        prog->samples = (qc_sample_t*)mem_a(sizeof(qc_sample_t) * QCVM_SAMPLE_RING);
+    if (prog->samples_used == QCVM_SAMPLE_RING)
+        prog_sample_flush(prog);
+
+    sample            = prog->samples + prog->samples_used++;
+    sample->statement = statement;
+    sample->depth     = 0;
+
+    /* every function once, so recursion doesn't count a function twice */
+    for (i = vec_size(prog->stack); i && sample->depth < QCVM_SAMPLE_DEPTH; --i) {
+        uint32_t function = (uint32_t)(prog->stack[i-1].function - prog->functions);
+        for (k = 0; k < sample->depth; ++k) {
+            if (sample->functions[k] == function)
                 break;
         }
-        ++str;
+        if (k == sample->depth)
+            sample->functions[sample->depth++] = function;
     }
-    putchar('"');
-    return len;
+    prog->sample_total++;
+
+    return (long)prog->sample_interval;
 }
 
-static void trace_print_global(qc_program_t *prog, unsigned int glob, int vtype) {
-    static char spaces[28+1] = "                            ";
-    prog_section_def_t *def;
-    qcany_t    *value;
-    int       len;
+/*
+ * Loads the line numbers written next to the progs by -flno, which the
+ * sample report uses to tell the lines apart. Fails when the file can't
+ * be read or was written for different progs.
+ */
+bool prog_load_lno(qc_program_t *prog, const char *filename) {
+    FILE     *file = fs_file_open(filename, "rb");
+    char      magic[4];
+    uint32_t  header[5];
+    int32_t  *linenums = NULL;
 
-    if (!glob) {
-        if ((len = printf("<null>,")) == -1)
-            len = 0;
+    if (!file)
+        return false;
 
-        goto done;
+    if (fs_file_read(magic, sizeof(magic), 1, file) != 1 ||
+        fs_file_read(header, sizeof(header), 1, file) != 1 ||
+        memcmp(magic, "LNOF", 4))
+    {
+        goto error;
     }
+    util_endianswap(header, 5, sizeof(header[0]));
 
-    def = prog_getdef(prog, glob);
-    value = (qcany_t*)(&prog->globals[glob]);
-
-    len = printf("[@%u] ", glob);
-    if (def) {
-        const char *name = prog_getstring(prog, def->name);
-        if (name[0] == '#')
-            len += printf("$");
-        else
-            len += printf("%s ", name);
-        vtype = def->type & DEF_TYPEMASK;
+    /* version, defs, globals, fields, statements */
+    if (header[0] != 1                     ||
+        header[1] != prog->defs_count      ||
+        header[3] != prog->fields_count    ||
+        header[4] != prog->code_count)
+    {
+        goto error;
     }
 
-    switch (vtype) {
-        case TYPE_VOID:
-        case TYPE_ENTITY:
-        case TYPE_FIELD:
-        case TYPE_FUNCTION:
-        case TYPE_POINTER:
-            len += printf("(%i),", value->_int);
-            break;
-        case TYPE_VECTOR:
-            len += printf("'%g %g %g',", value->vector[0],
-                                         value->vector[1],
-                                         value->vector[2]);
-            break;
-        case TYPE_STRING:
-            if (value->string)
-                len += print_escaped_string(prog_getstring(prog, value->string), sizeof(spaces)-len-5);
-            else
-                len += printf("(null)");
-            len += printf(",");
-            /* len += printf("\"%s\",", prog_getstring(prog, value->string)); */
-            break;
-        case TYPE_FLOAT:
-        default:
-            len += printf("%g,", value->_float);
-            break;
+    if (fs_file_read(vec_add(linenums, prog->code_count), sizeof(linenums[0]), prog->code_count, file) != prog->code_count)
+        goto error;
+    util_endianswap(linenums, prog->code_count, sizeof(linenums[0]));
+
+    vec_free(prog->linenums);
+    prog->linenums = linenums;
+    fs_file_close(file);
+    return true;
+
+error:
+    fprintf(stderr, "`%s` is not a line number file for `%s`\n", filename, prog->filename);
+    vec_free(linenums);
+    fs_file_close(file);
+    return false;
+}
+
+/*
+ * The functions by entry, to find the one holding a statement with a
+ * binary search: the one with the last entry before it. Of functions
+ * sharing an entry the first is taken, so those sort last.
+ */
+typedef struct {
+    qcint_t entry;
+    size_t  function;
+} qc_sample_entry_t;
+
+static int prog_sample_entry_cmp(const void *a, const void *b) {
+    const qc_sample_entry_t *x = (const qc_sample_entry_t*)a;
+    const qc_sample_entry_t *y = (const qc_sample_entry_t*)b;
+    if (x->entry != y->entry)
+        return (x->entry < y->entry) ? -1 : 1;
+    return (x->function > y->function) ? -1 : (x->function < y->function);
+}
+
+static qc_sample_entry_t *prog_sample_entries(qc_program_t *prog) {
+    qc_sample_entry_t *entries = NULL;
+    size_t             i;
+
+    for (i = 1; i < prog->functions_count; ++i) {
+        qc_sample_entry_t entry;
+        if (prog->functions[i].entry < 0)
+            continue;
+        entry.entry    = prog->functions[i].entry;
+        entry.function = i;
+        vec_push(entries, entry);
     }
-done:
-    if (len < (int)sizeof(spaces)-1) {
-        spaces[sizeof(spaces)-1-len] = 0;
-        fs_file_puts(stdout, spaces);
-        spaces[sizeof(spaces)-1-len] = ' ';
+    if (vec_size(entries))
+        qsort(entries, vec_size(entries), sizeof(entries[0]), &prog_sample_entry_cmp);
+    return entries;
+}
+
+static size_t prog_sample_function(const qc_sample_entry_t *entries, size_t statement) {
+    size_t lo = 0;
+    size_t hi = vec_size(entries);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((size_t)entries[mid].entry <= statement)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    return lo ? entries[lo - 1].function : 0;
 }
 
-static void prog_print_statement(qc_program_t *prog, prog_section_statement_t *st) {
-    if (st->opcode >= VINSTR_END) {
-        printf("<illegal instruction %d>\n", st->opcode);
-        return;
+/*
+ * Writes the histograms of the samples by function and by line, the
+ * most sampled first.
+ */
+bool prog_sample_report(qc_program_t *prog, const char *filename) {
+    FILE              *file    = prog_report_open(filename);
+    qc_sample_count_t *counts  = NULL;
+    qc_sample_entry_t *entries = NULL;
+    double             total;
+    size_t             i;
+
+    if (!file)
+        return false;
+
+    prog_sample_flush(prog);
+    total = prog->sample_total ? (double)prog->sample_total : 1.0;
+
+    fs_file_printf(file, "%lu samples of `%s`, one every %lu instructions\n\n",
+                   (unsigned long)prog->sample_total,
+                   prog->filename,
+                   (unsigned long)prog->sample_interval);
+
+    for (i = 1; i < prog->functions_count; ++i) {
+        qc_sample_count_t count;
+        if (!prog->sample_inclusive[i])
+            continue;
+        count.index    = i;
+        count.count    = prog->sample_self[i];
+        count.function = i;
+        vec_push(counts, count);
     }
-    if ((prog->xflags & VMXF_TRACE) && vec_size(prog->function_stack)) {
-        size_t i;
-        for (i = 0; i < vec_size(prog->function_stack); ++i)
-            printf("->");
-        printf("%s:", vec_last(prog->function_stack));
+    if (vec_size(counts))
+        qsort(counts, vec_size(counts), sizeof(counts[0]), &prog_sample_count_cmp);
+
+    fs_file_printf(file, "%10s %7s %10s %7s  %s\n", "self", "", "total", "", "function");
+    for (i = 0; i < vec_size(counts); ++i) {
+        size_t f = counts[i].index;
+        fs_file_printf(file, "%10lu %6.2f%% %10lu %6.2f%%  %s\n",
+                       (unsigned long)prog->sample_self[f],
+                       100.0 * prog->sample_self[f] / total,
+                       (unsigned long)prog->sample_inclusive[f],
+                       100.0 * prog->sample_inclusive[f] / total,
+                       prog_getstring(prog, prog->functions[f].name));
     }
-    printf(" <> %-12s", util_instr_str[st->opcode]);
-    if (st->opcode >= INSTR_IF &&
-        st->opcode <= INSTR_IFNOT)
-    {
-        trace_print_global(prog, st->o1.u1, TYPE_FLOAT);
-        printf("%d\n", st->o2.s1);
+
+    if (counts)
+        vec_shrinkto(counts, 0);
+    entries = prog_sample_entries(prog);
+    for (i = 0; i < prog->code_count; ++i) {
+        qc_sample_count_t count;
+        size_t            k;
+
+        if (!prog->sample_statements[i])
+            continue;
+        count.index    = i;
+        count.count    = prog->sample_statements[i];
+        count.function = prog_sample_function(entries, i);
+
+        /* merge the statements of a line, which all belong to one function */
+        for (k = vec_size(counts); prog->linenums && k && counts[k-1].function == count.function; --k) {
+            if (prog->linenums[counts[k-1].index] == prog->linenums[i])
+                break;
+        }
+        if (prog->linenums && k && counts[k-1].function == count.function)
+            counts[k-1].count += count.count;
+        else
+            vec_push(counts, count);
     }
-    else if (st->opcode >= INSTR_CALL0 &&
-             st->opcode <= INSTR_CALL8)
-    {
-        trace_print_global(prog, st->o1.u1, TYPE_FUNCTION);
-        printf("\n");
+    if (vec_size(counts))
+        qsort(counts, vec_size(counts), sizeof(counts[0]), &prog_sample_count_cmp);
+
+    fs_file_printf(file, "\n%10s %7s  %s\n", "samples", "", "line");
+    for (i = 0; i < vec_size(counts); ++i) {
+        prog_section_function_t *func = prog->functions + counts[i].function;
+        fs_file_printf(file, "%10lu %6.2f%%  ",
+                       (unsigned long)counts[i].count,
+                       100.0 * counts[i].count / total);
+        if (prog->linenums)
+            fs_file_printf(file, "%s:%i", prog_getstring(prog, func->file), (int)prog->linenums[counts[i].index]);
+        else
+            fs_file_printf(file, "%s statement %lu", prog_getstring(prog, func->file), (unsigned long)counts[i].index);
+        fs_file_printf(file, " (%s)\n", prog_getstring(prog, func->name));
     }
-    else if (st->opcode == INSTR_GOTO)
-    {
-        printf("%i\n", st->o1.s1);
+
+    vec_free(entries);
+    vec_free(counts);
+    prog_report_close(file);
+    return true;
+}
+
+/*
+ * Coverage, from the statement counts of a profiling run. Functions are
+ * cut into basic blocks at jump targets and after every jump or return;
+ * all the statements of a block run as often as the first one, so its
+ * count tells how hot the block is or that it never ran. Blocks no jump
+ * leads to, like the DONE after a return, aren't counted as code. A line
+ * counts as often as its statement which ran the most.
+ */
+typedef struct {
+    size_t first;     /* the statements first to end-1 */
+    size_t end;
+    size_t function;
+} qc_coverage_block_t;
+
+typedef struct {
+    uint32_t name;    /* string of the file name */
+    size_t  *counts;  /* by line */
+    bool    *code;    /* whether statements are on the line */
+} qc_coverage_file_t;
+
+/* where the statements of a function end, 0 when another one has them */
+static size_t prog_coverage_end(qc_program_t *prog, size_t function) {
+    qcint_t entry = prog->functions[function].entry;
+    size_t  end   = prog->code_count;
+    size_t  i;
+
+    for (i = 1; i < prog->functions_count; ++i) {
+        qcint_t next = prog->functions[i].entry;
+        if (next == entry && i < function)
+            return 0;
+        if (next > entry && (size_t)next < end)
+            end = (size_t)next;
     }
-    else
-    {
-        int t[3] = { TYPE_FLOAT, TYPE_FLOAT, TYPE_FLOAT };
-        switch (st->opcode)
-        {
-            case INSTR_MUL_FV:
-                t[1] = t[2] = TYPE_VECTOR;
-                break;
-            case INSTR_MUL_VF:
-                t[0] = t[2] = TYPE_VECTOR;
-                break;
-            case INSTR_MUL_V:
-                t[0] = t[1] = TYPE_VECTOR;
-                break;
-            case INSTR_ADD_V:
-            case INSTR_SUB_V:
-            case INSTR_EQ_V:
-            case INSTR_NE_V:
-                t[0] = t[1] = t[2] = TYPE_VECTOR;
-                break;
-            case INSTR_EQ_S:
-            case INSTR_NE_S:
-                t[0] = t[1] = TYPE_STRING;
-                break;
-            case INSTR_STORE_F:
-            case INSTR_STOREP_F:
-                t[2] = -1;
-                break;
-            case INSTR_STORE_V:
-                t[0] = t[1] = TYPE_VECTOR; t[2] = -1;
-                break;
-            case INSTR_STORE_S:
-                t[0] = t[1] = TYPE_STRING; t[2] = -1;
-                break;
-            case INSTR_STORE_ENT:
-                t[0] = t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STORE_FLD:
-                t[0] = t[1] = TYPE_FIELD; t[2] = -1;
-                break;
-            case INSTR_STORE_FNC:
-                t[0] = t[1] = TYPE_FUNCTION; t[2] = -1;
-                break;
-            case INSTR_STOREP_V:
-                t[0] = TYPE_VECTOR; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STOREP_S:
-                t[0] = TYPE_STRING; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STOREP_ENT:
-                t[0] = TYPE_ENTITY; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STOREP_FLD:
-                t[0] = TYPE_FIELD; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
-            case INSTR_STOREP_FNC:
-                t[0] = TYPE_FUNCTION; t[1] = TYPE_ENTITY; t[2] = -1;
-                break;
+    return end;
+}
+
+static qc_coverage_block_t *prog_coverage_blocks(qc_program_t *prog) {
+    qc_coverage_block_t *blocks    = NULL;
+    bool                *leaders   = NULL;
+    bool                *reachable = NULL;
+    size_t              *pending   = NULL;
+    size_t               f, i;
+
+    for (f = 1; f < prog->functions_count; ++f) {
+        qc_coverage_block_t block;
+        qcint_t             entry = prog->functions[f].entry;
+        size_t              end;
+
+        if (entry <= 0 || (size_t)entry >= prog->code_count)
+            continue;
+        if (!(end = prog_coverage_end(prog, f)))
+            continue;
+
+        if (leaders) {
+            vec_shrinkto(leaders, 0);
+            vec_shrinkto(reachable, 0);
+        }
+        memset(vec_add(leaders, end - entry), 0, sizeof(leaders[0]) * (end - entry));
+        memset(vec_add(reachable, end - entry), 0, sizeof(reachable[0]) * (end - entry));
+        leaders[0] = true;
+
+        /* follow the jumps from the entry */
+        vec_push(pending, (size_t)entry);
+        while (vec_size(pending)) {
+            qcint_t target = -1;
+            bool    next   = true;
+
+            i = vec_last(pending);
+            vec_pop(pending);
+            if (i >= end || reachable[i - entry])
+                continue;
+            reachable[i - entry] = true;
+
+            switch (prog->code[i].opcode) {
+                case INSTR_IF:
+                case INSTR_IFNOT:
+                    target = (qcint_t)i + prog->code[i].o2.s1;
+                    break;
+                case INSTR_GOTO:
+                    target = (qcint_t)i + prog->code[i].o1.s1;
+                    next   = false;
+                    break;
+                case INSTR_RETURN:
+                case INSTR_DONE:
+                    next   = false;
+                    break;
+                default:
+                    vec_push(pending, i + 1);
+                    continue;
+            }
+            if (target >= entry && target < (qcint_t)end) {
+                leaders[target - entry] = true;
+                vec_push(pending, (size_t)target);
+            }
+            if (i + 1 < end)
+                leaders[i + 1 - entry] = true;
+            if (next)
+                vec_push(pending, i + 1);
+        }
+
+        block.function = f;
+        block.first    = (size_t)entry;
+        for (i = (size_t)entry + 1; i <= end; ++i) {
+            if (i == end || leaders[i - entry]) {
+                block.end = i;
+                if (reachable[block.first - entry])
+                    vec_push(blocks, block);
+                block.first = i;
+            }
         }
-        if (t[0] >= 0) trace_print_global(prog, st->o1.u1, t[0]);
-        else           printf("(none),          ");
-        if (t[1] >= 0) trace_print_global(prog, st->o2.u1, t[1]);
-        else           printf("(none),          ");
-        if (t[2] >= 0) trace_print_global(prog, st->o3.u1, t[2]);
-        else           printf("(none)");
-        printf("\n");
     }
+
+    vec_free(leaders);
+    vec_free(reachable);
+    vec_free(pending);
+    return blocks;
 }
 
-static qcint_t prog_enterfunction(qc_program_t *prog, prog_section_function_t *func) {
-    qc_exec_stack_t st;
-    size_t  parampos;
-    int32_t p;
+static qc_coverage_file_t *prog_coverage_files(qc_program_t *prog, const qc_coverage_block_t *blocks) {
+    qc_coverage_file_t *files = NULL;
+    size_t              b, i, s;
 
-    /* back up locals */
-    st.localsp  = vec_size(prog->localstack);
-    st.stmt     = prog->statement;
-    st.function = func;
+    for (b = 0; b < vec_size(blocks); ++b) {
+        uint32_t name = prog->functions[blocks[b].function].file;
 
-    if (prog->xflags & VMXF_TRACE) {
-        const char *str = prog_getstring(prog, func->name);
-        vec_push(prog->function_stack, str);
-    }
+        for (i = 0; i < vec_size(files); ++i) {
+            if (files[i].name == name)
+                break;
+        }
+        if (i == vec_size(files)) {
+            qc_coverage_file_t file;
+            file.name   = name;
+            file.counts = NULL;
+            file.code   = NULL;
+            vec_push(files, file);
+        }
 
-#ifdef QCVM_BACKUP_STRATEGY_CALLER_VARS
-    if (vec_size(prog->stack))
-    {
-        prog_section_function_t *cur;
-        cur = prog->stack[vec_size(prog->stack)-1].function;
-        if (cur)
-        {
-            qcint_t *globals = prog->globals + cur->firstlocal;
-            vec_append(prog->localstack, cur->locals, globals);
+        for (s = blocks[b].first; s < blocks[b].end; ++s) {
+            int32_t line = prog->linenums[s];
+            if (line <= 0)
+                continue;
+            while (vec_size(files[i].counts) <= (size_t)line) {
+                vec_push(files[i].counts, 0);
+                vec_push(files[i].code, false);
+            }
+            files[i].code[line] = true;
+            if (prog->profile[s] > files[i].counts[line])
+                files[i].counts[line] = prog->profile[s];
         }
     }
-#else
-    {
-        qcint_t *globals = prog->globals + func->firstlocal;
-        vec_append(prog->localstack, func->locals, globals);
+    return files;
+}
+
+static void prog_coverage_files_delete(qc_coverage_file_t *files) {
+    size_t i;
+    for (i = 0; i < vec_size(files); ++i) {
+        vec_free(files[i].counts);
+        vec_free(files[i].code);
     }
-#endif
+    vec_free(files);
+}
 
-    /* copy parameters */
-    parampos = func->firstlocal;
-    for (p = 0; p < func->nargs; ++p)
-    {
-        size_t s;
-        for (s = 0; s < func->argsize[p]; ++s) {
-            prog->globals[parampos] = prog->globals[OFS_PARM0 + 3*p + s];
-            ++parampos;
-        }
+/* prints where the statements first to end-1 are in the source */
+static void prog_coverage_where(qc_program_t *prog, size_t first, size_t end, size_t function) {
+    int32_t low = 0, high = 0;
+    size_t  s;
+
+    for (s = first; prog->linenums && s < end; ++s) {
+        if (prog->linenums[s] <= 0)
+            continue;
+        if (!low || prog->linenums[s] < low)
+            low = prog->linenums[s];
+        if (prog->linenums[s] > high)
+            high = prog->linenums[s];
     }
 
-    vec_push(prog->stack, st);
+    printf("%s", prog_getstring(prog, prog->functions[function].file));
+    if (!low && end - first == 1)
+        printf(" statement %lu", (unsigned long)first);
+    else if (!low)
+        printf(" statements %lu-%lu", (unsigned long)first, (unsigned long)end - 1);
+    else if (low == high)
+        printf(":%i", (int)low);
+    else
+        printf(":%i-%i", (int)low, (int)high);
+    printf(" (%s)\n", prog_getstring(prog, prog->functions[function].name));
+}
 
-    return func->entry;
+static void prog_coverage_ratio(const char *what, size_t hit, size_t total) {
+    printf("  %-12s %8lu of %-8lu %6.2f%%\n", what,
+           (unsigned long)hit, (unsigned long)total,
+           total ? 100.0 * hit / total : 100.0);
 }
 
-static qcint_t prog_leavefunction(qc_program_t *prog) {
-    prog_section_function_t *prev = NULL;
-    size_t oldsp;
+/*
+ * Prints the coverage of the last profiling run: the totals, every
+ * function which ran by the instructions it executed, the hottest basic
+ * blocks, the code which never ran, and with the line numbers loaded the
+ * sources annotated with the count of every line, like gcov does.
+ */
+void prog_coverage_print(qc_program_t *prog) {
+    qc_coverage_block_t *blocks = prog_coverage_blocks(prog);
+    qc_coverage_file_t  *files  = NULL;
+    qc_sample_count_t   *counts = NULL;
+    size_t              *instructions;
+    size_t              *statements;
+    size_t              *sizes;
+    size_t               functions = 0, functionshit = 0;
+    size_t               blockshit = 0, code = 0, codehit = 0;
+    size_t               lines = 0, lineshit = 0;
+    size_t               b, i, s;
+    char                *line = NULL;
+    size_t               size = 0;
+
+    /* by function: the instructions executed, statements which ran, statements */
+    instructions = (size_t*)mem_a(sizeof(size_t) * prog->functions_count * 3);
+    statements   = instructions + prog->functions_count;
+    sizes        = statements + prog->functions_count;
+    memset(instructions, 0, sizeof(size_t) * prog->functions_count * 3);
+
+    for (b = 0; b < vec_size(blocks); ++b) {
+        size_t length = blocks[b].end - blocks[b].first;
+        size_t runs   = prog->profile[blocks[b].first];
+
+        instructions[blocks[b].function] += runs * length;
+        sizes[blocks[b].function]        += length;
+        code += length;
+        for (s = blocks[b].first; s < blocks[b].end; ++s) {
+            if (prog->profile[s]) {
+                statements[blocks[b].function]++;
+                codehit++;
+            }
+        }
+        if (runs)
+            blockshit++;
+        if (blocks[b].first == (size_t)prog->functions[blocks[b].function].entry) {
+            functions++;
+            if (runs)
+                functionshit++;
+        }
+    }
 
-    qc_exec_stack_t st = vec_last(prog->stack);
+    if (prog->linenums) {
+        files = prog_coverage_files(prog, blocks);
+        for (i = 0; i < vec_size(files); ++i) {
+            for (s = 0; s < vec_size(files[i].code); ++s) {
+                if (!files[i].code[s])
+                    continue;
+                lines++;
+                if (files[i].counts[s])
+                    lineshit++;
+            }
+        }
+    }
 
-    if (prog->xflags & VMXF_TRACE) {
-        if (vec_size(prog->function_stack))
-            vec_pop(prog->function_stack);
+    printf("coverage of `%s`\n", prog->filename);
+    if (prog->linenums)
+        prog_coverage_ratio("lines", lineshit, lines);
+    prog_coverage_ratio("statements", codehit, code);
+    prog_coverage_ratio("blocks", blockshit, vec_size(blocks));
+    prog_coverage_ratio("functions", functionshit, functions);
+
+    /* the functions which ran, the most instructions first */
+    for (i = 1; i < prog->functions_count; ++i) {
+        qc_sample_count_t count;
+        if (!instructions[i])
+            continue;
+        count.index    = i;
+        count.count    = instructions[i];
+        count.function = i;
+        vec_push(counts, count);
+    }
+    if (vec_size(counts))
+        qsort(counts, vec_size(counts), sizeof(counts[0]), &prog_sample_count_cmp);
+
+    printf("\n%14s %10s %10s  %s\n", "instructions", "calls", "statements", "function");
+    for (i = 0; i < vec_size(counts); ++i) {
+        size_t f = counts[i].index;
+        printf("%14lu %10lu %9.2f%%  ",
+               (unsigned long)instructions[f],
+               (unsigned long)prog->profile_functions[f].calls,
+               100.0 * statements[f] / sizes[f]);
+        prog_coverage_where(prog, prog->functions[f].entry, prog->functions[f].entry + 1, f);
     }
 
-#ifdef QCVM_BACKUP_STRATEGY_CALLER_VARS
-    if (vec_size(prog->stack) > 1) {
-        prev  = prog->stack[vec_size(prog->stack)-2].function;
-        oldsp = prog->stack[vec_size(prog->stack)-2].localsp;
+    /* the hottest blocks, by the instructions executed in them */
+    if (counts)
+        vec_shrinkto(counts, 0);
+    for (b = 0; b < vec_size(blocks); ++b) {
+        qc_sample_count_t count;
+        if (!prog->profile[blocks[b].first])
+            continue;
+        count.index    = b;
+        count.count    = prog->profile[blocks[b].first] * (blocks[b].end - blocks[b].first);
+        count.function = blocks[b].function;
+        vec_push(counts, count);
     }
-#else
-    prev  = prog->stack[vec_size(prog->stack)-1].function;
-    oldsp = prog->stack[vec_size(prog->stack)-1].localsp;
-#endif
-    if (prev) {
-        qcint_t *globals = prog->globals + prev->firstlocal;
-        memcpy(globals, prog->localstack + oldsp, prev->locals * sizeof(prog->localstack[0]));
-        /* vec_remove(prog->localstack, oldsp, vec_size(prog->localstack)-oldsp); */
-        vec_shrinkto(prog->localstack, oldsp);
+    if (vec_size(counts))
+        qsort(counts, vec_size(counts), sizeof(counts[0]), &prog_sample_count_cmp);
+
+    printf("\n%14s %10s  %s\n", "instructions", "runs", "hottest blocks");
+    for (i = 0; i < vec_size(counts) && i < QCVM_COVERAGE_HOT; ++i) {
+        const qc_coverage_block_t *block = blocks + counts[i].index;
+        printf("%14lu %10lu  ",
+               (unsigned long)counts[i].count,
+               (unsigned long)prog->profile[block->first]);
+        prog_coverage_where(prog, block->first, block->end, block->function);
     }
 
-    vec_pop(prog->stack);
+    /* what never ran, neighbouring blocks of a function together */
+    printf("\nnever executed:\n");
+    for (b = 0; b < vec_size(blocks); b = s) {
+        for (s = b; s < vec_size(blocks) && blocks[s].function == blocks[b].function; ++s) {
+            if (prog->profile[blocks[s].first])
+                break;
+        }
+        if (s == b) {
+            ++s;
+            continue;
+        }
+        printf("  ");
+        prog_coverage_where(prog, blocks[b].first, blocks[s-1].end, blocks[b].function);
+    }
+
+    /* the sources, line by line */
+    for (i = 0; i < vec_size(files); ++i) {
+        const char *name   = prog_getstring(prog, files[i].name);
+        FILE       *source = fs_file_open(name, "rb");
+        size_t      n      = 1;
+
+        printf("\n%s:\n", name);
+        while (source ? fs_file_getline(&line, &size, source) != EOF : n < vec_size(files[i].code)) {
+            bool  hascode = n < vec_size(files[i].code) && files[i].code[n];
+            char  count[32];
+
+            if (!hascode)
+                util_strncpy(count, "-", sizeof(count));
+            else if (!files[i].counts[n])
+                util_strncpy(count, "#####", sizeof(count));
+            else
+                util_snprintf(count, sizeof(count), "%lu", (unsigned long)files[i].counts[n]);
 
-    return st.stmt - 1; /* offset the ++st */
+            if (source)
+                printf("%14s %6lu: %s%s", count, (unsigned long)n, line, strchr(line, '\n') ? "" : "\n");
+            else if (hascode)
+                printf("%14s %6lu\n", count, (unsigned long)n);
+            ++n;
+        }
+        if (source)
+            fs_file_close(source);
+    }
+
+    if (line)
+        mem_d(line);
+    mem_d(instructions);
+    vec_free(counts);
+    prog_coverage_files_delete(files);
+    vec_free(blocks);
 }
 
-bool prog_exec(qc_program_t *prog, prog_section_function_t *func, size_t flags, long maxjumps) {
-    long jumpcount = 0;
-    size_t oldxflags = prog->xflags;
-    prog_section_statement_t *st;
+/*
+ * Writes the line and function counts as an lcov tracefile, for genhtml
+ * and whatever else reads those. Needs the line numbers.
+ */
+bool prog_coverage_lcov(qc_program_t *prog, const char *filename) {
+    qc_coverage_block_t *blocks;
+    qc_coverage_file_t  *files;
+    FILE                *file;
+    size_t               i, b, s;
+
+    if (!prog->linenums) {
+        fprintf(stderr, "lcov output needs the line numbers of `%s`, compile it with -flno\n", prog->filename);
+        return false;
+    }
 
-    prog->vmerror = 0;
-    prog->xflags = flags;
+    if (!(file = prog_report_open(filename)))
+        return false;
 
-    st = prog->code + prog_enterfunction(prog, func);
-    --st;
-    switch (flags)
-    {
-        default:
-        case 0:
-        {
-#define QCVM_LOOP    1
-#define QCVM_PROFILE 0
-#define QCVM_TRACE   0
-#           include __FILE__
-        }
-        case (VMXF_TRACE):
-        {
-#define QCVM_PROFILE 0
-#define QCVM_TRACE   1
-#           include __FILE__
+    blocks = prog_coverage_blocks(prog);
+    files  = prog_coverage_files(prog, blocks);
+
+    for (i = 0; i < vec_size(files); ++i) {
+        size_t found = 0, hit = 0;
+
+        fs_file_printf(file, "TN:\nSF:%s\n", prog_getstring(prog, files[i].name));
+
+        for (b = 0; b < vec_size(blocks); ++b) {
+            prog_section_function_t *func = prog->functions + blocks[b].function;
+            if (func->file != files[i].name || blocks[b].first != (size_t)func->entry)
+                continue;
+            fs_file_printf(file, "FN:%i,%s\n",
+                           (int)(prog->linenums[func->entry] > 0 ? prog->linenums[func->entry] : 1),
+                           prog_getstring(prog, func->name));
         }
-        case (VMXF_PROFILE):
-        {
-#define QCVM_PROFILE 1
-#define QCVM_TRACE   0
-#           include __FILE__
+        for (b = 0; b < vec_size(blocks); ++b) {
+            prog_section_function_t *func = prog->functions + blocks[b].function;
+            if (func->file != files[i].name || blocks[b].first != (size_t)func->entry)
+                continue;
+            fs_file_printf(file, "FNDA:%lu,%s\n",
+                           (unsigned long)prog->profile_functions[blocks[b].function].calls,
+                           prog_getstring(prog, func->name));
+            found++;
+            if (prog->profile[func->entry])
+                hit++;
         }
-        case (VMXF_TRACE|VMXF_PROFILE):
-        {
-#define QCVM_PROFILE 1
-#define QCVM_TRACE   1
-#           include __FILE__
+        fs_file_printf(file, "FNF:%lu\nFNH:%lu\n", (unsigned long)found, (unsigned long)hit);
+
+        found = hit = 0;
+        for (s = 0; s < vec_size(files[i].code); ++s) {
+            if (!files[i].code[s])
+                continue;
+            fs_file_printf(file, "DA:%lu,%lu\n", (unsigned long)s, (unsigned long)files[i].counts[s]);
+            found++;
+            if (files[i].counts[s])
+                hit++;
         }
-    };
+        fs_file_printf(file, "LF:%lu\nLH:%lu\nend_of_record\n", (unsigned long)found, (unsigned long)hit);
+    }
 
-cleanup:
-    prog->xflags = oldxflags;
-    vec_free(prog->localstack);
-    vec_free(prog->stack);
-    if (prog->vmerror)
-        return false;
+    prog_coverage_files_delete(files);
+    vec_free(blocks);
+    prog_report_close(file);
     return true;
 }
 
-/***********************************************************************
- * main for when building the standalone executor
+/*
+ * Writes the counts of a profiling run by function and line, which is
+ * what gmqcc -profile-use reads back: unlike the statement numbers they
+ * still mean something after the source was changed. Every line with
+ * code has a `line count true false function` line, where count is how
+ * often the line ran and true and false how often the conditions of the
+ * branches on it were true and false. Needs the line numbers.
  */
+typedef struct {
+    int32_t line;
+    size_t  count;
+    size_t  ontrue;   /* the conditions of the branches on it */
+    size_t  onfalse;
+} qc_profile_line_t;
+
+bool prog_profile_lines(qc_program_t *prog, const char *filename) {
+    qc_coverage_block_t *blocks;
+    qc_profile_line_t   *lines = NULL;
+    FILE                *file;
+    size_t               b, i, s;
+
+    if (!prog->linenums) {
+        fprintf(stderr, "the line profile needs the line numbers of `%s`, compile it with -flno\n", prog->filename);
+        return false;
+    }
 
-#if defined(QCVM_EXECUTOR)
-#include <math.h>
+    if (!(file = prog_report_open(filename)))
+        return false;
 
-const char *type_name[TYPE_COUNT] = {
-    "void",
-    "string",
-    "float",
-    "vector",
-    "entity",
-    "field",
-    "function",
-    "pointer",
-    "integer",
+    fs_file_puts(file, "QCVMLINES 1\n");
 
-    "variant",
+    blocks = prog_coverage_blocks(prog);
+    for (b = 0; b < vec_size(blocks); ++b) {
+        for (s = blocks[b].first; s < blocks[b].end; ++s) {
+            prog_section_statement_t *st = prog->code + s;
+            int32_t                   line = prog->linenums[s];
 
-    "struct",
-    "union",
-    "array",
+            if (line <= 0)
+                continue;
+            for (i = 0; i < vec_size(lines); ++i) {
+                if (lines[i].line == line)
+                    break;
+            }
+            if (i == vec_size(lines)) {
+                qc_profile_line_t add;
+                add.line    = line;
+                add.count   = 0;
+                add.ontrue  = 0;
+                add.onfalse = 0;
+                vec_push(lines, add);
+            }
 
-    "nil",
-    "noexpr"
-};
+            if (prog->profile[s] > lines[i].count)
+                lines[i].count = prog->profile[s];
+            if (st->opcode == INSTR_IF) {
+                lines[i].ontrue  += prog->profile_taken[s];
+                lines[i].onfalse += prog->profile[s] - prog->profile_taken[s];
+            } else if (st->opcode == INSTR_IFNOT) {
+                lines[i].onfalse += prog->profile_taken[s];
+                lines[i].ontrue  += prog->profile[s] - prog->profile_taken[s];
+            }
+        }
 
-typedef struct {
-    int         vtype;
-    const char *value;
-} qcvm_parameter;
+        /* the function is done with its last block */
+        if (b + 1 < vec_size(blocks) && blocks[b+1].function == blocks[b].function)
+            continue;
+        for (i = 0; i < vec_size(lines); ++i) {
+            fs_file_printf(file, "%i %lu %lu %lu %s\n",
+                           (int)lines[i].line,
+                           (unsigned long)lines[i].count,
+                           (unsigned long)lines[i].ontrue,
+                           (unsigned long)lines[i].onfalse,
+                           prog_getstring(prog, prog->functions[blocks[b].function].name));
+        }
+        if (lines)
+            vec_shrinkto(lines, 0);
+    }
 
-static qcvm_parameter *main_params = NULL;
+    vec_free(lines);
+    vec_free(blocks);
+    prog_report_close(file);
+    return true;
+}
 
-#define CheckArgs(num) do {                                                    \
-    if (prog->argc != (num)) {                                                 \
-        prog->vmerror++;                                                       \
-        fprintf(stderr, "ERROR: invalid number of arguments for %s: %i, expected %i\n", \
-        __FUNCTION__, prog->argc, (num));                                      \
-        return -1;                                                             \
-    }                                                                          \
-} while (0)
+/***********************************************************************
+ * VM code
+ */
 
-#define GetGlobal(idx) ((qcany_t*)(prog->globals + (idx)))
-#define GetArg(num) GetGlobal(OFS_PARM0 + 3*(num))
-#define Return(any) *(GetGlobal(OFS_RETURN)) = (any)
+const char* prog_getstring(qc_program_t *prog, qcint_t str) {
+    /* cast for return required for C++ */
+    if (str < 0)
+        return  "<<<invalid string>>>";
+    if (str < (qcint_t)prog->strings_count)
+        return prog->strings + str;
 
-static int qc_print(qc_program_t *prog) {
-    size_t i;
-    const char *laststr = NULL;
-    for (i = 0; i < (size_t)prog->argc; ++i) {
-        qcany_t *str = (qcany_t*)(prog->globals + OFS_PARM0 + 3*i);
-        laststr = prog_getstring(prog, str->string);
-        printf("%s", laststr);
-    }
-    if (laststr && (prog->xflags & VMXF_TRACE)) {
-        size_t len = strlen(laststr);
-        if (!len || laststr[len-1] != '\n')
-            printf("\n");
-    }
-    return 0;
+    str -= (qcint_t)prog->tempstring_start;
+    if ((size_t)str >> QCVM_TEMPSTRING_CHUNK_SHIFT >= vec_size(prog->tempstring_chunks))
+        return  "<<<invalid string>>>";
+    return prog->tempstring_chunks[(size_t)str >> QCVM_TEMPSTRING_CHUNK_SHIFT]
+         + ((size_t)str & (QCVM_TEMPSTRING_CHUNK - 1));
 }
 
-static int qc_error(qc_program_t *prog) {
-    fprintf(stderr, "*** VM raised an error:\n");
-    qc_print(prog);
-    prog->vmerror++;
-    return -1;
+prog_section_def_t* prog_entfield(qc_program_t *prog, qcint_t off) {
+    if (off < 0 || off >= (qcint_t)vec_size(prog->fields_by_offset))
+        return NULL;
+    return prog->fields_by_offset[off];
 }
 
-static int qc_ftos(qc_program_t *prog) {
-    char buffer[512];
-    qcany_t *num;
+prog_section_def_t* prog_getdef(qc_program_t *prog, qcint_t off)
+{
+    if (off < 0 || off >= (qcint_t)vec_size(prog->defs_by_offset))
+        return NULL;
+    return prog->defs_by_offset[off];
+}
+
+static void prog_entity_touch(qc_program_t *prog, qcint_t e) {
+    prog->entitydirty[e] = true;
+    vec_push(prog->entitytouched, e);
+}
+
+static void prog_tempstring_touch(qc_program_t *prog, size_t chunk) {
+    if (!prog->tempstringdirty[chunk]) {
+        prog->tempstringdirty[chunk] = true;
+        vec_push(prog->tempstringtouched, chunk);
+    }
+}
+
+/*
+ * Returns the first field of an entity. The other fields follow it
+ * `prog->fieldstride` words apart, field `f` is the qcint_t at index
+ * f * fieldstride. Only with the default layout is that 1, so the entity
+ * is an array of its fields; with the field-major layout the fields of
+ * the other entities of the chunk lie in between, and the components of
+ * a vector field are as far apart as any other fields.
+ */
+qcany_t* prog_getedict(qc_program_t *prog, qcint_t e) {
+    if (e < 0 || e >= (qcint_t)vec_size(prog->entitypool)) {
+        prog->vmerror++;
+        fprintf(stderr, "Accessing out of bounds edict %i\n", (int)e);
+        e = 0;
+    }
+    /* the caller may write to it */
+    PROG_ENTTOUCH(prog, e);
+    return (qcany_t*)PROG_ENTFIELD(prog, e, 0);
+}
+
+static qcint_t *prog_entity_chunk(qc_program_t *prog) {
+    size_t size = QCVM_ENTITY_CHUNK * (prog->entityfields ? prog->entityfields : 1) * sizeof(qcint_t);
+    return (qcint_t*)memset(mem_a(size), 0, size);
+}
+
+static void prog_entity_clear(qc_program_t *prog, qcint_t e) {
+    qcint_t *data = PROG_ENTFIELD(prog, e, 0);
+    size_t   f;
+    PROG_ENTTOUCH(prog, e);
+    if (prog->fieldstride == 1) {
+        memset(data, 0, prog->entityfields * sizeof(qcint_t));
+        return;
+    }
+    for (f = 0; f < prog->entityfields; ++f)
+        data[f * prog->fieldstride] = 0;
+}
+
+/*
+ * With the default layout all fields of an entity are next to each other
+ * like in a struct. The field-major layout stores each field of all the
+ * entities of a chunk next to each other instead, which is faster when
+ * going over one field of many entities. Vectors are three fields, so in
+ * that layout their components are `fieldstride` apart.
+ */
+void prog_entity_layout(qc_program_t *prog, int layout) {
+    size_t entitystride = (layout == VMENTITY_FIELD_MAJOR) ? 1 : prog->entityfields;
+    size_t fieldstride  = (layout == VMENTITY_FIELD_MAJOR) ? QCVM_ENTITY_CHUNK : 1;
+    size_t c;
+
+    if (entitystride == prog->entitystride && fieldstride == prog->fieldstride)
+        return;
+
+    /* move the data of every chunk over into the new layout */
+    for (c = 0; c < vec_size(prog->entitychunks); ++c) {
+        qcint_t *from = prog->entitychunks[c];
+        qcint_t *to   = prog_entity_chunk(prog);
+        size_t   e, f;
+        for (e = 0; e < QCVM_ENTITY_CHUNK; ++e) {
+            for (f = 0; f < prog->entityfields; ++f)
+                to[e * entitystride + f * fieldstride] = from[e * prog->entitystride + f * prog->fieldstride];
+        }
+        prog->entitychunks[c] = to;
+        mem_d(from);
+    }
+    prog->entitystride = entitystride;
+    prog->fieldstride  = fieldstride;
+}
+
+qcint_t prog_spawn_entity(qc_program_t *prog) {
+    qcint_t e;
+
+    if (vec_size(prog->entityfree)) {
+        e = vec_last(prog->entityfree);
+        vec_pop(prog->entityfree);
+    } else {
+        e = (qcint_t)vec_size(prog->entitypool);
+        /* the entity has to fit into a field pointer */
+        if ((size_t)e >> (31 - prog->fieldshift)) {
+            prog->vmerror++;
+            fprintf(stderr, "Out of entities\n");
+            return 0;
+        }
+        if ((size_t)e >= vec_size(prog->entitychunks) * QCVM_ENTITY_CHUNK)
+            vec_push(prog->entitychunks, prog_entity_chunk(prog));
+        vec_push(prog->entitypool, false);
+        prog->entities++;
+        if (vec_size(prog->entitydirty) < vec_size(prog->entitypool))
+            vec_push(prog->entitydirty, false);
+    }
+
+    prog->entitypool[e] = true;
+    prog_entity_clear(prog, e);
+    return e;
+}
+
+void prog_free_entity(qc_program_t *prog, qcint_t e) {
+    if (!e) {
+        prog->vmerror++;
+        fprintf(stderr, "Trying to free world entity\n");
+        return;
+    }
+    if (e < 0 || e >= (qcint_t)vec_size(prog->entitypool)) {
+        prog->vmerror++;
+        fprintf(stderr, "Trying to free out of bounds entity\n");
+        return;
+    }
+    if (!prog->entitypool[e]) {
+        prog->vmerror++;
+        fprintf(stderr, "Double free on entity\n");
+        return;
+    }
+    prog->entitypool[e] = false;
+    vec_push(prog->entityfree, e);
+}
+
+static size_t prog_tempstring_alloc(qc_program_t *prog, unsigned int sizeclass) {
+    size_t slot = (size_t)1 << (sizeclass + QCVM_TEMPSTRING_MIN_SHIFT);
+    size_t offset;
+    char  *block;
+
+    if (vec_size(prog->tempstring_free[sizeclass])) {
+        offset = vec_last(prog->tempstring_free[sizeclass]);
+        vec_pop(prog->tempstring_free[sizeclass]);
+        prog->tempstring_stats.reused++;
+        return offset;
+    }
+
+    /* slots larger than a chunk get a block of their own */
+    if (slot > QCVM_TEMPSTRING_CHUNK) {
+        size_t i;
+        block  = (char*)mem_a(slot);
+        offset = vec_size(prog->tempstring_chunks) << QCVM_TEMPSTRING_CHUNK_SHIFT;
+        vec_push(prog->tempstring_blocks, block);
+        for (i = 0; i < slot >> QCVM_TEMPSTRING_CHUNK_SHIFT; ++i) {
+            vec_push(prog->tempstring_chunks, block + (i << QCVM_TEMPSTRING_CHUNK_SHIFT));
+            vec_push(prog->tempstringdirty, false);
+        }
+        prog->tempstring_stats.reserved += slot;
+        return offset;
+    }
+
+    if (prog->tempstring_at + slot > prog->tempstring_end) {
+        block = (char*)mem_a(QCVM_TEMPSTRING_CHUNK);
+        prog->tempstring_at  = vec_size(prog->tempstring_chunks) << QCVM_TEMPSTRING_CHUNK_SHIFT;
+        prog->tempstring_end = prog->tempstring_at + QCVM_TEMPSTRING_CHUNK;
+        vec_push(prog->tempstring_blocks, block);
+        vec_push(prog->tempstring_chunks, block);
+        vec_push(prog->tempstringdirty, false);
+        prog->tempstring_stats.reserved += QCVM_TEMPSTRING_CHUNK;
+    }
+    offset = prog->tempstring_at;
+    prog->tempstring_at += slot;
+    return offset;
+}
+
+/*
+ * Releases `count` live tempstrings starting at `from`, the newest first
+ * so their slots are reused in the order they were made. Only the ones
+ * made after them have to move down.
+ */
+static void prog_tempstring_release(qc_program_t *prog, size_t from, size_t count) {
+    size_t i;
+
+    if (!count)
+        return;
+    for (i = from + count; i-- > from; ) {
+        qc_tempstring_t *str = prog->tempstring_live + i;
+        vec_push(prog->tempstring_free[str->sizeclass], str->offset);
+        prog->tempstring_stats.used -= (size_t)1 << (str->sizeclass + QCVM_TEMPSTRING_MIN_SHIFT);
+    }
+    if (from + count == vec_size(prog->tempstring_live))
+        vec_shrinkto(prog->tempstring_live, from);
+    else
+        vec_remove(prog->tempstring_live, from, count);
+    prog->tempstring_stats.resets++;
+}
+
+/*
+ * Releases the tempstrings made since `mark` when a call returns, but
+ * the one it returns, if any, which moves to `mark` for the caller.
+ */
+static void prog_tempstring_leave(qc_program_t *prog, size_t mark) {
+    size_t  count = vec_size(prog->tempstring_live);
+    qcint_t ret   = prog->globals[OFS_RETURN];
+    size_t  i;
+
+    if (mark >= count)
+        return;
+    if (ret >= (qcint_t)prog->tempstring_start) {
+        for (i = mark; i < count; ++i) {
+            if (prog->tempstring_start + prog->tempstring_live[i].offset == (size_t)ret) {
+                qc_tempstring_t str = prog->tempstring_live[i];
+                prog->tempstring_live[i]    = prog->tempstring_live[mark];
+                prog->tempstring_live[mark] = str;
+                ++mark;
+                break;
+            }
+        }
+    }
+    prog_tempstring_release(prog, mark, count - mark);
+}
+
+/*
+ * Called when the string `str` is stored to the global `to`. When it's a
+ * tempstring and `to` isn't a local of the running function, a parameter
+ * or the return value, it may outlive the frames running now, which keep
+ * their tempstrings then.
+ */
+static GMQCC_INLINE void prog_tempstring_escape(qc_program_t *prog, qcint_t str, const qcany_t *to) {
+    size_t                   at = (const qcint_t*)to - prog->globals;
+    prog_section_function_t *func;
+
+    if (str < (qcint_t)prog->tempstring_start)
+        return;
+    if (at >= OFS_RETURN && at < OFS_PARM7 + 3)
+        return;
+    if (vec_size(prog->stack)) {
+        func = vec_last(prog->stack).function;
+        if (at >= func->firstlocal && at < func->firstlocal + func->locals)
+            return;
+    }
+    prog->tempstring_escapes++;
+}
+
+qcint_t prog_tempstring(qc_program_t *prog, const char *str) {
+    size_t          len       = strlen(str);
+    unsigned int    sizeclass = 0;
+    size_t          i;
+    qc_tempstring_t live;
+
+    while (((size_t)1 << (sizeclass + QCVM_TEMPSTRING_MIN_SHIFT)) < len + 1)
+        ++sizeclass;
+
+    if (sizeclass >= VM_TEMPSTRING_CLASSES ||
+        prog->tempstring_start + (vec_size(prog->tempstring_chunks) << QCVM_TEMPSTRING_CHUNK_SHIFT)
+            + ((size_t)1 << (sizeclass + QCVM_TEMPSTRING_MIN_SHIFT)) > 0x7FFFFFFF)
+    {
+        qcvmerror(prog, "`%s` ran out of tempstring space", prog->filename);
+        return 0;
+    }
+
+    live.offset    = prog_tempstring_alloc(prog, sizeclass);
+    live.sizeclass = sizeclass;
+    vec_push(prog->tempstring_live, live);
+    for (i = live.offset >> QCVM_TEMPSTRING_CHUNK_SHIFT; i <= (live.offset + len) >> QCVM_TEMPSTRING_CHUNK_SHIFT; ++i)
+        prog_tempstring_touch(prog, i);
+    memcpy(prog->tempstring_chunks[live.offset >> QCVM_TEMPSTRING_CHUNK_SHIFT]
+               + (live.offset & (QCVM_TEMPSTRING_CHUNK - 1)),
+           str, len + 1);
+
+    prog->tempstring_stats.allocations++;
+    prog->tempstring_stats.used += (size_t)1 << (sizeclass + QCVM_TEMPSTRING_MIN_SHIFT);
+    if (prog->tempstring_stats.used > prog->tempstring_stats.peak)
+        prog->tempstring_stats.peak = prog->tempstring_stats.used;
+
+    return (qcint_t)(prog->tempstring_start + live.offset);
+}
+
+/***********************************************************************
+ * The embedding interface
+ */
+
+static void prog_snapshot_clean(qc_program_t *prog, size_t base);
+
+void prog_reset(qc_program_t *prog) {
+    size_t i;
+
+    memcpy(prog->globals, prog->initglobals, vec_size(prog->initglobals) * sizeof(prog->globals[0]));
+
+    /* only the world entity survives, the chunks are kept for reuse */
+    vec_shrinkto(prog->entitypool, 1);
+    if (prog->entityfree)
+        vec_shrinkto(prog->entityfree, 0);
+    prog_entity_clear(prog, 0);
+    prog->entities = 1;
+
+    /* nothing is known about what changed since, snapshots restore fully */
+    prog_snapshot_clean(prog, 0);
+
+    prog_tempstring_release(prog, 0, vec_size(prog->tempstring_live));
+    prog->tempstring_frame = 0;
+
+    vec_shrinkto(prog->stack, 0);
+    vec_shrinkto(prog->localstack, 0);
+    if (prog->suspended)
+        vec_shrinkto(prog->suspended, 0);
+    for (i = 0; i < vec_size(prog->frameinfo); ++i)
+        prog->frameinfo[i].active = 0;
+
+    /* the profile keeps what it collected, only the open frames go */
+    if (prog->profile_frames)
+        vec_shrinkto(prog->profile_frames, 0);
+    for (i = 0; i < vec_size(prog->profile_functions); ++i)
+        prog->profile_functions[i].active = 0;
+
+    prog->statement = 0;
+    prog->argc      = 0;
+    prog->vmerror   = 0;
+}
+
+void prog_builtin_set(qc_program_t *prog, size_t number, prog_builtin_t builtin) {
+    if (number >= vec_size(prog->builtins)) {
+        size_t grow = number + 1 - vec_size(prog->builtins);
+        memset(vec_add(prog->builtins, grow), 0, grow * sizeof(prog->builtins[0]));
+    }
+    prog->builtins[number] = builtin;
+    prog->builtins_count   = vec_size(prog->builtins);
+
+    /* the builtin replaces an intrinsic of the same number */
+    if (number < vec_size(prog->intrinsics) && prog->intrinsics[number].function) {
+        prog->intrinsics[number].function = NULL;
+        prog_intrinsics(prog);
+        prog_labels(prog);
+    }
+}
+
+/*
+ * Registers an intrinsic for the builtin `number`, to be called directly
+ * with up to two parameters wherever the builtin certainly is the one
+ * called with `argc` parameters, see prog_intrinsics. Elsewhere, like a
+ * call through a function variable, the builtin still is called, so it
+ * has to be set up as well. Setting the builtin again drops the intrinsic.
+ */
+void prog_intrinsic_set(qc_program_t *prog, size_t number, prog_intrinsic_t intrinsic, size_t argc) {
+    if (number >= vec_size(prog->intrinsics)) {
+        size_t grow = number + 1 - vec_size(prog->intrinsics);
+        memset(vec_add(prog->intrinsics, grow), 0, grow * sizeof(prog->intrinsics[0]));
+    }
+    prog->intrinsics[number].function = (argc <= 2) ? intrinsic : NULL;
+    prog->intrinsics[number].argc     = argc;
+    prog_intrinsics(prog);
+    prog_labels(prog);
+}
+
+bool prog_builtin_register(qc_program_t *prog, const char *name, prog_builtin_t builtin) {
+    prog_section_function_t *func = prog_findfunction(prog, name);
+    if (!func || func->entry >= 0)
+        return false;
+    prog_builtin_set(prog, (size_t)-func->entry, builtin);
+    return true;
+}
+
+prog_section_function_t* prog_findfunction(qc_program_t *prog, const char *name) {
+    return (prog_section_function_t*)util_htget(prog->function_index, name);
+}
+
+prog_section_def_t* prog_finddef(qc_program_t *prog, const char *name) {
+    return (prog_section_def_t*)util_htget(prog->def_index, name);
+}
+
+prog_section_def_t* prog_findfield(qc_program_t *prog, const char *name) {
+    return (prog_section_def_t*)util_htget(prog->field_index, name);
+}
+
+qcany_t* prog_getglobal(qc_program_t *prog, const prog_section_def_t *def) {
+    return (qcany_t*)(prog->globals + def->offset);
+}
+
+/* see prog_getedict for where the components of a vector field are */
+qcany_t* prog_getfield(qc_program_t *prog, qcint_t e, const prog_section_def_t *field) {
+    if (e < 0 || e >= (qcint_t)vec_size(prog->entitypool)) {
+        qcvmerror(prog, "Accessing out of bounds edict %i", (int)e);
+        e = 0;
+    }
+    PROG_ENTTOUCH(prog, e);
+    return (qcany_t*)PROG_ENTFIELD(prog, e, field->offset);
+}
+
+static qcany_t* prog_parm(qc_program_t *prog, size_t parm) {
+    if (parm > 7) {
+        qcvmerror(prog, "no such parameter: %u", (unsigned int)parm);
+        parm = 7;
+    }
+    return (qcany_t*)(prog->globals + OFS_PARM0 + 3*parm);
+}
+
+void prog_setparm_float(qc_program_t *prog, size_t parm, qcfloat_t value) {
+    prog_parm(prog, parm)->_float = value;
+}
+
+void prog_setparm_vector(qc_program_t *prog, size_t parm, const qcfloat_t value[3]) {
+    qcany_t *arg = prog_parm(prog, parm);
+    arg->vector[0] = value[0];
+    arg->vector[1] = value[1];
+    arg->vector[2] = value[2];
+}
+
+void prog_setparm_string(qc_program_t *prog, size_t parm, const char *value) {
+    prog_parm(prog, parm)->string = prog_tempstring(prog, value);
+}
+
+void prog_setparm_entity(qc_program_t *prog, size_t parm, qcint_t e) {
+    prog_parm(prog, parm)->edict = e;
+}
+
+bool prog_call(qc_program_t *prog, prog_section_function_t *func, size_t argc) {
+    qcint_t builtinnumber;
+
+    prog->argc = (int)argc;
+    if (func->entry >= 0)
+        return prog_exec(prog, func, VMXF_THREADED, VM_JUMPS_DEFAULT);
+
+    prog->vmerror = 0;
+    builtinnumber = -func->entry;
+    if (builtinnumber < (qcint_t)prog->builtins_count && prog->builtins[builtinnumber])
+        prog->builtins[builtinnumber](prog);
+    else
+        qcvmerror(prog, "No such builtin #%i in %s! Try updating your gmqcc sources",
+                  (int)builtinnumber, prog->filename);
+    return !prog->vmerror;
+}
+
+qcany_t* prog_return(qc_program_t *prog) {
+    return (qcany_t*)(prog->globals + OFS_RETURN);
+}
+
+/*
+ * Snapshots copy the globals, entities and tempstrings of a program so it
+ * can be put back into that state later. The VM marks every entity and
+ * tempstring chunk it writes to, and the last snapshot taken or restored
+ * is remembered as the base: restoring it again, or updating it, only
+ * copies what was marked since. Any other snapshot is copied completely,
+ * and so is a snapshot taken from another program: ids are only unique
+ * per program. Restoring one also rewrites globals the program itself
+ * never writes; calls and intrinsics specialized by prog_verify check
+ * the function global every time, so they follow.
+ * The globals are always copied whole, nearly every instruction writes
+ * them so marking would cost more than the copy.
+ *
+ * Snapshots are taken and restored between calls, not from builtins.
+ */
+#define PROG_VEC_ASSIGN(A, B)                                                   \
+    do {                                                                        \
+        if (A)                                                                  \
+            vec_shrinkto((A), 0);                                               \
+        if (vec_size(B))                                                        \
+            vec_append((A), vec_size(B), (B));                                  \
+    } while (0)
+
+static void prog_snapshot_clean(qc_program_t *prog, size_t base) {
+    size_t i;
+    for (i = 0; i < vec_size(prog->entitytouched); ++i)
+        prog->entitydirty[prog->entitytouched[i]] = false;
+    for (i = 0; i < vec_size(prog->tempstringtouched); ++i) {
+        if (prog->tempstringtouched[i] < vec_size(prog->tempstringdirty))
+            prog->tempstringdirty[prog->tempstringtouched[i]] = false;
+    }
+    if (prog->entitytouched)
+        vec_shrinkto(prog->entitytouched, 0);
+    if (prog->tempstringtouched)
+        vec_shrinkto(prog->tempstringtouched, 0);
+    prog->snapshot_base = base;
+}
+
+static void prog_entity_save(qc_program_t *prog, qcint_t e, qcint_t *data) {
+    const qcint_t *fld = PROG_ENTFIELD(prog, e, 0);
+    size_t         f;
+    if (prog->fieldstride == 1) {
+        memcpy(data, fld, prog->entityfields * sizeof(qcint_t));
+        return;
+    }
+    for (f = 0; f < prog->entityfields; ++f)
+        data[f] = fld[f * prog->fieldstride];
+}
+
+static void prog_entity_restore(qc_program_t *prog, qcint_t e, const qcint_t *data) {
+    qcint_t *fld = PROG_ENTFIELD(prog, e, 0);
+    size_t   f;
+    if (prog->fieldstride == 1) {
+        memcpy(fld, data, prog->entityfields * sizeof(qcint_t));
+        return;
+    }
+    for (f = 0; f < prog->entityfields; ++f)
+        fld[f * prog->fieldstride] = data[f];
+}
+
+/* the number of chunks in every block of the tempstring arena */
+static void prog_tempstring_layout(qc_program_t *prog, size_t **sizes) {
+    size_t b = 0;
+    size_t c;
+
+    if (*sizes)
+        vec_shrinkto(*sizes, 0);
+    for (c = 0; c < vec_size(prog->tempstring_chunks); ++c) {
+        if (b < vec_size(prog->tempstring_blocks) && prog->tempstring_chunks[c] == prog->tempstring_blocks[b]) {
+            vec_push(*sizes, 0);
+            ++b;
+        }
+        vec_last(*sizes)++;
+    }
+}
+
+/*
+ * Brings the blocks of the tempstring arena in line with `sizes`. Returns
+ * the number of leading chunks which were kept, the others are new.
+ */
+static size_t prog_tempstring_rearrange(qc_program_t *prog, const size_t *sizes) {
+    size_t *have  = NULL;
+    size_t  keep  = 0;
+    size_t  kept  = 0;
+    size_t  b, c;
+
+    prog_tempstring_layout(prog, &have);
+    while (keep < vec_size(have) && keep < vec_size(sizes) && have[keep] == sizes[keep])
+        kept += sizes[keep++];
+    vec_free(have);
+
+    for (b = keep; b < vec_size(prog->tempstring_blocks); ++b)
+        mem_d(prog->tempstring_blocks[b]);
+    if (prog->tempstring_blocks) {
+        vec_shrinkto(prog->tempstring_blocks, keep);
+        vec_shrinkto(prog->tempstring_chunks, kept);
+        vec_shrinkto(prog->tempstringdirty,   kept);
+    }
+
+    for (b = keep; b < vec_size(sizes); ++b) {
+        char *block = (char*)mem_a(sizes[b] << QCVM_TEMPSTRING_CHUNK_SHIFT);
+        vec_push(prog->tempstring_blocks, block);
+        for (c = 0; c < sizes[b]; ++c) {
+            vec_push(prog->tempstring_chunks, block + (c << QCVM_TEMPSTRING_CHUNK_SHIFT));
+            vec_push(prog->tempstringdirty, false);
+        }
+    }
+    return kept;
+}
+
+qc_snapshot_t *prog_snapshot(qc_program_t *prog) {
+    qc_snapshot_t *snapshot = (qc_snapshot_t*)mem_a(sizeof(qc_snapshot_t));
+    memset(snapshot, 0, sizeof(*snapshot));
+    if (!prog_snapshot_update(prog, snapshot)) {
+        prog_snapshot_delete(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+/* makes the snapshot hold the current state */
+bool prog_snapshot_update(qc_program_t *prog, qc_snapshot_t *snapshot) {
+    size_t fields   = prog->entityfields;
+    size_t entities = vec_size(prog->entitypool);
+    size_t chunks   = vec_size(prog->tempstring_chunks);
+    size_t saved    = vec_size(snapshot->entitypool);
+    size_t had      = vec_size(snapshot->tempstrings) >> QCVM_TEMPSTRING_CHUNK_SHIFT;
+    bool   full     = snapshot->owner != prog || snapshot->id != prog->snapshot_base;
+    size_t i, c;
+
+    if (vec_size(prog->stack)) {
+        qcvmerror(prog, "`%s` cannot take a snapshot while executing", prog->filename);
+        return false;
+    }
+    if (snapshot->owner != prog) {
+        snapshot->owner = prog;
+        snapshot->id    = ++prog->snapshot_serial;
+    }
+
+    PROG_VEC_ASSIGN(snapshot->globals, prog->globals);
+
+    if (vec_size(snapshot->entitydata) < entities * fields)
+        (void)vec_add(snapshot->entitydata, entities * fields - vec_size(snapshot->entitydata));
+    else if (snapshot->entitydata)
+        vec_shrinkto(snapshot->entitydata, entities * fields);
+    if (full)
+        saved = 0;
+    for (i = 0; i < vec_size(prog->entitytouched) && !full; ++i) {
+        qcint_t e = prog->entitytouched[i];
+        if ((size_t)e < saved)
+            prog_entity_save(prog, e, snapshot->entitydata + e * fields);
+    }
+    for (i = saved; i < entities; ++i)
+        prog_entity_save(prog, (qcint_t)i, snapshot->entitydata + i * fields);
+    PROG_VEC_ASSIGN(snapshot->entitypool, prog->entitypool);
+    PROG_VEC_ASSIGN(snapshot->entityfree, prog->entityfree);
+
+    if (vec_size(snapshot->tempstrings) < chunks << QCVM_TEMPSTRING_CHUNK_SHIFT)
+        (void)vec_add(snapshot->tempstrings, (chunks << QCVM_TEMPSTRING_CHUNK_SHIFT) - vec_size(snapshot->tempstrings));
+    else if (snapshot->tempstrings)
+        vec_shrinkto(snapshot->tempstrings, chunks << QCVM_TEMPSTRING_CHUNK_SHIFT);
+    if (full)
+        had = 0;
+    for (i = 0; i < vec_size(prog->tempstringtouched) && !full; ++i) {
+        c = prog->tempstringtouched[i];
+        if (c < had) {
+            memcpy(snapshot->tempstrings + (c << QCVM_TEMPSTRING_CHUNK_SHIFT),
+                   prog->tempstring_chunks[c], QCVM_TEMPSTRING_CHUNK);
+        }
+    }
+    for (c = had; c < chunks; ++c) {
+        memcpy(snapshot->tempstrings + (c << QCVM_TEMPSTRING_CHUNK_SHIFT),
+               prog->tempstring_chunks[c], QCVM_TEMPSTRING_CHUNK);
+    }
+    prog_tempstring_layout(prog, &snapshot->tempstring_blocks);
+    for (c = 0; c < VM_TEMPSTRING_CLASSES; ++c)
+        PROG_VEC_ASSIGN(snapshot->tempstring_free[c], prog->tempstring_free[c]);
+    PROG_VEC_ASSIGN(snapshot->tempstring_live, prog->tempstring_live);
+    snapshot->tempstring_frame = prog->tempstring_frame;
+    snapshot->tempstring_at    = prog->tempstring_at;
+    snapshot->tempstring_end   = prog->tempstring_end;
+    snapshot->tempstring_stats = prog->tempstring_stats;
+
+    prog_snapshot_clean(prog, snapshot->id);
+    return true;
+}
+
+bool prog_restore(qc_program_t *prog, const qc_snapshot_t *snapshot) {
+    size_t fields   = prog->entityfields;
+    size_t entities = vec_size(snapshot->entitypool);
+    bool   full     = snapshot->owner != prog || snapshot->id != prog->snapshot_base;
+    size_t kept;
+    size_t i, c;
+
+    if (vec_size(prog->stack)) {
+        qcvmerror(prog, "`%s` cannot restore a snapshot while executing", prog->filename);
+        return false;
+    }
+    if (vec_size(snapshot->globals) != vec_size(prog->globals) ||
+        vec_size(snapshot->entitydata) != entities * fields)
+    {
+        qcvmerror(prog, "the snapshot doesn't belong to `%s`", prog->filename);
+        return false;
+    }
+
+    memcpy(prog->globals, snapshot->globals, vec_size(prog->globals) * sizeof(prog->globals[0]));
+
+    /* entities spawned since are dropped, their chunks are kept for reuse */
+    while (vec_size(prog->entitychunks) * QCVM_ENTITY_CHUNK < entities)
+        vec_push(prog->entitychunks, prog_entity_chunk(prog));
+    while (vec_size(prog->entitydirty) < entities)
+        vec_push(prog->entitydirty, false);
+    if (full) {
+        for (i = 0; i < entities; ++i)
+            prog_entity_restore(prog, (qcint_t)i, snapshot->entitydata + i * fields);
+    } else {
+        for (i = 0; i < vec_size(prog->entitytouched); ++i) {
+            qcint_t e = prog->entitytouched[i];
+            if ((size_t)e < entities)
+                prog_entity_restore(prog, e, snapshot->entitydata + e * fields);
+        }
+    }
+    PROG_VEC_ASSIGN(prog->entitypool, snapshot->entitypool);
+    PROG_VEC_ASSIGN(prog->entityfree, snapshot->entityfree);
+    prog->entities = (qcint_t)entities;
+
+    kept = prog_tempstring_rearrange(prog, snapshot->tempstring_blocks);
+    if (full)
+        kept = 0;
+    for (i = 0; i < vec_size(prog->tempstringtouched) && !full; ++i) {
+        c = prog->tempstringtouched[i];
+        if (c < kept) {
+            memcpy(prog->tempstring_chunks[c],
+                   snapshot->tempstrings + (c << QCVM_TEMPSTRING_CHUNK_SHIFT), QCVM_TEMPSTRING_CHUNK);
+        }
+    }
+    for (c = kept; c < vec_size(prog->tempstring_chunks); ++c) {
+        memcpy(prog->tempstring_chunks[c],
+               snapshot->tempstrings + (c << QCVM_TEMPSTRING_CHUNK_SHIFT), QCVM_TEMPSTRING_CHUNK);
+    }
+    for (c = 0; c < VM_TEMPSTRING_CLASSES; ++c)
+        PROG_VEC_ASSIGN(prog->tempstring_free[c], snapshot->tempstring_free[c]);
+    PROG_VEC_ASSIGN(prog->tempstring_live, snapshot->tempstring_live);
+    prog->tempstring_frame = snapshot->tempstring_frame;
+    prog->tempstring_at    = snapshot->tempstring_at;
+    prog->tempstring_end   = snapshot->tempstring_end;
+    prog->tempstring_stats = snapshot->tempstring_stats;
+    /* the running frames don't know the tempstrings put back */
+    prog->tempstring_escapes++;
+
+    prog->vmerror = 0;
+    /* another program's id could be one of ours, so there's no base then */
+    prog_snapshot_clean(prog, snapshot->owner == prog ? snapshot->id : 0);
+    return true;
+}
+
+void prog_snapshot_delete(qc_snapshot_t *snapshot) {
+    size_t c;
+    vec_free(snapshot->globals);
+    vec_free(snapshot->entitypool);
+    vec_free(snapshot->entityfree);
+    vec_free(snapshot->entitydata);
+    vec_free(snapshot->tempstrings);
+    vec_free(snapshot->tempstring_blocks);
+    for (c = 0; c < VM_TEMPSTRING_CLASSES; ++c)
+        vec_free(snapshot->tempstring_free[c]);
+    vec_free(snapshot->tempstring_live);
+    mem_d(snapshot);
+}
+
+/*
+ * The snapshot file: the magic `QCVMSNAP`, then a header of 32 bit words
+ * (version, crc, entity fields, the sizes of everything that follows,
+ * then the tempstring frame, fill and end), the sections as 32 bit words
+ * and the tempstring chunks. Words are little endian.
+ */
+#define QCVM_SNAPSHOT_HEADER (11 + VM_TEMPSTRING_CLASSES)
+
+/* takes `count` words off the `*left` words which are left in the file */
+static bool prog_snapshot_fits(size_t *left, size_t count) {
+    if (count > *left)
+        return false;
+    *left -= count;
+    return true;
+}
+
+bool prog_snapshot_save(qc_program_t *prog, const qc_snapshot_t *snapshot, const char *filename) {
+    FILE     *file;
+    uint32_t *words = NULL;
+    size_t    i, c;
+    bool      success;
+
+    vec_push(words, 1);
+    vec_push(words, prog->crc16);
+    vec_push(words, prog->entityfields);
+    vec_push(words, vec_size(snapshot->globals));
+    vec_push(words, vec_size(snapshot->entitypool));
+    vec_push(words, vec_size(snapshot->entityfree));
+    vec_push(words, vec_size(snapshot->tempstring_blocks));
+    vec_push(words, vec_size(snapshot->tempstring_live));
+    for (c = 0; c < VM_TEMPSTRING_CLASSES; ++c)
+        vec_push(words, vec_size(snapshot->tempstring_free[c]));
+    vec_push(words, snapshot->tempstring_frame);
+    vec_push(words, snapshot->tempstring_at);
+    vec_push(words, snapshot->tempstring_end);
+
+    for (i = 0; i < vec_size(snapshot->globals); ++i)
+        vec_push(words, snapshot->globals[i]);
+    for (i = 0; i < vec_size(snapshot->entitypool); ++i)
+        vec_push(words, snapshot->entitypool[i] ? 1 : 0);
+    for (i = 0; i < vec_size(snapshot->entityfree); ++i)
+        vec_push(words, snapshot->entityfree[i]);
+    for (i = 0; i < vec_size(snapshot->entitydata); ++i)
+        vec_push(words, snapshot->entitydata[i]);
+    for (i = 0; i < vec_size(snapshot->tempstring_blocks); ++i)
+        vec_push(words, snapshot->tempstring_blocks[i]);
+    for (i = 0; i < vec_size(snapshot->tempstring_live); ++i) {
+        vec_push(words, snapshot->tempstring_live[i].offset);
+        vec_push(words, snapshot->tempstring_live[i].sizeclass);
+    }
+    for (c = 0; c < VM_TEMPSTRING_CLASSES; ++c) {
+        for (i = 0; i < vec_size(snapshot->tempstring_free[c]); ++i)
+            vec_push(words, snapshot->tempstring_free[c][i]);
+    }
+    util_endianswap(words, vec_size(words), sizeof(words[0]));
+
+    if (!(file = fs_file_open(filename, "wb"))) {
+        loaderror("failed to open `%s` for writing", filename);
+        vec_free(words);
+        return false;
+    }
+    success = fs_file_write("QCVMSNAP", 8, 1, file) == 1 &&
+              fs_file_write(words, sizeof(words[0]), vec_size(words), file) == vec_size(words) &&
+              (!vec_size(snapshot->tempstrings) ||
+               fs_file_write(snapshot->tempstrings, vec_size(snapshot->tempstrings), 1, file) == 1);
+    if (!success)
+        loaderror("failed to write `%s`", filename);
+    fs_file_close(file);
+    vec_free(words);
+    return success;
+}
+
+/*
+ * Nothing is allocated before the header was checked against the program
+ * and the length of the file: the counts in it have to add up to what is
+ * in the file exactly, so a truncated or damaged file is rejected instead
+ * of being taken for a huge snapshot.
+ */
+qc_snapshot_t *prog_snapshot_load(qc_program_t *prog, const char *filename) {
+    FILE           *file = fs_file_open(filename, "rb");
+    char            magic[8];
+    uint32_t        header[QCVM_SNAPSHOT_HEADER];
+    uint32_t       *words    = NULL;
+    const uint32_t *w;
+    qc_snapshot_t  *snapshot = NULL;
+    size_t          count, entities, chunks = 0, arena;
+    size_t          left, rest;
+    long            length;
+    size_t          i, c;
+
+    if (!file) {
+        loaderror("failed to open `%s`", filename);
+        return NULL;
+    }
+    if (fs_file_seek(file, 0, SEEK_END) != 0 || (length = fs_file_tell(file)) < 0 ||
+        fs_file_seek(file, 0, SEEK_SET) != 0 ||
+        (size_t)length < sizeof(magic) + sizeof(header))
+    {
+        goto error;
+    }
+    if (fs_file_read(magic, sizeof(magic), 1, file) != 1 ||
+        fs_file_read(header, sizeof(header), 1, file) != 1 ||
+        memcmp(magic, "QCVMSNAP", 8))
+    {
+        goto error;
+    }
+    util_endianswap(header, QCVM_SNAPSHOT_HEADER, sizeof(header[0]));
+    entities = header[4];
+    if (header[0] != 1 || header[1] != prog->crc16 || header[2] != prog->entityfields ||
+        header[3] != vec_size(prog->globals) || !entities ||
+        (entities - 1) >> (31 - prog->fieldshift) || header[5] >= entities)
+    {
+        goto error;
+    }
+
+    rest  = (size_t)length - sizeof(magic) - sizeof(header);
+    left  = rest / sizeof(words[0]);
+    count = left;
+    if (!prog_snapshot_fits(&left, header[3]) ||
+        !prog_snapshot_fits(&left, entities) ||
+        !prog_snapshot_fits(&left, header[5]) ||
+        (prog->entityfields && entities > left / prog->entityfields) ||
+        !prog_snapshot_fits(&left, entities * prog->entityfields) ||
+        !prog_snapshot_fits(&left, header[6]) ||
+        header[7] > left / 2 ||
+        !prog_snapshot_fits(&left, 2 * (size_t)header[7]))
+    {
+        goto error;
+    }
+    for (c = 0; c < VM_TEMPSTRING_CLASSES; ++c) {
+        if (!prog_snapshot_fits(&left, header[8 + c]))
+            goto error;
+    }
+    count -= left;
+    rest  -= count * sizeof(words[0]);
+
+    if (fs_file_read(vec_add(words, count), sizeof(words[0]), count, file) != count)
+        goto error;
+    util_endianswap(words, count, sizeof(words[0]));
+
+    snapshot = (qc_snapshot_t*)mem_a(sizeof(qc_snapshot_t));
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->owner = prog;
+    snapshot->id    = ++prog->snapshot_serial;
+
+    w = words;
+    vec_append(snapshot->globals, header[3], (const qcint_t*)w);
+    w += header[3];
+    for (i = 0; i < entities; ++i)
+        vec_push(snapshot->entitypool, *w++ != 0);
+    for (i = 0; i < header[5]; ++i, ++w) {
+        if (!*w || *w >= entities)
+            goto error;
+        vec_push(snapshot->entityfree, (qcint_t)*w);
+    }
+    if (prog->entityfields)
+        vec_append(snapshot->entitydata, entities * prog->entityfields, (const qcint_t*)w);
+    w += entities * prog->entityfields;
+    for (i = 0; i < header[6]; ++i, ++w) {
+        if (!*w || *w > (rest >> QCVM_TEMPSTRING_CHUNK_SHIFT) - chunks)
+            goto error;
+        vec_push(snapshot->tempstring_blocks, *w);
+        chunks += *w;
+    }
+    /* the tempstring chunks are all that follows */
+    arena = chunks << QCVM_TEMPSTRING_CHUNK_SHIFT;
+    if (arena != rest)
+        goto error;
+    for (i = 0; i < header[7]; ++i, w += 2) {
+        qc_tempstring_t live;
+        live.offset    = w[0];
+        live.sizeclass = w[1];
+        if (live.sizeclass >= VM_TEMPSTRING_CLASSES ||
+            live.offset + ((size_t)1 << (live.sizeclass + QCVM_TEMPSTRING_MIN_SHIFT)) > arena)
+        {
+            goto error;
+        }
+        vec_push(snapshot->tempstring_live, live);
+        snapshot->tempstring_stats.used += (size_t)1 << (live.sizeclass + QCVM_TEMPSTRING_MIN_SHIFT);
+    }
+    for (c = 0; c < VM_TEMPSTRING_CLASSES; ++c) {
+        for (i = 0; i < header[8 + c]; ++i, ++w) {
+            if (*w >= arena)
+                goto error;
+            vec_push(snapshot->tempstring_free[c], *w);
+        }
+    }
+    snapshot->tempstring_frame = header[8 + VM_TEMPSTRING_CLASSES];
+    snapshot->tempstring_at    = header[9 + VM_TEMPSTRING_CLASSES];
+    snapshot->tempstring_end   = header[10 + VM_TEMPSTRING_CLASSES];
+    if (snapshot->tempstring_frame > header[7] ||
+        snapshot->tempstring_at > snapshot->tempstring_end || snapshot->tempstring_end > arena)
+    {
+        goto error;
+    }
+    if (arena && fs_file_read(vec_add(snapshot->tempstrings, arena), arena, 1, file) != 1)
+        goto error;
+    snapshot->tempstring_stats.peak     = snapshot->tempstring_stats.used;
+    snapshot->tempstring_stats.reserved = arena;
+
+    vec_free(words);
+    fs_file_close(file);
+    return snapshot;
+
+error:
+    qcvmerror(prog, "`%s` is not a snapshot of `%s`", filename, prog->filename);
+    if (snapshot)
+        prog_snapshot_delete(snapshot);
+    vec_free(words);
+    fs_file_close(file);
+    return NULL;
+}
+
+static size_t print_escaped_string(const char *str, size_t maxlen) {
+    size_t len = 2;
+    putchar('"');
+    --maxlen; /* because we're lazy and have escape sequences */
+    while (*str) {
+        if (len >= maxlen) {
+            putchar('.');
+            putchar('.');
+            putchar('.');
+            len += 3;
+            break;
+        }
+        switch (*str) {
+            case '\a': len += 2; putchar('\\'); putchar('a'); break;
+            case '\b': len += 2; putchar('\\'); putchar('b'); break;
+            case '\r': len += 2; putchar('\\'); putchar('r'); break;
+            case '\n': len += 2; putchar('\\'); putchar('n'); break;
+            case '\t': len += 2; putchar('\\'); putchar('t'); break;
+            case '\f': len += 2; putchar('\\'); putchar('f'); break;
+            case '\v': len += 2; putchar('\\'); putchar('v'); break;
+            case '\\': len += 2; putchar('\\'); putchar('\\'); break;
+            case '"':  len += 2; putchar('\\'); putchar('"'); break;
+            default:
+                ++len;
+                putchar(*str);
+                break;
+        }
+        ++str;
+    }
+    putchar('"');
+    return len;
+}
+
+static void trace_print_global(qc_program_t *prog, unsigned int glob, int vtype) {
+    static const char spaces[28+1] = "                            ";
+    prog_section_def_t *def;
+    qcany_t    *value;
+    int       len;
+
+    if (!glob) {
+        if ((len = printf("<null>,")) == -1)
+            len = 0;
+
+        goto done;
+    }
+
+    def = prog_getdef(prog, glob);
+    value = (qcany_t*)(&prog->globals[glob]);
+
+    len = printf("[@%u] ", glob);
+    if (def) {
+        const char *name = prog_getstring(prog, def->name);
+        if (name[0] == '#')
+            len += printf("$");
+        else
+            len += printf("%s ", name);
+        vtype = def->type & DEF_TYPEMASK;
+    }
+
+    switch (vtype) {
+        case TYPE_VOID:
+        case TYPE_ENTITY:
+        case TYPE_FIELD:
+        case TYPE_FUNCTION:
+        case TYPE_POINTER:
+            len += printf("(%i),", value->_int);
+            break;
+        case TYPE_VECTOR:
+            len += printf("'%g %g %g',", value->vector[0],
+                                         value->vector[1],
+                                         value->vector[2]);
+            break;
+        case TYPE_STRING:
+            if (value->string)
+                len += print_escaped_string(prog_getstring(prog, value->string), sizeof(spaces)-len-5);
+            else
+                len += printf("(null)");
+            len += printf(",");
+            /* len += printf("\"%s\",", prog_getstring(prog, value->string)); */
+            break;
+        case TYPE_FLOAT:
+        default:
+            len += printf("%g,", value->_float);
+            break;
+    }
+done:
+    if (len < (int)sizeof(spaces)-1) {
+        /* the padding is shared, so it must not be cut in place */
+        printf("%.*s", (int)sizeof(spaces)-1-len, spaces);
+    }
+}
+
+static void prog_print_statement(qc_program_t *prog, prog_section_statement_t *st) {
+    if (st->opcode >= VINSTR_END) {
+        printf("<illegal instruction %d>\n", st->opcode);
+        return;
+    }
+    if ((prog->xflags & VMXF_TRACE) && vec_size(prog->function_stack)) {
+        size_t i;
+        for (i = 0; i < vec_size(prog->function_stack); ++i)
+            printf("->");
+        printf("%s:", vec_last(prog->function_stack));
+    }
+    printf(" <> %-12s", util_instr_str[st->opcode]);
+    if (st->opcode >= INSTR_IF &&
+        st->opcode <= INSTR_IFNOT)
+    {
+        trace_print_global(prog, st->o1.u1, TYPE_FLOAT);
+        printf("%d\n", st->o2.s1);
+    }
+    else if (st->opcode >= INSTR_CALL0 &&
+             st->opcode <= INSTR_CALL8)
+    {
+        trace_print_global(prog, st->o1.u1, TYPE_FUNCTION);
+        printf("\n");
+    }
+    else if (st->opcode == INSTR_GOTO)
+    {
+        printf("%i\n", st->o1.s1);
+    }
+    else
+    {
+        int t[3] = { TYPE_FLOAT, TYPE_FLOAT, TYPE_FLOAT };
+        switch (st->opcode)
+        {
+            case INSTR_MUL_FV:
+                t[1] = t[2] = TYPE_VECTOR;
+                break;
+            case INSTR_MUL_VF:
+                t[0] = t[2] = TYPE_VECTOR;
+                break;
+            case INSTR_MUL_V:
+                t[0] = t[1] = TYPE_VECTOR;
+                break;
+            case INSTR_ADD_V:
+            case INSTR_SUB_V:
+            case INSTR_EQ_V:
+            case INSTR_NE_V:
+                t[0] = t[1] = t[2] = TYPE_VECTOR;
+                break;
+            case INSTR_EQ_S:
+            case INSTR_NE_S:
+                t[0] = t[1] = TYPE_STRING;
+                break;
+            case INSTR_STORE_F:
+            case INSTR_STOREP_F:
+                t[2] = -1;
+                break;
+            case INSTR_STORE_V:
+                t[0] = t[1] = TYPE_VECTOR; t[2] = -1;
+                break;
+            case INSTR_STORE_S:
+                t[0] = t[1] = TYPE_STRING; t[2] = -1;
+                break;
+            case INSTR_STORE_ENT:
+                t[0] = t[1] = TYPE_ENTITY; t[2] = -1;
+                break;
+            case INSTR_STORE_FLD:
+                t[0] = t[1] = TYPE_FIELD; t[2] = -1;
+                break;
+            case INSTR_STORE_FNC:
+                t[0] = t[1] = TYPE_FUNCTION; t[2] = -1;
+                break;
+            case INSTR_STOREP_V:
+                t[0] = TYPE_VECTOR; t[1] = TYPE_ENTITY; t[2] = -1;
+                break;
+            case INSTR_STOREP_S:
+                t[0] = TYPE_STRING; t[1] = TYPE_ENTITY; t[2] = -1;
+                break;
+            case INSTR_STOREP_ENT:
+                t[0] = TYPE_ENTITY; t[1] = TYPE_ENTITY; t[2] = -1;
+                break;
+            case INSTR_STOREP_FLD:
+                t[0] = TYPE_FIELD; t[1] = TYPE_ENTITY; t[2] = -1;
+                break;
+            case INSTR_STOREP_FNC:
+                t[0] = TYPE_FUNCTION; t[1] = TYPE_ENTITY; t[2] = -1;
+                break;
+        }
+        if (t[0] >= 0) trace_print_global(prog, st->o1.u1, t[0]);
+        else           printf("(none),          ");
+        if (t[1] >= 0) trace_print_global(prog, st->o2.u1, t[1]);
+        else           printf("(none),          ");
+        if (t[2] >= 0) trace_print_global(prog, st->o3.u1, t[2]);
+        else           printf("(none)");
+        printf("\n");
+    }
+}
+
+static qcint_t prog_enterfunction(qc_program_t *prog, prog_section_function_t *func) {
+    qc_exec_stack_t      st;
+    qc_exec_frameinfo_t *info = prog->frameinfo + (func - prog->functions);
+    qcint_t             *src;
+    qcint_t             *dst;
+    int32_t              p;
+
+    /* back up locals */
+    st.localsp  = vec_size(prog->localstack);
+    st.stmt     = prog->statement;
+    st.function = func;
+    st.saved    = false;
+    st.tempstrings = vec_size(prog->tempstring_live);
+    st.escapes     = prog->tempstring_escapes;
+
+    if (prog->xflags & VMXF_TRACE) {
+        const char *str = prog_getstring(prog, func->name);
+        vec_push(prog->function_stack, str);
+    }
+    if (prog->xflags & VMXF_PROFILE)
+        prog_profile_enter(prog, func - prog->functions);
+
+#ifdef QCVM_BACKUP_STRATEGY_CALLER_VARS
+    if (vec_size(prog->stack))
+    {
+        prog_section_function_t *cur;
+        cur = prog->stack[vec_size(prog->stack)-1].function;
+        if (cur)
+        {
+            qcint_t *globals = prog->globals + cur->firstlocal;
+            vec_append(prog->localstack, cur->locals, globals);
+        }
+    }
+#else
+    /*
+     * Nobody else looks at the locals of a function which isn't running
+     * and doesn't share them with another function, so they are only
+     * backed up when the function recurses, or the globals are shared.
+     */
+    if (info->active || info->shared) {
+        qcint_t *globals = prog->globals + func->firstlocal;
+        vec_append(prog->localstack, func->locals, globals);
+        st.saved = true;
+    }
+#endif
+    ++info->active;
+
+    /* copy parameters */
+    src = prog->globals + OFS_PARM0;
+    dst = prog->globals + func->firstlocal;
+    for (p = 0; p < func->nargs; ++p, src += 3)
+    {
+        size_t s;
+        switch (func->argsize[p]) {
+            case 1:
+                dst[0] = src[0];
+                dst += 1;
+                break;
+            case 3:
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                dst += 3;
+                break;
+            default:
+                for (s = 0; s < func->argsize[p]; ++s)
+                    *dst++ = src[s];
+                break;
+        }
+    }
+
+    vec_push(prog->stack, st);
+
+    return func->entry;
+}
+
+static qcint_t prog_leavefunction(qc_program_t *prog) {
+    prog_section_function_t *prev = NULL;
+    size_t oldsp = 0;
+
+    qc_exec_stack_t st = vec_last(prog->stack);
+
+    if (prog->xflags & VMXF_TRACE) {
+        if (vec_size(prog->function_stack))
+            vec_pop(prog->function_stack);
+    }
+    if (prog->xflags & VMXF_PROFILE)
+        prog_profile_leave(prog);
+
+    --prog->frameinfo[st.function - prog->functions].active;
+
+#ifdef QCVM_BACKUP_STRATEGY_CALLER_VARS
+    if (vec_size(prog->stack) > 1) {
+        prev  = prog->stack[vec_size(prog->stack)-2].function;
+        oldsp = prog->stack[vec_size(prog->stack)-2].localsp;
+    }
+#else
+    if (st.saved) {
+        prev  = st.function;
+        oldsp = st.localsp;
+    }
+#endif
+    if (prev) {
+        qcint_t *globals = prog->globals + prev->firstlocal;
+        memcpy(globals, prog->localstack + oldsp, prev->locals * sizeof(prog->localstack[0]));
+        /* vec_remove(prog->localstack, oldsp, vec_size(prog->localstack)-oldsp); */
+        vec_shrinkto(prog->localstack, oldsp);
+    }
+
+    vec_pop(prog->stack);
+
+    if (prog->tempstring_escapes == st.escapes)
+        prog_tempstring_leave(prog, st.tempstrings);
+
+    return st.stmt;
+}
+
+/* calls a function translated to C, see prog_native_set */
+static void prog_native_run(qc_program_t *prog, prog_section_function_t *func, prog_native_t native) {
+    prog_enterfunction(prog, func);
+    native(prog);
+    /* the translated stores don't look at tempstrings */
+    prog->tempstring_escapes++;
+    prog_leavefunction(prog);
+}
+
+#ifdef QCVM_THREADED
+/*
+ * The threaded loop needs label addresses, which is an extension to the
+ * language. The pedantic warnings about it are silenced for this function
+ * only, everything else still builds as strict C.
+ */
+#if defined(__GNUC__)
+#   pragma GCC diagnostic push
+#   pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+#if defined(__clang__)
+#   pragma clang diagnostic push
+#   pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#endif
+static qc_exec_instr_t *prog_exec_threaded(qc_program_t *prog, qc_exec_instr_t *ip, long maxjumps, size_t stackbase, long *budgetp) {
+    long jumpcount = 0;
+    bool budgeted = (budgetp != NULL);
+    long budget = budgeted ? *budgetp : 0;
+    qc_exec_instr_t *segment = ip;
+    qc_exec_instr_t *resume = NULL;
+#define QCVM_LOOP          1
+#define QCVM_THREADED_LOOP 1
+#define QCVM_PROFILE       0
+#define QCVM_TRACE         0
+#define QCVM_SAMPLE        0
+#   include __FILE__
+cleanup:
+    if (budgeted)
+        *budgetp = budget;
+    return resume;
+}
+
+/* the same counting every statement for the profile, like the switch loop does */
+static qc_exec_instr_t *prog_exec_threaded_profile(qc_program_t *prog, qc_exec_instr_t *ip, long maxjumps, size_t stackbase, long *budgetp) {
+    long jumpcount = 0;
+    bool budgeted = (budgetp != NULL);
+    long budget = budgeted ? *budgetp : 0;
+    qc_exec_instr_t *segment = ip;
+    qc_exec_instr_t *resume = NULL;
+#define QCVM_LOOP          1
+#define QCVM_THREADED_LOOP 1
+#define QCVM_PROFILE       1
+#define QCVM_TRACE         0
+#define QCVM_SAMPLE        0
+#   include __FILE__
+cleanup:
+    if (budgeted)
+        *budgetp = budget;
+    return resume;
+}
+
+/* and taking a sample every so many instructions, the countdown is the caller's */
+static qc_exec_instr_t *prog_exec_threaded_sample(qc_program_t *prog, qc_exec_instr_t *ip, long maxjumps, size_t stackbase, long *budgetp, long *samplewaitp) {
+    long jumpcount = 0;
+    long samplewait = *samplewaitp;
+    bool budgeted = (budgetp != NULL);
+    long budget = budgeted ? *budgetp : 0;
+    qc_exec_instr_t *segment = ip;
+    qc_exec_instr_t *resume = NULL;
+#define QCVM_LOOP          1
+#define QCVM_THREADED_LOOP 1
+#define QCVM_PROFILE       0
+#define QCVM_TRACE         0
+#define QCVM_SAMPLE        1
+#   include __FILE__
+cleanup:
+    *samplewaitp = samplewait;
+    if (budgeted)
+        *budgetp = budget;
+    return resume;
+}
+#if defined(__clang__)
+#   pragma clang diagnostic pop
+#endif
+#if defined(__GNUC__)
+#   pragma GCC diagnostic pop
+#endif
+#endif /*! QCVM_THREADED */
+
+/***********************************************************************
+ * The closure engine
+ *
+ * Every instruction has a handler function bound to it by prog_labels,
+ * which executes it and returns the instruction to continue with. The
+ * loop in prog_exec_closures does nothing but call them. Like with the
+ * threaded engine no handler is looked up while running, but it's plain
+ * C and works with any compiler. It's used for VMXF_CLOSURE and behaves
+ * the same as the other engines, down to the error messages. Tracing,
+ * profiling and sampling look at every statement and use the loops.
+ */
+
+/* the state of a run, which the handlers share */
+typedef struct qc_exec_run_s {
+    qc_program_t    *prog;
+    size_t           stackbase;
+    long             jumpcount;
+    long             maxjumps;
+    bool             budgeted;
+    long             budget;
+    qc_exec_instr_t *segment;  /* see QCVM_PAY */
+    qc_exec_instr_t *resume;
+} qc_exec_run_t;
+
+/* the same as in the VM loop */
+#define OPA ( ip->a )
+#define OPB ( ip->b )
+#define OPC ( ip->c )
+#define GLOBAL(x) ( (qcany_t*) (prog->globals + (x)) )
+#if !defined(FLOAT_IS_TRUE_FOR_INT)
+#   define FLOAT_IS_TRUE_FOR_INT(x) ( (x) & 0x7FFFFFFF )
+#endif
+
+#define QCVM_CLOSURE(X) \
+    static qc_exec_instr_t *qcvm_closure_##X(qc_exec_run_t *run, qc_exec_instr_t *ip)
+
+/* continues at `ip` after a jump or call, or stops there, see QCVM_YIELD */
+static GMQCC_INLINE qc_exec_instr_t *qcvm_closure_land(qc_exec_run_t *run, qc_exec_instr_t *ip) {
+    run->segment = ip;
+    if (run->budgeted && run->budget <= 0) {
+        run->resume = ip;
+        return NULL;
+    }
+    return ip;
+}
+
+static GMQCC_INLINE void qcvm_closure_pay(qc_exec_run_t *run, qc_exec_instr_t *ip) {
+    if (run->budgeted)
+        run->budget -= (long)(ip - run->segment) + 1;
+}
+
+static GMQCC_INLINE qc_exec_instr_t *qcvm_closure_jump(qc_exec_run_t *run, qc_exec_instr_t *ip) {
+    qcvm_closure_pay(run, ip);
+    if (++run->jumpcount >= run->maxjumps) {
+        qcvmerror(run->prog, "`%s` hit the runaway loop counter limit of %li jumps", run->prog->filename, run->jumpcount);
+        return NULL;
+    }
+    return qcvm_closure_land(run, ip->u.jump);
+}
+
+/*
+ * The entity accesses, with their bounds checked the same way as in the
+ * VM loop; `size` is 1 or 3 words. These are shared with the code
+ * translated to C, see prog_native_field.
+ */
+static GMQCC_INLINE qcint_t *prog_field_read(qc_program_t *prog, qcint_t e, qcint_t f, qcint_t size) {
+    if (e < 0 || e >= prog->entities) {
+        qcvmerror(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename);
+        return NULL;
+    }
+    if (f < 0 || f + size > (qcint_t)prog->entityfields) {
+        qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
+                  prog->filename,
+                  f + size - 1);
+        return NULL;
+    }
+    return PROG_ENTFIELD(prog, e, f);
+}
+
+static GMQCC_INLINE bool prog_field_address(qc_program_t *prog, qcint_t e, qcint_t f, qcint_t *out) {
+    if (e < 0 || e >= prog->entities) {
+        qcvmerror(prog, "prog `%s` attempted to address an out of bounds entity %i", prog->filename, e);
+        return false;
+    }
+    if ((unsigned int)f >= (unsigned int)(prog->entityfields)) {
+        qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
+                  prog->filename,
+                  f);
+        return false;
+    }
+    *out = (e << prog->fieldshift) | f;
+    return true;
+}
+
+/* where a STOREP through `pointer` writes to, or NULL */
+static GMQCC_INLINE qcint_t *prog_field_write(qc_program_t *prog, qcint_t pointer, qcint_t size) {
+    qcint_t e = pointer >> prog->fieldshift;
+    qcint_t f = pointer & ((1 << prog->fieldshift) - 1);
+    if (pointer < 0 || e >= prog->entities || f + size > (qcint_t)prog->entityfields) {
+        qcvmerror(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename, pointer);
+        return NULL;
+    }
+    if (!e && !prog->allowworldwrites)
+        qcvmerror(prog, "`%s` tried to assign to world.%s (field %i)\n",
+                  prog->filename,
+                  prog_getstring(prog, prog_entfield(prog, f)->name),
+                  f);
+    PROG_ENTTOUCH(prog, e);
+    return PROG_ENTFIELD(prog, e, f);
+}
+
+QCVM_CLOSURE(illegal) {
+    qcvmerror(run->prog, "Illegal instruction in %s\n", run->prog->filename);
+    (void)ip;
+    return NULL;
+}
+
+QCVM_CLOSURE(INSTR_RETURN) {
+    qc_program_t *prog = run->prog;
+    GLOBAL(OFS_RETURN)->ivector[0] = OPA->ivector[0];
+    GLOBAL(OFS_RETURN)->ivector[1] = OPA->ivector[1];
+    GLOBAL(OFS_RETURN)->ivector[2] = OPA->ivector[2];
+    qcvm_closure_pay(run, ip);
+    ip = prog->decoded + prog_leavefunction(prog);
+    run->segment = ip;
+    if (vec_size(prog->stack) == run->stackbase)
+        return NULL;
+    return ip;
+}
+
+QCVM_CLOSURE(INSTR_MUL_F) {
+    (void)run;
+    OPC->_float = OPA->_float * OPB->_float;
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_MUL_V) {
+    (void)run;
+    OPC->_float = OPA->vector[0]*OPB->vector[0] +
+                  OPA->vector[1]*OPB->vector[1] +
+                  OPA->vector[2]*OPB->vector[2];
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_MUL_FV) {
+    qcfloat_t f = OPA->_float;
+    (void)run;
+    OPC->vector[0] = f * OPB->vector[0];
+    OPC->vector[1] = f * OPB->vector[1];
+    OPC->vector[2] = f * OPB->vector[2];
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_MUL_VF) {
+    qcfloat_t f = OPB->_float;
+    (void)run;
+    OPC->vector[0] = f * OPA->vector[0];
+    OPC->vector[1] = f * OPA->vector[1];
+    OPC->vector[2] = f * OPA->vector[2];
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_DIV_F) {
+    (void)run;
+    if (OPB->_float != 0.0f)
+        OPC->_float = OPA->_float / OPB->_float;
+    else
+        OPC->_float = 0;
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_ADD_F) {
+    (void)run;
+    OPC->_float = OPA->_float + OPB->_float;
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_ADD_V) {
+    (void)run;
+    OPC->vector[0] = OPA->vector[0] + OPB->vector[0];
+    OPC->vector[1] = OPA->vector[1] + OPB->vector[1];
+    OPC->vector[2] = OPA->vector[2] + OPB->vector[2];
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_SUB_F) {
+    (void)run;
+    OPC->_float = OPA->_float - OPB->_float;
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_SUB_V) {
+    (void)run;
+    OPC->vector[0] = OPA->vector[0] - OPB->vector[0];
+    OPC->vector[1] = OPA->vector[1] - OPB->vector[1];
+    OPC->vector[2] = OPA->vector[2] - OPB->vector[2];
+    return ip + 1;
+}
+
+QCVM_CLOSURE(INSTR_EQ_F) {
+    (void)run;
+    OPC->_float = (OPA->_float == OPB->_float);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_EQ_V) {
+    (void)run;
+    OPC->_float = ((OPA->vector[0] == OPB->vector[0]) &&
+                   (OPA->vector[1] == OPB->vector[1]) &&
+                   (OPA->vector[2] == OPB->vector[2]) );
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_EQ_S) {
+    OPC->_float = !strcmp(prog_getstring(run->prog, OPA->string),
+                          prog_getstring(run->prog, OPB->string));
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_EQ_E) {
+    (void)run;
+    OPC->_float = (OPA->_int == OPB->_int);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_EQ_FNC) {
+    (void)run;
+    OPC->_float = (OPA->function == OPB->function);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NE_F) {
+    (void)run;
+    OPC->_float = (OPA->_float != OPB->_float);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NE_V) {
+    (void)run;
+    OPC->_float = ((OPA->vector[0] != OPB->vector[0]) ||
+                   (OPA->vector[1] != OPB->vector[1]) ||
+                   (OPA->vector[2] != OPB->vector[2]) );
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NE_S) {
+    OPC->_float = !!strcmp(prog_getstring(run->prog, OPA->string),
+                           prog_getstring(run->prog, OPB->string));
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NE_E) {
+    (void)run;
+    OPC->_float = (OPA->_int != OPB->_int);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NE_FNC) {
+    (void)run;
+    OPC->_float = (OPA->function != OPB->function);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_LE) {
+    (void)run;
+    OPC->_float = (OPA->_float <= OPB->_float);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_GE) {
+    (void)run;
+    OPC->_float = (OPA->_float >= OPB->_float);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_LT) {
+    (void)run;
+    OPC->_float = (OPA->_float < OPB->_float);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_GT) {
+    (void)run;
+    OPC->_float = (OPA->_float > OPB->_float);
+    return ip + 1;
+}
+
+QCVM_CLOSURE(INSTR_LOAD_F) {
+    qcint_t *fld = prog_field_read(run->prog, OPA->edict, OPB->_int, 1);
+    if (!fld)
+        return NULL;
+    OPC->_int = *fld;
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_LOAD_V) {
+    qc_program_t *prog = run->prog;
+    qcint_t      *fld  = prog_field_read(prog, OPA->edict, OPB->_int, 3);
+    if (!fld)
+        return NULL;
+    OPC->ivector[0] = fld[0];
+    OPC->ivector[1] = fld[prog->fieldstride];
+    OPC->ivector[2] = fld[prog->fieldstride * 2];
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_ADDRESS) {
+    if (!prog_field_address(run->prog, OPA->edict, OPB->_int, &OPC->_int))
+        return NULL;
+    return ip + 1;
+}
+
+QCVM_CLOSURE(INSTR_STORE_S) {
+    prog_tempstring_escape(run->prog, OPA->_int, OPB);
+    OPB->_int = OPA->_int;
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_STORE_F) {
+    (void)run;
+    OPB->_int = OPA->_int;
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_STORE_V) {
+    (void)run;
+    OPB->ivector[0] = OPA->ivector[0];
+    OPB->ivector[1] = OPA->ivector[1];
+    OPB->ivector[2] = OPA->ivector[2];
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_STOREP_F) {
+    qcint_t *fld = prog_field_write(run->prog, OPB->_int, 1);
+    if (!fld)
+        return NULL;
+    *fld = OPA->_int;
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_STOREP_S) {
+    /* an entity outlives any frame */
+    if (OPA->_int >= (qcint_t)run->prog->tempstring_start)
+        run->prog->tempstring_escapes++;
+    return qcvm_closure_INSTR_STOREP_F(run, ip);
+}
+QCVM_CLOSURE(INSTR_STOREP_V) {
+    qc_program_t *prog = run->prog;
+    qcint_t      *fld  = prog_field_write(prog, OPB->_int, 3);
+    if (!fld)
+        return NULL;
+    fld[0]                     = OPA->ivector[0];
+    fld[prog->fieldstride]     = OPA->ivector[1];
+    fld[prog->fieldstride * 2] = OPA->ivector[2];
+    return ip + 1;
+}
+
+QCVM_CLOSURE(INSTR_NOT_F) {
+    (void)run;
+    OPC->_float = !FLOAT_IS_TRUE_FOR_INT(OPA->_int);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NOT_V) {
+    (void)run;
+    OPC->_float = !OPA->vector[0] &&
+                  !OPA->vector[1] &&
+                  !OPA->vector[2];
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NOT_S) {
+    OPC->_float = !OPA->string ||
+                  !*prog_getstring(run->prog, OPA->string);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NOT_ENT) {
+    (void)run;
+    OPC->_float = (OPA->edict == 0);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_NOT_FNC) {
+    (void)run;
+    OPC->_float = !OPA->function;
+    return ip + 1;
+}
+
+QCVM_CLOSURE(INSTR_IF) {
+    /* this is consistent with darkplaces' behaviour */
+    if (FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+        return qcvm_closure_jump(run, ip);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_IFNOT) {
+    if (!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+        return qcvm_closure_jump(run, ip);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_GOTO) {
+    return qcvm_closure_jump(run, ip);
+}
+
+QCVM_CLOSURE(INSTR_CALL0) {
+    qc_program_t            *prog = run->prog;
+    prog_section_function_t *newf;
+
+    prog->argc = ip->opcode - INSTR_CALL0;
+    if (!OPA->function)
+        qcvmerror(prog, "NULL function in `%s`", prog->filename);
+
+    if (!OPA->function || OPA->function >= (qcint_t)prog->functions_count) {
+        qcvmerror(prog, "CALL outside the program in `%s`", prog->filename);
+        return NULL;
+    }
+
+    newf = &prog->functions[OPA->function];
+    prog->statement = (ip - prog->decoded) + 1;
+
+    if (newf->entry < 0) {
+        /* negative statements are built in functions */
+        qcint_t builtinnumber = -newf->entry;
+        if (builtinnumber < (qcint_t)prog->builtins_count && prog->builtins[builtinnumber])
+            prog->builtins[builtinnumber](prog);
+        else
+            qcvmerror(prog, "No such builtin #%i in %s! Try updating your gmqcc sources",
+                      builtinnumber, prog->filename);
+        if (prog->vmerror)
+            return NULL;
+        return ip + 1;
+    }
+    if (prog->natives && prog->natives[OPA->function]) {
+        prog_native_run(prog, newf, prog->natives[OPA->function]);
+        if (prog->vmerror)
+            return NULL;
+        return ip + 1;
+    }
+
+    qcvm_closure_pay(run, ip);
+    return qcvm_closure_land(run, prog->decoded + prog_enterfunction(prog, newf));
+}
+
+QCVM_CLOSURE(INSTR_STATE) {
+    qcvmerror(run->prog, "`%s` tried to execute a STATE operation", run->prog->filename);
+    return ip + 1;
+}
+
+QCVM_CLOSURE(INSTR_AND) {
+    (void)run;
+    OPC->_float = FLOAT_IS_TRUE_FOR_INT(OPA->_int) &&
+                  FLOAT_IS_TRUE_FOR_INT(OPB->_int);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_OR) {
+    (void)run;
+    OPC->_float = FLOAT_IS_TRUE_FOR_INT(OPA->_int) ||
+                  FLOAT_IS_TRUE_FOR_INT(OPB->_int);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_BITAND) {
+    (void)run;
+    OPC->_float = ((int)OPA->_float) & ((int)OPB->_float);
+    return ip + 1;
+}
+QCVM_CLOSURE(INSTR_BITOR) {
+    (void)run;
+    OPC->_float = ((int)OPA->_float) | ((int)OPB->_float);
+    return ip + 1;
+}
+
+/* superinstructions call the handler of the second statement themselves */
+QCVM_CLOSURE(QCVM_OP_LOAD_F_STORE_F) {
+    if (!qcvm_closure_INSTR_LOAD_F(run, ip))
+        return NULL;
+    return qcvm_closure_INSTR_STORE_F(run, ip + 1);
+}
+QCVM_CLOSURE(QCVM_OP_ADDRESS_STOREP_F) {
+    if (!prog_field_address(run->prog, OPA->edict, OPB->_int, &OPC->_int))
+        return NULL;
+    return qcvm_closure_INSTR_STOREP_F(run, ip + 1);
+}
+QCVM_CLOSURE(QCVM_OP_MUL_F_ADD_F) {
+    OPC->_float = OPA->_float * OPB->_float;
+    return qcvm_closure_INSTR_ADD_F(run, ip + 1);
+}
+QCVM_CLOSURE(QCVM_OP_EQ_F_IFNOT) {
+    OPC->_float = (OPA->_float == OPB->_float);
+    return qcvm_closure_INSTR_IFNOT(run, ip + 1);
+}
+QCVM_CLOSURE(QCVM_OP_NE_F_IFNOT) {
+    OPC->_float = (OPA->_float != OPB->_float);
+    return qcvm_closure_INSTR_IFNOT(run, ip + 1);
+}
+QCVM_CLOSURE(QCVM_OP_LE_IFNOT) {
+    OPC->_float = (OPA->_float <= OPB->_float);
+    return qcvm_closure_INSTR_IFNOT(run, ip + 1);
+}
+QCVM_CLOSURE(QCVM_OP_GE_IFNOT) {
+    OPC->_float = (OPA->_float >= OPB->_float);
+    return qcvm_closure_INSTR_IFNOT(run, ip + 1);
+}
+QCVM_CLOSURE(QCVM_OP_LT_IFNOT) {
+    OPC->_float = (OPA->_float < OPB->_float);
+    return qcvm_closure_INSTR_IFNOT(run, ip + 1);
+}
+QCVM_CLOSURE(QCVM_OP_GT_IFNOT) {
+    OPC->_float = (OPA->_float > OPB->_float);
+    return qcvm_closure_INSTR_IFNOT(run, ip + 1);
+}
+
+/*
+ * Specialized calls turn back into the plain CALL for good when the
+ * function global doesn't hold the function they were made for anymore,
+ * see QCVM_GENERIC.
+ */
+QCVM_CLOSURE(QCVM_OP_CALL_INTRINSIC) {
+    qc_program_t *prog = run->prog;
+    if (OPA->function != ip->function) {
+        prog_closure_generic(ip);
+        return ip;
+    }
+    ip->u.intrinsic(GLOBAL(OFS_RETURN), GLOBAL(OFS_PARM0), GLOBAL(OFS_PARM1));
+    return ip + 1;
+}
+
+QCVM_CLOSURE(QCVM_OP_CALL_VERIFIED) {
+    qc_program_t *prog = run->prog;
+
+    if (OPA->function != ip->function) {
+        prog_closure_generic(ip);
+        return ip;
+    }
+
+    prog->argc      = ip->opcode - INSTR_CALL0;
+    prog->statement = (ip - prog->decoded) + 1;
+    if (prog->natives && prog->natives[OPA->function]) {
+        prog_native_run(prog, prog->functions + OPA->function, prog->natives[OPA->function]);
+        if (prog->vmerror)
+            return NULL;
+        return ip + 1;
+    }
+
+    qcvm_closure_pay(run, ip);
+    return qcvm_closure_land(run, prog->decoded + prog_enterfunction(prog, prog->functions + OPA->function));
+}
+
+#if QCVM_SSE2
+QCVM_CLOSURE(QCVM_OP_MUL_V_SIMD) {
+    (void)run;
+    OPC->_float = qcvm_vec_dot(OPA, OPB);
+    return ip + 1;
+}
+QCVM_CLOSURE(QCVM_OP_MUL_FV_SIMD) {
+    (void)run;
+    qcvm_vec_store(OPC, _mm_mul_ps(_mm_set1_ps(OPA->_float), qcvm_vec_load(OPB)));
+    return ip + 1;
+}
+QCVM_CLOSURE(QCVM_OP_MUL_VF_SIMD) {
+    (void)run;
+    qcvm_vec_store(OPC, _mm_mul_ps(_mm_set1_ps(OPB->_float), qcvm_vec_load(OPA)));
+    return ip + 1;
+}
+QCVM_CLOSURE(QCVM_OP_ADD_V_SIMD) {
+    (void)run;
+    qcvm_vec_store(OPC, _mm_add_ps(qcvm_vec_load(OPA), qcvm_vec_load(OPB)));
+    return ip + 1;
+}
+QCVM_CLOSURE(QCVM_OP_SUB_V_SIMD) {
+    (void)run;
+    qcvm_vec_store(OPC, _mm_sub_ps(qcvm_vec_load(OPA), qcvm_vec_load(OPB)));
+    return ip + 1;
+}
+QCVM_CLOSURE(QCVM_OP_EQ_V_SIMD) {
+    (void)run;
+    OPC->_float = ((_mm_movemask_ps(_mm_cmpeq_ps(qcvm_vec_load(OPA), qcvm_vec_load(OPB))) & 7) == 7);
+    return ip + 1;
+}
+QCVM_CLOSURE(QCVM_OP_NE_V_SIMD) {
+    (void)run;
+    OPC->_float = ((_mm_movemask_ps(_mm_cmpneq_ps(qcvm_vec_load(OPA), qcvm_vec_load(OPB))) & 7) != 0);
+    return ip + 1;
+}
+QCVM_CLOSURE(QCVM_OP_NOT_V_SIMD) {
+    (void)run;
+    OPC->_float = ((_mm_movemask_ps(_mm_cmpeq_ps(qcvm_vec_load(OPA), _mm_setzero_ps())) & 7) == 7);
+    return ip + 1;
+}
+QCVM_CLOSURE(QCVM_OP_STORE_V_SIMD) {
+    (void)run;
+    qcvm_vec_store(OPB, qcvm_vec_load(OPA));
+    return ip + 1;
+}
+#endif
+
+/* Keep in the same order as the instruction enum and QCVM_OP_* */
+static const qc_exec_closure_t qcvm_closures[QCVM_OP_COUNT] = {
+    qcvm_closure_INSTR_RETURN,  qcvm_closure_INSTR_MUL_F,   qcvm_closure_INSTR_MUL_V,
+    qcvm_closure_INSTR_MUL_FV,  qcvm_closure_INSTR_MUL_VF,  qcvm_closure_INSTR_DIV_F,
+    qcvm_closure_INSTR_ADD_F,   qcvm_closure_INSTR_ADD_V,   qcvm_closure_INSTR_SUB_F,
+    qcvm_closure_INSTR_SUB_V,   qcvm_closure_INSTR_EQ_F,    qcvm_closure_INSTR_EQ_V,
+    qcvm_closure_INSTR_EQ_S,    qcvm_closure_INSTR_EQ_E,    qcvm_closure_INSTR_EQ_FNC,
+    qcvm_closure_INSTR_NE_F,    qcvm_closure_INSTR_NE_V,    qcvm_closure_INSTR_NE_S,
+    qcvm_closure_INSTR_NE_E,    qcvm_closure_INSTR_NE_FNC,  qcvm_closure_INSTR_LE,
+    qcvm_closure_INSTR_GE,      qcvm_closure_INSTR_LT,      qcvm_closure_INSTR_GT,
+    qcvm_closure_INSTR_LOAD_F,  qcvm_closure_INSTR_LOAD_V,  qcvm_closure_INSTR_LOAD_F,
+    qcvm_closure_INSTR_LOAD_F,  qcvm_closure_INSTR_LOAD_F,  qcvm_closure_INSTR_LOAD_F,
+    qcvm_closure_INSTR_ADDRESS, qcvm_closure_INSTR_STORE_F, qcvm_closure_INSTR_STORE_V,
+    qcvm_closure_INSTR_STORE_S, qcvm_closure_INSTR_STORE_F, qcvm_closure_INSTR_STORE_F,
+    qcvm_closure_INSTR_STORE_F, qcvm_closure_INSTR_STOREP_F,qcvm_closure_INSTR_STOREP_V,
+    qcvm_closure_INSTR_STOREP_S,qcvm_closure_INSTR_STOREP_F,qcvm_closure_INSTR_STOREP_F,
+    qcvm_closure_INSTR_STOREP_F,qcvm_closure_INSTR_RETURN,  qcvm_closure_INSTR_NOT_F,
+    qcvm_closure_INSTR_NOT_V,   qcvm_closure_INSTR_NOT_S,   qcvm_closure_INSTR_NOT_ENT,
+    qcvm_closure_INSTR_NOT_FNC, qcvm_closure_INSTR_IF,      qcvm_closure_INSTR_IFNOT,
+    qcvm_closure_INSTR_CALL0,   qcvm_closure_INSTR_CALL0,   qcvm_closure_INSTR_CALL0,
+    qcvm_closure_INSTR_CALL0,   qcvm_closure_INSTR_CALL0,   qcvm_closure_INSTR_CALL0,
+    qcvm_closure_INSTR_CALL0,   qcvm_closure_INSTR_CALL0,   qcvm_closure_INSTR_CALL0,
+    qcvm_closure_INSTR_STATE,   qcvm_closure_INSTR_GOTO,    qcvm_closure_INSTR_AND,
+    qcvm_closure_INSTR_OR,      qcvm_closure_INSTR_BITAND,  qcvm_closure_INSTR_BITOR,
+
+    qcvm_closure_illegal,
+    qcvm_closure_QCVM_OP_LOAD_F_STORE_F,
+    qcvm_closure_QCVM_OP_ADDRESS_STOREP_F,
+    qcvm_closure_QCVM_OP_MUL_F_ADD_F,
+    qcvm_closure_QCVM_OP_EQ_F_IFNOT,
+    qcvm_closure_QCVM_OP_NE_F_IFNOT,
+    qcvm_closure_QCVM_OP_LE_IFNOT,
+    qcvm_closure_QCVM_OP_GE_IFNOT,
+    qcvm_closure_QCVM_OP_LT_IFNOT,
+    qcvm_closure_QCVM_OP_GT_IFNOT,
+
+    qcvm_closure_QCVM_OP_CALL_INTRINSIC,
+
+    qcvm_closure_QCVM_OP_CALL_VERIFIED,
+
+#if QCVM_SSE2
+    qcvm_closure_QCVM_OP_MUL_V_SIMD,
+    qcvm_closure_QCVM_OP_MUL_FV_SIMD,
+    qcvm_closure_QCVM_OP_MUL_VF_SIMD,
+    qcvm_closure_QCVM_OP_ADD_V_SIMD,
+    qcvm_closure_QCVM_OP_SUB_V_SIMD,
+    qcvm_closure_QCVM_OP_EQ_V_SIMD,
+    qcvm_closure_QCVM_OP_NE_V_SIMD,
+    qcvm_closure_QCVM_OP_NOT_V_SIMD,
+    qcvm_closure_QCVM_OP_STORE_V_SIMD
+#else
+    qcvm_closure_illegal, qcvm_closure_illegal, qcvm_closure_illegal,
+    qcvm_closure_illegal, qcvm_closure_illegal, qcvm_closure_illegal,
+    qcvm_closure_illegal, qcvm_closure_illegal, qcvm_closure_illegal
+#endif
+};
+
+#undef QCVM_CLOSURE
+#undef OPA
+#undef OPB
+#undef OPC
+#undef GLOBAL
+
+static void prog_closure_generic(qc_exec_instr_t *ip) {
+    ip->op      = ip->opcode;
+    ip->closure = qcvm_closures[ip->op];
+}
+
+static void prog_closures(qc_program_t *prog) {
+    size_t i;
+    for (i = 0; i < vec_size(prog->decoded); ++i) {
+        prog->decoded[i].closure = (prog->decoded[i].op < QCVM_OP_COUNT)
+                                       ? qcvm_closures[prog->decoded[i].op]
+                                       : qcvm_closure_illegal;
+    }
+}
+
+static qc_exec_instr_t *prog_exec_closures(qc_program_t *prog, qc_exec_instr_t *ip, long maxjumps, size_t stackbase, long *budgetp) {
+    qc_exec_run_t run;
+
+    run.prog      = prog;
+    run.stackbase = stackbase;
+    run.jumpcount = 0;
+    run.maxjumps  = maxjumps;
+    run.budgeted  = (budgetp != NULL);
+    run.budget    = run.budgeted ? *budgetp : 0;
+    run.segment   = ip;
+    run.resume    = NULL;
+
+    while (ip)
+        ip = ip->closure(&run, ip);
+
+    if (run.budgeted)
+        *budgetp = run.budget;
+    return run.resume;
+}
+
+/*
+ * Runs a call from `ip` on, with prog->xflags already set up, until the
+ * stack is back at `stackbase`, also after an error. With a budget it
+ * can stop before, see prog_exec_budget: the frames stay and where to
+ * continue is returned.
+ */
+static qc_exec_instr_t *prog_run(qc_program_t *prog, qc_exec_instr_t *ip, size_t stackbase, size_t flags, long maxjumps, long *budgetp) {
+    long jumpcount = 0;
+    size_t engine = flags & ~(VMXF_THREADED|VMXF_CLOSURE);
+    long samplewait = prog->sample_countdown;
+    bool budgeted = (budgetp != NULL);
+    long budget = budgeted ? *budgetp : 0;
+    qc_exec_instr_t *segment = ip;
+    qc_exec_instr_t *resume = NULL;
+
+    /* sampling is pointless when every statement is looked at anyway */
+    if (engine & (VMXF_TRACE|VMXF_PROFILE))
+        engine &= ~VMXF_SAMPLE;
+    if (engine & VMXF_PROFILE)
+        prog->profile_clock = prog_profile_clock();
+
+    prog->running++;
+    switch (engine)
+    {
+        default:
+        case 0:
+        {
+            if (flags & VMXF_CLOSURE) {
+                resume = prog_exec_closures(prog, ip, maxjumps, stackbase, budgeted ? &budget : NULL);
+                goto cleanup;
+            }
+#ifdef QCVM_THREADED
+            if (flags & VMXF_THREADED) {
+                resume = prog_exec_threaded(prog, ip, maxjumps, stackbase, budgeted ? &budget : NULL);
+                goto cleanup;
+            }
+#endif
+#define QCVM_LOOP          1
+#define QCVM_THREADED_LOOP 0
+#define QCVM_PROFILE       0
+#define QCVM_TRACE         0
+#define QCVM_SAMPLE        0
+#           include __FILE__
+        }
+        case (VMXF_TRACE):
+        {
+#define QCVM_THREADED_LOOP 0
+#define QCVM_PROFILE       0
+#define QCVM_TRACE         1
+#define QCVM_SAMPLE        0
+#           include __FILE__
+        }
+        case (VMXF_PROFILE):
+        {
+#ifdef QCVM_THREADED
+            if (flags & VMXF_THREADED) {
+                resume = prog_exec_threaded_profile(prog, ip, maxjumps, stackbase, budgeted ? &budget : NULL);
+                goto cleanup;
+            }
+#endif
+#define QCVM_THREADED_LOOP 0
+#define QCVM_PROFILE       1
+#define QCVM_TRACE         0
+#define QCVM_SAMPLE        0
+#           include __FILE__
+        }
+        case (VMXF_TRACE|VMXF_PROFILE):
+        {
+#define QCVM_THREADED_LOOP 0
+#define QCVM_PROFILE       1
+#define QCVM_TRACE         1
+#define QCVM_SAMPLE        0
+#           include __FILE__
+        }
+        case (VMXF_SAMPLE):
+        {
+#ifdef QCVM_THREADED
+            if (flags & VMXF_THREADED) {
+                resume = prog_exec_threaded_sample(prog, ip, maxjumps, stackbase, budgeted ? &budget : NULL, &samplewait);
+                goto cleanup;
+            }
+#endif
+#define QCVM_THREADED_LOOP 0
+#define QCVM_PROFILE       0
+#define QCVM_TRACE         0
+#define QCVM_SAMPLE        1
+#           include __FILE__
+        }
+    };
+
+cleanup:
+    /* drop the frames an error left behind, the stacks stay allocated */
+    if (prog->vmerror)
+        resume = NULL;
+    if (!resume) {
+        while (vec_size(prog->stack) > stackbase)
+            prog_leavefunction(prog);
+    }
+    prog->sample_countdown = samplewait;
+    prog->running--;
+    if (budgeted)
+        *budgetp = budget;
+    return resume;
+}
+
+/* a new frame for the tempstrings of a call, see prog_tempstring */
+static void prog_exec_frame(qc_program_t *prog) {
+    if (!vec_size(prog->stack)) {
+        prog_tempstring_release(prog, 0, prog->tempstring_frame);
+        prog->tempstring_frame = 0;
+    }
+}
+
+/* calls `func` with prog_run, or natively when it was translated to C */
+static qc_exec_instr_t *prog_run_call(qc_program_t *prog, prog_section_function_t *func, size_t flags, long maxjumps, long *budget) {
+    size_t        stackbase = vec_size(prog->stack);
+    prog_native_t native    = prog->natives ? prog->natives[func - prog->functions] : NULL;
+    qcint_t       entry;
+
+    if (flags & VMXF_PROFILE)
+        prog->profile_clock = prog_profile_clock();
+    if (native) {
+        prog_native_run(prog, func, native);
+        return NULL;
+    }
+    entry = prog_enterfunction(prog, func);
+    return prog_run(prog, prog->decoded + entry, stackbase, flags, maxjumps, budget);
+}
+
+/*
+ * Runs a call of `func`, or continues one suspended at `ip`, and keeps
+ * it for prog_resume when it runs out of budget.
+ */
+static int prog_exec_slice(qc_program_t *prog, prog_section_function_t *func, qc_exec_instr_t *ip, size_t stackbase, size_t flags, long maxjumps, long *budget) {
+    size_t           oldxflags = prog->xflags;
+    qc_exec_instr_t *resume;
+
+    prog->vmerror = 0;
+    prog->xflags  = flags;
+    if (func)
+        resume = prog_run_call(prog, func, flags, maxjumps, budget);
+    else
+        resume = prog_run(prog, ip, stackbase, flags, maxjumps, budget);
+
+    if (!stackbase)
+        prog->tempstring_frame = vec_size(prog->tempstring_live);
+    prog->xflags = oldxflags;
+    if (prog->vmerror)
+        return VMEXEC_ERROR;
+    if (resume) {
+        qc_exec_suspended_t *call = vec_add(prog->suspended, 1);
+        call->stackbase = stackbase;
+        call->statement = resume - prog->decoded;
+        call->xflags    = flags;
+        call->maxjumps  = maxjumps;
+        call->budget    = *budget;
+        return VMEXEC_SUSPENDED;
+    }
+    return VMEXEC_DONE;
+}
+
+/*
+ * Calls a function until it returns. A call jumping `maxjumps` times is
+ * taken for a runaway loop: it fails right there and its frames are dropped.
+ */
+bool prog_exec(qc_program_t *prog, prog_section_function_t *func, size_t flags, long maxjumps) {
+    prog_exec_frame(prog);
+    return prog_exec_slice(prog, func, NULL, vec_size(prog->stack), flags, maxjumps, NULL) == VMEXEC_DONE;
+}
+
+/*
+ * Calls a function with a budget of `budget` instructions. When it needs
+ * more it stops at the next jump or call after the budget is used up,
+ * which can be a few instructions over it, and VMEXEC_SUSPENDED is the
+ * result; its frames stay on the stack for prog_resume to continue it.
+ * The runaway counter `maxjumps` counts from zero in every run.
+ *
+ * Other calls can be made while a call is suspended, they run above its
+ * frames like calls made from a builtin; suspended calls are resumed in
+ * reverse order. A budgeted call made from within a builtin can't stop
+ * and runs until it returns.
+ */
+int prog_exec_budget(qc_program_t *prog, prog_section_function_t *func, size_t flags, long maxjumps, long budget) {
+    prog_exec_frame(prog);
+    return prog_exec_slice(prog, func, NULL, vec_size(prog->stack), flags, maxjumps,
+                           prog->running ? NULL : &budget);
+}
+
+/*
+ * Continues the last suspended call with a budget of `budget` further
+ * instructions, less what the last run went over its budget. The result
+ * is as for prog_exec_budget.
+ */
+int prog_resume(qc_program_t *prog, long budget) {
+    qc_exec_suspended_t call;
+
+    if (!vec_size(prog->suspended) || prog->running) {
+        qcvmerror(prog, "`%s` has no suspended call to resume", prog->filename);
+        return VMEXEC_ERROR;
+    }
+
+    call = vec_last(prog->suspended);
+    vec_pop(prog->suspended);
+    budget += call.budget;
+    return prog_exec_slice(prog, NULL, prog->decoded + call.statement, call.stackbase,
+                           call.xflags, call.maxjumps, &budget);
+}
+
+/*
+ * Drops the last suspended call and its frames instead of resuming it.
+ * Its tempstrings go with the next frame.
+ */
+bool prog_abort(qc_program_t *prog) {
+    size_t stackbase;
+
+    if (!vec_size(prog->suspended) || prog->running)
+        return false;
+
+    stackbase = vec_last(prog->suspended).stackbase;
+    vec_pop(prog->suspended);
+    while (vec_size(prog->stack) > stackbase)
+        prog_leavefunction(prog);
+    return true;
+}
+
+/*
+ * Makes calls of a function run `native` instead of its statements. This
+ * is meant for the functions translated to C by qcvm -emit-c, whose code
+ * registers all of them at once. A native function runs as a whole: it
+ * doesn't count jumps, isn't traced, profiled or sampled except for the
+ * call itself, and a budgeted call doesn't stop inside of it.
+ */
+void prog_native_set(qc_program_t *prog, size_t function, prog_native_t native) {
+    if (function >= prog->functions_count)
+        return;
+    if (!prog->natives)
+        memset(vec_add(prog->natives, prog->functions_count), 0, prog->functions_count * sizeof(prog->natives[0]));
+    prog->natives[function] = native;
+}
+
+/*
+ * The translated code calls these for what its statements do besides
+ * plain arithmetic, so it behaves exactly like the VM. A call is what
+ * CALL<argc> at `statement` does; the result is false if that, or
+ * anything it called, failed.
+ */
+bool prog_native_call(qc_program_t *prog, qcint_t function, int argc, size_t statement) {
+    prog_section_function_t *newf;
+
+    prog->argc = argc;
+    if (!function)
+        qcvmerror(prog, "NULL function in `%s`", prog->filename);
+
+    if (!function || function >= (qcint_t)prog->functions_count) {
+        qcvmerror(prog, "CALL outside the program in `%s`", prog->filename);
+        return false;
+    }
+
+    newf = &prog->functions[function];
+    prog->statement = statement + 1;
+
+    if (newf->entry < 0) {
+        /* negative statements are built in functions */
+        qcint_t builtinnumber = -newf->entry;
+        if (builtinnumber < (qcint_t)prog->builtins_count && prog->builtins[builtinnumber])
+            prog->builtins[builtinnumber](prog);
+        else
+            qcvmerror(prog, "No such builtin #%i in %s! Try updating your gmqcc sources",
+                      builtinnumber, prog->filename);
+    }
+    else
+        prog_run_call(prog, newf, prog->xflags, VM_JUMPS_DEFAULT, NULL);
+
+    return !prog->vmerror;
+}
+
+qcint_t *prog_native_field(qc_program_t *prog, qcint_t e, qcint_t f, qcint_t size) {
+    return prog_field_read(prog, e, f, size);
+}
+
+bool prog_native_address(qc_program_t *prog, qcint_t e, qcint_t f, qcint_t *out) {
+    return prog_field_address(prog, e, f, out);
+}
+
+qcint_t *prog_native_pointer(qc_program_t *prog, qcint_t pointer, qcint_t size) {
+    return prog_field_write(prog, pointer, size);
+}
+
+void prog_native_state(qc_program_t *prog) {
+    qcvmerror(prog, "`%s` tried to execute a STATE operation", prog->filename);
+}
+
+/*
+ * Calls a function, like a think function, once for each of a list of
+ * entities, with `self` set to the entity and restored afterwards. The
+ * setup prog_exec does for every call is done once for the whole batch:
+ * looking up `self` and a native translation, switching the flags and
+ * opening the one frame for the tempstrings of all the calls, so each
+ * entity only costs entering the function and running it. An error only
+ * ends the call for the entity it happened in, the rest of the batch
+ * still runs; the result is false if any call failed. Entities which
+ * aren't spawned are errors as well and aren't called.
+ */
+bool prog_exec_batch(qc_program_t *prog, prog_section_function_t *func, const qcint_t *entities, size_t count, size_t flags, long maxjumps) {
+    prog_section_def_t *self      = prog_finddef(prog, "self");
+    prog_native_t       native    = prog->natives ? prog->natives[func - prog->functions] : NULL;
+    size_t              oldxflags = prog->xflags;
+    size_t              stackbase = vec_size(prog->stack);
+    bool                success   = true;
+    qcint_t             oldself;
+    size_t              i;
+
+    prog->vmerror = 0;
+    if (!self) {
+        qcvmerror(prog, "`%s` has no self global", prog->filename);
+        return false;
+    }
+
+    oldself      = prog->globals[self->offset];
+    prog->xflags = flags;
+    prog_exec_frame(prog);
+
+    for (i = 0; i < count; ++i) {
+        qcint_t e = entities[i];
+
+        prog->vmerror = 0;
+        if (e < 0 || e >= prog->entities || !prog->entitypool[e]) {
+            qcvmerror(prog, "`%s` can't run %s for the free entity %i",
+                      prog->filename, prog_getstring(prog, func->name), (int)e);
+            success = false;
+            continue;
+        }
+
+        prog->globals[self->offset] = e;
+        if (native)
+            prog_native_run(prog, func, native);
+        else
+            prog_run(prog, prog->decoded + prog_enterfunction(prog, func), stackbase, flags, maxjumps, NULL);
+        if (prog->vmerror)
+            success = false;
+    }
+
+    prog->globals[self->offset] = oldself;
+    if (!stackbase)
+        prog->tempstring_frame = vec_size(prog->tempstring_live);
+    prog->xflags = oldxflags;
+    return success;
+}
+
+/***********************************************************************
+ * main for when building the standalone executor
+ */
+
+#if defined(QCVM_EXECUTOR)
+#include <math.h>
+
+const char *type_name[TYPE_COUNT] = {
+    "void",
+    "string",
+    "float",
+    "vector",
+    "entity",
+    "field",
+    "function",
+    "pointer",
+    "integer",
+
+    "variant",
+
+    "struct",
+    "union",
+    "array",
+
+    "nil",
+    "noexpr"
+};
+
+typedef struct {
+    int         vtype;
+    const char *value;
+} qcvm_parameter;
+
+static qcvm_parameter *main_params = NULL;
+static bool            main_verify = false;
+
+#define CheckArgs(num) do {                                                    \
+    if (prog->argc != (num)) {                                                 \
+        prog->vmerror++;                                                       \
+        fprintf(stderr, "ERROR: invalid number of arguments for %s: %i, expected %i\n", \
+        __FUNCTION__, prog->argc, (num));                                      \
+        return -1;                                                             \
+    }                                                                          \
+} while (0)
+
+#define GetGlobal(idx) ((qcany_t*)(prog->globals + (idx)))
+#define GetArg(num) GetGlobal(OFS_PARM0 + 3*(num))
+#define Return(any) *(GetGlobal(OFS_RETURN)) = (any)
+
+static int qc_print(qc_program_t *prog) {
+    size_t i;
+    const char *laststr = NULL;
+    for (i = 0; i < (size_t)prog->argc; ++i) {
+        qcany_t *str = (qcany_t*)(prog->globals + OFS_PARM0 + 3*i);
+        laststr = prog_getstring(prog, str->string);
+        printf("%s", laststr);
+    }
+    if (laststr && (prog->xflags & VMXF_TRACE)) {
+        size_t len = strlen(laststr);
+        if (!len || laststr[len-1] != '\n')
+            printf("\n");
+    }
+    return 0;
+}
+
+static int qc_error(qc_program_t *prog) {
+    fprintf(stderr, "*** VM raised an error:\n");
+    qc_print(prog);
+    prog->vmerror++;
+    return -1;
+}
+
+static int qc_ftos(qc_program_t *prog) {
+    char buffer[512];
+    qcany_t *num;
     qcany_t str;
     CheckArgs(1);
     num = GetArg(0);
@@ -710,51 +4583,61 @@ static int qc_spawn(qc_program_t *prog) {
     return (ent.edict ? 0 : -1);
 }
 
-static int qc_kill(qc_program_t *prog) {
-    qcany_t *ent;
-    CheckArgs(1);
-    ent = GetArg(0);
-    prog_free_entity(prog, ent->edict);
-    return 0;
+static int qc_kill(qc_program_t *prog) {
+    qcany_t *ent;
+    CheckArgs(1);
+    ent = GetArg(0);
+    prog_free_entity(prog, ent->edict);
+    return 0;
+}
+
+/*
+ * The math builtins are intrinsics as well, see prog_intrinsic_set. The
+ * builtins check the arguments and call the intrinsic.
+ */
+static void qc_sqrt_intrinsic(qcany_t *out, const qcany_t *num, const qcany_t *unused) {
+    (void)unused;
+    out->_float = sqrt(num->_float);
+}
+
+static void qc_vlen_intrinsic(qcany_t *out, const qcany_t *vec, const qcany_t *unused) {
+    (void)unused;
+    out->_float = sqrt(qcvm_vec_dot(vec, vec));
+}
+
+static void qc_normalize_intrinsic(qcany_t *out, const qcany_t *vec, const qcany_t *unused) {
+    double len;
+    (void)unused;
+    len = sqrt(qcvm_vec_dot(vec, vec));
+    if (len)
+        len = 1.0 / len;
+    else
+        len = 0;
+    out->vector[0] = len * vec->vector[0];
+    out->vector[1] = len * vec->vector[1];
+    out->vector[2] = len * vec->vector[2];
+}
+
+static void qc_floor_intrinsic(qcany_t *out, const qcany_t *num, const qcany_t *unused) {
+    (void)unused;
+    out->_float = floor(num->_float);
 }
 
 static int qc_sqrt(qc_program_t *prog) {
-    qcany_t *num, out;
     CheckArgs(1);
-    num = GetArg(0);
-    out._float = sqrt(num->_float);
-    Return(out);
+    qc_sqrt_intrinsic(GetGlobal(OFS_RETURN), GetArg(0), NULL);
     return 0;
 }
 
 static int qc_vlen(qc_program_t *prog) {
-    qcany_t *vec, len;
     CheckArgs(1);
-    vec = GetArg(0);
-    len._float = sqrt(vec->vector[0] * vec->vector[0] +
-                      vec->vector[1] * vec->vector[1] +
-                      vec->vector[2] * vec->vector[2]);
-    Return(len);
+    qc_vlen_intrinsic(GetGlobal(OFS_RETURN), GetArg(0), NULL);
     return 0;
 }
 
 static int qc_normalize(qc_program_t *prog) {
-    double len;
-    qcany_t *vec;
-    qcany_t out;
     CheckArgs(1);
-    vec = GetArg(0);
-    len = sqrt(vec->vector[0] * vec->vector[0] +
-               vec->vector[1] * vec->vector[1] +
-               vec->vector[2] * vec->vector[2]);
-    if (len)
-        len = 1.0 / len;
-    else
-        len = 0;
-    out.vector[0] = len * vec->vector[0];
-    out.vector[1] = len * vec->vector[1];
-    out.vector[2] = len * vec->vector[2];
-    Return(out);
+    qc_normalize_intrinsic(GetGlobal(OFS_RETURN), GetArg(0), NULL);
     return 0;
 }
 
@@ -764,152 +4647,740 @@ static int qc_strcat(qc_program_t *prog) {
     qcany_t *str1,  *str2;
     qcany_t  out;
 
-    const char *cstr1;
-    const char *cstr2;
+    const char *cstr1;
+    const char *cstr2;
+
+    CheckArgs(2);
+    str1 = GetArg(0);
+    str2 = GetArg(1);
+    cstr1 = prog_getstring(prog, str1->string);
+    cstr2 = prog_getstring(prog, str2->string);
+    len1 = strlen(cstr1);
+    len2 = strlen(cstr2);
+    buffer = (char*)mem_a(len1 + len2 + 1);
+    memcpy(buffer, cstr1, len1);
+    memcpy(buffer+len1, cstr2, len2+1);
+    out.string = prog_tempstring(prog, buffer);
+    mem_d(buffer);
+    Return(out);
+    return 0;
+}
+
+static int qc_strcmp(qc_program_t *prog) {
+    qcany_t *str1,  *str2;
+    qcany_t out;
+
+    const char *cstr1;
+    const char *cstr2;
+
+    if (prog->argc != 2 && prog->argc != 3) {
+        fprintf(stderr, "ERROR: invalid number of arguments for strcmp/strncmp: %i, expected 2 or 3\n",
+               prog->argc);
+        return -1;
+    }
+
+    str1 = GetArg(0);
+    str2 = GetArg(1);
+    cstr1 = prog_getstring(prog, str1->string);
+    cstr2 = prog_getstring(prog, str2->string);
+    if (prog->argc == 3)
+        out._float = strncmp(cstr1, cstr2, GetArg(2)->_float);
+    else
+        out._float = strcmp(cstr1, cstr2);
+    Return(out);
+    return 0;
+}
+
+static int qc_floor(qc_program_t *prog) {
+    CheckArgs(1);
+    qc_floor_intrinsic(GetGlobal(OFS_RETURN), GetArg(0), NULL);
+    return 0;
+}
+
+static prog_builtin_t qc_builtins[] = {
+    NULL,
+    &qc_print,       /*   1   */
+    &qc_ftos,        /*   2   */
+    &qc_spawn,       /*   3   */
+    &qc_kill,        /*   4   */
+    &qc_vtos,        /*   5   */
+    &qc_error,       /*   6   */
+    &qc_vlen,        /*   7   */
+    &qc_etos,        /*   8   */
+    &qc_stof,        /*   9   */
+    &qc_strcat,      /*   10  */
+    &qc_strcmp,      /*   11  */
+    &qc_normalize,   /*   12  */
+    &qc_sqrt,        /*   13  */
+    &qc_floor        /*   14  */
+};
+
+static const struct {
+    size_t           number;
+    prog_intrinsic_t intrinsic;
+} qc_intrinsics[] = {
+    {  7, &qc_vlen_intrinsic      },
+    { 12, &qc_normalize_intrinsic },
+    { 13, &qc_sqrt_intrinsic      },
+    { 14, &qc_floor_intrinsic     }
+};
+
+static const char *arg0 = NULL;
+
+static void version(void) {
+    printf("GMQCC-QCVM %d.%d.%d Built %s %s\n",
+           GMQCC_VERSION_MAJOR,
+           GMQCC_VERSION_MINOR,
+           GMQCC_VERSION_PATCH,
+           __DATE__,
+           __TIME__
+    );
+}
+
+static void usage(void) {
+    printf("usage: %s [options] [parameters] file\n", arg0);
+    printf("options:\n");
+    printf("  -h, --help         print this message\n"
+           "  -trace             trace the execution\n"
+           "  -profile           perform profiling during execution\n"
+           "  -dispatch engine   select the dispatch engine: switch, threaded, closure\n"
+           "  -nofuse            don't combine statements into superinstructions\n"
+           "  -nointrinsics      call the math builtins like any other builtin\n"
+           "  -novector          don't use SIMD for vector instructions\n"
+           "  -verify            verify the program and refuse it if it fails\n"
+           "  -noverify          don't verify the program, the default\n"
+           "  -fuse-profile file only combine the statements hot in a saved profile\n");
+    printf("  -profile-out file  profile and save the statement counts to file\n"
+           "  -profile-folded f  profile and save the call stacks for flamegraphs\n"
+           "  -profile-json file profile and save the function report as JSON\n"
+           "  -profile-lines f   profile and save the counts by line for gmqcc\n"
+           "  -coverage          print the coverage by line and basic block\n"
+           "  -lcov file         profile and save the coverage as an lcov file\n");
+    printf("  -sample file       sample where execution is and save a report to file\n"
+           "  -sample-interval n take a sample every n instructions (1000)\n"
+           "  -field-major       store the entities field by field\n"
+           "  -budget n          run main in slices of n instructions\n");
+    printf("  -jobs file         run the jobs listed in file in parallel, `-`\n"
+           "                     in it names the progs given after the options\n"
+           "  -j n               use n threads for the jobs (one per core)\n"
+           "  -emit-c file       translate the functions to C and exit\n");
+    printf("  -info              print information from the prog's header\n"
+           "  -disasm            disassemble and exit\n"
+           "  -disasm-func func  disassemble and exit\n"
+           "  -printdefs         list the defs section\n"
+           "  -printfields       list the field section\n"
+           "  -printfuns         list functions information\n"
+           "  -v                 be verbose\n"
+           "  -vv                be even more verbose\n");
+    printf("parameters:\n");
+    printf("  -vector <V>   pass a vector parameter to main()\n"
+           "  -float  <f>   pass a float parameter to main()\n"
+           "  -string <s>   pass a string parameter to main() \n");
+}
+
+static void prog_main_setparams(qc_program_t *prog, const qcvm_parameter *params) {
+    size_t i;
+    qcany_t *arg;
+
+    for (i = 0; i < vec_size(params); ++i) {
+        arg = GetGlobal(OFS_PARM0 + 3*i);
+        arg->vector[0] = 0;
+        arg->vector[1] = 0;
+        arg->vector[2] = 0;
+        switch (params[i].vtype) {
+            case TYPE_VECTOR:
+#ifdef _MSC_VER
+                (void)sscanf_s(params[i].value, " %f %f %f ",
+                               &arg->vector[0],
+                               &arg->vector[1],
+                               &arg->vector[2]);
+#else
+                (void)sscanf(params[i].value, " %f %f %f ",
+                             &arg->vector[0],
+                             &arg->vector[1],
+                             &arg->vector[2]);
+#endif
+                break;
+            case TYPE_FLOAT:
+                arg->_float = atof(params[i].value);
+                break;
+            case TYPE_STRING:
+                arg->string = prog_tempstring(prog, params[i].value);
+                break;
+            default:
+                fprintf(stderr, "error: unhandled parameter type: %i\n", params[i].vtype);
+                break;
+        }
+    }
+}
+
+static void prog_main_builtins(qc_program_t *prog) {
+    size_t i;
+    for (i = 1; i < GMQCC_ARRAY_COUNT(qc_builtins); ++i)
+        prog_builtin_set(prog, i, qc_builtins[i]);
+    for (i = 0; i < GMQCC_ARRAY_COUNT(qc_intrinsics); ++i)
+        prog_intrinsic_set(prog, qc_intrinsics[i].number, qc_intrinsics[i].intrinsic, 1);
+}
+
+/*
+ * With -jobs the executor runs a list of independent calls on a pool of
+ * threads. Each line of the job file names the progs, the function and
+ * the parameters the way they're given on the command line, with double
+ * quotes around values containing spaces:
+ *
+ *     bot.dat think -float 3 -vector "0 64 0"
+ *
+ * A job naming `-` as its progs runs the program given on the command
+ * line.
+ *
+ * Every job loads its own instance of the program, instances share the
+ * mapped code and strings but nothing they write, so they run without
+ * any locking. The threads only meet to take the next job.
+ */
+typedef struct {
+    size_t          line;
+    const char     *progsfile;
+    char           *function;
+    qcvm_parameter *params;
+    char          **tokens;
+    const char     *error;
+} qcvm_job_t;
+
+typedef struct {
+    qcvm_job_t   *jobs;
+    size_t        next;
+    size_t        xflags;
+} qcvm_pool_t;
+
+static util_mutex_t qcvm_pool_lock = UTIL_MUTEX_INIT;
+
+static char **qcvm_job_tokenize(const char *line) {
+    char **tokens = NULL;
+    char  *token;
+
+    for (;;) {
+        token = NULL;
+        while (util_isspace(*line))
+            ++line;
+        if (!*line || *line == '#')
+            break;
+        if (*line == '"') {
+            for (++line; *line && *line != '"'; ++line)
+                vec_push(token, *line);
+            if (*line)
+                ++line;
+        } else {
+            for (; *line && !util_isspace(*line); ++line)
+                vec_push(token, *line);
+        }
+        vec_push(token, 0);
+        vec_push(tokens, token);
+    }
+    return tokens;
+}
+
+static void qcvm_job_delete(qcvm_job_t *job) {
+    size_t i;
+    for (i = 0; i < vec_size(job->tokens); ++i)
+        vec_free(job->tokens[i]);
+    vec_free(job->tokens);
+    vec_free(job->params);
+}
+
+static qcvm_job_t *qcvm_jobs_load(const char *filename, const char *progsfile) {
+    FILE       *file = fs_file_open(filename, "rb");
+    qcvm_job_t *jobs = NULL;
+    qcvm_job_t  job;
+    char       *line = NULL;
+    size_t      size = 0;
+    size_t      i;
+    size_t      lineno = 0;
+
+    if (!file) {
+        fprintf(stderr, "failed to open job file `%s`\n", filename);
+        return NULL;
+    }
+
+    while (fs_file_getline(&line, &size, file) != EOF) {
+        memset(&job, 0, sizeof(job));
+        job.line   = ++lineno;
+        job.tokens = qcvm_job_tokenize(line);
+        if (!vec_size(job.tokens))
+            continue;
+        if (vec_size(job.tokens) < 2 || (vec_size(job.tokens) & 1))
+            goto malformed;
+
+        job.progsfile = job.tokens[0];
+        job.function  = job.tokens[1];
+        if (!strcmp(job.progsfile, "-")) {
+            if (!progsfile) {
+                fprintf(stderr, "%s:%lu: the job runs `-` but no program was given\n",
+                        filename, (unsigned long)lineno);
+                goto failed;
+            }
+            job.progsfile = progsfile;
+        }
+        for (i = 2; i < vec_size(job.tokens); i += 2) {
+            qcvm_parameter p;
+            if (!strcmp(job.tokens[i], "-float"))
+                p.vtype = TYPE_FLOAT;
+            else if (!strcmp(job.tokens[i], "-vector"))
+                p.vtype = TYPE_VECTOR;
+            else if (!strcmp(job.tokens[i], "-string"))
+                p.vtype = TYPE_STRING;
+            else
+                goto malformed;
+            p.value = job.tokens[i+1];
+            vec_push(job.params, p);
+        }
+        vec_push(jobs, job);
+        continue;
+
+malformed:
+        fprintf(stderr, "%s:%lu: malformed job, expected: progs function [parameters]\n",
+                filename, (unsigned long)lineno);
+failed:
+        qcvm_job_delete(&job);
+        for (i = 0; i < vec_size(jobs); ++i)
+            qcvm_job_delete(&jobs[i]);
+        vec_free(jobs);
+        break;
+    }
+
+    if (line)
+        mem_d(line);
+    fs_file_close(file);
+    return jobs;
+}
+
+static void qcvm_job_run(qcvm_job_t *job, size_t xflags) {
+    qc_program_t            *prog;
+    prog_section_function_t *func;
+
+    if (!(prog = prog_load(job->progsfile, false))) {
+        job->error = "failed to load program";
+        return;
+    }
+    prog_main_builtins(prog);
+    if (main_verify && !prog_verify(prog)) {
+        job->error = "program doesn't verify";
+        prog_delete(prog);
+        return;
+    }
+
+    if (!(func = prog_findfunction(prog, job->function)))
+        job->error = "no such function";
+    else if (vec_size(job->params) > 8)
+        job->error = "too many parameters";
+    else {
+        prog_main_setparams(prog, job->params);
+        if (!prog_exec(prog, func, xflags, VM_JUMPS_DEFAULT))
+            job->error = "execution failed";
+    }
+    prog_delete(prog);
+}
+
+static void qcvm_job_worker(void *data) {
+    qcvm_pool_t *pool = (qcvm_pool_t*)data;
+    qcvm_job_t  *job;
+
+    for (;;) {
+        util_mutex_lock(&qcvm_pool_lock);
+        job = (pool->next < vec_size(pool->jobs)) ? &pool->jobs[pool->next++] : NULL;
+        util_mutex_unlock(&qcvm_pool_lock);
+        if (!job)
+            return;
+        qcvm_job_run(job, pool->xflags);
+    }
+}
+
+static int qcvm_jobs_run(const char *filename, const char *progsfile, size_t threads, size_t xflags) {
+    util_thread_t *workers = NULL;
+    qcvm_pool_t    pool;
+    size_t         i;
+    size_t         failed = 0;
+
+    pool.jobs   = qcvm_jobs_load(filename, progsfile);
+    pool.next   = 0;
+    pool.xflags = xflags;
+    if (!pool.jobs)
+        return 1;
+
+    if (!threads)
+        threads = util_cpu_count();
+    if (threads > vec_size(pool.jobs))
+        threads = vec_size(pool.jobs);
+
+    /* the calling thread is one of the workers */
+    for (i = 1; i < threads; ++i) {
+        util_thread_t thread;
+        if (!util_thread_create(&thread, &qcvm_job_worker, &pool)) {
+            fprintf(stderr, "failed to create a thread, running with %lu\n", (unsigned long)i);
+            break;
+        }
+        vec_push(workers, thread);
+    }
+    qcvm_job_worker(&pool);
+    for (i = 0; i < vec_size(workers); ++i)
+        util_thread_join(workers[i]);
+    vec_free(workers);
+
+    for (i = 0; i < vec_size(pool.jobs); ++i) {
+        qcvm_job_t *job = &pool.jobs[i];
+        if (job->error) {
+            fprintf(stderr, "%s:%lu: %s %s: %s\n", filename, (unsigned long)job->line,
+                    job->progsfile, job->function, job->error);
+            failed++;
+        }
+        qcvm_job_delete(job);
+    }
+    printf("%lu jobs, %lu failed\n", (unsigned long)vec_size(pool.jobs), (unsigned long)failed);
+    vec_free(pool.jobs);
+    return failed ? 1 : 0;
+}
+
+/*
+ * Translates the program to C for prog_native_set: a function for every
+ * function of the program doing what its statements do, and one which
+ * registers them with a program loaded from the same file, named after
+ * it: progs.dat gives `progs_natives`. A function using anything the VM
+ * can't execute either, like a jump out of it, is left to the VM.
+ *
+ * Building the executor with -DQCVM_NATIVES=progs_natives and the output
+ * makes a qcvm which only runs that program, with its functions in C.
+ */
+static int qcvm_emit_entry_compare(const void *a, const void *b) {
+    qcint_t x = *(const qcint_t*)a;
+    qcint_t y = *(const qcint_t*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+/* where the statements of the function starting at `entry` end */
+static size_t qcvm_emit_end(qc_program_t *prog, const qcint_t *entries, qcint_t entry) {
+    size_t i;
+    for (i = 0; i < vec_size(entries); ++i) {
+        if (entries[i] > entry)
+            return (size_t)entries[i];
+    }
+    return prog->code_count;
+}
+
+static size_t qcvm_emit_target(prog_section_statement_t *st, size_t i) {
+    return (st->opcode == INSTR_GOTO) ? i + st->o1.s1 : i + st->o2.s1;
+}
+
+/* whether the statements from `entry` to `end` can be translated */
+static bool qcvm_emit_check(qc_program_t *prog, size_t entry, size_t end, bool *labels) {
+    size_t globals = vec_size(prog->globals);
+    size_t i;
+
+    if (end <= entry)
+        return false;
+
+    for (i = entry; i < end; ++i) {
+        prog_section_statement_t *st = prog->code + i;
+        if (st->opcode >= VINSTR_END)
+            return false;
+        if (st->opcode == INSTR_GOTO || st->opcode == INSTR_IF || st->opcode == INSTR_IFNOT) {
+            qcint_t target = (qcint_t)qcvm_emit_target(st, i);
+            if (target < (qcint_t)entry || target >= (qcint_t)end)
+                return false;
+            labels[target - entry] = true;
+        }
+        if ((st->opcode != INSTR_GOTO && st->o1.u1 >= globals) ||
+            (st->opcode != INSTR_IF && st->opcode != INSTR_IFNOT && st->o2.u1 >= globals) ||
+            st->o3.u1 >= globals)
+            return false;
+    }
+
+    /* running off the end goes on with the next function in the VM */
+    i = prog->code[end - 1].opcode;
+    return i == INSTR_DONE || i == INSTR_RETURN || i == INSTR_GOTO;
+}
+
+static void qcvm_emit_statement(FILE *file, qc_program_t *prog, size_t i) {
+    prog_section_statement_t *st = prog->code + i;
+    char a[16], b[16], c[16];
+
+    util_snprintf(a, sizeof(a), "G(%u)", (unsigned int)st->o1.u1);
+    util_snprintf(b, sizeof(b), "G(%u)", (unsigned int)st->o2.u1);
+    util_snprintf(c, sizeof(c), "G(%u)", (unsigned int)st->o3.u1);
+
+    switch (st->opcode) {
+        case INSTR_DONE:
+        case INSTR_RETURN:
+            fs_file_printf(file, "    G(OFS_RETURN)->ivector[0] = %s->ivector[0];\n", a);
+            fs_file_printf(file, "    G(OFS_RETURN)->ivector[1] = %s->ivector[1];\n", a);
+            fs_file_printf(file, "    G(OFS_RETURN)->ivector[2] = %s->ivector[2];\n", a);
+            fs_file_puts(file, "    return;\n");
+            break;
+
+        case INSTR_MUL_F:  fs_file_printf(file, "    %s->_float = %s->_float * %s->_float;\n", c, a, b); break;
+        case INSTR_DIV_F:
+            fs_file_printf(file, "    if (%s->_float != 0.0f)\n", b);
+            fs_file_printf(file, "        %s->_float = %s->_float / %s->_float;\n", c, a, b);
+            fs_file_printf(file, "    else\n        %s->_float = 0;\n", c);
+            break;
+        case INSTR_ADD_F:  fs_file_printf(file, "    %s->_float = %s->_float + %s->_float;\n", c, a, b); break;
+        case INSTR_SUB_F:  fs_file_printf(file, "    %s->_float = %s->_float - %s->_float;\n", c, a, b); break;
+        case INSTR_MUL_V:
+            fs_file_printf(file, "    %s->_float = %s->vector[0]*%s->vector[0] + %s->vector[1]*%s->vector[1] + %s->vector[2]*%s->vector[2];\n",
+                           c, a, b, a, b, a, b);
+            break;
+        case INSTR_MUL_FV:
+        case INSTR_MUL_VF:
+        {
+            const char *f = (st->opcode == INSTR_MUL_FV) ? a : b;
+            const char *v = (st->opcode == INSTR_MUL_FV) ? b : a;
+            fs_file_printf(file, "    f = %s->_float;\n", f);
+            fs_file_printf(file, "    %s->vector[0] = f * %s->vector[0];\n", c, v);
+            fs_file_printf(file, "    %s->vector[1] = f * %s->vector[1];\n", c, v);
+            fs_file_printf(file, "    %s->vector[2] = f * %s->vector[2];\n", c, v);
+            break;
+        }
+        case INSTR_ADD_V:
+        case INSTR_SUB_V:
+        {
+            const char *op = (st->opcode == INSTR_ADD_V) ? "+" : "-";
+            fs_file_printf(file, "    %s->vector[0] = %s->vector[0] %s %s->vector[0];\n", c, a, op, b);
+            fs_file_printf(file, "    %s->vector[1] = %s->vector[1] %s %s->vector[1];\n", c, a, op, b);
+            fs_file_printf(file, "    %s->vector[2] = %s->vector[2] %s %s->vector[2];\n", c, a, op, b);
+            break;
+        }
+
+        case INSTR_EQ_F:   fs_file_printf(file, "    %s->_float = (%s->_float == %s->_float);\n", c, a, b); break;
+        case INSTR_NE_F:   fs_file_printf(file, "    %s->_float = (%s->_float != %s->_float);\n", c, a, b); break;
+        case INSTR_LE:     fs_file_printf(file, "    %s->_float = (%s->_float <= %s->_float);\n", c, a, b); break;
+        case INSTR_GE:     fs_file_printf(file, "    %s->_float = (%s->_float >= %s->_float);\n", c, a, b); break;
+        case INSTR_LT:     fs_file_printf(file, "    %s->_float = (%s->_float < %s->_float);\n", c, a, b); break;
+        case INSTR_GT:     fs_file_printf(file, "    %s->_float = (%s->_float > %s->_float);\n", c, a, b); break;
+        case INSTR_EQ_E:   fs_file_printf(file, "    %s->_float = (%s->_int == %s->_int);\n", c, a, b); break;
+        case INSTR_NE_E:   fs_file_printf(file, "    %s->_float = (%s->_int != %s->_int);\n", c, a, b); break;
+        case INSTR_EQ_FNC: fs_file_printf(file, "    %s->_float = (%s->function == %s->function);\n", c, a, b); break;
+        case INSTR_NE_FNC: fs_file_printf(file, "    %s->_float = (%s->function != %s->function);\n", c, a, b); break;
+        case INSTR_EQ_V:
+            fs_file_printf(file, "    %s->_float = ((%s->vector[0] == %s->vector[0]) && (%s->vector[1] == %s->vector[1]) && (%s->vector[2] == %s->vector[2]));\n",
+                           c, a, b, a, b, a, b);
+            break;
+        case INSTR_NE_V:
+            fs_file_printf(file, "    %s->_float = ((%s->vector[0] != %s->vector[0]) || (%s->vector[1] != %s->vector[1]) || (%s->vector[2] != %s->vector[2]));\n",
+                           c, a, b, a, b, a, b);
+            break;
+        case INSTR_EQ_S:
+        case INSTR_NE_S:
+            fs_file_printf(file, "    %s->_float = %s(prog_getstring(prog, %s->string), prog_getstring(prog, %s->string));\n",
+                           c, (st->opcode == INSTR_EQ_S) ? "!strcmp" : "!!strcmp", a, b);
+            break;
+
+        case INSTR_LOAD_F:
+        case INSTR_LOAD_S:
+        case INSTR_LOAD_FLD:
+        case INSTR_LOAD_ENT:
+        case INSTR_LOAD_FNC:
+            fs_file_printf(file, "    if (!(fld = prog_native_field(prog, %s->edict, %s->_int, 1)))\n        return;\n", a, b);
+            fs_file_printf(file, "    %s->_int = *fld;\n", c);
+            break;
+        case INSTR_LOAD_V:
+            fs_file_printf(file, "    if (!(fld = prog_native_field(prog, %s->edict, %s->_int, 3)))\n        return;\n", a, b);
+            fs_file_printf(file, "    %s->ivector[0] = fld[0];\n", c);
+            fs_file_printf(file, "    %s->ivector[1] = fld[prog->fieldstride];\n", c);
+            fs_file_printf(file, "    %s->ivector[2] = fld[prog->fieldstride * 2];\n", c);
+            break;
+        case INSTR_ADDRESS:
+            fs_file_printf(file, "    if (!prog_native_address(prog, %s->edict, %s->_int, &%s->_int))\n        return;\n", a, b, c);
+            break;
+
+        case INSTR_STORE_F:
+        case INSTR_STORE_S:
+        case INSTR_STORE_ENT:
+        case INSTR_STORE_FLD:
+        case INSTR_STORE_FNC:
+            fs_file_printf(file, "    %s->_int = %s->_int;\n", b, a);
+            break;
+        case INSTR_STORE_V:
+            fs_file_printf(file, "    %s->ivector[0] = %s->ivector[0];\n", b, a);
+            fs_file_printf(file, "    %s->ivector[1] = %s->ivector[1];\n", b, a);
+            fs_file_printf(file, "    %s->ivector[2] = %s->ivector[2];\n", b, a);
+            break;
+        case INSTR_STOREP_F:
+        case INSTR_STOREP_S:
+        case INSTR_STOREP_ENT:
+        case INSTR_STOREP_FLD:
+        case INSTR_STOREP_FNC:
+            fs_file_printf(file, "    if (!(fld = prog_native_pointer(prog, %s->_int, 1)))\n        return;\n", b);
+            fs_file_printf(file, "    *fld = %s->_int;\n", a);
+            break;
+        case INSTR_STOREP_V:
+            fs_file_printf(file, "    if (!(fld = prog_native_pointer(prog, %s->_int, 3)))\n        return;\n", b);
+            fs_file_printf(file, "    fld[0] = %s->ivector[0];\n", a);
+            fs_file_printf(file, "    fld[prog->fieldstride] = %s->ivector[1];\n", a);
+            fs_file_printf(file, "    fld[prog->fieldstride * 2] = %s->ivector[2];\n", a);
+            break;
 
-    CheckArgs(2);
-    str1 = GetArg(0);
-    str2 = GetArg(1);
-    cstr1 = prog_getstring(prog, str1->string);
-    cstr2 = prog_getstring(prog, str2->string);
-    len1 = strlen(cstr1);
-    len2 = strlen(cstr2);
-    buffer = (char*)mem_a(len1 + len2 + 1);
-    memcpy(buffer, cstr1, len1);
-    memcpy(buffer+len1, cstr2, len2+1);
-    out.string = prog_tempstring(prog, buffer);
-    mem_d(buffer);
-    Return(out);
-    return 0;
-}
+        case INSTR_NOT_F:   fs_file_printf(file, "    %s->_float = !FLOAT_IS_TRUE_FOR_INT(%s->_int);\n", c, a); break;
+        case INSTR_NOT_V:
+            fs_file_printf(file, "    %s->_float = !%s->vector[0] && !%s->vector[1] && !%s->vector[2];\n", c, a, a, a);
+            break;
+        case INSTR_NOT_S:
+            fs_file_printf(file, "    %s->_float = !%s->string || !*prog_getstring(prog, %s->string);\n", c, a, a);
+            break;
+        case INSTR_NOT_ENT: fs_file_printf(file, "    %s->_float = (%s->edict == 0);\n", c, a); break;
+        case INSTR_NOT_FNC: fs_file_printf(file, "    %s->_float = !%s->function;\n", c, a); break;
 
-static int qc_strcmp(qc_program_t *prog) {
-    qcany_t *str1,  *str2;
-    qcany_t out;
+        case INSTR_IF:
+            fs_file_printf(file, "    if (FLOAT_IS_TRUE_FOR_INT(%s->_int))\n        goto s%lu;\n",
+                           a, (unsigned long)qcvm_emit_target(st, i));
+            break;
+        case INSTR_IFNOT:
+            fs_file_printf(file, "    if (!FLOAT_IS_TRUE_FOR_INT(%s->_int))\n        goto s%lu;\n",
+                           a, (unsigned long)qcvm_emit_target(st, i));
+            break;
+        case INSTR_GOTO:
+            fs_file_printf(file, "    goto s%lu;\n", (unsigned long)qcvm_emit_target(st, i));
+            break;
 
-    const char *cstr1;
-    const char *cstr2;
+        case INSTR_CALL0: case INSTR_CALL1: case INSTR_CALL2:
+        case INSTR_CALL3: case INSTR_CALL4: case INSTR_CALL5:
+        case INSTR_CALL6: case INSTR_CALL7: case INSTR_CALL8:
+            fs_file_printf(file, "    if (!prog_native_call(prog, %s->function, %d, %lu))\n        return;\n",
+                           a, (int)(st->opcode - INSTR_CALL0), (unsigned long)i);
+            break;
+        case INSTR_STATE:
+            fs_file_puts(file, "    prog_native_state(prog);\n");
+            break;
 
-    if (prog->argc != 2 && prog->argc != 3) {
-        fprintf(stderr, "ERROR: invalid number of arguments for strcmp/strncmp: %i, expected 2 or 3\n",
-               prog->argc);
-        return -1;
+        case INSTR_AND:
+            fs_file_printf(file, "    %s->_float = FLOAT_IS_TRUE_FOR_INT(%s->_int) && FLOAT_IS_TRUE_FOR_INT(%s->_int);\n", c, a, b);
+            break;
+        case INSTR_OR:
+            fs_file_printf(file, "    %s->_float = FLOAT_IS_TRUE_FOR_INT(%s->_int) || FLOAT_IS_TRUE_FOR_INT(%s->_int);\n", c, a, b);
+            break;
+        case INSTR_BITAND:
+            fs_file_printf(file, "    %s->_float = ((int)%s->_float) & ((int)%s->_float);\n", c, a, b);
+            break;
+        case INSTR_BITOR:
+            fs_file_printf(file, "    %s->_float = ((int)%s->_float) | ((int)%s->_float);\n", c, a, b);
+            break;
     }
-
-    str1 = GetArg(0);
-    str2 = GetArg(1);
-    cstr1 = prog_getstring(prog, str1->string);
-    cstr2 = prog_getstring(prog, str2->string);
-    if (prog->argc == 3)
-        out._float = strncmp(cstr1, cstr2, GetArg(2)->_float);
-    else
-        out._float = strcmp(cstr1, cstr2);
-    Return(out);
-    return 0;
 }
 
-static int qc_floor(qc_program_t *prog) {
-    qcany_t *num, out;
-    CheckArgs(1);
-    num = GetArg(0);
-    out._float = floor(num->_float);
-    Return(out);
-    return 0;
-}
-
-static prog_builtin_t qc_builtins[] = {
-    NULL,
-    &qc_print,       /*   1   */
-    &qc_ftos,        /*   2   */
-    &qc_spawn,       /*   3   */
-    &qc_kill,        /*   4   */
-    &qc_vtos,        /*   5   */
-    &qc_error,       /*   6   */
-    &qc_vlen,        /*   7   */
-    &qc_etos,        /*   8   */
-    &qc_stof,        /*   9   */
-    &qc_strcat,      /*   10  */
-    &qc_strcmp,      /*   11  */
-    &qc_normalize,   /*   12  */
-    &qc_sqrt,        /*   13  */
-    &qc_floor        /*   14  */
-};
-
-static const char *arg0 = NULL;
+#ifdef QCVM_NATIVES
+bool QCVM_NATIVES(qc_program_t *prog);
+#endif
 
-static void version(void) {
-    printf("GMQCC-QCVM %d.%d.%d Built %s %s\n",
-           GMQCC_VERSION_MAJOR,
-           GMQCC_VERSION_MINOR,
-           GMQCC_VERSION_PATCH,
-           __DATE__,
-           __TIME__
-    );
-}
+static bool qcvm_emit_c(qc_program_t *prog, const char *progsfile, const char *filename) {
+    FILE       *file;
+    qcint_t    *entries    = NULL;
+    bool       *translated = NULL;
+    bool       *labels     = NULL;
+    char        name[64];
+    const char *base;
+    size_t      i, k, n;
+
+    /* the name of the registering function, from the progs file's */
+    base = strrchr(progsfile, '/');
+    base = base ? base + 1 : progsfile;
+    for (n = 0; base[n] && base[n] != '.' && n < sizeof(name) - 9; ++n)
+        name[n] = (util_isalpha(base[n]) || util_isdigit(base[n])) ? base[n] : '_';
+    name[n] = '\0';
+    if (!n || util_isdigit(name[0]))
+        name[0] = '_';
+    strcat(name, "_natives");
+
+    if (!(file = fs_file_open(filename, "wb"))) {
+        loaderror("failed to open `%s` for writing", filename);
+        return false;
+    }
 
-static void usage(void) {
-    printf("usage: %s [options] [parameters] file\n", arg0);
-    printf("options:\n");
-    printf("  -h, --help         print this message\n"
-           "  -trace             trace the execution\n"
-           "  -profile           perform profiling during execution\n"
-           "  -info              print information from the prog's header\n"
-           "  -disasm            disassemble and exit\n"
-           "  -disasm-func func  disassemble and exit\n"
-           "  -printdefs         list the defs section\n"
-           "  -printfields       list the field section\n"
-           "  -printfuns         list functions information\n"
-           "  -v                 be verbose\n"
-           "  -vv                be even more verbose\n");
-    printf("parameters:\n");
-    printf("  -vector <V>   pass a vector parameter to main()\n"
-           "  -float  <f>   pass a float parameter to main()\n"
-           "  -string <s>   pass a string parameter to main() \n");
-}
+    for (i = 1; i < prog->functions_count; ++i) {
+        if (prog->functions[i].entry >= 0)
+            vec_push(entries, prog->functions[i].entry);
+    }
+    if (entries)
+        qsort(entries, vec_size(entries), sizeof(entries[0]), qcvm_emit_entry_compare);
+
+    fs_file_printf(file, "/* %s translated by qcvm -emit-c, see prog_native_set */\n", base);
+    fs_file_puts(file, "#include <string.h>\n"
+                       "#include \"gmqcc.h\"\n\n"
+                       "#define G(x) ((qcany_t*)(g + (x)))\n"
+                       "#define FLOAT_IS_TRUE_FOR_INT(x) ((x) & 0x7FFFFFFF)\n\n");
+
+    translated = (bool*)mem_a(prog->functions_count * sizeof(bool));
+    memset(translated, 0, prog->functions_count * sizeof(bool));
+
+    for (i = 1; i < prog->functions_count; ++i) {
+        prog_section_function_t *func = prog->functions + i;
+        size_t                   end;
+        bool                     fld = false;
+        bool                     f   = false;
+
+        if (func->entry < 0)
+            continue;
+
+        /* the label flags are only ever grown, to the longest function so far */
+        end = qcvm_emit_end(prog, entries, func->entry);
+        if (end > (size_t)func->entry && vec_size(labels) < end - func->entry)
+            (void)vec_add(labels, end - func->entry - vec_size(labels));
+        if (labels)
+            memset(labels, 0, vec_size(labels) * sizeof(bool));
+        if (!qcvm_emit_check(prog, func->entry, end, labels)) {
+            fs_file_printf(file, "/* %s is left to the VM */\n\n", prog_getstring(prog, func->name));
+            continue;
+        }
+        translated[i] = true;
 
-static void prog_main_setparams(qc_program_t *prog) {
-    size_t i;
-    qcany_t *arg;
+        for (k = func->entry; k < end; ++k) {
+            int op = prog->code[k].opcode;
+            fld = fld || (op >= INSTR_LOAD_F && op <= INSTR_LOAD_FNC) || (op >= INSTR_STOREP_F && op <= INSTR_STOREP_FNC);
+            f   = f   || op == INSTR_MUL_FV || op == INSTR_MUL_VF;
+        }
 
-    for (i = 0; i < vec_size(main_params); ++i) {
-        arg = GetGlobal(OFS_PARM0 + 3*i);
-        arg->vector[0] = 0;
-        arg->vector[1] = 0;
-        arg->vector[2] = 0;
-        switch (main_params[i].vtype) {
-            case TYPE_VECTOR:
-#ifdef _MSC_VER
-                (void)sscanf_s(main_params[i].value, " %f %f %f ",
-                               &arg->vector[0],
-                               &arg->vector[1],
-                               &arg->vector[2]);
-#else
-                (void)sscanf(main_params[i].value, " %f %f %f ",
-                             &arg->vector[0],
-                             &arg->vector[1],
-                             &arg->vector[2]);
-#endif
-                break;
-            case TYPE_FLOAT:
-                arg->_float = atof(main_params[i].value);
-                break;
-            case TYPE_STRING:
-                arg->string = prog_tempstring(prog, main_params[i].value);
-                break;
-            default:
-                fprintf(stderr, "error: unhandled parameter type: %i\n", main_params[i].vtype);
-                break;
+        fs_file_printf(file, "/* %s */\nstatic void qc_function_%lu(qc_program_t *prog) {\n",
+                       prog_getstring(prog, func->name), (unsigned long)i);
+        fs_file_puts(file, "    qcint_t *g = prog->globals;\n");
+        if (fld)
+            fs_file_puts(file, "    qcint_t *fld;\n");
+        if (f)
+            fs_file_puts(file, "    qcfloat_t f;\n");
+        fs_file_puts(file, "\n");
+
+        for (k = func->entry; k < end; ++k) {
+            if (labels[k - func->entry])
+                fs_file_printf(file, "s%lu:\n", (unsigned long)k);
+            qcvm_emit_statement(file, prog, k);
         }
+        fs_file_puts(file, "}\n\n");
+    }
+
+    fs_file_printf(file, "/* registers the functions with a program loaded from %s */\n", base);
+    fs_file_printf(file, "bool %s(qc_program_t *prog);\n", name);
+    fs_file_printf(file, "bool %s(qc_program_t *prog) {\n", name);
+    fs_file_printf(file, "    if (prog->crc16 != %u || prog->functions_count != %lu || prog->code_count != %lu)\n"
+                         "        return false;\n",
+                   (unsigned int)prog->crc16, (unsigned long)prog->functions_count, (unsigned long)prog->code_count);
+    for (i = 1; i < prog->functions_count; ++i) {
+        if (translated[i])
+            fs_file_printf(file, "    prog_native_set(prog, %lu, qc_function_%lu);\n", (unsigned long)i, (unsigned long)i);
     }
+    fs_file_puts(file, "    return true;\n}\n");
+
+    mem_d(translated);
+    vec_free(labels);
+    vec_free(entries);
+    fs_file_close(file);
+    return true;
 }
 
 void prog_disasm_function(qc_program_t *prog, size_t id);
 
 int main(int argc, char **argv) {
     size_t      i;
-    qcint_t       fnmain = -1;
     qc_program_t *prog;
+#ifdef QCVM_THREADED
+    size_t      xflags = VMXF_THREADED;
+#else
     size_t      xflags = VMXF_DEFAULT;
+#endif
     bool        opts_printfields = false;
     bool        opts_printdefs   = false;
     bool        opts_printfuns   = false;
@@ -917,8 +5388,25 @@ int main(int argc, char **argv) {
     bool        opts_info        = false;
     bool        noexec           = false;
     const char *progsfile        = NULL;
+    const char *profilein        = NULL;
+    const char *profileout       = NULL;
+    const char *profilefolded    = NULL;
+    const char *profilejson      = NULL;
+    const char *profilelines     = NULL;
+    const char *samplefile       = NULL;
+    size_t      sampleinterval   = 0;
+    bool        coverage         = false;
+    const char *lcovfile         = NULL;
+    long        budget           = 0;
+    int         fusemode         = VMFUSE_STATIC;
+    bool        intrinsics       = true;
+    bool        vectorize        = true;
+    int         entitylayout     = VMENTITY_ENTITY_MAJOR;
     const char **dis_list        = NULL;
     int         opts_v           = 0;
+    const char *jobsfile         = NULL;
+    size_t      jobthreads       = 0;
+    const char *emitfile         = NULL;
 
     arg0 = argv[0];
 
@@ -940,34 +5428,187 @@ int main(int argc, char **argv) {
             --argc;
             ++argv;
         }
-        else if (!strncmp(argv[1], "-vv", 3)) {
-            const char *av = argv[1]+1;
-            for (; *av; ++av) {
-                if (*av == 'v')
-                    ++opts_v;
-                else {
-                    usage();
-                    exit(1);
-                }
+        else if (!strncmp(argv[1], "-vv", 3)) {
+            const char *av = argv[1]+1;
+            for (; *av; ++av) {
+                if (*av == 'v')
+                    ++opts_v;
+                else {
+                    usage();
+                    exit(1);
+                }
+            }
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-version") ||
+                 !strcmp(argv[1], "--version"))
+        {
+            version();
+            exit(0);
+        }
+        else if (!strcmp(argv[1], "-trace")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_TRACE;
+        }
+        else if (!strcmp(argv[1], "-profile")) {
+            --argc;
+            ++argv;
+            xflags |= VMXF_PROFILE;
+        }
+        else if (!strcmp(argv[1], "-dispatch")) {
+            --argc;
+            ++argv;
+            if (argc <= 1) {
+                usage();
+                exit(1);
+            }
+            xflags &= ~(VMXF_THREADED|VMXF_CLOSURE);
+            if (!strcmp(argv[1], "closure"))
+                xflags |= VMXF_CLOSURE;
+            else if (!strcmp(argv[1], "threaded")) {
+#ifdef QCVM_THREADED
+                xflags |= VMXF_THREADED;
+#else
+                fprintf(stderr, "threaded dispatch is not available in this build, using switch\n");
+#endif
+            } else if (strcmp(argv[1], "switch")) {
+                fprintf(stderr, "unknown dispatch engine: %s\n", argv[1]);
+                usage();
+                exit(1);
+            }
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-nofuse")) {
+            --argc;
+            ++argv;
+            fusemode = VMFUSE_NONE;
+        }
+        else if (!strcmp(argv[1], "-nointrinsics")) {
+            --argc;
+            ++argv;
+            intrinsics = false;
+        }
+        else if (!strcmp(argv[1], "-verify")) {
+            --argc;
+            ++argv;
+            main_verify = true;
+        }
+        else if (!strcmp(argv[1], "-noverify")) {
+            --argc;
+            ++argv;
+            main_verify = false;
+        }
+        else if (!strcmp(argv[1], "-novector")) {
+            --argc;
+            ++argv;
+            vectorize = false;
+        }
+        else if (!strcmp(argv[1], "-field-major")) {
+            --argc;
+            ++argv;
+            entitylayout = VMENTITY_FIELD_MAJOR;
+        }
+        else if (!strcmp(argv[1], "-fuse-profile")   ||
+                 !strcmp(argv[1], "-profile-out")    ||
+                 !strcmp(argv[1], "-profile-folded") ||
+                 !strcmp(argv[1], "-profile-json")   ||
+                 !strcmp(argv[1], "-profile-lines")  ||
+                 !strcmp(argv[1], "-lcov"))
+        {
+            const char **out = NULL;
+            if      (!strcmp(argv[1], "-profile-out"))    out = &profileout;
+            else if (!strcmp(argv[1], "-profile-folded")) out = &profilefolded;
+            else if (!strcmp(argv[1], "-profile-json"))   out = &profilejson;
+            else if (!strcmp(argv[1], "-profile-lines"))  out = &profilelines;
+            else if (!strcmp(argv[1], "-lcov"))           out = &lcovfile;
+            --argc;
+            ++argv;
+            if (argc <= 1) {
+                usage();
+                exit(1);
+            }
+            if (out) {
+                *out       = argv[1];
+                xflags    |= VMXF_PROFILE;
+            } else {
+                profilein  = argv[1];
+                fusemode   = VMFUSE_PROFILE;
+            }
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-coverage")) {
+            --argc;
+            ++argv;
+            coverage = true;
+            xflags  |= VMXF_PROFILE;
+        }
+        else if (!strcmp(argv[1], "-sample")) {
+            --argc;
+            ++argv;
+            if (argc <= 1) {
+                usage();
+                exit(1);
+            }
+            samplefile = argv[1];
+            xflags    |= VMXF_SAMPLE;
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-sample-interval")) {
+            --argc;
+            ++argv;
+            if (argc <= 1 || !(sampleinterval = strtoul(argv[1], NULL, 10))) {
+                usage();
+                exit(1);
+            }
+            --argc;
+            ++argv;
+        }
+        else if (!strcmp(argv[1], "-budget")) {
+            --argc;
+            ++argv;
+            if (argc <= 1 || (budget = strtol(argv[1], NULL, 10)) <= 0) {
+                usage();
+                exit(1);
             }
             --argc;
             ++argv;
         }
-        else if (!strcmp(argv[1], "-version") ||
-                 !strcmp(argv[1], "--version"))
-        {
-            version();
-            exit(0);
+        else if (!strcmp(argv[1], "-emit-c")) {
+            --argc;
+            ++argv;
+            if (argc <= 1) {
+                usage();
+                exit(1);
+            }
+            emitfile = argv[1];
+            --argc;
+            ++argv;
         }
-        else if (!strcmp(argv[1], "-trace")) {
+        else if (!strcmp(argv[1], "-jobs")) {
+            --argc;
+            ++argv;
+            if (argc <= 1) {
+                usage();
+                exit(1);
+            }
+            jobsfile = argv[1];
             --argc;
             ++argv;
-            xflags |= VMXF_TRACE;
         }
-        else if (!strcmp(argv[1], "-profile")) {
+        else if (!strcmp(argv[1], "-j")) {
+            --argc;
+            ++argv;
+            if (argc <= 1 || !(jobthreads = strtoul(argv[1], NULL, 10))) {
+                usage();
+                exit(1);
+            }
             --argc;
             ++argv;
-            xflags |= VMXF_PROFILE;
         }
         else if (!strcmp(argv[1], "-info")) {
             --argc;
@@ -1066,6 +5707,11 @@ int main(int argc, char **argv) {
         ++argv;
     }
 
+    if (jobsfile) {
+        /* the profile, sample and coverage reports are per program, the jobs don't write them */
+        return qcvm_jobs_run(jobsfile, progsfile, jobthreads, xflags & ~(VMXF_PROFILE | VMXF_SAMPLE));
+    }
+
     if (!progsfile) {
         fprintf(stderr, "must specify a program to execute\n");
         usage();
@@ -1078,8 +5724,57 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    prog->builtins       = qc_builtins;
-    prog->builtins_count = GMQCC_ARRAY_COUNT(qc_builtins);
+    prog_main_builtins(prog);
+    if (!intrinsics) {
+        /* setting the builtins again drops their intrinsics */
+        for (i = 0; i < GMQCC_ARRAY_COUNT(qc_intrinsics); ++i)
+            prog_builtin_set(prog, qc_intrinsics[i].number, qc_builtins[qc_intrinsics[i].number]);
+    }
+
+    if (emitfile) {
+        bool emitted = qcvm_emit_c(prog, progsfile, emitfile);
+        prog_delete(prog);
+        return emitted ? 0 : 1;
+    }
+#ifdef QCVM_NATIVES
+    if (!QCVM_NATIVES(prog)) {
+        fprintf(stderr, "`%s` isn't the program translated to C\n", progsfile);
+        prog_delete(prog);
+        exit(1);
+    }
+#endif
+
+    if (profilein && !prog_profile_load(prog, profilein)) {
+        prog_delete(prog);
+        exit(1);
+    }
+    if (fusemode != VMFUSE_STATIC)
+        prog_fuse(prog, fusemode);
+    if (!vectorize)
+        prog_vectorize(prog, false);
+    prog_entity_layout(prog, entitylayout);
+    if (main_verify && !prog_verify(prog)) {
+        prog_delete(prog);
+        exit(1);
+    }
+
+    if (samplefile || coverage || lcovfile || profilelines) {
+        /* the line numbers are next to the progs when compiled with -flno */
+        char       *lnofile = NULL;
+        const char *dot;
+        size_t      len;
+
+        dot = strrchr(progsfile, '.');
+        len = dot ? (size_t)(dot - progsfile) : strlen(progsfile);
+        memcpy(vec_add(lnofile, len), progsfile, len);
+        memcpy(vec_add(lnofile, 5), ".lno", 5);
+        prog_load_lno(prog, lnofile);
+        vec_free(lnofile);
+    }
+    if (samplefile) {
+        if (sampleinterval)
+            prog_sample_interval(prog, sampleinterval);
+    }
 
     if (opts_info) {
         printf("Program's system-checksum = 0x%04x\n", (unsigned int)prog->crc16);
@@ -1091,11 +5786,11 @@ int main(int argc, char **argv) {
                "    fields: %lu\n"
                " functions: %lu\n"
                "   strings: %lu\n",
-               (unsigned long)vec_size(prog->code),
-               (unsigned long)vec_size(prog->defs),
-               (unsigned long)vec_size(prog->fields),
-               (unsigned long)vec_size(prog->functions),
-               (unsigned long)vec_size(prog->strings));
+               (unsigned long)prog->code_count,
+               (unsigned long)prog->defs_count,
+               (unsigned long)prog->fields_count,
+               (unsigned long)prog->functions_count,
+               (unsigned long)prog->strings_count);
     }
 
     if (opts_info) {
@@ -1103,24 +5798,19 @@ int main(int argc, char **argv) {
         return 0;
     }
     for (i = 0; i < vec_size(dis_list); ++i) {
-        size_t k;
+        prog_section_function_t *func;
         printf("Looking for `%s`\n", dis_list[i]);
-        for (k = 1; k < vec_size(prog->functions); ++k) {
-            const char *name = prog_getstring(prog, prog->functions[k].name);
-            if (!strcmp(name, dis_list[i])) {
-                prog_disasm_function(prog, k);
-                break;
-            }
-        }
+        if ((func = prog_findfunction(prog, dis_list[i])))
+            prog_disasm_function(prog, func - prog->functions);
     }
     if (opts_disasm) {
-        for (i = 1; i < vec_size(prog->functions); ++i)
+        for (i = 1; i < prog->functions_count; ++i)
             prog_disasm_function(prog, i);
         return 0;
     }
     if (opts_printdefs) {
         const char *getstring = NULL;
-        for (i = 0; i < vec_size(prog->defs); ++i) {
+        for (i = 0; i < prog->defs_count; ++i) {
             printf("Global: %8s %-16s at %u%s",
                    type_name[prog->defs[i].type & DEF_TYPEMASK],
                    prog_getstring(prog, prog->defs[i].name),
@@ -1154,7 +5844,7 @@ int main(int argc, char **argv) {
         }
     }
     if (opts_printfields) {
-        for (i = 0; i < vec_size(prog->fields); ++i) {
+        for (i = 0; i < prog->fields_count; ++i) {
             printf("Field: %8s %-16s at %u%s\n",
                    type_name[prog->fields[i].type],
                    prog_getstring(prog, prog->fields[i].name),
@@ -1163,7 +5853,7 @@ int main(int argc, char **argv) {
         }
     }
     if (opts_printfuns) {
-        for (i = 0; i < vec_size(prog->functions); ++i) {
+        for (i = 0; i < prog->functions_count; ++i) {
             int32_t a;
             printf("Function: %-16s taking %i parameters:(",
                    prog_getstring(prog, prog->functions[i].name),
@@ -1200,15 +5890,44 @@ int main(int argc, char **argv) {
         }
     }
     if (!noexec) {
-        for (i = 1; i < vec_size(prog->functions); ++i) {
-            const char *name = prog_getstring(prog, prog->functions[i].name);
-            if (!strcmp(name, "main"))
-                fnmain = (qcint_t)i;
-        }
-        if (fnmain > 0)
+        prog_section_function_t *fnmain = prog_findfunction(prog, "main");
+        if (fnmain)
         {
-            prog_main_setparams(prog);
-            prog_exec(prog, &prog->functions[fnmain], xflags, VM_JUMPS_DEFAULT);
+            prog_main_setparams(prog, main_params);
+            if (budget) {
+                /* all at once, just in slices */
+                size_t slices = 1;
+                int    result = prog_exec_budget(prog, fnmain, xflags, VM_JUMPS_DEFAULT, budget);
+                while (result == VMEXEC_SUSPENDED) {
+                    result = prog_resume(prog, budget);
+                    ++slices;
+                }
+                if (opts_v)
+                    printf("main ran in %lu slices of %ld instructions\n", (unsigned long)slices, budget);
+            }
+            else
+                prog_exec(prog, fnmain, xflags, VM_JUMPS_DEFAULT);
+            if (profileout)
+                prog_profile_save(prog, profileout);
+            if (profilefolded)
+                prog_profile_folded(prog, profilefolded);
+            if (profilejson)
+                prog_profile_json(prog, profilejson);
+            if (profilelines)
+                prog_profile_lines(prog, profilelines);
+            if (samplefile)
+                prog_sample_report(prog, samplefile);
+            if (lcovfile)
+                prog_coverage_lcov(prog, lcovfile);
+            if (coverage)
+                prog_coverage_print(prog);
+            if (opts_v) {
+                printf("Tempstrings: %lu made, %lu reused, peak %lu bytes in use, %lu bytes reserved\n",
+                       (unsigned long)prog->tempstring_stats.allocations,
+                       (unsigned long)prog->tempstring_stats.reused,
+                       (unsigned long)prog->tempstring_stats.peak,
+                       (unsigned long)prog->tempstring_stats.reserved);
+            }
         }
         else
             fprintf(stderr, "No main function found\n");
@@ -1245,9 +5964,9 @@ void prog_disasm_function(qc_program_t *prog, size_t id) {
  * sort of isn't, which makes it nicer looking.
  */
 
-#define OPA ( (qcany_t*) (prog->globals + st->o1.u1) )
-#define OPB ( (qcany_t*) (prog->globals + st->o2.u1) )
-#define OPC ( (qcany_t*) (prog->globals + st->o3.u1) )
+#define OPA ( ip->a )
+#define OPB ( ip->b )
+#define OPC ( ip->c )
 
 #define GLOBAL(x) ( (qcany_t*) (prog->globals + (x)) )
 
@@ -1256,143 +5975,317 @@ void prog_disasm_function(qc_program_t *prog, size_t id) {
 #   define FLOAT_IS_TRUE_FOR_INT(x) ( (x) & 0x7FFFFFFF )
 #endif
 
-while (1) {
+/*
+ * The same loop body is used for both dispatch engines. With the switch
+ * engine every handler is a case label and leaving it means breaking
+ * back into the while loop. With the threaded engine every handler is
+ * a real label and leaving it means jumping straight to the handler of
+ * the next instruction through the label stored in it by prog_load.
+ *
+ * QCVM_NEXT continues with the following instruction, QCVM_DISPATCH
+ * continues with whatever `ip` was set to. QCVM_FUSE continues with
+ * the following instruction knowing it's handler X, which the threaded
+ * engine can jump to directly. QCVM_GENERIC turns the instruction back
+ * into its own opcode for good and runs that, for a specialization
+ * whose assumption doesn't hold anymore.
+ *
+ * The profiling loops count every statement before it runs, QCVM_COUNT,
+ * and execute the plain opcodes. The sampling loops count down to the
+ * next sample before every instruction, QCVM_TAKE_SAMPLE, and keep the
+ * fused ones. The threaded variants of both find the handlers in their
+ * own table, the labels stored in the instructions belong to
+ * prog_exec_threaded; when sampling gives up on a specialization, the
+ * stale label is corrected once that loop runs into it again.
+ */
+#define QCVM_COUNT                                                           \
+    do {                                                                     \
+        prog->profile[ip - prog->decoded]++;                                 \
+        if (!(++prog->profile_instructions & (QCVM_PROFILE_TICK - 1)))       \
+            prog->profile_clock = prog_profile_clock();                      \
+    } while (0)
+#define QCVM_TAKE_SAMPLE                                                     \
+    do {                                                                     \
+        if (--samplewait <= 0)                                               \
+            samplewait = prog_sample(prog, ip - prog->decoded);              \
+    } while (0)
+
+#if QCVM_THREADED_LOOP && QCVM_PROFILE
+#   define QCVM_CASE(X)   qcvm_op_##X:
+#   define QCVM_ILLEGAL   qcvm_op_illegal:
+#   define QCVM_DISPATCH  do { QCVM_COUNT; goto *qcvm_labels[ip->opcode]; } while (0)
+#   define QCVM_NEXT      ++ip; QCVM_DISPATCH
+#   define QCVM_FUSE(X)   ++ip; QCVM_DISPATCH
+#   define QCVM_GENERIC   QCVM_DISPATCH
+#elif QCVM_THREADED_LOOP && QCVM_SAMPLE
+#   define QCVM_CASE(X)   qcvm_op_##X:
+#   define QCVM_ILLEGAL   qcvm_op_illegal:
+#   define QCVM_DISPATCH  do { QCVM_TAKE_SAMPLE; goto *qcvm_labels[ip->op]; } while (0)
+#   define QCVM_NEXT      ++ip; QCVM_DISPATCH
+#   define QCVM_FUSE(X)   ++ip; QCVM_TAKE_SAMPLE; goto qcvm_op_##X
+#   define QCVM_GENERIC   ip->op = ip->opcode; QCVM_DISPATCH
+#elif QCVM_THREADED_LOOP
+#   define QCVM_CASE(X)   qcvm_op_##X:
+#   define QCVM_ILLEGAL   qcvm_op_illegal:
+#   define QCVM_DISPATCH  goto *ip->label
+#   define QCVM_NEXT      goto *(++ip)->label
+#   define QCVM_FUSE(X)   ++ip; goto qcvm_op_##X
+#   define QCVM_GENERIC   ip->op = ip->opcode; ip->label = qcvm_labels[ip->op]; QCVM_DISPATCH
+#else
+#   define QCVM_CASE(X)   case X:
+#   define QCVM_ILLEGAL   default:
+#   define QCVM_DISPATCH  break
+#   define QCVM_NEXT      ++ip; break
+#   define QCVM_FUSE(X)   ++ip; break
+#   define QCVM_GENERIC   ip->op = ip->opcode; QCVM_DISPATCH
+#endif
+
+/*
+ * A budgeted run (see prog_exec_budget) pays for the instructions since
+ * `segment` whenever it leaves a straight line of them: QCVM_PAY before
+ * `ip` is moved. QCVM_YIELD then starts the next line at `ip` and stops
+ * the run there if the budget is used up.
+ */
+#define QCVM_PAY                                                             \
+    do {                                                                     \
+        if (budgeted)                                                        \
+            budget -= (long)(ip - segment) + 1;                              \
+    } while (0)
+#define QCVM_YIELD                                                           \
+    do {                                                                     \
+        segment = ip;                                                        \
+        if (budgeted && budget <= 0) {                                       \
+            resume = ip;                                                     \
+            goto cleanup;                                                    \
+        }                                                                    \
+    } while (0)
+
+#if QCVM_THREADED_LOOP
+{
+    /* Keep in the same order as the instruction enum and QCVM_OP_* */
+    static const void *const qcvm_labels[QCVM_OP_COUNT] = {
+        &&qcvm_op_INSTR_DONE,       &&qcvm_op_INSTR_MUL_F,      &&qcvm_op_INSTR_MUL_V,
+        &&qcvm_op_INSTR_MUL_FV,     &&qcvm_op_INSTR_MUL_VF,     &&qcvm_op_INSTR_DIV_F,
+        &&qcvm_op_INSTR_ADD_F,      &&qcvm_op_INSTR_ADD_V,      &&qcvm_op_INSTR_SUB_F,
+        &&qcvm_op_INSTR_SUB_V,      &&qcvm_op_INSTR_EQ_F,       &&qcvm_op_INSTR_EQ_V,
+        &&qcvm_op_INSTR_EQ_S,       &&qcvm_op_INSTR_EQ_E,       &&qcvm_op_INSTR_EQ_FNC,
+        &&qcvm_op_INSTR_NE_F,       &&qcvm_op_INSTR_NE_V,       &&qcvm_op_INSTR_NE_S,
+        &&qcvm_op_INSTR_NE_E,       &&qcvm_op_INSTR_NE_FNC,     &&qcvm_op_INSTR_LE,
+        &&qcvm_op_INSTR_GE,         &&qcvm_op_INSTR_LT,         &&qcvm_op_INSTR_GT,
+        &&qcvm_op_INSTR_LOAD_F,     &&qcvm_op_INSTR_LOAD_V,     &&qcvm_op_INSTR_LOAD_S,
+        &&qcvm_op_INSTR_LOAD_ENT,   &&qcvm_op_INSTR_LOAD_FLD,   &&qcvm_op_INSTR_LOAD_FNC,
+        &&qcvm_op_INSTR_ADDRESS,    &&qcvm_op_INSTR_STORE_F,    &&qcvm_op_INSTR_STORE_V,
+        &&qcvm_op_INSTR_STORE_S,    &&qcvm_op_INSTR_STORE_ENT,  &&qcvm_op_INSTR_STORE_FLD,
+        &&qcvm_op_INSTR_STORE_FNC,  &&qcvm_op_INSTR_STOREP_F,   &&qcvm_op_INSTR_STOREP_V,
+        &&qcvm_op_INSTR_STOREP_S,   &&qcvm_op_INSTR_STOREP_ENT, &&qcvm_op_INSTR_STOREP_FLD,
+        &&qcvm_op_INSTR_STOREP_FNC, &&qcvm_op_INSTR_RETURN,     &&qcvm_op_INSTR_NOT_F,
+        &&qcvm_op_INSTR_NOT_V,      &&qcvm_op_INSTR_NOT_S,      &&qcvm_op_INSTR_NOT_ENT,
+        &&qcvm_op_INSTR_NOT_FNC,    &&qcvm_op_INSTR_IF,         &&qcvm_op_INSTR_IFNOT,
+        &&qcvm_op_INSTR_CALL0,      &&qcvm_op_INSTR_CALL1,      &&qcvm_op_INSTR_CALL2,
+        &&qcvm_op_INSTR_CALL3,      &&qcvm_op_INSTR_CALL4,      &&qcvm_op_INSTR_CALL5,
+        &&qcvm_op_INSTR_CALL6,      &&qcvm_op_INSTR_CALL7,      &&qcvm_op_INSTR_CALL8,
+        &&qcvm_op_INSTR_STATE,      &&qcvm_op_INSTR_GOTO,       &&qcvm_op_INSTR_AND,
+        &&qcvm_op_INSTR_OR,         &&qcvm_op_INSTR_BITAND,     &&qcvm_op_INSTR_BITOR,
+
+        &&qcvm_op_illegal,
+        &&qcvm_op_QCVM_OP_LOAD_F_STORE_F,
+        &&qcvm_op_QCVM_OP_ADDRESS_STOREP_F,
+        &&qcvm_op_QCVM_OP_MUL_F_ADD_F,
+        &&qcvm_op_QCVM_OP_EQ_F_IFNOT,
+        &&qcvm_op_QCVM_OP_NE_F_IFNOT,
+        &&qcvm_op_QCVM_OP_LE_IFNOT,
+        &&qcvm_op_QCVM_OP_GE_IFNOT,
+        &&qcvm_op_QCVM_OP_LT_IFNOT,
+        &&qcvm_op_QCVM_OP_GT_IFNOT,
+
+        &&qcvm_op_QCVM_OP_CALL_INTRINSIC,
+
+        &&qcvm_op_QCVM_OP_CALL_VERIFIED,
+
+#if QCVM_SSE2
+        &&qcvm_op_QCVM_OP_MUL_V_SIMD,
+        &&qcvm_op_QCVM_OP_MUL_FV_SIMD,
+        &&qcvm_op_QCVM_OP_MUL_VF_SIMD,
+        &&qcvm_op_QCVM_OP_ADD_V_SIMD,
+        &&qcvm_op_QCVM_OP_SUB_V_SIMD,
+        &&qcvm_op_QCVM_OP_EQ_V_SIMD,
+        &&qcvm_op_QCVM_OP_NE_V_SIMD,
+        &&qcvm_op_QCVM_OP_NOT_V_SIMD,
+        &&qcvm_op_QCVM_OP_STORE_V_SIMD
+#else
+        &&qcvm_op_illegal, &&qcvm_op_illegal, &&qcvm_op_illegal,
+        &&qcvm_op_illegal, &&qcvm_op_illegal, &&qcvm_op_illegal,
+        &&qcvm_op_illegal, &&qcvm_op_illegal, &&qcvm_op_illegal
+#endif
+    };
+
     prog_section_function_t  *newf;
-    qcany_t          *ed;
-    qcany_t          *ptr;
+    qcint_t          *fld;
+    qcint_t           e;
+    qcint_t           f;
+
+#if !QCVM_PROFILE && !QCVM_SAMPLE
+    /* called when decoding: resolve the handler of every instruction */
+    if (!ip) {
+        size_t i;
+        for (i = 0; i < vec_size(prog->decoded); ++i) {
+            prog->decoded[i].label = (prog->decoded[i].op < QCVM_OP_COUNT)
+                                         ? qcvm_labels[prog->decoded[i].op]
+                                         : &&qcvm_op_illegal;
+        }
+        return NULL;
+    }
+#endif
 
-    ++st;
+    QCVM_DISPATCH;
+    {
+#else
+while (1) {
+    prog_section_function_t  *newf;
+    qcint_t          *fld;
+    qcint_t           e;
+    qcint_t           f;
 
 #if QCVM_PROFILE
-    prog->profile[st - prog->code]++;
+    QCVM_COUNT;
 #endif
 
 #if QCVM_TRACE
-    prog_print_statement(prog, st);
+    prog_print_statement(prog, prog->code + (ip - prog->decoded));
 #endif
 
-    switch (st->opcode)
+#if QCVM_SAMPLE
+    QCVM_TAKE_SAMPLE;
+#endif
+
+    /* tracing and profiling want to see every single statement */
+#if QCVM_PROFILE || QCVM_TRACE
+    switch (ip->opcode)
+#else
+    switch (ip->op)
+#endif
     {
-        default:
+#endif
+        QCVM_ILLEGAL
             qcvmerror(prog, "Illegal instruction in %s\n", prog->filename);
             goto cleanup;
 
-        case INSTR_DONE:
-        case INSTR_RETURN:
-            /* TODO: add instruction count to function profile count */
+        QCVM_CASE(INSTR_DONE)
+        QCVM_CASE(INSTR_RETURN)
             GLOBAL(OFS_RETURN)->ivector[0] = OPA->ivector[0];
             GLOBAL(OFS_RETURN)->ivector[1] = OPA->ivector[1];
             GLOBAL(OFS_RETURN)->ivector[2] = OPA->ivector[2];
 
-            st = prog->code + prog_leavefunction(prog);
-            if (!vec_size(prog->stack))
+            QCVM_PAY;
+            ip = prog->decoded + prog_leavefunction(prog);
+            segment = ip;
+            if (vec_size(prog->stack) == stackbase)
                 goto cleanup;
 
-            break;
+            QCVM_DISPATCH;
 
-        case INSTR_MUL_F:
+        QCVM_CASE(INSTR_MUL_F)
             OPC->_float = OPA->_float * OPB->_float;
-            break;
-        case INSTR_MUL_V:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_MUL_V)
             OPC->_float = OPA->vector[0]*OPB->vector[0] +
                           OPA->vector[1]*OPB->vector[1] +
                           OPA->vector[2]*OPB->vector[2];
-            break;
-        case INSTR_MUL_FV:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_MUL_FV)
         {
             qcfloat_t f = OPA->_float;
             OPC->vector[0] = f * OPB->vector[0];
             OPC->vector[1] = f * OPB->vector[1];
             OPC->vector[2] = f * OPB->vector[2];
-            break;
+            QCVM_NEXT;
         }
-        case INSTR_MUL_VF:
+        QCVM_CASE(INSTR_MUL_VF)
         {
             qcfloat_t f = OPB->_float;
             OPC->vector[0] = f * OPA->vector[0];
             OPC->vector[1] = f * OPA->vector[1];
             OPC->vector[2] = f * OPA->vector[2];
-            break;
+            QCVM_NEXT;
         }
-        case INSTR_DIV_F:
+        QCVM_CASE(INSTR_DIV_F)
             if (OPB->_float != 0.0f)
                 OPC->_float = OPA->_float / OPB->_float;
             else
                 OPC->_float = 0;
-            break;
+            QCVM_NEXT;
 
-        case INSTR_ADD_F:
+        QCVM_CASE(INSTR_ADD_F)
             OPC->_float = OPA->_float + OPB->_float;
-            break;
-        case INSTR_ADD_V:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_ADD_V)
             OPC->vector[0] = OPA->vector[0] + OPB->vector[0];
             OPC->vector[1] = OPA->vector[1] + OPB->vector[1];
             OPC->vector[2] = OPA->vector[2] + OPB->vector[2];
-            break;
-        case INSTR_SUB_F:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_SUB_F)
             OPC->_float = OPA->_float - OPB->_float;
-            break;
-        case INSTR_SUB_V:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_SUB_V)
             OPC->vector[0] = OPA->vector[0] - OPB->vector[0];
             OPC->vector[1] = OPA->vector[1] - OPB->vector[1];
             OPC->vector[2] = OPA->vector[2] - OPB->vector[2];
-            break;
+            QCVM_NEXT;
 
-        case INSTR_EQ_F:
+        QCVM_CASE(INSTR_EQ_F)
             OPC->_float = (OPA->_float == OPB->_float);
-            break;
-        case INSTR_EQ_V:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_EQ_V)
             OPC->_float = ((OPA->vector[0] == OPB->vector[0]) &&
                            (OPA->vector[1] == OPB->vector[1]) &&
                            (OPA->vector[2] == OPB->vector[2]) );
-            break;
-        case INSTR_EQ_S:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_EQ_S)
             OPC->_float = !strcmp(prog_getstring(prog, OPA->string),
                                   prog_getstring(prog, OPB->string));
-            break;
-        case INSTR_EQ_E:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_EQ_E)
             OPC->_float = (OPA->_int == OPB->_int);
-            break;
-        case INSTR_EQ_FNC:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_EQ_FNC)
             OPC->_float = (OPA->function == OPB->function);
-            break;
-        case INSTR_NE_F:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NE_F)
             OPC->_float = (OPA->_float != OPB->_float);
-            break;
-        case INSTR_NE_V:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NE_V)
             OPC->_float = ((OPA->vector[0] != OPB->vector[0]) ||
                            (OPA->vector[1] != OPB->vector[1]) ||
                            (OPA->vector[2] != OPB->vector[2]) );
-            break;
-        case INSTR_NE_S:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NE_S)
             OPC->_float = !!strcmp(prog_getstring(prog, OPA->string),
                                    prog_getstring(prog, OPB->string));
-            break;
-        case INSTR_NE_E:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NE_E)
             OPC->_float = (OPA->_int != OPB->_int);
-            break;
-        case INSTR_NE_FNC:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NE_FNC)
             OPC->_float = (OPA->function != OPB->function);
-            break;
+            QCVM_NEXT;
 
-        case INSTR_LE:
+        QCVM_CASE(INSTR_LE)
             OPC->_float = (OPA->_float <= OPB->_float);
-            break;
-        case INSTR_GE:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_GE)
             OPC->_float = (OPA->_float >= OPB->_float);
-            break;
-        case INSTR_LT:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_LT)
             OPC->_float = (OPA->_float < OPB->_float);
-            break;
-        case INSTR_GT:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_GT)
             OPC->_float = (OPA->_float > OPB->_float);
-            break;
+            QCVM_NEXT;
 
-        case INSTR_LOAD_F:
-        case INSTR_LOAD_S:
-        case INSTR_LOAD_FLD:
-        case INSTR_LOAD_ENT:
-        case INSTR_LOAD_FNC:
+        QCVM_CASE(INSTR_LOAD_F)
+        QCVM_CASE(INSTR_LOAD_S)
+        QCVM_CASE(INSTR_LOAD_FLD)
+        QCVM_CASE(INSTR_LOAD_ENT)
+        QCVM_CASE(INSTR_LOAD_FNC)
             if (OPA->edict < 0 || OPA->edict >= prog->entities) {
                 qcvmerror(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename);
                 goto cleanup;
@@ -1403,10 +6296,9 @@ while (1) {
                           OPB->_int);
                 goto cleanup;
             }
-            ed = prog_getedict(prog, OPA->edict);
-            OPC->_int = ((qcany_t*)( ((qcint_t*)ed) + OPB->_int ))->_int;
-            break;
-        case INSTR_LOAD_V:
+            OPC->_int = *PROG_ENTFIELD(prog, OPA->edict, OPB->_int);
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_LOAD_V)
             if (OPA->edict < 0 || OPA->edict >= prog->entities) {
                 qcvmerror(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename);
                 goto cleanup;
@@ -1418,14 +6310,13 @@ while (1) {
                           OPB->_int + 2);
                 goto cleanup;
             }
-            ed = prog_getedict(prog, OPA->edict);
-            ptr = (qcany_t*)( ((qcint_t*)ed) + OPB->_int );
-            OPC->ivector[0] = ptr->ivector[0];
-            OPC->ivector[1] = ptr->ivector[1];
-            OPC->ivector[2] = ptr->ivector[2];
-            break;
+            fld = PROG_ENTFIELD(prog, OPA->edict, OPB->_int);
+            OPC->ivector[0] = fld[0];
+            OPC->ivector[1] = fld[prog->fieldstride];
+            OPC->ivector[2] = fld[prog->fieldstride * 2];
+            QCVM_NEXT;
 
-        case INSTR_ADDRESS:
+        QCVM_CASE(INSTR_ADDRESS)
             if (OPA->edict < 0 || OPA->edict >= prog->entities) {
                 qcvmerror(prog, "prog `%s` attempted to address an out of bounds entity %i", prog->filename, OPA->edict);
                 goto cleanup;
@@ -1438,161 +6329,340 @@ while (1) {
                 goto cleanup;
             }
 
-            ed = prog_getedict(prog, OPA->edict);
-            OPC->_int = ((qcint_t*)ed) - prog->entitydata + OPB->_int;
-            break;
+            OPC->_int = (OPA->edict << prog->fieldshift) | OPB->_int;
+            QCVM_NEXT;
 
-        case INSTR_STORE_F:
-        case INSTR_STORE_S:
-        case INSTR_STORE_ENT:
-        case INSTR_STORE_FLD:
-        case INSTR_STORE_FNC:
+        QCVM_CASE(INSTR_STORE_S)
+            prog_tempstring_escape(prog, OPA->_int, OPB);
             OPB->_int = OPA->_int;
-            break;
-        case INSTR_STORE_V:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_STORE_F)
+        QCVM_CASE(INSTR_STORE_ENT)
+        QCVM_CASE(INSTR_STORE_FLD)
+        QCVM_CASE(INSTR_STORE_FNC)
+            OPB->_int = OPA->_int;
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_STORE_V)
             OPB->ivector[0] = OPA->ivector[0];
             OPB->ivector[1] = OPA->ivector[1];
             OPB->ivector[2] = OPA->ivector[2];
-            break;
-
-        case INSTR_STOREP_F:
-        case INSTR_STOREP_S:
-        case INSTR_STOREP_ENT:
-        case INSTR_STOREP_FLD:
-        case INSTR_STOREP_FNC:
-            if (OPB->_int < 0 || OPB->_int >= (qcint_t)vec_size(prog->entitydata)) {
+            QCVM_NEXT;
+
+        QCVM_CASE(INSTR_STOREP_S)
+            /* an entity outlives any frame */
+            if (OPA->_int >= (qcint_t)prog->tempstring_start)
+                prog->tempstring_escapes++;
+            e = OPB->_int >> prog->fieldshift;
+            f = OPB->_int & ((1 << prog->fieldshift) - 1);
+            if (OPB->_int < 0 || e >= prog->entities || f >= (qcint_t)prog->entityfields) {
                 qcvmerror(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename, OPB->_int);
                 goto cleanup;
             }
-            if (OPB->_int < (qcint_t)prog->entityfields && !prog->allowworldwrites)
+            if (!e && !prog->allowworldwrites)
                 qcvmerror(prog, "`%s` tried to assign to world.%s (field %i)\n",
                           prog->filename,
-                          prog_getstring(prog, prog_entfield(prog, OPB->_int)->name),
-                          OPB->_int);
-            ptr = (qcany_t*)(prog->entitydata + OPB->_int);
-            ptr->_int = OPA->_int;
-            break;
-        case INSTR_STOREP_V:
-            if (OPB->_int < 0 || OPB->_int + 2 >= (qcint_t)vec_size(prog->entitydata)) {
+                          prog_getstring(prog, prog_entfield(prog, f)->name),
+                          f);
+            PROG_ENTTOUCH(prog, e);
+            *PROG_ENTFIELD(prog, e, f) = OPA->_int;
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_STOREP_F)
+        QCVM_CASE(INSTR_STOREP_ENT)
+        QCVM_CASE(INSTR_STOREP_FLD)
+        QCVM_CASE(INSTR_STOREP_FNC)
+            e = OPB->_int >> prog->fieldshift;
+            f = OPB->_int & ((1 << prog->fieldshift) - 1);
+            if (OPB->_int < 0 || e >= prog->entities || f >= (qcint_t)prog->entityfields) {
                 qcvmerror(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename, OPB->_int);
                 goto cleanup;
             }
-            if (OPB->_int < (qcint_t)prog->entityfields && !prog->allowworldwrites)
+            if (!e && !prog->allowworldwrites)
                 qcvmerror(prog, "`%s` tried to assign to world.%s (field %i)\n",
                           prog->filename,
-                          prog_getstring(prog, prog_entfield(prog, OPB->_int)->name),
-                          OPB->_int);
-            ptr = (qcany_t*)(prog->entitydata + OPB->_int);
-            ptr->ivector[0] = OPA->ivector[0];
-            ptr->ivector[1] = OPA->ivector[1];
-            ptr->ivector[2] = OPA->ivector[2];
-            break;
-
-        case INSTR_NOT_F:
+                          prog_getstring(prog, prog_entfield(prog, f)->name),
+                          f);
+            PROG_ENTTOUCH(prog, e);
+            *PROG_ENTFIELD(prog, e, f) = OPA->_int;
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_STOREP_V)
+            e = OPB->_int >> prog->fieldshift;
+            f = OPB->_int & ((1 << prog->fieldshift) - 1);
+            if (OPB->_int < 0 || e >= prog->entities || f + 3 > (qcint_t)prog->entityfields) {
+                qcvmerror(prog, "`%s` attempted to write to an out of bounds edict (%i)", prog->filename, OPB->_int);
+                goto cleanup;
+            }
+            if (!e && !prog->allowworldwrites)
+                qcvmerror(prog, "`%s` tried to assign to world.%s (field %i)\n",
+                          prog->filename,
+                          prog_getstring(prog, prog_entfield(prog, f)->name),
+                          f);
+            PROG_ENTTOUCH(prog, e);
+            fld = PROG_ENTFIELD(prog, e, f);
+            fld[0]                     = OPA->ivector[0];
+            fld[prog->fieldstride]     = OPA->ivector[1];
+            fld[prog->fieldstride * 2] = OPA->ivector[2];
+            QCVM_NEXT;
+
+        QCVM_CASE(INSTR_NOT_F)
             OPC->_float = !FLOAT_IS_TRUE_FOR_INT(OPA->_int);
-            break;
-        case INSTR_NOT_V:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NOT_V)
             OPC->_float = !OPA->vector[0] &&
                           !OPA->vector[1] &&
                           !OPA->vector[2];
-            break;
-        case INSTR_NOT_S:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NOT_S)
             OPC->_float = !OPA->string ||
                           !*prog_getstring(prog, OPA->string);
-            break;
-        case INSTR_NOT_ENT:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NOT_ENT)
             OPC->_float = (OPA->edict == 0);
-            break;
-        case INSTR_NOT_FNC:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_NOT_FNC)
             OPC->_float = !OPA->function;
-            break;
+            QCVM_NEXT;
 
-        case INSTR_IF:
+        QCVM_CASE(INSTR_IF)
             /* this is consistent with darkplaces' behaviour */
             if(FLOAT_IS_TRUE_FOR_INT(OPA->_int))
             {
-                st += st->o2.s1 - 1;    /* offset the s++ */
-                if (++jumpcount >= maxjumps)
+                QCVM_PAY;
+#if QCVM_PROFILE
+                prog->profile_taken[ip - prog->decoded]++;
+#endif
+                ip = ip->u.jump;
+                if (++jumpcount >= maxjumps) {
                     qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename, jumpcount);
+                    goto cleanup;
+                }
+                QCVM_YIELD;
+                QCVM_DISPATCH;
             }
-            break;
-        case INSTR_IFNOT:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_IFNOT)
             if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
             {
-                st += st->o2.s1 - 1;    /* offset the s++ */
-                if (++jumpcount >= maxjumps)
+                QCVM_PAY;
+#if QCVM_PROFILE
+                prog->profile_taken[ip - prog->decoded]++;
+#endif
+                ip = ip->u.jump;
+                if (++jumpcount >= maxjumps) {
                     qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename, jumpcount);
+                    goto cleanup;
+                }
+                QCVM_YIELD;
+                QCVM_DISPATCH;
             }
-            break;
-
-        case INSTR_CALL0:
-        case INSTR_CALL1:
-        case INSTR_CALL2:
-        case INSTR_CALL3:
-        case INSTR_CALL4:
-        case INSTR_CALL5:
-        case INSTR_CALL6:
-        case INSTR_CALL7:
-        case INSTR_CALL8:
-            prog->argc = st->opcode - INSTR_CALL0;
+            QCVM_NEXT;
+
+        QCVM_CASE(INSTR_CALL0)
+        QCVM_CASE(INSTR_CALL1)
+        QCVM_CASE(INSTR_CALL2)
+        QCVM_CASE(INSTR_CALL3)
+        QCVM_CASE(INSTR_CALL4)
+        QCVM_CASE(INSTR_CALL5)
+        QCVM_CASE(INSTR_CALL6)
+        QCVM_CASE(INSTR_CALL7)
+        QCVM_CASE(INSTR_CALL8)
+            prog->argc = ip->opcode - INSTR_CALL0;
             if (!OPA->function)
                 qcvmerror(prog, "NULL function in `%s`", prog->filename);
 
-            if(!OPA->function || OPA->function >= (qcint_t)vec_size(prog->functions))
+            if(!OPA->function || OPA->function >= (qcint_t)prog->functions_count)
             {
                 qcvmerror(prog, "CALL outside the program in `%s`", prog->filename);
                 goto cleanup;
             }
 
             newf = &prog->functions[OPA->function];
-            newf->profile++;
 
-            prog->statement = (st - prog->code) + 1;
+            prog->statement = (ip - prog->decoded) + 1;
 
             if (newf->entry < 0)
             {
                 /* negative statements are built in functions */
                 qcint_t builtinnumber = -newf->entry;
+#if QCVM_PROFILE
+                prog->profile_clock = prog_profile_clock();
+                prog_profile_enter(prog, OPA->function);
+#endif
                 if (builtinnumber < (qcint_t)prog->builtins_count && prog->builtins[builtinnumber])
                     prog->builtins[builtinnumber](prog);
                 else
                     qcvmerror(prog, "No such builtin #%i in %s! Try updating your gmqcc sources",
                               builtinnumber, prog->filename);
+#if QCVM_PROFILE
+                prog->profile_clock = prog_profile_clock();
+                prog_profile_leave(prog);
+#endif
+            }
+            else if (prog->natives && prog->natives[OPA->function])
+                prog_native_run(prog, newf, prog->natives[OPA->function]);
+            else {
+                QCVM_PAY;
+                ip = prog->decoded + prog_enterfunction(prog, newf);
+                QCVM_YIELD;
+                QCVM_DISPATCH;
             }
-            else
-                st = prog->code + prog_enterfunction(prog, newf) - 1; /* offset st++ */
             if (prog->vmerror)
                 goto cleanup;
-            break;
+            QCVM_NEXT;
 
-        case INSTR_STATE:
+        QCVM_CASE(INSTR_STATE)
             qcvmerror(prog, "`%s` tried to execute a STATE operation", prog->filename);
-            break;
+            QCVM_NEXT;
 
-        case INSTR_GOTO:
-            st += st->o1.s1 - 1;    /* offset the s++ */
-            if (++jumpcount == 10000000)
+        QCVM_CASE(INSTR_GOTO)
+            QCVM_PAY;
+            ip = ip->u.jump;
+            if (++jumpcount >= maxjumps) {
                 qcvmerror(prog, "`%s` hit the runaway loop counter limit of %li jumps", prog->filename, jumpcount);
-            break;
+                goto cleanup;
+            }
+            QCVM_YIELD;
+            QCVM_DISPATCH;
 
-        case INSTR_AND:
+        QCVM_CASE(INSTR_AND)
             OPC->_float = FLOAT_IS_TRUE_FOR_INT(OPA->_int) &&
                           FLOAT_IS_TRUE_FOR_INT(OPB->_int);
-            break;
-        case INSTR_OR:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_OR)
             OPC->_float = FLOAT_IS_TRUE_FOR_INT(OPA->_int) ||
                           FLOAT_IS_TRUE_FOR_INT(OPB->_int);
-            break;
+            QCVM_NEXT;
 
-        case INSTR_BITAND:
+        QCVM_CASE(INSTR_BITAND)
             OPC->_float = ((int)OPA->_float) & ((int)OPB->_float);
-            break;
-        case INSTR_BITOR:
+            QCVM_NEXT;
+        QCVM_CASE(INSTR_BITOR)
             OPC->_float = ((int)OPA->_float) | ((int)OPB->_float);
-            break;
+            QCVM_NEXT;
+
+        /*
+         * Superinstructions: the first statement is executed here, the
+         * second one is continued with right away without dispatching.
+         */
+        QCVM_CASE(QCVM_OP_LOAD_F_STORE_F)
+            if (OPA->edict < 0 || OPA->edict >= prog->entities) {
+                qcvmerror(prog, "progs `%s` attempted to read an out of bounds entity", prog->filename);
+                goto cleanup;
+            }
+            if ((unsigned int)(OPB->_int) >= (unsigned int)(prog->entityfields)) {
+                qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
+                          prog->filename,
+                          OPB->_int);
+                goto cleanup;
+            }
+            OPC->_int = *PROG_ENTFIELD(prog, OPA->edict, OPB->_int);
+            QCVM_FUSE(INSTR_STORE_F);
+
+        QCVM_CASE(QCVM_OP_ADDRESS_STOREP_F)
+            if (OPA->edict < 0 || OPA->edict >= prog->entities) {
+                qcvmerror(prog, "prog `%s` attempted to address an out of bounds entity %i", prog->filename, OPA->edict);
+                goto cleanup;
+            }
+            if ((unsigned int)(OPB->_int) >= (unsigned int)(prog->entityfields))
+            {
+                qcvmerror(prog, "prog `%s` attempted to read an invalid field from entity (%i)",
+                          prog->filename,
+                          OPB->_int);
+                goto cleanup;
+            }
+            OPC->_int = (OPA->edict << prog->fieldshift) | OPB->_int;
+            QCVM_FUSE(INSTR_STOREP_F);
+
+        QCVM_CASE(QCVM_OP_MUL_F_ADD_F)
+            OPC->_float = OPA->_float * OPB->_float;
+            QCVM_FUSE(INSTR_ADD_F);
+
+        QCVM_CASE(QCVM_OP_EQ_F_IFNOT)
+            OPC->_float = (OPA->_float == OPB->_float);
+            QCVM_FUSE(INSTR_IFNOT);
+        QCVM_CASE(QCVM_OP_NE_F_IFNOT)
+            OPC->_float = (OPA->_float != OPB->_float);
+            QCVM_FUSE(INSTR_IFNOT);
+        QCVM_CASE(QCVM_OP_LE_IFNOT)
+            OPC->_float = (OPA->_float <= OPB->_float);
+            QCVM_FUSE(INSTR_IFNOT);
+        QCVM_CASE(QCVM_OP_GE_IFNOT)
+            OPC->_float = (OPA->_float >= OPB->_float);
+            QCVM_FUSE(INSTR_IFNOT);
+        QCVM_CASE(QCVM_OP_LT_IFNOT)
+            OPC->_float = (OPA->_float < OPB->_float);
+            QCVM_FUSE(INSTR_IFNOT);
+        QCVM_CASE(QCVM_OP_GT_IFNOT)
+            OPC->_float = (OPA->_float > OPB->_float);
+            QCVM_FUSE(INSTR_IFNOT);
+
+        QCVM_CASE(QCVM_OP_CALL_INTRINSIC)
+            if (OPA->function != ip->function) {
+                QCVM_GENERIC;
+            }
+            ip->u.intrinsic(GLOBAL(OFS_RETURN), GLOBAL(OFS_PARM0), GLOBAL(OFS_PARM1));
+            QCVM_NEXT;
+
+        QCVM_CASE(QCVM_OP_CALL_VERIFIED)
+            if (OPA->function != ip->function) {
+                QCVM_GENERIC;
+            }
+            prog->argc      = ip->opcode - INSTR_CALL0;
+            prog->statement = (ip - prog->decoded) + 1;
+            if (prog->natives && prog->natives[OPA->function]) {
+                prog_native_run(prog, prog->functions + OPA->function, prog->natives[OPA->function]);
+                if (prog->vmerror)
+                    goto cleanup;
+                QCVM_NEXT;
+            }
+            QCVM_PAY;
+            ip = prog->decoded + prog_enterfunction(prog, prog->functions + OPA->function);
+            QCVM_YIELD;
+            QCVM_DISPATCH;
+
+#if QCVM_SSE2
+        QCVM_CASE(QCVM_OP_MUL_V_SIMD)
+            OPC->_float = qcvm_vec_dot(OPA, OPB);
+            QCVM_NEXT;
+        QCVM_CASE(QCVM_OP_MUL_FV_SIMD)
+            qcvm_vec_store(OPC, _mm_mul_ps(_mm_set1_ps(OPA->_float), qcvm_vec_load(OPB)));
+            QCVM_NEXT;
+        QCVM_CASE(QCVM_OP_MUL_VF_SIMD)
+            qcvm_vec_store(OPC, _mm_mul_ps(_mm_set1_ps(OPB->_float), qcvm_vec_load(OPA)));
+            QCVM_NEXT;
+        QCVM_CASE(QCVM_OP_ADD_V_SIMD)
+            qcvm_vec_store(OPC, _mm_add_ps(qcvm_vec_load(OPA), qcvm_vec_load(OPB)));
+            QCVM_NEXT;
+        QCVM_CASE(QCVM_OP_SUB_V_SIMD)
+            qcvm_vec_store(OPC, _mm_sub_ps(qcvm_vec_load(OPA), qcvm_vec_load(OPB)));
+            QCVM_NEXT;
+        QCVM_CASE(QCVM_OP_EQ_V_SIMD)
+            OPC->_float = ((_mm_movemask_ps(_mm_cmpeq_ps(qcvm_vec_load(OPA), qcvm_vec_load(OPB))) & 7) == 7);
+            QCVM_NEXT;
+        QCVM_CASE(QCVM_OP_NE_V_SIMD)
+            OPC->_float = ((_mm_movemask_ps(_mm_cmpneq_ps(qcvm_vec_load(OPA), qcvm_vec_load(OPB))) & 7) != 0);
+            QCVM_NEXT;
+        QCVM_CASE(QCVM_OP_NOT_V_SIMD)
+            OPC->_float = ((_mm_movemask_ps(_mm_cmpeq_ps(qcvm_vec_load(OPA), _mm_setzero_ps())) & 7) == 7);
+            QCVM_NEXT;
+        QCVM_CASE(QCVM_OP_STORE_V_SIMD)
+            qcvm_vec_store(OPB, qcvm_vec_load(OPA));
+            QCVM_NEXT;
+#endif
     }
 }
 
+#undef QCVM_CASE
+#undef QCVM_ILLEGAL
+#undef QCVM_NEXT
+#undef QCVM_DISPATCH
+#undef QCVM_COUNT
+#undef QCVM_TAKE_SAMPLE
+#undef QCVM_FUSE
+#undef QCVM_GENERIC
+#undef QCVM_PAY
+#undef QCVM_YIELD
+#undef QCVM_THREADED_LOOP
 #undef QCVM_PROFILE
 #undef QCVM_TRACE
+#undef QCVM_SAMPLE
 #endif /* !QCVM_LOOP */
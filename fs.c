@@ -171,6 +171,77 @@ long int fs_file_tell(FILE *fp) {
     return ftell(fp);
 }
 
+/*
+ * Maps a whole file read-only into memory, so that processes mapping
+ * the same file share its pages. Returns NULL when the file can't be
+ * mapped, in which case it has to be read instead.
+ */
+#if defined(_WIN32)
+#   if defined(__MINGW32__)
+#       include <windows.h>
+#   endif
+    void *fs_file_map(const char *filename, size_t *size) {
+        HANDLE         file;
+        HANDLE         mapping;
+        LARGE_INTEGER  length;
+        void          *data = NULL;
+
+        file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return NULL;
+
+        if (!GetFileSizeEx(file, &length) || !length.QuadPart || length.QuadPart != (LONGLONG)(size_t)length.QuadPart) {
+            CloseHandle(file);
+            return NULL;
+        }
+
+        if ((mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL))) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+
+        *size = (size_t)length.QuadPart;
+        return data;
+    }
+
+    void fs_file_unmap(void *data, size_t size) {
+        (void)size;
+        UnmapViewOfFile(data);
+    }
+#else
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <sys/mman.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+    void *fs_file_map(const char *filename, size_t *size) {
+        struct stat  info;
+        void        *data;
+        int          fd;
+
+        if ((fd = open(filename, O_RDONLY)) == -1)
+            return NULL;
+
+        if (fstat(fd, &info) == -1 || !info.st_size || info.st_size != (off_t)(size_t)info.st_size) {
+            close(fd);
+            return NULL;
+        }
+
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            return NULL;
+
+        *size = (size_t)info.st_size;
+        return data;
+    }
+
+    void fs_file_unmap(void *data, size_t size) {
+        munmap(data, size);
+    }
+#endif
+
 /*
  * Implements libc getline for systems that don't have it, which is
  * assmed all.  This works the same as getline().
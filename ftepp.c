@@ -60,6 +60,11 @@ typedef struct {
     pptoken **output;
 } ppmacro;
 
+typedef struct {
+    char     *name;
+    uint64_t  digest; /* of the macro the file found, 0 when undefined */
+} ppdepend;
+
 typedef struct ftepp_s {
     lex_file    *lex;
     int          token;
@@ -74,6 +79,17 @@ typedef struct ftepp_s {
     char        *itemname;
     char        *includename;
     bool         in_macro;
+
+    /* what the current file depends on and changes once tracking,
+     * see ftepp_track */
+    ht           lookups;    /* hashtable<string, ftepp_t*> */
+    ppdepend    *depends;
+    ht           changed;    /* hashtable<string, ftepp_t*> */
+    char       **changes;
+    char       **includes;
+    char       **misses;     /* include paths tried before the one found */
+    bool         speculate;
+    bool         dependent;
 } ftepp_t;
 
 /*
@@ -327,6 +343,33 @@ static void ppmacro_delete(ppmacro *self)
     mem_d(self);
 }
 
+static uint64_t ppmacro_digest(const ppmacro *macro)
+{
+    uint64_t digest = UTIL_FNV64_INIT;
+    char     flags[2];
+    size_t   i;
+
+    if (!macro)
+        return 0;
+    flags[0] = macro->has_params;
+    flags[1] = macro->variadic;
+    digest = util_fnv64(digest, flags, sizeof(flags));
+    for (i = 0; i < vec_size(macro->params); ++i)
+        digest = util_fnv64(digest, macro->params[i], strlen(macro->params[i]) + 1);
+    for (i = 0; i < vec_size(macro->output); ++i) {
+        /* the token by its bytes in order, the same on every machine */
+        uint32_t      token = (uint32_t)macro->output[i]->token;
+        unsigned char bytes[4];
+        bytes[0] = (unsigned char)token;
+        bytes[1] = (unsigned char)(token >> 8);
+        bytes[2] = (unsigned char)(token >> 16);
+        bytes[3] = (unsigned char)(token >> 24);
+        digest = util_fnv64(digest, bytes, sizeof(bytes));
+        digest = util_fnv64(digest, macro->output[i]->value, strlen(macro->output[i]->value) + 1);
+    }
+    return digest ? digest : 1;
+}
+
 static ftepp_t* ftepp_new(void)
 {
     ftepp_t *ftepp;
@@ -345,6 +388,30 @@ static GMQCC_INLINE void ftepp_flush_do(ftepp_t *self)
     vec_free(self->output_string);
 }
 
+static void ftepp_untrack(ftepp_t *self)
+{
+    size_t i;
+    if (self->lookups)
+        util_htdel(self->lookups);
+    if (self->changed)
+        util_htdel(self->changed);
+    for (i = 0; i < vec_size(self->depends); ++i)
+        mem_d(self->depends[i].name);
+    vec_free(self->depends);
+    for (i = 0; i < vec_size(self->changes); ++i)
+        mem_d(self->changes[i]);
+    vec_free(self->changes);
+    for (i = 0; i < vec_size(self->includes); ++i)
+        mem_d(self->includes[i]);
+    vec_free(self->includes);
+    for (i = 0; i < vec_size(self->misses); ++i)
+        mem_d(self->misses[i]);
+    vec_free(self->misses);
+    self->lookups   = NULL;
+    self->changed   = NULL;
+    self->dependent = false;
+}
+
 static void ftepp_delete(ftepp_t *self)
 {
     ftepp_flush_do(self);
@@ -353,6 +420,8 @@ static void ftepp_delete(ftepp_t *self)
     if (self->includename)
         vec_free(self->includename);
 
+    ftepp_untrack(self);
+
     util_htrem(self->macros, (void (*)(void*))&ppmacro_delete);
 
     vec_free(self->conditions);
@@ -381,13 +450,37 @@ static GMQCC_INLINE void ftepp_update_output_condition(ftepp_t *ftepp)
         ftepp->output_on = ftepp->output_on && ftepp->conditions[i].on;
 }
 
+static void ftepp_macro_changed(ftepp_t *ftepp, const char *name)
+{
+    if (!ftepp->changed || util_htget(ftepp->changed, name))
+        return;
+    util_htset(ftepp->changed, name, ftepp);
+    vec_push(ftepp->changes, util_strdup(name));
+}
+
 static GMQCC_INLINE ppmacro* ftepp_macro_find(ftepp_t *ftepp, const char *name)
 {
-    return (ppmacro*)util_htget(ftepp->macros, name);
+    ppmacro *macro = (ppmacro*)util_htget(ftepp->macros, name);
+    /* only the definition from before the file counts */
+    if (ftepp->lookups && !util_htget(ftepp->lookups, name) && !util_htget(ftepp->changed, name)) {
+        ppdepend depend;
+        depend.name   = util_strdup(name);
+        depend.digest = ppmacro_digest(macro);
+        vec_push(ftepp->depends, depend);
+        util_htset(ftepp->lookups, name, ftepp);
+    }
+    return macro;
+}
+
+static GMQCC_INLINE void ftepp_macro_add(ftepp_t *ftepp, ppmacro *macro)
+{
+    ftepp_macro_changed(ftepp, macro->name);
+    util_htset(ftepp->macros, macro->name, (void*)macro);
 }
 
 static GMQCC_INLINE void ftepp_macro_delete(ftepp_t *ftepp, const char *name)
 {
+    ftepp_macro_changed(ftepp, name);
     util_htrm(ftepp->macros, name, (void (*)(void*))&ppmacro_delete);
 }
 
@@ -579,7 +672,7 @@ static bool ftepp_define(ftepp_t *ftepp)
     }
 
     if (ftepp->output_on)
-        util_htset(ftepp->macros, macro->name, (void*)macro);
+        ftepp_macro_add(ftepp, macro);
     else {
         ppmacro_delete(macro);
     }
@@ -1301,7 +1394,7 @@ static void unescape(const char *str, char *out) {
     *out = 0;
 }
 
-static char *ftepp_include_find_path(const char *file, const char *pathfile)
+static char *ftepp_include_find_path(ftepp_t *ftepp, const char *file, const char *pathfile)
 {
     FILE       *fp;
     char       *filename = NULL;
@@ -1328,6 +1421,9 @@ static char *ftepp_include_find_path(const char *file, const char *pathfile)
         fs_file_close(fp);
         return filename;
     }
+    /* the file would be found there once it exists */
+    if (ftepp->changed)
+        vec_push(ftepp->misses, util_strdup(filename));
     vec_free(filename);
     return NULL;
 }
@@ -1336,9 +1432,9 @@ static char *ftepp_include_find(ftepp_t *ftepp, const char *file)
 {
     char *filename = NULL;
 
-    filename = ftepp_include_find_path(file, ftepp->includename);
+    filename = ftepp_include_find_path(ftepp, file, ftepp->includename);
     if (!filename)
-        filename = ftepp_include_find_path(file, ftepp->itemname);
+        filename = ftepp_include_find_path(ftepp, file, ftepp->itemname);
     return filename;
 }
 
@@ -1476,6 +1572,8 @@ static bool ftepp_include(ftepp_t *ftepp)
         vec_free(filename);
         return false;
     }
+    if (ftepp->changed)
+        vec_push(ftepp->includes, util_strdup(filename));
     ftepp->lex = inlex;
     old_includename = ftepp->includename;
     ftepp->includename = filename;
@@ -1700,6 +1798,16 @@ static bool ftepp_preprocess(ftepp_t *ftepp)
                 /* is it a predef? */
                 if (OPTS_FLAG(FTEPP_PREDEFS)) {
                     char *(*predef)(lex_file*) = ftepp_predef(ftepp_tokval(ftepp));
+                    if (predef && ftepp->changed &&
+                        predef != &ftepp_predef_line && predef != &ftepp_predef_file)
+                    {
+                        /* the others keep state or aren't thread safe */
+                        ftepp->dependent = true;
+                        if (ftepp->speculate) {
+                            ftepp_next(ftepp);
+                            break;
+                        }
+                    }
                     if (predef) {
                         expand = predef(ftepp->lex);
                         ftepp_out (ftepp, expand, false);
@@ -1785,6 +1893,8 @@ static bool ftepp_preprocess_done(ftepp_t *ftepp)
 
 bool ftepp_preprocess_file(ftepp_t *ftepp, const char *filename)
 {
+    if (ftepp->changed)
+        ftepp_track(ftepp, ftepp->speculate);
     ftepp->lex = lex_open(filename);
     ftepp->itemname = util_strdup(filename);
     if (!ftepp->lex) {
@@ -1896,6 +2006,409 @@ void ftepp_add_define(ftepp_t *ftepp, const char *source, const char *name)
     util_htset(ftepp->macros, name, macro);
 }
 
+/*
+ * Preprocessing a file gives the same result again as long as the macros
+ * it looks at are defined the same way. Once tracking, every file
+ * preprocessed records those along with the macros it changes, and
+ * ftepp_adopt takes the result of item over into ftepp when that holds.
+ * Files are preprocessed ahead on other threads by preprocessors with
+ * speculate set, starting from the same predefined macros as the one
+ * used for all files, and results are kept in the compile cache with
+ * ftepp_save and ftepp_load.
+ */
+void ftepp_track(ftepp_t *ftepp, bool speculate)
+{
+    ftepp_untrack(ftepp);
+    ftepp->lookups   = util_htnew(HT_MACROS);
+    ftepp->changed   = util_htnew(HT_MACROS);
+    ftepp->speculate = speculate;
+}
+
+bool ftepp_adopt(ftepp_t *ftepp, ftepp_t *item)
+{
+    size_t i;
+
+    if (item->dependent || item->errors || vec_size(item->conditions) || vec_size(ftepp->conditions))
+        return false;
+    for (i = 0; i < vec_size(item->depends); ++i) {
+        if (ppmacro_digest((ppmacro*)util_htget(ftepp->macros, item->depends[i].name)) != item->depends[i].digest)
+            return false;
+    }
+
+    for (i = 0; i < vec_size(item->changes); ++i) {
+        const char *name  = item->changes[i];
+        ppmacro    *macro = (ppmacro*)util_htget(item->macros, name);
+
+        ftepp_macro_delete(ftepp, name);
+        if (macro) {
+            util_htrm(item->macros, name, NULL);
+            util_htset(ftepp->macros, name, macro);
+        }
+    }
+    return true;
+}
+
+/*
+ * Compile cache entries: the output, the macros depended on by digest,
+ * the macros changed as ftepp defines them after the file, the files
+ * included by digest of their contents and the paths an include was
+ * looked for in vain. Numbers are little endian on every machine, so a
+ * cache can be shared.
+ */
+#define FTEPP_CACHE_MAGIC   0x43505147 /* GQPC */
+#define FTEPP_CACHE_VERSION 2
+
+static void ftepp_save_u32(FILE *file, uint32_t value)
+{
+    unsigned char bytes[4];
+    bytes[0] = (unsigned char)value;
+    bytes[1] = (unsigned char)(value >> 8);
+    bytes[2] = (unsigned char)(value >> 16);
+    bytes[3] = (unsigned char)(value >> 24);
+    fs_file_write(bytes, 1, sizeof(bytes), file);
+}
+
+static void ftepp_save_u64(FILE *file, uint64_t value)
+{
+    ftepp_save_u32(file, (uint32_t)value);
+    ftepp_save_u32(file, (uint32_t)(value >> 32));
+}
+
+/* the constant of a token, by the member its type uses */
+static void ftepp_save_const(FILE *file, const pptoken *token)
+{
+    uint32_t words[3] = { 0, 0, 0 };
+    uint64_t bits;
+
+    switch (token->token) {
+        case TOKEN_INTCONST:
+        case TOKEN_CHARCONST:
+        case TOKEN_VA_ARGS_ARRAY:
+            words[0] = (uint32_t)token->constval.i;
+            break;
+        case TOKEN_TYPENAME:
+            words[0] = (uint32_t)token->constval.t;
+            break;
+        case TOKEN_FLOATCONST:
+            memcpy(&bits, &token->constval.f, sizeof(bits));
+            words[0] = (uint32_t)bits;
+            words[1] = (uint32_t)(bits >> 32);
+            break;
+        case TOKEN_VECTORCONST:
+            memcpy(&words[0], &token->constval.v.x, sizeof(words[0]));
+            memcpy(&words[1], &token->constval.v.y, sizeof(words[1]));
+            memcpy(&words[2], &token->constval.v.z, sizeof(words[2]));
+            break;
+    }
+    ftepp_save_u32(file, words[0]);
+    ftepp_save_u32(file, words[1]);
+    ftepp_save_u32(file, words[2]);
+}
+
+static void ftepp_save_str(FILE *file, const char *str, size_t len)
+{
+    ftepp_save_u32(file, (uint32_t)len);
+    fs_file_write(str, 1, len, file);
+}
+
+static void ftepp_save_macro(FILE *file, const ppmacro *macro)
+{
+    size_t i;
+    ftepp_save_u32(file, (macro->has_params ? 1 : 0) | (macro->variadic ? 2 : 0));
+    ftepp_save_u32(file, vec_size(macro->params));
+    for (i = 0; i < vec_size(macro->params); ++i)
+        ftepp_save_str(file, macro->params[i], strlen(macro->params[i]));
+    ftepp_save_u32(file, vec_size(macro->output));
+    for (i = 0; i < vec_size(macro->output); ++i) {
+        ftepp_save_u32(file, (uint32_t)macro->output[i]->token);
+        ftepp_save_str(file, macro->output[i]->value, strlen(macro->output[i]->value));
+        ftepp_save_const(file, macro->output[i]);
+    }
+}
+
+bool ftepp_save(ftepp_t *ftepp, ftepp_t *item, const char *filename)
+{
+    FILE   *file;
+    char   *temp = NULL;
+    size_t  i;
+    bool    written;
+
+    if (item->dependent || item->errors || !item->changed || vec_size(item->conditions))
+        return false;
+
+    /* concurrent compiles only ever see a whole entry */
+    util_asprintf(&temp, "%s.tmp", filename);
+    if (!(file = fs_file_open(temp, "wb"))) {
+        mem_d(temp);
+        return false;
+    }
+
+    ftepp_save_u32(file, FTEPP_CACHE_MAGIC);
+    ftepp_save_u32(file, FTEPP_CACHE_VERSION);
+    ftepp_save_str(file, item->output_string, vec_size(item->output_string));
+
+    ftepp_save_u32(file, vec_size(item->depends));
+    for (i = 0; i < vec_size(item->depends); ++i) {
+        ftepp_save_str(file, item->depends[i].name, strlen(item->depends[i].name));
+        ftepp_save_u64(file, item->depends[i].digest);
+    }
+
+    ftepp_save_u32(file, vec_size(item->changes));
+    for (i = 0; i < vec_size(item->changes); ++i) {
+        ppmacro *macro = (ppmacro*)util_htget(ftepp->macros, item->changes[i]);
+        ftepp_save_str(file, item->changes[i], strlen(item->changes[i]));
+        ftepp_save_u32(file, !!macro);
+        if (macro)
+            ftepp_save_macro(file, macro);
+    }
+
+    ftepp_save_u32(file, vec_size(item->includes));
+    for (i = 0; i < vec_size(item->includes); ++i) {
+        uint64_t digest = UTIL_FNV64_INIT;
+        if (!util_fnv64_file(&digest, item->includes[i]))
+            break;
+        ftepp_save_str(file, item->includes[i], strlen(item->includes[i]));
+        ftepp_save_u64(file, digest);
+    }
+    written = (i == vec_size(item->includes));
+
+    ftepp_save_u32(file, vec_size(item->misses));
+    for (i = 0; i < vec_size(item->misses); ++i) {
+        /* one appearing meanwhile wasn't seen by the output */
+        FILE *missing = fs_file_open(item->misses[i], "rb");
+        if (missing) {
+            fs_file_close(missing);
+            written = false;
+            break;
+        }
+        ftepp_save_str(file, item->misses[i], strlen(item->misses[i]));
+    }
+    ftepp_save_u32(file, FTEPP_CACHE_MAGIC);
+
+    written = (written && !fs_file_error(file));
+    fs_file_close(file);
+    /* rename doesn't replace files everywhere */
+    if (written && rename(temp, filename))
+        written = !remove(filename) && !rename(temp, filename);
+    if (!written) {
+        remove(temp);
+        written = false;
+    }
+    mem_d(temp);
+    return written;
+}
+
+static bool ftepp_load_u32(FILE *file, uint32_t *value)
+{
+    unsigned char bytes[4];
+    if (fs_file_read(bytes, 1, sizeof(bytes), file) != sizeof(bytes))
+        return false;
+    *value = (uint32_t)bytes[0]         | ((uint32_t)bytes[1] << 8) |
+             ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return true;
+}
+
+static bool ftepp_load_u64(FILE *file, uint64_t *value)
+{
+    uint32_t low, high;
+    if (!ftepp_load_u32(file, &low) || !ftepp_load_u32(file, &high))
+        return false;
+    *value = (uint64_t)low | ((uint64_t)high << 32);
+    return true;
+}
+
+static bool ftepp_load_const(FILE *file, pptoken *token)
+{
+    uint32_t words[3];
+    uint64_t bits;
+
+    if (!ftepp_load_u32(file, &words[0]) ||
+        !ftepp_load_u32(file, &words[1]) ||
+        !ftepp_load_u32(file, &words[2]))
+    {
+        return false;
+    }
+
+    memset(&token->constval, 0, sizeof(token->constval));
+    switch (token->token) {
+        case TOKEN_INTCONST:
+        case TOKEN_CHARCONST:
+        case TOKEN_VA_ARGS_ARRAY:
+            token->constval.i = (int)words[0];
+            break;
+        case TOKEN_TYPENAME:
+            token->constval.t = (int)words[0];
+            break;
+        case TOKEN_FLOATCONST:
+            bits = (uint64_t)words[0] | ((uint64_t)words[1] << 32);
+            memcpy(&token->constval.f, &bits, sizeof(bits));
+            break;
+        case TOKEN_VECTORCONST:
+            memcpy(&token->constval.v.x, &words[0], sizeof(words[0]));
+            memcpy(&token->constval.v.y, &words[1], sizeof(words[1]));
+            memcpy(&token->constval.v.z, &words[2], sizeof(words[2]));
+            break;
+    }
+    return true;
+}
+
+static char *ftepp_load_str(FILE *file)
+{
+    uint32_t  len;
+    char     *str;
+
+    if (!ftepp_load_u32(file, &len) || len > (1 << 28))
+        return NULL;
+    str = (char*)mem_a(len + 1);
+    if (fs_file_read(str, 1, len, file) != len) {
+        mem_d(str);
+        return NULL;
+    }
+    str[len] = 0;
+    return str;
+}
+
+static ppmacro *ftepp_load_macro(FILE *file, const char *name)
+{
+    lex_ctx_t ctx = { "__cache__", 0, 0 };
+    ppmacro  *macro = ppmacro_new(ctx, name);
+    uint32_t  flags;
+    uint32_t  count;
+    uint32_t  i;
+
+    if (!ftepp_load_u32(file, &flags))
+        goto fail;
+    macro->has_params = !!(flags & 1);
+    macro->variadic   = !!(flags & 2);
+
+    if (!ftepp_load_u32(file, &count))
+        goto fail;
+    for (i = 0; i < count; ++i) {
+        char *param = ftepp_load_str(file);
+        if (!param)
+            goto fail;
+        vec_push(macro->params, param);
+    }
+
+    if (!ftepp_load_u32(file, &count))
+        goto fail;
+    for (i = 0; i < count; ++i) {
+        pptoken *token = (pptoken*)mem_a(sizeof(pptoken));
+        uint32_t type;
+        if (!ftepp_load_u32(file, &type) || !(token->value = ftepp_load_str(file))) {
+            mem_d(token);
+            goto fail;
+        }
+        token->token = (int)type;
+        vec_push(macro->output, token);
+        if (!ftepp_load_const(file, token))
+            goto fail;
+    }
+    return macro;
+
+fail:
+    ppmacro_delete(macro);
+    return NULL;
+}
+
+/*
+ * Loads a cache entry as a preprocessor holding the output and the
+ * changed macros, to be taken over with ftepp_adopt. Returns NULL when
+ * there is none, when an included file changed, or when a file now exists
+ * where an include was looked for first.
+ */
+ftepp_t *ftepp_load(const char *filename)
+{
+    ftepp_t  *item;
+    FILE     *file;
+    uint32_t  value;
+    uint32_t  count;
+    uint32_t  i;
+    char     *str;
+
+    if (!(file = fs_file_open(filename, "rb")))
+        return NULL;
+
+    item = ftepp_new();
+    ftepp_track(item, false);
+
+    if (!ftepp_load_u32(file, &value) || value != FTEPP_CACHE_MAGIC ||
+        !ftepp_load_u32(file, &value) || value != FTEPP_CACHE_VERSION ||
+        !(str = ftepp_load_str(file)))
+    {
+        goto fail;
+    }
+    ftepp_out(item, str, true);
+    mem_d(str);
+    vec_push(item->output_string, 0);
+    vec_shrinkby(item->output_string, 1);
+
+    if (!ftepp_load_u32(file, &count))
+        goto fail;
+    for (i = 0; i < count; ++i) {
+        ppdepend depend;
+        if (!(depend.name = ftepp_load_str(file)))
+            goto fail;
+        vec_push(item->depends, depend);
+        if (!ftepp_load_u64(file, &vec_last(item->depends).digest))
+            goto fail;
+    }
+
+    if (!ftepp_load_u32(file, &count))
+        goto fail;
+    for (i = 0; i < count; ++i) {
+        if (!(str = ftepp_load_str(file)))
+            goto fail;
+        vec_push(item->changes, str);
+        if (!ftepp_load_u32(file, &value))
+            goto fail;
+        if (value) {
+            ppmacro *macro = ftepp_load_macro(file, str);
+            if (!macro)
+                goto fail;
+            util_htset(item->macros, str, macro);
+        }
+    }
+
+    if (!ftepp_load_u32(file, &count))
+        goto fail;
+    for (i = 0; i < count; ++i) {
+        uint64_t digest  = UTIL_FNV64_INIT;
+        uint64_t current = UTIL_FNV64_INIT;
+        bool     same;
+        if (!(str = ftepp_load_str(file)))
+            goto fail;
+        same = ftepp_load_u64(file, &digest) && util_fnv64_file(&current, str) && digest == current;
+        mem_d(str);
+        if (!same)
+            goto fail;
+    }
+
+    if (!ftepp_load_u32(file, &count))
+        goto fail;
+    for (i = 0; i < count; ++i) {
+        FILE *found;
+        if (!(str = ftepp_load_str(file)))
+            goto fail;
+        found = fs_file_open(str, "rb");
+        mem_d(str);
+        if (found) {
+            fs_file_close(found);
+            goto fail;
+        }
+    }
+    if (!ftepp_load_u32(file, &value) || value != FTEPP_CACHE_MAGIC)
+        goto fail;
+
+    fs_file_close(file);
+    return item;
+
+fail:
+    fs_file_close(file);
+    ftepp_delete(item);
+    return NULL;
+}
+
 const char *ftepp_get(ftepp_t *ftepp)
 {
     return ftepp->output_string;
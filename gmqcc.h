@@ -107,6 +107,19 @@ GMQCC_IND_STRING(GMQCC_VERSION_PATCH) \
 #   define GMQCC_USED
 #endif /*! defined(__GNUC__) || defined (__CLANG__) */
 
+/*
+ * Variables every thread gets its own copy of. Without compiler support
+ * GMQCC_NO_THREAD_LOCAL is defined and the compiler stays on one thread.
+ */
+#if defined(__GNUC__) || defined(__CLANG__)
+#   define GMQCC_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#   define GMQCC_THREAD_LOCAL __declspec(thread)
+#else
+#   define GMQCC_THREAD_LOCAL
+#   define GMQCC_NO_THREAD_LOCAL
+#endif
+
 /*
  * Inline is not supported in < C90, however some compilers
  * like gcc and clang might have an inline attribute we can
@@ -341,6 +354,10 @@ size_t util_optimizationtostr(const char *, char *, size_t);
 
 uint16_t util_crc16(uint16_t crc, const char *data, size_t len);
 
+#define UTIL_FNV64_INIT ((((uint64_t)0xCBF29CE4) << 32) | 0x84222325)
+uint64_t util_fnv64     (uint64_t hash, const void *data, size_t len);
+bool     util_fnv64_file(uint64_t *hash, const char *filename);
+
 void     util_seed(uint32_t);
 uint32_t util_rand(void);
 
@@ -357,6 +374,31 @@ char       *util_strcat   (char *dest, const char *src);
 char       *util_strncpy  (char *dest, const char *src, size_t num);
 const char *util_strerror (int num);
 
+/*
+ * Threads and mutexes. These are used to run several programs at once
+ * in the executor and to finalize functions in parallel in the compiler;
+ * the allocator in stat.c takes the lock on every allocation so it's
+ * safe to use from any thread. Mutexes are static, initialized with
+ * UTIL_MUTEX_INIT.
+ */
+#ifdef _WIN32
+#   include <windows.h>
+    typedef SRWLOCK util_mutex_t;
+    typedef HANDLE  util_thread_t;
+#   define UTIL_MUTEX_INIT SRWLOCK_INIT
+#else
+#   include <pthread.h>
+    typedef pthread_mutex_t util_mutex_t;
+    typedef pthread_t       util_thread_t;
+#   define UTIL_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+void   util_mutex_lock   (util_mutex_t *);
+void   util_mutex_unlock (util_mutex_t *);
+bool   util_thread_create(util_thread_t *, void (*function)(void *), void *data);
+void   util_thread_join  (util_thread_t);
+size_t util_cpu_count    (void);
+
 /*
  * A flexible vector implementation: all vector pointers contain some
  * data about themselfs exactly - sizeof(vector_t) behind the pointer
@@ -464,6 +506,9 @@ size_t         fs_file_write  (const void *,  size_t, size_t, FILE *);
 FILE          *fs_file_open   (const char *, const char *);
 int            fs_file_getline(char  **, size_t *, FILE *);
 
+void          *fs_file_map    (const char *, size_t *);
+void           fs_file_unmap  (void *, size_t);
+
 /* directory handling */
 int            fs_dir_make    (const char *);
 DIR           *fs_dir_open    (const char *);
@@ -808,6 +853,32 @@ int  con_vout  (const char *, va_list);
 int  con_err   (const char *, ...);
 int  con_out   (const char *, ...);
 
+/*
+ * Captures the output of the calling thread instead of printing it, so
+ * work split across threads is reported in a fixed order. Everything
+ * written between con_capture_begin and con_capture_end is kept along
+ * with what it adds to the compile_* counters; con_capture_replay then
+ * prints and counts it as if it happened right there, con_capture_free
+ * drops it.
+ */
+typedef struct {
+    FILE *handle;
+    char *text;
+} con_output_t;
+
+typedef struct {
+    con_output_t *output;
+    size_t        errors;
+    size_t        warnings;
+    size_t        Werrors;
+    lex_ctx_t     first_werror;
+} con_capture_t;
+
+void con_capture_begin (con_capture_t *);
+void con_capture_end   (void);
+void con_capture_replay(con_capture_t *);
+void con_capture_free  (con_capture_t *);
+
 /* error/warning interface */
 extern size_t compile_errors;
 extern size_t compile_Werrors;
@@ -865,56 +936,328 @@ enum {
     VMERR_END
 };
 
+/* a call fails when it jumps this often, a runaway loop stops there */
 #define VM_JUMPS_DEFAULT 1000000
 
 /* execute-flags */
-#define VMXF_DEFAULT 0x0000     /* default flags - nothing */
-#define VMXF_TRACE   0x0001     /* trace: print statements before executing */
-#define VMXF_PROFILE 0x0002     /* profile: increment the profile counters */
+#define VMXF_DEFAULT  0x0000    /* default flags - nothing */
+#define VMXF_TRACE    0x0001    /* trace: print statements before executing */
+#define VMXF_PROFILE  0x0002    /* profile: increment the profile counters */
+#define VMXF_THREADED 0x0004    /* threaded: use the threaded dispatch if it's compiled in */
+#define VMXF_SAMPLE   0x0008    /* sample: record where execution is every sample_interval instructions */
+#define VMXF_CLOSURE  0x0010    /* closure: use the closure dispatch, before VMXF_THREADED */
+
+/* results of prog_exec_budget and prog_resume */
+enum {
+    VMEXEC_ERROR,       /* the call failed, its frames are gone */
+    VMEXEC_DONE,        /* the call returned */
+    VMEXEC_SUSPENDED    /* the call ran out of budget, see prog_resume */
+};
+
+/* entity storage layouts for prog_entity_layout */
+enum {
+    VMENTITY_ENTITY_MAJOR, /* the fields of an entity are contiguous (default) */
+    VMENTITY_FIELD_MAJOR   /* one field of consecutive entities is contiguous */
+};
+
+/* superinstruction modes for prog_fuse */
+enum {
+    VMFUSE_NONE,    /* execute every statement on its own */
+    VMFUSE_STATIC,  /* fuse every known pair of statements (default) */
+    VMFUSE_PROFILE  /* fuse what is hot according to the profile counters */
+};
 
 struct qc_program_s;
-typedef int (*prog_builtin_t)(struct qc_program_s *prog);
+typedef int  (*prog_builtin_t)(struct qc_program_s *prog);
+typedef void (*prog_native_t)(struct qc_program_s *prog);  /* see prog_native_set */
+typedef void (*prog_error_t)  (struct qc_program_s *prog, const char *message);
+
+/*
+ * An intrinsic is a builtin without side effects on the VM which gets
+ * its first two parameters and where to store its result directly, see
+ * prog_intrinsic_set.
+ */
+typedef void (*prog_intrinsic_t)(qcany_t *out, const qcany_t *a, const qcany_t *b);
+
+typedef struct {
+    prog_intrinsic_t function;
+    size_t           argc;
+} qc_intrinsic_t;
 
 typedef struct {
     qcint_t                    stmt;
     size_t                   localsp;
     prog_section_function_t *function;
+    bool                     saved;   /* locals were backed up at localsp */
+    size_t                   tempstrings; /* live tempstrings on entry */
+    size_t                   escapes;     /* prog->tempstring_escapes on entry */
 } qc_exec_stack_t;
 
+/*
+ * A call which ran out of its instruction budget, see prog_exec_budget.
+ * Its frames stay on the stack above `stackbase`.
+ */
+typedef struct {
+    size_t stackbase;
+    size_t statement;  /* where it continues */
+    size_t xflags;
+    long   maxjumps;
+    long   budget;     /* the last budget left, <= 0 when it was overrun */
+} qc_exec_suspended_t;
+
+/* per function call state, see prog_enterfunction */
+typedef struct {
+    uint32_t active; /* number of its frames on the stack */
+    bool     shared; /* its locals overlap another function's locals */
+} qc_exec_frameinfo_t;
+
+/*
+ * The call graph profile, see prog_profile_enter. Instruction counts and
+ * times are inclusive (total) and exclusive (self) of the callees; a
+ * function on the stack more than once only counts its outermost frame
+ * into its totals.
+ */
+typedef struct {
+    size_t callee;
+    size_t calls;
+} qc_profile_edge_t;
+
+typedef struct {
+    size_t             calls;
+    size_t             self;      /* instructions */
+    size_t             total;
+    double             selftime;  /* seconds */
+    double             totaltime;
+    size_t             active;    /* frames on the profile stack */
+    qc_profile_edge_t *callees;
+} qc_profile_function_t;
+
+/* a node of the call tree, node 0 is the root every stack starts at */
+typedef struct {
+    size_t  function;
+    size_t  parent;
+    size_t  self;                 /* instructions */
+    size_t *children;
+} qc_profile_node_t;
+
+/*
+ * A sample of the sampling profiler, see prog_sample: the statement which
+ * was about to execute and the different functions on the stack, the
+ * innermost QCVM_SAMPLE_DEPTH of them, innermost first.
+ */
+#define QCVM_SAMPLE_DEPTH 16
+
+typedef struct {
+    size_t   statement;
+    size_t   depth;
+    uint32_t functions[QCVM_SAMPLE_DEPTH];
+} qc_sample_t;
+
+typedef struct {
+    size_t function;
+    size_t node;
+    size_t instructions;          /* prog->profile_instructions on entry */
+    double time;
+    size_t childinstr;            /* inclusive counts of the callees */
+    double childtime;
+} qc_profile_frame_t;
+
+/*
+ * Tempstrings come from slots of power of two size classes, starting at
+ * 16 bytes. Released slots are reused by the next tempstring of the same
+ * class.
+ */
+#define VM_TEMPSTRING_CLASSES 28
+
+typedef struct {
+    size_t       offset;
+    unsigned int sizeclass;
+} qc_tempstring_t;
+
+typedef struct {
+    size_t allocations; /* tempstrings made */
+    size_t reused;      /* how many of those reused a released slot */
+    size_t resets;      /* frames released */
+    size_t used;        /* bytes in live slots */
+    size_t peak;        /* the most bytes ever in live slots */
+    size_t reserved;    /* bytes allocated for the arena */
+} qc_tempstring_stats_t;
+
+/*
+ * A copy of the state of a program which it can be put back to, see
+ * prog_snapshot. Entities are stored field after field whatever the
+ * layout, tempstrings as the chunks of the arena.
+ */
+typedef struct {
+    const void            *owner;              /* the program it was taken from */
+    size_t                 id;
+    qcint_t               *globals;
+    bool                  *entitypool;
+    qcint_t               *entityfree;
+    qcint_t               *entitydata;
+    char                  *tempstrings;
+    size_t                *tempstring_blocks;  /* chunks in every block */
+    size_t                *tempstring_free[VM_TEMPSTRING_CLASSES];
+    qc_tempstring_t       *tempstring_live;
+    size_t                 tempstring_frame;
+    size_t                 tempstring_at;
+    size_t                 tempstring_end;
+    qc_tempstring_stats_t  tempstring_stats;
+} qc_snapshot_t;
+
+struct qc_exec_instr_s;
+struct qc_exec_run_s;
+
+/*
+ * A handler of the closure dispatch: executes the instruction `ip` and
+ * returns the one to continue with, or NULL when the run is over.
+ */
+typedef struct qc_exec_instr_s *(*qc_exec_closure_t)(struct qc_exec_run_s *run, struct qc_exec_instr_s *ip);
+
+/*
+ * A statement as the VM loop executes it. These are translated from the
+ * statements once when loading: the operands are resolved to pointers
+ * into the globals and the jumps of GOTO, IF and IFNOT to the instruction
+ * they land on. `op` selects the handler, which is either the opcode or
+ * a specialization of it, like a superinstruction (see prog_fuse).
+ */
+typedef struct qc_exec_instr_s {
+    const void             *label;   /* handler for the threaded dispatch */
+    qc_exec_closure_t       closure; /* handler for the closure dispatch */
+    qcany_t                *a;
+    qcany_t                *b;
+    qcany_t                *c;
+    union {
+        struct qc_exec_instr_s *jump;      /* GOTO, IF and IFNOT */
+        prog_intrinsic_t        intrinsic; /* direct calls of an intrinsic */
+    } u;
+    qcint_t                 function; /* where a specialized call was proven to go */
+    uint16_t                op;
+    uint16_t                opcode; /* the statement's own opcode */
+} qc_exec_instr_t;
+
 typedef struct qc_program_s {
     char                    *filename;
+
+    /*
+     * The read-only sections. These either point into the mapped file or
+     * are vectors, so their sizes are kept separately.
+     */
     prog_section_statement_t *code;
     prog_section_def_t       *defs;
     prog_section_def_t       *fields;
     prog_section_function_t  *functions;
     char                    *strings;
+    size_t                   code_count;
+    size_t                   defs_count;
+    size_t                   fields_count;
+    size_t                   functions_count;
+    size_t                   strings_count;
+    void                    *map;       /* the mapped file, or NULL if read */
+    size_t                   map_size;
+
     qcint_t                   *globals;
-    qcint_t                   *entitydata;
+    qcint_t                   *initglobals; /* globals as loaded, for prog_reset */
     bool                    *entitypool;
 
+    /*
+     * Entities are stored in chunks which never move once allocated. Where
+     * a field lives depends on the layout, see prog_entity_layout. Pointers
+     * to fields, as made by ADDRESS, are (entity << fieldshift) | field.
+     */
+    qcint_t                **entitychunks;
+    qcint_t                 *entityfree;   /* free entities, last freed first */
+    size_t                   entitystride; /* words between entities in a chunk */
+    size_t                   fieldstride;  /* words between fields of an entity */
+    unsigned int             fieldshift;
+
     const char*             *function_stack;
 
     uint16_t crc16;
 
-    size_t tempstring_start;
-    size_t tempstring_at;
+    /* the tempstring arena, see prog_tempstring */
+    char                 **tempstring_chunks;  /* by id, a block may span several */
+    char                 **tempstring_blocks;  /* the allocations behind the chunks */
+    size_t                *tempstring_free[VM_TEMPSTRING_CLASSES];
+    qc_tempstring_t       *tempstring_live;    /* in order of allocation */
+    size_t                 tempstring_frame;   /* live ones made before the last exec ended */
+    size_t                 tempstring_start;   /* id of the first tempstring byte */
+    size_t                 tempstring_escapes; /* stores which may outlive a frame */
+    size_t                 tempstring_at;
+    size_t                 tempstring_end;
+    qc_tempstring_stats_t  tempstring_stats;
 
     qcint_t  vmerror;
 
+    /*
+     * What changed since the snapshot `snapshot_base` was taken or restored,
+     * so only that has to be copied the next time.
+     */
+    size_t   snapshot_base;
+    size_t   snapshot_serial;
+    bool    *entitydirty;        /* by entity */
+    qcint_t *entitytouched;      /* the dirty entities */
+    bool    *tempstringdirty;    /* by chunk */
+    size_t  *tempstringtouched;  /* the dirty chunks */
+
     size_t *profile;
+    size_t *profile_taken;       /* by statement, how often a branch jumped */
+
+    /* the call graph profile, by function, see prog_profile_enter */
+    qc_profile_function_t *profile_functions;
+    qc_profile_node_t     *profile_nodes;
+    qc_profile_frame_t    *profile_frames;
+    size_t                 profile_instructions;
+    double                 profile_clock;        /* seconds, see prog_profile_enter */
+
+    /*
+     * The sampling profiler, see prog_sample. Samples go to a ring which
+     * is folded into the counts by statement and function when it fills.
+     */
+    qc_sample_t           *samples;
+    size_t                 samples_used;
+    size_t                 sample_interval;   /* instructions between samples */
+    long                   sample_countdown;
+    size_t                 sample_total;
+    size_t                *sample_statements; /* samples at every statement */
+    size_t                *sample_self;       /* ... in every function */
+    size_t                *sample_inclusive;  /* ... with the function on the stack */
+    int32_t               *linenums;          /* by statement, from the .lno file */
+
+    /* the statements translated for execution, see qc_exec_instr_t */
+    qc_exec_instr_t *decoded;
+    int              fusemode;   /* last passed to prog_fuse */
+    bool             scalar;     /* no SIMD vector instructions, see prog_fuse */
+    bool             verified;   /* passed prog_verify */
 
     prog_builtin_t *builtins;
     size_t          builtins_count;
+    qc_intrinsic_t *intrinsics;  /* by builtin number */
+    prog_native_t  *natives;     /* by function */
+
+    /* lookup tables, see prog_index */
+    prog_section_def_t **defs_by_offset;
+    prog_section_def_t **fields_by_offset;
+    hash_table_t        *def_index;
+    hash_table_t        *field_index;
+    hash_table_t        *function_index;
+
+    /* receives the VM's errors instead of stdout when set */
+    prog_error_t    error;
 
     /* size_t ip; */
     qcint_t  entities;
     size_t entityfields;
     bool   allowworldwrites;
 
-    qcint_t         *localstack;
-    qc_exec_stack_t *stack;
+    qcint_t             *localstack;
+    qc_exec_stack_t     *stack;
+    qc_exec_frameinfo_t *frameinfo;
     size_t statement;
 
+    qc_exec_suspended_t *suspended;  /* the last one is resumed first */
+    size_t               running;    /* VM loops on the C stack */
+
     size_t xflags;
 
     int    argc; /* current arg count for debugging */
@@ -926,8 +1269,79 @@ bool                prog_exec      (qc_program_t *prog, prog_section_function_t
 const char*         prog_getstring (qc_program_t *prog, qcint_t str);
 prog_section_def_t* prog_entfield  (qc_program_t *prog, qcint_t off);
 prog_section_def_t* prog_getdef    (qc_program_t *prog, qcint_t off);
-qcany_t*            prog_getedict  (qc_program_t *prog, qcint_t e);
+qcany_t*            prog_getedict  (qc_program_t *prog, qcint_t e); /* fields are prog->fieldstride apart */
 qcint_t               prog_tempstring(qc_program_t *prog, const char *_str);
+void                prog_fuse      (qc_program_t *prog, int mode);
+void                prog_vectorize (qc_program_t *prog, bool enable);
+bool                prog_verify    (qc_program_t *prog);
+bool                prog_profile_save(qc_program_t *prog, const char *filename);
+bool                prog_profile_load(qc_program_t *prog, const char *filename);
+bool                prog_profile_folded(qc_program_t *prog, const char *filename);
+bool                prog_profile_json(qc_program_t *prog, const char *filename);
+bool                prog_profile_lines(qc_program_t *prog, const char *filename);
+bool                prog_load_lno  (qc_program_t *prog, const char *filename);
+void                prog_sample_interval(qc_program_t *prog, size_t interval);
+bool                prog_sample_report(qc_program_t *prog, const char *filename);
+void                prog_coverage_print(qc_program_t *prog);
+bool                prog_coverage_lcov(qc_program_t *prog, const char *filename);
+
+/*
+ * The interface for embedding the VM, built into libqcvm. A program is
+ * loaded once, after which its functions can be called any number of
+ * times: set the parameters, prog_call, read prog_return. prog_reset
+ * puts the globals, entities and tempstrings back to their state after
+ * loading.
+ *
+ * A tempstring passed to a builtin is released when the QC function
+ * calling it returns, so a builtin keeping one around has to copy it.
+ */
+void                     prog_reset           (qc_program_t *prog);
+void                     prog_builtin_set     (qc_program_t *prog, size_t number, prog_builtin_t builtin);
+bool                     prog_builtin_register(qc_program_t *prog, const char *name, prog_builtin_t builtin);
+void                     prog_intrinsic_set   (qc_program_t *prog, size_t number, prog_intrinsic_t intrinsic, size_t argc);
+prog_section_function_t* prog_findfunction    (qc_program_t *prog, const char *name);
+prog_section_def_t*      prog_finddef         (qc_program_t *prog, const char *name);
+prog_section_def_t*      prog_findfield       (qc_program_t *prog, const char *name);
+qcany_t*                 prog_getglobal       (qc_program_t *prog, const prog_section_def_t *def);
+qcany_t*                 prog_getfield        (qc_program_t *prog, qcint_t e, const prog_section_def_t *field);
+qcint_t                  prog_spawn_entity    (qc_program_t *prog);
+void                     prog_entity_layout   (qc_program_t *prog, int layout);
+void                     prog_free_entity     (qc_program_t *prog, qcint_t e);
+void                     prog_setparm_float   (qc_program_t *prog, size_t parm, qcfloat_t value);
+void                     prog_setparm_vector  (qc_program_t *prog, size_t parm, const qcfloat_t value[3]);
+void                     prog_setparm_string  (qc_program_t *prog, size_t parm, const char *value);
+void                     prog_setparm_entity  (qc_program_t *prog, size_t parm, qcint_t e);
+bool                     prog_call            (qc_program_t *prog, prog_section_function_t *func, size_t argc);
+bool                     prog_exec_batch      (qc_program_t *prog, prog_section_function_t *func, const qcint_t *entities,
+                                               size_t count, size_t flags, long maxjumps);
+int                      prog_exec_budget     (qc_program_t *prog, prog_section_function_t *func, size_t flags,
+                                               long maxjumps, long budget);
+int                      prog_resume          (qc_program_t *prog, long budget);
+bool                     prog_abort           (qc_program_t *prog);
+qcany_t*                 prog_return          (qc_program_t *prog);
+
+/*
+ * Snapshots of the globals, entities and tempstrings, for rolling a
+ * program back. Only what changed since the last snapshot or restore
+ * is copied, see prog_snapshot.
+ */
+qc_snapshot_t*           prog_snapshot        (qc_program_t *prog);
+bool                     prog_snapshot_update (qc_program_t *prog, qc_snapshot_t *snapshot);
+bool                     prog_restore         (qc_program_t *prog, const qc_snapshot_t *snapshot);
+void                     prog_snapshot_delete (qc_snapshot_t *snapshot);
+bool                     prog_snapshot_save   (qc_program_t *prog, const qc_snapshot_t *snapshot, const char *filename);
+qc_snapshot_t*           prog_snapshot_load   (qc_program_t *prog, const char *filename);
+
+/*
+ * Functions translated to C ahead of time, see qcvm -emit-c, replace
+ * their statements once set. The rest is what the translated code calls.
+ */
+void                     prog_native_set      (qc_program_t *prog, size_t function, prog_native_t native);
+bool                     prog_native_call     (qc_program_t *prog, qcint_t function, int argc, size_t statement);
+qcint_t*                 prog_native_field    (qc_program_t *prog, qcint_t e, qcint_t f, qcint_t size);
+bool                     prog_native_address  (qc_program_t *prog, qcint_t e, qcint_t f, qcint_t *out);
+qcint_t*                 prog_native_pointer  (qc_program_t *prog, qcint_t pointer, qcint_t size);
+void                     prog_native_state    (qc_program_t *prog);
 
 
 /*===================================================================*/
@@ -939,6 +1353,7 @@ bool             parser_compile_file  (struct parser_s *parser, const char *);
 bool             parser_compile_string(struct parser_s *parser, const char *, const char *, size_t);
 bool             parser_finish        (struct parser_s *parser, const char *);
 void             parser_cleanup       (struct parser_s *parser);
+bool             parser_profile       (struct parser_s *parser, const char *);
 
 /*===================================================================*/
 /*====================== ftepp.c commandline ========================*/
@@ -952,6 +1367,10 @@ const char     *ftepp_get              (struct ftepp_s *ftepp);
 void            ftepp_flush            (struct ftepp_s *ftepp);
 void            ftepp_add_define       (struct ftepp_s *ftepp, const char *source, const char *name);
 void            ftepp_add_macro        (struct ftepp_s *ftepp, const char *name,   const char *value);
+void            ftepp_track            (struct ftepp_s *ftepp, bool speculate);
+bool            ftepp_adopt            (struct ftepp_s *ftepp, struct ftepp_s *item);
+bool            ftepp_save             (struct ftepp_s *ftepp, struct ftepp_s *item, const char *filename);
+struct ftepp_s *ftepp_load             (const char *filename);
 
 /*===================================================================*/
 /*======================= main.c commandline ========================*/
@@ -1042,7 +1461,7 @@ extern const opts_flag_def_t opts_flag_list[COUNT_FLAGS+1];
 extern const opts_flag_def_t opts_warn_list[COUNT_WARNINGS+1];
 extern const opts_flag_def_t opts_opt_list[COUNT_OPTIMIZATIONS+1];
 extern const unsigned int    opts_opt_oflag[COUNT_OPTIMIZATIONS+1];
-extern unsigned int          opts_optimizationcount[COUNT_OPTIMIZATIONS];
+extern GMQCC_THREAD_LOCAL unsigned int opts_optimizationcount[COUNT_OPTIMIZATIONS];
 
 /* other options: */
 typedef enum {
@@ -346,6 +346,7 @@ ir_builder* ir_builder_new(const char *modulename)
 
     self->reserved_va_count = NULL;
     self->code              = code_init();
+    self->profile           = NULL;
 
     return self;
 }
@@ -475,6 +476,76 @@ ir_value* ir_builder_create_field(ir_builder *self, const char *name, int vtype)
     return ve;
 }
 
+/*
+ * Reads the counts by function and line which qcvm -profile-lines saves,
+ * NULL when the file can't be read or isn't such a profile. The branches
+ * on a line found in them are laid out so that the path taken more often
+ * falls through, see ir_function_profile; all branches on one line share
+ * the counts.
+ */
+ht ir_profile_read(const char *filename)
+{
+    FILE              *file    = fs_file_open(filename, "rb");
+    char              *line    = NULL;
+    size_t             size    = 0;
+    unsigned int       version;
+    unsigned long      lineno, count, ontrue, onfalse;
+    int                name;
+    char               key[1024];
+    ir_branch_profile *branch;
+    ht                 profile = NULL;
+
+    if (!file) {
+        con_err("failed to open profile `%s`\n", filename);
+        return NULL;
+    }
+
+    if (fs_file_getline(&line, &size, file) == EOF ||
+        sscanf(line, "QCVMLINES %u", &version) != 1 || version != 1)
+    {
+        con_err("`%s` is not a line profile from qcvm -profile-lines\n", filename);
+        goto end;
+    }
+
+    profile = util_htnew(IR_HT_SIZE);
+    while (fs_file_getline(&line, &size, file) != EOF) {
+        name = 0;
+        if (sscanf(line, "%lu %lu %lu %lu %n", &lineno, &count, &ontrue, &onfalse, &name) != 4 || !name) {
+            con_err("malformed line in profile `%s`: %s", filename, line);
+            ir_profile_delete(profile);
+            profile = NULL;
+            goto end;
+        }
+        line[strcspn(line, "\r\n")] = 0;
+        util_snprintf(key, sizeof(key), "%s:%lu", line + name, lineno);
+
+        if (!(branch = (ir_branch_profile*)util_htget(profile, key))) {
+            branch = (ir_branch_profile*)mem_a(sizeof(*branch));
+            branch->ontrue  = 0;
+            branch->onfalse = 0;
+            util_htset(profile, key, branch);
+        }
+        branch->ontrue  += ontrue;
+        branch->onfalse += onfalse;
+    }
+
+end:
+    if (line)
+        mem_d(line);
+    fs_file_close(file);
+    return profile;
+}
+
+static void ir_branch_profile_delete(void *data)
+{
+    mem_d(data);
+}
+
+void ir_profile_delete(ht profile)
+{
+    util_htrem(profile, &ir_branch_profile_delete);
+}
+
 /***********************************************************************
  *IR Function
  */
@@ -986,6 +1057,26 @@ static void ir_instr_delete_quick(ir_instr *self)
     mem_d(self);
 }
 
+/*
+ * Globals are read and written by the instructions of every function,
+ * and functions are finalized on several threads at once, see
+ * parser_finish, so their reads and writes are only changed with this
+ * lock held.
+ */
+static util_mutex_t ir_globals_lock = UTIL_MUTEX_INIT;
+
+static void ir_value_lock(const ir_value *v)
+{
+    if (v->store == store_global)
+        util_mutex_lock(&ir_globals_lock);
+}
+
+static void ir_value_unlock(const ir_value *v)
+{
+    if (v->store == store_global)
+        util_mutex_unlock(&ir_globals_lock);
+}
+
 static void ir_instr_delete(ir_instr *self)
 {
     size_t i;
@@ -997,18 +1088,22 @@ static void ir_instr_delete(ir_instr *self)
      */
     for (i = 0; i < vec_size(self->phi); ++i) {
         size_t idx;
+        ir_value_lock(self->phi[i].value);
         if (vec_ir_instr_find(self->phi[i].value->writes, self, &idx))
             vec_remove(self->phi[i].value->writes, idx, 1);
         if (vec_ir_instr_find(self->phi[i].value->reads, self, &idx))
             vec_remove(self->phi[i].value->reads, idx, 1);
+        ir_value_unlock(self->phi[i].value);
     }
     vec_free(self->phi);
     for (i = 0; i < vec_size(self->params); ++i) {
         size_t idx;
+        ir_value_lock(self->params[i]);
         if (vec_ir_instr_find(self->params[i]->writes, self, &idx))
             vec_remove(self->params[i]->writes, idx, 1);
         if (vec_ir_instr_find(self->params[i]->reads, self, &idx))
             vec_remove(self->params[i]->reads, idx, 1);
+        ir_value_unlock(self->params[i]);
     }
     vec_free(self->params);
     (void)!ir_instr_op(self, 0, NULL, false);
@@ -1021,16 +1116,20 @@ static bool ir_instr_op(ir_instr *self, int op, ir_value *v, bool writing)
 {
     if (self->_ops[op]) {
         size_t idx;
+        ir_value_lock(self->_ops[op]);
         if (writing && vec_ir_instr_find(self->_ops[op]->writes, self, &idx))
             vec_remove(self->_ops[op]->writes, idx, 1);
         else if (vec_ir_instr_find(self->_ops[op]->reads, self, &idx))
             vec_remove(self->_ops[op]->reads, idx, 1);
+        ir_value_unlock(self->_ops[op]);
     }
     if (v) {
+        ir_value_lock(v);
         if (writing)
             vec_push(v->writes, self);
         else
             vec_push(v->reads, self);
+        ir_value_unlock(v);
     }
     self->_ops[op] = v;
     return true;
@@ -2218,9 +2317,11 @@ bool ir_function_allocate_locals(ir_function *self)
                 if (param < 8)
                     ir_value_code_setaddr(v, OFS_PARM0 + 3*param);
                 else {
-                    size_t nprotos = vec_size(self->owner->extparam_protos);
+                    size_t nprotos;
                     ir_value *ep;
                     param -= 8;
+                    util_mutex_lock(&ir_globals_lock);
+                    nprotos = vec_size(self->owner->extparam_protos);
                     if (nprotos > param)
                         ep = self->owner->extparam_protos[param];
                     else
@@ -2229,6 +2330,7 @@ bool ir_function_allocate_locals(ir_function *self)
                         while (++nprotos <= param)
                             ep = ir_gen_extparam_proto(self->owner);
                     }
+                    util_mutex_unlock(&ir_globals_lock);
                     ir_instr_op(v->writes[0], 0, ep, true);
                     call->params[param+8] = ep;
                 }
@@ -2484,18 +2586,15 @@ static bool ir_block_life_propagate(ir_block *self, bool *changed)
         }
 
         if (instr->opcode == INSTR_MUL_VF)
-        {
             value = instr->_ops[2];
-            /* the float source will get an additional lifetime */
-            if (ir_value_life_merge(value, instr->eid+1))
-                *changed = true;
-            if (value->memberof && ir_value_life_merge(value->memberof, instr->eid+1))
-                *changed = true;
-        }
         else if (instr->opcode == INSTR_MUL_FV || instr->opcode == INSTR_LOAD_V)
-        {
             value = instr->_ops[1];
-            /* the float source will get an additional lifetime */
+        else
+            value = NULL;
+
+        /* the float source will get an additional lifetime, globals don't
+         * need one and are shared with the functions on other threads */
+        if (value && value->store != store_global) {
             if (ir_value_life_merge(value, instr->eid+1))
                 *changed = true;
             if (value->memberof && ir_value_life_merge(value->memberof, instr->eid+1))
@@ -2999,6 +3098,28 @@ static bool gen_blocks_recursive(code_t *code, ir_function *func, ir_block *bloc
     return true;
 }
 
+/* marks the conditions of the profile likely when they were true more often than not */
+static void ir_function_profile(ir_builder *ir, ir_function *self)
+{
+    ir_branch_profile *branch;
+    ir_instr          *instr;
+    char               key[1024];
+    size_t             i;
+
+    for (i = 0; i < vec_size(self->blocks); ++i) {
+        if (!vec_size(self->blocks[i]->instr))
+            continue;
+        instr = vec_last(self->blocks[i]->instr);
+        if (instr->opcode != VINSTR_COND)
+            continue;
+
+        util_snprintf(key, sizeof(key), "%s:%lu", self->name, (unsigned long)instr->context.line);
+        branch = (ir_branch_profile*)util_htget(ir->profile, key);
+        if (branch && branch->ontrue + branch->onfalse)
+            instr->likely = (branch->ontrue >= branch->onfalse);
+    }
+}
+
 static bool gen_function_code(code_t *code, ir_function *self)
 {
     ir_block *block;
@@ -3298,6 +3419,8 @@ static bool gen_global_function_code(ir_builder *ir, ir_value *global)
         irerror(irfun->context, "Failed to generate vararg-copy code for function %s", irfun->name);
         return false;
     }
+    if (ir->profile)
+        ir_function_profile(ir, irfun);
     if (!gen_function_code(ir->code, irfun)) {
         irerror(irfun->context, "Failed to generate code for function %s", irfun->name);
         return false;
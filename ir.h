@@ -240,6 +240,12 @@ ir_block*       ir_function_create_block(lex_ctx_t ctx, ir_function*, const char
 
 /* builder */
 #define IR_HT_SIZE 1024
+/* how often the conditions of the branches on a line were true and false */
+typedef struct {
+    size_t ontrue;
+    size_t onfalse;
+} ir_branch_profile;
+
 typedef struct ir_builder_s
 {
     char *name;
@@ -270,6 +276,9 @@ typedef struct ir_builder_s
 
     /* code generator */
     code_t      *code;
+
+    /* branch counts by "function:line", see ir_profile_read; not owned */
+    ht            profile;
 } ir_builder;
 
 ir_builder*  ir_builder_new(const char *modulename);
@@ -281,6 +290,9 @@ ir_value*    ir_builder_get_va_count(ir_builder*);
 bool         ir_builder_generate(ir_builder *self, const char *filename);
 void         ir_builder_dump(ir_builder*, int (*oprintf)(const char*, ...));
 
+ht           ir_profile_read(const char *filename);
+void         ir_profile_delete(ht profile);
+
 /*
  * This code assumes 32 bit floats while generating binary
  * Blub: don't use extern here, it's annoying and shows up in nm
@@ -53,6 +53,18 @@ static const char *keywords_fg[] = {
  */
 static char* *lex_filenames;
 
+/* files are preprocessed on several threads, see main */
+static util_mutex_t lex_filenames_lock = UTIL_MUTEX_INIT;
+
+static char *lex_filename(const char *name)
+{
+    char *copy = util_strdup(name);
+    util_mutex_lock(&lex_filenames_lock);
+    vec_push(lex_filenames, copy);
+    util_mutex_unlock(&lex_filenames_lock);
+    return copy;
+}
+
 static void lexerror(lex_file *lex, const char *fmt, ...)
 {
     va_list ap;
@@ -197,13 +209,12 @@ lex_file* lex_open(const char *file)
     memset(lex, 0, sizeof(*lex));
 
     lex->file    = in;
-    lex->name    = util_strdup(file);
+    lex->name    = lex_filename(file);
     lex->line    = 1; /* we start counting at 1 */
     lex->column  = 0;
     lex->peekpos = 0;
     lex->eof     = false;
 
-    vec_push(lex_filenames, lex->name);
     return lex;
 }
 
@@ -224,14 +235,12 @@ lex_file* lex_open_string(const char *str, size_t len, const char *name)
     lex->open_string_length = len;
     lex->open_string_pos    = 0;
 
-    lex->name    = util_strdup(name ? name : "<string-source>");
+    lex->name    = lex_filename(name ? name : "<string-source>");
     lex->line    = 1; /* we start counting at 1 */
     lex->peekpos = 0;
     lex->eof     = false;
     lex->column  = 0;
 
-    vec_push(lex_filenames, lex->name);
-
     return lex;
 }
 
@@ -479,8 +488,7 @@ static bool lex_try_pragma(lex_file *lex)
             goto unroll;
     }
     else if (!strcmp(command, "file")) {
-        lex->name = util_strdup(param);
-        vec_push(lex_filenames, lex->name);
+        lex->name = lex_filename(param);
     }
     else if (!strcmp(command, "line")) {
         line = strtol(param, NULL, 0)-1;
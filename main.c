@@ -87,6 +87,9 @@ static int usage(void) {
             "  -Ono-<name>            disable specific optimization\n"
             "  -Ohelp                 list optimizations\n");
     con_out("  -force-crc=num         force a specific checksum into the header\n");
+    con_out("  -profile-use=file      lay out branches by a qcvm -profile-lines profile\n");
+    con_out("  -j<number>             threads to use, defaults to one per processor\n");
+    con_out("  -cache=directory       keep preprocessed files in directory to reuse\n");
     return -1;
 }
 
@@ -226,6 +229,14 @@ static bool options_parse(int argc, char **argv) {
                 config = argarg;
                 continue;
             }
+            if (options_long_gcc("profile-use", &argc, &argv, &argarg)) {
+                OPTS_OPTION_STR(OPTION_PROFILE_USE) = argarg;
+                continue;
+            }
+            if (options_long_gcc("cache", &argc, &argv, &argarg)) {
+                OPTS_OPTION_STR(OPTION_CACHE) = argarg;
+                continue;
+            }
             if (options_long_gcc("memdumpcols", &argc, &argv, &memdumpcols)) {
                 OPTS_OPTION_U16(OPTION_MEMDUMPCOLS) = (uint16_t)strtol(memdumpcols, NULL, 10);
                 continue;
@@ -301,6 +312,14 @@ static bool options_parse(int argc, char **argv) {
                     OPTS_OPTION_BOOL(OPTION_QUIET) = true;
                     break;
 
+                case 'j':
+                    if (!options_witharg(&argc, &argv, &argarg) || !util_isdigit(argarg[0])) {
+                        con_out("option -j requires the number of threads\n");
+                        return false;
+                    }
+                    OPTS_OPTION_U32(OPTION_JOBS) = (uint32_t)strtol(argarg, NULL, 10);
+                    break;
+
                 case 'D':
                     if (!strlen(argv[0]+2)) {
                         con_err("expected name after -D\n");
@@ -548,6 +567,131 @@ static bool progs_nextline(char **out, size_t *alen,FILE *src) {
     return true;
 }
 
+/* a preprocessor with the predefined macros and the ones from -D */
+static struct ftepp_s *preprocessor_create(void) {
+    struct ftepp_s *ftepp;
+    size_t          i;
+
+    if (!(ftepp = ftepp_create()))
+        return NULL;
+    for (i = 0; i < vec_size(ppems); ++i)
+        ftepp_add_macro(ftepp, ppems[i].name, ppems[i].value);
+    return ftepp;
+}
+
+/*
+ * The compile cache keeps what preprocessing a file gave, named after
+ * everything the result depends on but the macros from the files before
+ * it, which ftepp_adopt checks: the file's name and contents, the
+ * options, and the predefined and -D macros.
+ */
+static char *cache_entry(const char *filename) {
+    uint64_t  key = UTIL_FNV64_INIT;
+    char     *entry = NULL;
+    size_t    i;
+
+    key = util_fnv64(key, GMQCC_FULL_VERSION_STRING, sizeof(GMQCC_FULL_VERSION_STRING));
+    key = util_fnv64(key, filename, strlen(filename) + 1);
+    if (!util_fnv64_file(&key, filename))
+        return NULL;
+
+    key = util_fnv64(key, &OPTS_OPTION_U32(OPTION_STANDARD), sizeof(uint32_t));
+    key = util_fnv64(key, opts.flags,  sizeof(opts.flags));
+    key = util_fnv64(key, opts.warn,   sizeof(opts.warn));
+    key = util_fnv64(key, opts.werror, sizeof(opts.werror));
+    for (i = 0; i < vec_size(ppems); ++i) {
+        key = util_fnv64(key, ppems[i].name, strlen(ppems[i].name) + 1);
+        if (ppems[i].value)
+            key = util_fnv64(key, ppems[i].value, strlen(ppems[i].value) + 1);
+        key = util_fnv64(key, "", 1);
+    }
+
+    util_asprintf(&entry, "%s/%08lx%08lx.pp", OPTS_OPTION_STR(OPTION_CACHE),
+                  (unsigned long)(uint32_t)(key >> 32), (unsigned long)(uint32_t)key);
+    return entry;
+}
+
+static struct ftepp_s *cache_load(const char *filename) {
+    struct ftepp_s *item;
+    char           *entry;
+
+    if (!OPTS_OPTION_STR(OPTION_CACHE) || !(entry = cache_entry(filename)))
+        return NULL;
+    item = ftepp_load(entry);
+    mem_d(entry);
+    return item;
+}
+
+static void cache_save(struct ftepp_s *ftepp, struct ftepp_s *item, const char *filename) {
+    char *entry;
+
+    if (!(entry = cache_entry(filename)))
+        return;
+    if (!ftepp_save(ftepp, item, entry))
+        util_debug("COM", "not caching `%s`\n", filename);
+    mem_d(entry);
+}
+
+/*
+ * While the parser works on one file the next ones are preprocessed on
+ * other threads, each by its own preprocessor. ftepp_adopt decides if
+ * the result is the same as preprocessing the files in order; if not,
+ * the file is preprocessed again after the ones before it. Diagnostics
+ * are captured and printed when the file's turn comes.
+ */
+typedef struct {
+    const char     *filename;
+    struct ftepp_s *ftepp;
+    con_capture_t   capture;
+    bool            preprocessed;
+    bool            cached;
+    bool            running;
+    util_thread_t   thread;
+} preprocess_t;
+
+static void preprocess_ahead(void *data) {
+    preprocess_t *item = (preprocess_t*)data;
+
+    if ((item->ftepp = cache_load(item->filename))) {
+        item->preprocessed = item->cached = true;
+        return;
+    }
+    con_capture_begin(&item->capture);
+    item->ftepp = preprocessor_create();
+    /* anything said about -D was said already */
+    con_capture_free(&item->capture);
+    con_capture_begin(&item->capture);
+    if (item->ftepp) {
+        ftepp_track(item->ftepp, true);
+        item->preprocessed = ftepp_preprocess_file(item->ftepp, item->filename);
+    }
+    con_capture_end();
+}
+
+static void preprocess_start(preprocess_t *item, const char *filename) {
+    item->filename     = filename;
+    item->ftepp        = NULL;
+    item->capture.output = NULL;
+    item->preprocessed = false;
+    item->cached       = false;
+    item->running      = util_thread_create(&item->thread, &preprocess_ahead, item);
+}
+
+static void preprocess_wait(preprocess_t *item) {
+    if (!item->running)
+        return;
+    util_thread_join(item->thread);
+    item->running = false;
+}
+
+static void preprocess_delete(preprocess_t *item) {
+    preprocess_wait(item);
+    con_capture_free(&item->capture);
+    if (item->ftepp)
+        ftepp_finish(item->ftepp);
+    item->ftepp = NULL;
+}
+
 int main(int argc, char **argv) {
     size_t          itr;
     int             retval           = 0;
@@ -557,6 +701,9 @@ int main(int argc, char **argv) {
     FILE            *outfile         = NULL;
     struct parser_s *parser          = NULL;
     struct ftepp_s  *ftepp           = NULL;
+    struct ftepp_s  *cached          = NULL;
+    preprocess_t    *ahead           = NULL;
+    size_t           threads         = 0;
 
     app_name = argv[0];
     con_init ();
@@ -636,10 +783,16 @@ int main(int argc, char **argv) {
             retval = 1;
             goto cleanup;
         }
+        if (OPTS_OPTION_STR(OPTION_PROFILE_USE) &&
+            !parser_profile(parser, OPTS_OPTION_STR(OPTION_PROFILE_USE)))
+        {
+            retval = 1;
+            goto cleanup;
+        }
     }
 
     if (OPTS_OPTION_BOOL(OPTION_PP_ONLY) || OPTS_FLAG(FTEPP)) {
-        if (!(ftepp = ftepp_create())) {
+        if (!(ftepp = preprocessor_create())) {
             con_err("failed to initialize parser\n");
             retval = 1;
             goto cleanup;
@@ -648,18 +801,6 @@ int main(int argc, char **argv) {
 
     util_debug("COM", "starting ...\n");
 
-    /* add macros */
-    if (OPTS_OPTION_BOOL(OPTION_PP_ONLY) || OPTS_FLAG(FTEPP)) {
-        for (itr = 0; itr < vec_size(ppems); itr++) {
-            ftepp_add_macro(ftepp, ppems[itr].name, ppems[itr].value);
-            mem_d(ppems[itr].name);
-
-            /* can be null */
-            if (ppems[itr].value)
-                mem_d(ppems[itr].value);
-        }
-    }
-
     if (!vec_size(items)) {
         FILE  *src;
         char  *line    = NULL;
@@ -704,6 +845,30 @@ int main(int argc, char **argv) {
             con_out("There are %lu items to compile:\n", (unsigned long)vec_size(items));
         }
 
+        if (OPTS_FLAG(FTEPP) && !OPTS_OPTION_BOOL(OPTION_PP_ONLY) && vec_size(items) > 1) {
+            threads = OPTS_OPTION_U32(OPTION_JOBS);
+            if (!threads)
+                threads = util_cpu_count();
+#ifdef GMQCC_NO_THREAD_LOCAL
+            threads = 1;
+#endif
+        }
+        if (threads > 1) {
+            ahead = (preprocess_t*)mem_a(sizeof(*ahead) * vec_size(items));
+            for (itr = 0; itr < vec_size(items); ++itr) {
+                ahead[itr].ftepp          = NULL;
+                ahead[itr].capture.output = NULL;
+                ahead[itr].running        = false;
+                if (itr < threads)
+                    preprocess_start(&ahead[itr], items[itr].filename);
+            }
+        }
+        if (OPTS_FLAG(FTEPP) && !OPTS_OPTION_BOOL(OPTION_PP_ONLY) && OPTS_OPTION_STR(OPTION_CACHE)) {
+            /* no need to check if it's already there */
+            (void)fs_dir_make(OPTS_OPTION_STR(OPTION_CACHE));
+            ftepp_track(ftepp, false);
+        }
+
         for (itr = 0; itr < vec_size(items); ++itr) {
             if (!OPTS_OPTION_BOOL(OPTION_QUIET) &&
                 !OPTS_OPTION_BOOL(OPTION_PP_ONLY))
@@ -729,19 +894,56 @@ int main(int argc, char **argv) {
             }
             else {
                 if (OPTS_FLAG(FTEPP)) {
-                    const char *data;
-                    if (!ftepp_preprocess_file(ftepp, items[itr].filename)) {
-                        retval = 1;
-                        goto cleanup;
+                    const char     *data;
+                    struct ftepp_s *pp   = ftepp;
+                    bool            save = false;
+                    if (ahead) {
+                        preprocess_wait(&ahead[itr]);
+                        if (itr + threads < vec_size(items))
+                            preprocess_start(&ahead[itr + threads], items[itr + threads].filename);
+                        if (ahead[itr].preprocessed && ftepp_adopt(ftepp, ahead[itr].ftepp)) {
+                            save = !ahead[itr].cached && !vec_size(ahead[itr].capture.output);
+                            con_capture_replay(&ahead[itr].capture);
+                            pp = ahead[itr].ftepp;
+                        }
+                    } else if ((cached = cache_load(items[itr].filename))) {
+                        if (ftepp_adopt(ftepp, cached))
+                            pp = cached;
                     }
-                    data = ftepp_get(ftepp);
+                    if (pp == ftepp) {
+                        con_capture_t capture;
+                        bool          preprocessed;
+                        /* files which say anything aren't cached */
+                        if (OPTS_OPTION_STR(OPTION_CACHE))
+                            con_capture_begin(&capture);
+                        preprocessed = ftepp_preprocess_file(ftepp, items[itr].filename);
+                        if (OPTS_OPTION_STR(OPTION_CACHE)) {
+                            con_capture_end();
+                            save = preprocessed && !vec_size(capture.output);
+                            con_capture_replay(&capture);
+                        }
+                        if (!preprocessed) {
+                            retval = 1;
+                            goto cleanup;
+                        }
+                    }
+                    if (save && OPTS_OPTION_STR(OPTION_CACHE))
+                        cache_save(ftepp, pp, items[itr].filename);
+                    else if (pp != ftepp)
+                        util_debug("COM", "reusing `%s` preprocessed\n", items[itr].filename);
+                    data = ftepp_get(pp);
                     if (vec_size(data)) {
                         if (!parser_compile_string(parser, items[itr].filename, data, vec_size(data))) {
                             retval = 1;
                             goto cleanup;
                         }
                     }
-                    ftepp_flush(ftepp);
+                    ftepp_flush(pp);
+                    if (ahead)
+                        preprocess_delete(&ahead[itr]);
+                    if (cached)
+                        ftepp_finish(cached);
+                    cached = NULL;
                 }
                 else {
                     if (!parser_compile_file(parser, items[itr].filename)) {
@@ -769,10 +971,23 @@ int main(int argc, char **argv) {
 
 cleanup:
     util_debug("COM", "cleaning ...\n");
+    if (ahead) {
+        for (itr = 0; itr < vec_size(items); ++itr)
+            preprocess_delete(&ahead[itr]);
+        mem_d(ahead);
+    }
+    if (cached)
+        ftepp_finish(cached);
     if (ftepp)
         ftepp_finish(ftepp);
     con_close();
     vec_free(items);
+    for (itr = 0; itr < vec_size(ppems); ++itr) {
+        mem_d(ppems[itr].name);
+        /* can be null */
+        if (ppems[itr].value)
+            mem_d(ppems[itr].value);
+    }
     vec_free(ppems);
 
     if (!OPTS_OPTION_BOOL(OPTION_PP_ONLY))
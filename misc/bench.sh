@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+# Times the programs in misc/bench with qcvm, once as it runs them by
+# default and once with the flags on their "// compare:" line, which turn
+# off what the program measures. Run it from the top of a built gmqcc
+# source tree, optionally with the number of runs to take the best of:
+#
+#     misc/bench.sh [runs]
+prog=$0
+runs=${1:-5}
+dat=$(mktemp)
+trap 'rm -f "$dat"' EXIT
+
+for i in gmqcc qcvm tests/defs.qh; do
+	test -e "$i" && continue
+	echo "$prog: missing $i"
+	echo "$prog: run this script from the top of a built gmqcc source tree"
+	exit 1
+done
+
+# the best of $runs runs of qcvm with the given flags, in seconds
+best() {
+	local best= t r
+	for ((r = 0; r < runs; ++r)); do
+		t=$( { TIMEFORMAT=%R; time ./qcvm "$@" "$dat" > /dev/null; } 2>&1 )
+		best=$(awk -v t="$t" -v b="$best" 'BEGIN { print (b == "" || t < b) ? t : b }')
+	done
+	echo "$best"
+}
+
+for src in misc/bench/*.qc; do
+	flags=$(sed -ne 's,^// compare: *,,p' "$src")
+	if ! ./gmqcc -std=gmqcc -O3 -o "$dat" tests/defs.qh "$src" > /dev/null; then
+		echo "$prog: $src doesn't compile"
+		exit 1
+	fi
+	printf '%-20s default %ss, %s %ss\n' "$(basename "$src" .qc)" \
+		"$(best)" "$flags" "$(best $flags)"
+done
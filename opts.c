@@ -54,7 +54,7 @@ const opts_flag_def_t opts_flag_list[COUNT_FLAGS+1] = {
     { NULL, LONGBIT(0) }
 };
 
-unsigned int opts_optimizationcount[COUNT_OPTIMIZATIONS];
+GMQCC_THREAD_LOCAL unsigned int opts_optimizationcount[COUNT_OPTIMIZATIONS];
 opts_cmd_t   opts; /* command line options */
 
 static void opts_setdefault(void) {
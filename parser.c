@@ -5992,9 +5992,124 @@ static void parser_remove_ast(parser_t *parser)
 void parser_cleanup(parser_t *parser)
 {
     parser_remove_ast(parser);
+    if (parser->profile)
+        ir_profile_delete(parser->profile);
     mem_d(parser);
 }
 
+/*
+ * Reads the profile the branches are laid out by, see ir_profile_read.
+ * Done before anything is compiled so a bad file fails early.
+ */
+bool parser_profile(parser_t *parser, const char *filename)
+{
+    if (parser->profile)
+        ir_profile_delete(parser->profile);
+    parser->profile = ir_profile_read(filename);
+    return parser->profile != NULL;
+}
+
+/*
+ * Finalizing a function only touches the function itself, so they're
+ * finalized on several threads. Each one's diagnostics are captured and
+ * replayed in the order of the functions afterwards, which gives the
+ * same output as finalizing them one after the other, stopping at the
+ * first one which fails.
+ */
+typedef struct {
+    parser_t      *parser;
+    con_capture_t *captures;
+    bool          *finalized;
+    size_t         next;
+    unsigned int  *optimizations;
+} parser_finalize_t;
+
+static util_mutex_t parser_finalize_lock = UTIL_MUTEX_INIT;
+
+static void parser_finalize_worker(void *data) {
+    parser_finalize_t *pool = (parser_finalize_t*)data;
+    size_t             i;
+
+    for (;;) {
+        util_mutex_lock(&parser_finalize_lock);
+        i = pool->next++;
+        util_mutex_unlock(&parser_finalize_lock);
+        if (i >= vec_size(pool->parser->functions))
+            break;
+        con_capture_begin(&pool->captures[i]);
+        pool->finalized[i] = ir_function_finalize(pool->parser->functions[i]->ir_func);
+        con_capture_end();
+    }
+
+    /* the optimization counts are per thread, add them to the caller's */
+    if (pool->optimizations != opts_optimizationcount) {
+        util_mutex_lock(&parser_finalize_lock);
+        for (i = 0; i < COUNT_OPTIMIZATIONS; ++i)
+            pool->optimizations[i] += opts_optimizationcount[i];
+        util_mutex_unlock(&parser_finalize_lock);
+    }
+}
+
+static bool parser_finalize(parser_t *parser) {
+    util_thread_t     *workers = NULL;
+    parser_finalize_t  pool;
+    size_t             threads = OPTS_OPTION_U32(OPTION_JOBS);
+    size_t             count   = vec_size(parser->functions);
+    size_t             i;
+    bool               retval  = true;
+
+#ifdef GMQCC_NO_THREAD_LOCAL
+    threads = 1;
+#endif
+    if (!threads)
+        threads = util_cpu_count();
+    if (threads > count)
+        threads = count;
+
+    if (threads <= 1) {
+        for (i = 0; i < count; ++i) {
+            if (!ir_function_finalize(parser->functions[i]->ir_func)) {
+                con_out("failed to finalize function %s\n", parser->functions[i]->name);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    pool.parser        = parser;
+    pool.captures      = (con_capture_t*)mem_a(sizeof(*pool.captures)  * count);
+    pool.finalized     = (bool*)         mem_a(sizeof(*pool.finalized) * count);
+    pool.next          = 0;
+    pool.optimizations = opts_optimizationcount;
+
+    /* the calling thread is one of the workers */
+    for (i = 1; i < threads; ++i) {
+        util_thread_t thread;
+        if (!util_thread_create(&thread, &parser_finalize_worker, &pool))
+            break;
+        vec_push(workers, thread);
+    }
+    parser_finalize_worker(&pool);
+    for (i = 0; i < vec_size(workers); ++i)
+        util_thread_join(workers[i]);
+    vec_free(workers);
+
+    for (i = 0; i < count; ++i) {
+        if (!retval) {
+            con_capture_free(&pool.captures[i]);
+            continue;
+        }
+        con_capture_replay(&pool.captures[i]);
+        if (!pool.finalized[i]) {
+            con_out("failed to finalize function %s\n", parser->functions[i]->name);
+            retval = false;
+        }
+    }
+    mem_d(pool.captures);
+    mem_d(pool.finalized);
+    return retval;
+}
+
 bool parser_finish(parser_t *parser, const char *output)
 {
     size_t i;
@@ -6135,12 +6250,9 @@ bool parser_finish(parser_t *parser, const char *output)
 
     if (OPTS_OPTION_BOOL(OPTION_DUMP))
         ir_builder_dump(ir, con_out);
-    for (i = 0; i < vec_size(parser->functions); ++i) {
-        if (!ir_function_finalize(parser->functions[i]->ir_func)) {
-            con_out("failed to finalize function %s\n", parser->functions[i]->name);
-            ir_builder_delete(ir);
-            return false;
-        }
+    if (!parser_finalize(parser)) {
+        ir_builder_delete(ir);
+        return false;
     }
     parser_remove_ast(parser);
 
@@ -6154,6 +6266,7 @@ bool parser_finish(parser_t *parser, const char *output)
         if (OPTS_OPTION_BOOL(OPTION_DUMPFIN))
             ir_builder_dump(ir, con_out);
 
+        ir->profile = parser->profile;
         if (!ir_builder_generate(ir, output)) {
             con_out("*** failed to generate output file\n");
             ir_builder_delete(ir);
@@ -115,6 +115,9 @@ struct parser_s {
 
     fold_t   *fold;
     intrin_t *intrin;
+
+    /* branch counts from -profile-use, see parser_profile */
+    ht        profile;
 };
 
 
@@ -81,6 +81,15 @@ static stat_size_table_t stat_size_vectors          = NULL;
 static stat_size_table_t stat_size_hashtables       = NULL;
 static stat_mem_block_t *stat_mem_block_root        = NULL;
 
+/*
+ * The block list and the counters are shared by every thread that
+ * allocates, which is more than one when the executor runs programs
+ * in parallel. The size tables get their own lock since updating them
+ * allocates.
+ */
+static util_mutex_t      stat_mem_lock              = UTIL_MUTEX_INIT;
+static util_mutex_t      stat_size_lock             = UTIL_MUTEX_INIT;
+
 /*
  * A tiny size_t key-value hashtbale for tracking vector and hashtable
  * sizes. We can use it for other things too, if we need to. This is
@@ -130,6 +139,8 @@ void *stat_mem_allocate(size_t size, size_t line, const char *file) {
     info->size = size;
     info->file = file;
     info->prev = NULL;
+
+    util_mutex_lock(&stat_mem_lock);
     info->next = stat_mem_block_root;
 
     /* likely since it only happens once */
@@ -146,6 +157,7 @@ void *stat_mem_allocate(size_t size, size_t line, const char *file) {
 
     if (stat_mem_high > stat_mem_peak)
         stat_mem_peak = stat_mem_high;
+    util_mutex_unlock(&stat_mem_lock);
 
     VALGRIND_MALLOCLIKE_BLOCK(data, size, sizeof(stat_mem_block_t), 0);
     return data;
@@ -165,6 +177,7 @@ void stat_mem_deallocate(void *ptr) {
      */
     VALGRIND_MAKE_MEM_DEFINED(info, sizeof(stat_mem_block_t));
 
+    util_mutex_lock(&stat_mem_lock);
     stat_mem_deallocated       += info->size;
     stat_mem_high              -= info->size;
     stat_mem_deallocated_total ++;
@@ -187,6 +200,7 @@ void stat_mem_deallocate(void *ptr) {
     /* move ahead */
     if (info == stat_mem_block_root)
         stat_mem_block_root = info->next;
+    util_mutex_unlock(&stat_mem_lock);
 
     free(info);
     VALGRIND_MAKE_MEM_NOACCESS(info, sizeof(stat_mem_block_t));
@@ -219,8 +233,10 @@ void *stat_mem_reallocate(void *ptr, size_t size, size_t line, const char *file)
     /* we need access to the old info redzone */
     VALGRIND_MAKE_MEM_DEFINED(oldinfo, sizeof(stat_mem_block_t));
 
-    memcpy(newinfo+1, oldinfo+1, oldinfo->size);
+    /* the block may shrink as well */
+    memcpy(newinfo+1, oldinfo+1, (oldinfo->size < size) ? oldinfo->size : size);
 
+    util_mutex_lock(&stat_mem_lock);
     if (oldinfo->prev) {
         /* just need access for a short period */
         VALGRIND_MAKE_MEM_DEFINED(oldinfo->prev, sizeof(stat_mem_block_t));
@@ -277,6 +293,7 @@ void *stat_mem_reallocate(void *ptr, size_t size, size_t line, const char *file)
 
     if (stat_mem_high > stat_mem_peak)
         stat_mem_peak = stat_mem_high;
+    util_mutex_unlock(&stat_mem_lock);
 
     free(oldinfo);
     VALGRIND_FREELIKE_BLOCK(ptr, sizeof(stat_mem_block_t));
@@ -301,8 +318,10 @@ char *stat_mem_strdup(const char *src, size_t line, const char *file, bool empty
         ptr[len] = '\0';
     }
 
+    util_mutex_lock(&stat_mem_lock);
     stat_used_strdups ++;
     stat_mem_strdups  += len;
+    util_mutex_unlock(&stat_mem_lock);
     return ptr;
 }
 
@@ -322,9 +341,11 @@ void _util_vec_grow(void **a, size_t i, size_t s) {
         m = i + 1;
         p = mem_a(s * m + sizeof(vector_t));
         ((vector_t*)p)->used = 0;
-        stat_used_vectors++;
     }
 
+    util_mutex_lock(&stat_size_lock);
+    if (!*a)
+        stat_used_vectors++;
     if (!stat_size_vectors)
         stat_size_vectors = stat_size_new();
 
@@ -334,6 +355,7 @@ void _util_vec_grow(void **a, size_t i, size_t s) {
         stat_size_put(stat_size_vectors, s, 1); /* start off with 1 */
         stat_type_vectors++;
     }
+    util_mutex_unlock(&stat_size_lock);
 
     *a = (vector_t*)p + 1;
     vec_meta(*a)->allocated = m;
@@ -514,9 +536,6 @@ hash_table_t *util_htnew(size_t size) {
     if (size < 1)
         return NULL;
 
-    if (!stat_size_hashtables)
-        stat_size_hashtables = stat_size_new();
-
     if (!(hashtable = (hash_table_t*)mem_a(sizeof(hash_table_t))))
         return NULL;
 
@@ -525,17 +544,22 @@ hash_table_t *util_htnew(size_t size) {
         return NULL;
     }
 
+    util_mutex_lock(&stat_size_lock);
+    if (!stat_size_hashtables)
+        stat_size_hashtables = stat_size_new();
+
     if ((find = stat_size_get(stat_size_hashtables, size)))
         find->value++;
     else {
         stat_type_hashtables++;
         stat_size_put(stat_size_hashtables, size, 1);
     }
+    stat_used_hashtables++;
+    util_mutex_unlock(&stat_size_lock);
 
     hashtable->size = size;
     memset(hashtable->table, 0, sizeof(hash_node_t*) * size);
 
-    stat_used_hashtables++;
     return hashtable;
 }
 
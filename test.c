@@ -257,6 +257,12 @@ static int task_pclose(FILE **handles) {
  *          Used to specify the INPUT source file to operate on, this must be
  *          provided, this tag is NOT optional
  *
+ *      X:
+ *          Used to run another program than the qcvm for executing the
+ *          task, like a host embedding the VM.  It is given the execution
+ *          flags and the compiled file like the qcvm.  Only valid when
+ *          T == -execute.
+ *
  *
  *  Notes:
  *      These tags have one-time use, using them more than once will result
@@ -282,6 +288,7 @@ typedef struct {
     char **comparematch;
     char  *rulesfile;
     char  *testflags;
+    char  *executor;
 } task_template_t;
 
 /*
@@ -303,6 +310,7 @@ static bool task_template_generate(task_template_t *tmpl, char tag, const char *
         case 'E': destval = &tmpl->executeflags;   break;
         case 'I': destval = &tmpl->sourcefile;     break;
         case 'F': destval = &tmpl->testflags;      break;
+        case 'X': destval = &tmpl->executor;       break;
         default:
             con_printmsg(LVL_ERROR, __FILE__, __LINE__, 0, "internal error",
                 "invalid tag `%c:` during code generation\n",
@@ -413,6 +421,7 @@ static bool task_template_parse(const char *file, task_template_t *tmpl, FILE *f
             case 'E':
             case 'I':
             case 'F':
+            case 'X':
                 if (data[1] != ':') {
                     con_printmsg(LVL_ERROR, file, line, 0, /*TODO: column for match*/ "tmpl parse error",
                         "expected `:` after `%c`",
@@ -499,6 +508,7 @@ static void task_template_nullify(task_template_t *tmpl) {
     tmpl->tempfilename   = NULL;
     tmpl->rulesfile      = NULL;
     tmpl->testflags      = NULL;
+    tmpl->executor       = NULL;
 }
 
 static task_template_t *task_template_compile(const char *file, const char *dir, size_t *pad) {
@@ -567,6 +577,10 @@ static task_template_t *task_template_compile(const char *file, const char *dir,
      * Now lets compile the template, compilation is really just
      * the process of validating the input.
      */
+    if (tmpl->executor && strcmp(tmpl->proceduretype, "-execute")) {
+        con_err("template compile error: %s tag `X:` when not executing\n", file);
+        goto failure;
+    }
     if (!strcmp(tmpl->proceduretype, "-compile")) {
         if (tmpl->executeflags)
             con_err("template compile warning: %s erroneous tag `E:` when only compiling\n", file);
@@ -633,6 +647,7 @@ static void task_template_destroy(task_template_t **tmpl) {
     if ((*tmpl)->sourcefile)     mem_d((*tmpl)->sourcefile);
     if ((*tmpl)->rulesfile)      mem_d((*tmpl)->rulesfile);
     if ((*tmpl)->testflags)      mem_d((*tmpl)->testflags);
+    if ((*tmpl)->executor)       mem_d((*tmpl)->executor);
 
     /*
      * Delete all allocated string for task tmpl then destroy the
@@ -971,18 +986,36 @@ static bool task_trymatch(size_t i, char ***line) {
     memset  (buffer,0,sizeof(buffer));
 
     if (!strcmp(tmpl->proceduretype, "-execute")) {
+        /*
+         * Additional QCVMFLAGS enviroment variable may be used to run
+         * all tests under another dispatch engine or with other VM
+         * options.  Like QCFLAGS these go BEFORE the flags of the
+         * template.  They are for the qcvm only, not for an executor
+         * given with `X:`.
+         */
+        const char *executor  = task_bins[TASK_EXECUTE];
+        const char *qcvmflags = getenv("QCVMFLAGS");
+        if (tmpl->executor) {
+            executor  = tmpl->executor;
+            qcvmflags = NULL;
+        }
+        if (!qcvmflags)
+            qcvmflags = "";
+
         /*
          * Drop the execution flags for the QCVM if none where
          * actually specified.
          */
         if (!strcmp(tmpl->executeflags, "$null")) {
-            util_snprintf(buffer,  sizeof(buffer), "%s %s",
-                task_bins[TASK_EXECUTE],
+            util_snprintf(buffer,  sizeof(buffer), "%s %s %s",
+                executor,
+                qcvmflags,
                 tmpl->tempfilename
             );
         } else {
-            util_snprintf(buffer,  sizeof(buffer), "%s %s %s",
-                task_bins[TASK_EXECUTE],
+            util_snprintf(buffer,  sizeof(buffer), "%s %s %s %s",
+                executor,
+                qcvmflags,
                 tmpl->executeflags,
                 tmpl->tempfilename
             );
@@ -1242,7 +1275,7 @@ static size_t task_schedualize(size_t *pad) {
             );
             for (; d < vec_size(task_tasks[i].tmpl->comparematch); d++) {
                 char  *select = task_tasks[i].tmpl->comparematch[d];
-                size_t length = 60 - strlen(select);
+                size_t length = (strlen(select) < 60) ? 60 - strlen(select) : 0;
 
                 con_out("        Expected: \"%s\"", select);
                 while (length --)
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Compiles a copy of tests/cache/progs.src with -cache= for the testsuite,
+# `X: ./tests/cache.sh` in a template, changing its files in between. For
+# every compile prints which files came from the cache, a line more when
+# the progs aren't exactly those of a compile without it, and what the
+# progs print.
+
+for progs; do :; done
+root="$(pwd)"
+work="${root}/${progs}.cache"
+
+rm -rf "${work}"
+cp -R tests/cache "${work}"
+cd "${work}" || exit 1
+
+compile() {
+    "${root}/gmqcc" -std=fteqcc -j1 > /dev/null 2>&1
+    mv progs.dat plain.dat
+    echo "$1: reused" $("${root}/gmqcc" -std=fteqcc -j1 -cache=cache -debug 2>&1 |
+        sed -n -e 's/^\[COM\] reusing `\(.*\)` preprocessed$/\1/p')
+    cmp -s plain.dat progs.dat || echo "$1: the progs differ from those without the cache"
+    "${root}/qcvm" progs.dat
+}
+
+compile first
+compile again
+echo '#define BONUS 5' > extra.qh
+compile header
+sed -e 's/LEVEL 2/LEVEL 7/' config.qc > config.new && mv config.new config.qc
+compile macro
+echo '#define BONUS 9' > sub/extra.qh
+compile include
+compile last
+
+cd "${root}" && rm -rf "${work}"
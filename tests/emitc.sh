@@ -0,0 +1,24 @@
+#!/bin/sh
+# Runs a program with qcvm and once more with its functions translated to
+# C by qcvm -emit-c, for the testsuite: `X: ./tests/emitc.sh` in a
+# template. Prints what the translated program printed, and a line more
+# when that isn't exactly what the VM printed.
+
+for progs; do :; done
+work="${progs}.emitc"
+cc="${CC:-cc}"
+
+./qcvm "$@" > "${work}.vm" 2>&1
+if ! ./qcvm -emit-c "${work}.c" "${progs}" ||
+   ! ${cc} -o "${work}" -I. -DQCVM_EXECUTOR=1 -DQCVM_NATIVES=TMPDAT_natives \
+        exec.c "${work}.c" libqcvm.a -lm -lpthread
+then
+    echo "emit-c: failed to build the translated program"
+    rm -f "${work}.vm" "${work}.c" "${work}"
+    exit 1
+fi
+
+"./${work}" "$@" > "${work}.native" 2>&1
+cat "${work}.native"
+cmp -s "${work}.vm" "${work}.native" || echo "emit-c: the translated program differs from the VM"
+rm -f "${work}.vm" "${work}.native" "${work}.c" "${work}"
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/*
+ * What the hosts embedding the VM for the testsuite share: the builtins,
+ * loading a program with them and running one of the tests a host has.
+ */
+
+static int host_print(qc_program_t *prog) {
+    int i;
+    for (i = 0; i < prog->argc; ++i)
+        fputs(prog_getstring(prog, prog->globals[OFS_PARM0 + 3*i]), stdout);
+    return 0;
+}
+
+static int host_add(qc_program_t *prog) {
+    qcany_t *a = (qcany_t*)(prog->globals + OFS_PARM0);
+    qcany_t *b = (qcany_t*)(prog->globals + OFS_PARM1);
+    prog_return(prog)->_float = a->_float + b->_float;
+    return 0;
+}
+
+static int host_spawn(qc_program_t *prog) {
+    prog_return(prog)->edict = prog_spawn_entity(prog);
+    return 0;
+}
+
+static int host_ftos(qc_program_t *prog) {
+    char buffer[64];
+    util_snprintf(buffer, sizeof(buffer), "%g", ((qcany_t*)(prog->globals + OFS_PARM0))->_float);
+    prog_return(prog)->string = prog_tempstring(prog, buffer);
+    return 0;
+}
+
+static int host_etos(qc_program_t *prog) {
+    char buffer[64];
+    util_snprintf(buffer, sizeof(buffer), "%i", (int)((qcany_t*)(prog->globals + OFS_PARM0))->edict);
+    prog_return(prog)->string = prog_tempstring(prog, buffer);
+    return 0;
+}
+
+static int host_strcat(qc_program_t *prog) {
+    char   buffer[1024];
+    size_t len = 0;
+    int    i;
+    for (i = 0; i < prog->argc; ++i) {
+        const char *str  = prog_getstring(prog, prog->globals[OFS_PARM0 + 3*i]);
+        size_t      more = strlen(str);
+        if (more > sizeof(buffer) - 1 - len)
+            more = sizeof(buffer) - 1 - len;
+        memcpy(buffer + len, str, more);
+        len += more;
+    }
+    buffer[len] = '\0';
+    prog_return(prog)->string = prog_tempstring(prog, buffer);
+    return 0;
+}
+
+/* like the error builtin of qcvm: the call fails */
+static int host_qcerror(qc_program_t *prog) {
+    printf("error: %s\n", prog_getstring(prog, prog->globals[OFS_PARM0]));
+    prog->vmerror++;
+    return -1;
+}
+
+static void host_error(qc_program_t *prog, const char *message) {
+    (void)prog;
+    printf("error: %s\n", message);
+}
+
+qc_program_t *host_load(const char *file) {
+    qc_program_t *prog = prog_load(file, false);
+    if (!prog) {
+        printf("failed to load %s\n", file);
+        return NULL;
+    }
+    prog->error = host_error;
+    prog_builtin_register(prog, "print", host_print);
+    prog_builtin_register(prog, "spawn", host_spawn);
+    prog_builtin_register(prog, "ftos", host_ftos);
+    prog_builtin_register(prog, "etos", host_etos);
+    prog_builtin_register(prog, "strcat", host_strcat);
+    prog_builtin_register(prog, "error", host_qcerror);
+    prog_builtin_set(prog, 100, host_add);
+    return prog;
+}
+
+prog_section_function_t *host_function(qc_program_t *prog, const char *name) {
+    prog_section_function_t *func = prog_findfunction(prog, name);
+    if (!func)
+        printf("no function %s\n", name);
+    return func;
+}
+
+float host_global(qc_program_t *prog, const char *name) {
+    prog_section_def_t *def = prog_finddef(prog, name);
+    return def ? prog_getglobal(prog, def)->_float : -1.0f;
+}
+
+/*
+ * Writes a copy of `file` to `copy` after letting `patch` change the
+ * data of the file, whose header is passed along.
+ */
+bool host_copy(const char *file, const char *copy, host_patch_t patch, const void *arg) {
+    prog_header_t  header;
+    char          *data = NULL;
+    FILE          *in;
+    FILE          *out;
+    long           size;
+    bool           success = false;
+
+    if (!(in = fopen(file, "rb")))
+        return false;
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    data = (char*)mem_a(size);
+    if (fread(data, size, 1, in) != 1) {
+        fclose(in);
+        mem_d(data);
+        return false;
+    }
+    fclose(in);
+
+    memcpy(&header, data, sizeof(header));
+    patch(data, &header, arg);
+    memcpy(data, &header, sizeof(header));
+
+    if ((out = fopen(copy, "wb"))) {
+        success = (fwrite(data, size, 1, out) == 1);
+        fclose(out);
+    }
+    mem_d(data);
+    return success;
+}
+
+int main(int argc, char **argv) {
+    qc_program_t *prog;
+    size_t        i;
+    bool          success;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <test> <progs.dat>\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 0; host_tests[i].name; ++i) {
+        if (!strcmp(host_tests[i].name, argv[1]))
+            break;
+    }
+    if (!host_tests[i].name) {
+        fprintf(stderr, "unknown test: %s\n", argv[1]);
+        return 1;
+    }
+
+    if (!(prog = host_load(argv[2])))
+        return 1;
+    success = host_tests[i].run(prog, argv[2]);
+    prog_delete(prog);
+    if (!success)
+        printf("%s failed\n", argv[1]);
+    return success ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef GMQCC_TESTS_HOST_HDR
+#define GMQCC_TESTS_HOST_HDR
+#include "gmqcc.h"
+
+/*
+ * Hosts embedding the VM through libqcvm, for the testsuite. Each of them
+ * is linked with tests/host.c and covers one part of the API. Templates
+ * run them with `X:` as `<host> <test> <progs.dat>` and match what the
+ * test prints.
+ */
+typedef struct {
+    const char *name;
+    bool      (*run)(qc_program_t *prog, const char *file);
+} host_test_t;
+
+/* the tests of a host, up to one without a name */
+extern const host_test_t host_tests[];
+
+/* loads a program with the builtins of the hosts */
+qc_program_t            *host_load    (const char *file);
+prog_section_function_t *host_function(qc_program_t *prog, const char *name);
+float                    host_global  (qc_program_t *prog, const char *name);
+
+/* copies a program file with changes made by `patch` */
+typedef void (*host_patch_t)(char *data, prog_header_t *header, const void *arg);
+bool host_copy(const char *file, const char *copy, host_patch_t patch, const void *arg);
+
+#endif
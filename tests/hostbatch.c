@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing a function run for a list of entities, see host.h */
+
+/*
+ * tests/batch.qc: a function run once for every entity of a list, where
+ * a failing call and an entity which was never spawned don't stop the
+ * rest of the list, and self is left as it was
+ */
+static bool host_test_batch(qc_program_t *prog, const char *file) {
+    static const qcint_t entities[] = { 1, 2, 3, 5, 2 };
+    prog_section_def_t  *health     = prog_findfield(prog, "health");
+    qcint_t              e;
+
+    for (e = 1; e <= 4; ++e) {
+        if (prog_spawn_entity(prog) != e)
+            return false;
+        prog_getfield(prog, e, health)->_float = e == 3 ? -1 : e;
+    }
+    prog->globals[prog_finddef(prog, "self")->offset] = 4;
+    printf("batch: %s\n", prog_exec_batch(prog, host_function(prog, "think"), entities,
+                                          GMQCC_ARRAY_COUNT(entities), VMXF_DEFAULT, VM_JUMPS_DEFAULT)
+                           ? "ok" : "failed");
+    for (e = 1; e <= 4; ++e)
+        printf("%d: %g\n", (int)e, prog_getfield(prog, e, health)->_float);
+    printf("thought: %g\n", host_global(prog, "thought"));
+    printf("self: %d\n", (int)prog->globals[prog_finddef(prog, "self")->offset]);
+    (void)file;
+    return true;
+}
+
+const host_test_t host_tests[] = {
+    { "batch", host_test_batch },
+    { NULL, NULL }
+};
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing the decoded instructions of a program, see host.h */
+
+/* replaces the statements from `first` up to the end of the code */
+typedef struct {
+    size_t                   first;
+    prog_section_statement_t st;
+} host_statements_t;
+
+static void host_patch_statements(char *data, prog_header_t *header, const void *arg) {
+    const host_statements_t *patch = (const host_statements_t*)arg;
+    size_t                   i;
+    for (i = patch->first; i < header->statements.length; ++i)
+        memcpy(data + header->statements.offset + i * sizeof(patch->st), &patch->st, sizeof(patch->st));
+}
+
+/*
+ * tests/jumps.qc: jumps patched to leave the code, and code patched to
+ * run past its end, stop at an illegal instruction instead of executing
+ * whatever is behind the decoded instructions
+ */
+static bool host_test_decode(qc_program_t *prog, const char *file) {
+    static const char *what[] = { "forward", "backward", "past the end" };
+    prog_section_function_t *count = host_function(prog, "count");
+    prog_section_function_t *last  = host_function(prog, "last");
+    char                     copy[4096];
+    size_t                   jump, ret, i;
+
+    if (!count || !last)
+        return false;
+    for (jump = count->entry; prog->code[jump].opcode != INSTR_GOTO; ++jump)
+        ;
+    for (ret = last->entry; prog->code[ret].opcode != INSTR_RETURN; ++ret)
+        ;
+
+    prog_setparm_float(prog, 0, 3);
+    if (!prog_call(prog, count, 1))
+        return false;
+    printf("counted: %g\n", host_global(prog, "counted"));
+
+    util_snprintf(copy, sizeof(copy), "%s.patched", file);
+    for (i = 0; i < GMQCC_ARRAY_COUNT(what); ++i) {
+        host_statements_t patch;
+        qc_program_t     *bad;
+
+        memset(&patch, 0, sizeof(patch));
+        switch (i) {
+            case 0:
+                patch.first     = jump;
+                patch.st.opcode = INSTR_GOTO;
+                patch.st.o1.s1  = 0x7FFF;
+                break;
+            case 1:
+                patch.first     = jump;
+                patch.st.opcode = INSTR_GOTO;
+                patch.st.o1.s1  = -(int16_t)jump - 1;
+                break;
+            default:
+                patch.first     = ret;
+                patch.st.opcode = INSTR_ADD_F;
+                break;
+        }
+        if (!host_copy(file, copy, host_patch_statements, &patch) || !(bad = host_load(copy)))
+            return false;
+
+        printf("%s: ", what[i]);
+        fflush(stdout);
+        prog_setparm_float(bad, 0, 3);
+        printf("%s\n", prog_call(bad, prog_findfunction(bad, (i < 2) ? "count" : "last"), 1) ? "ran" : "stopped");
+        prog_delete(bad);
+        remove(copy);
+    }
+    return true;
+}
+
+const host_test_t host_tests[] = {
+    { "decode", host_test_decode },
+    { NULL, NULL }
+};
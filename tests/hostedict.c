@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing the layouts of the entities, see host.h */
+
+/*
+ * tests/lookup.qc: the fields of an entity returned by prog_getedict are
+ * `fieldstride` apart in either layout, also after switching the layout
+ * with entities alive
+ */
+static bool host_test_edict(qc_program_t *prog, const char *file) {
+    static const int    layouts[] = { VMENTITY_ENTITY_MAJOR, VMENTITY_FIELD_MAJOR, VMENTITY_ENTITY_MAJOR };
+    static const char  *names[]   = { "entity-major", "field-major", "entity-major" };
+    prog_section_def_t *health    = prog_findfield(prog, "health");
+    prog_section_def_t *velocity  = prog_findfield(prog, "velocity");
+    qcint_t             e;
+    size_t              i;
+
+    /* written with the default layout, where the components of a vector are contiguous */
+    for (e = 1; e <= 3; ++e) {
+        qcany_t *vel;
+        if (prog_spawn_entity(prog) != e)
+            return false;
+        prog_getfield(prog, e, health)->_float = e * 10;
+        vel = prog_getfield(prog, e, velocity);
+        vel->vector[0] = e;
+        vel->vector[1] = e + 1;
+        vel->vector[2] = e + 2;
+    }
+
+    for (i = 0; i < GMQCC_ARRAY_COUNT(layouts); ++i) {
+        prog_entity_layout(prog, layouts[i]);
+        for (e = 1; e <= 3; ++e) {
+            qcint_t *ed     = (qcint_t*)prog_getedict(prog, e);
+            size_t   stride = prog->fieldstride;
+            printf("%s: %d: %g '%g %g %g'\n", names[i], (int)e,
+                   ((qcany_t*)(ed + health->offset * stride))->_float,
+                   ((qcany_t*)(ed + velocity->offset * stride))->_float,
+                   ((qcany_t*)(ed + (velocity->offset + 1) * stride))->_float,
+                   ((qcany_t*)(ed + (velocity->offset + 2) * stride))->_float);
+        }
+    }
+    (void)file;
+    return true;
+}
+
+const host_test_t host_tests[] = {
+    { "edict", host_test_edict },
+    { NULL, NULL }
+};
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing the lookups of defs, fields and functions, see host.h */
+
+/* the first def named `name`, or at `offset` if no name is given, by searching */
+static prog_section_def_t *host_search(qc_program_t *prog, prog_section_def_t *defs, size_t count,
+                                       const char *name, qcint_t offset)
+{
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        if (name ? !strcmp(prog_getstring(prog, defs[i].name), name) : defs[i].offset == offset)
+            return defs + i;
+    }
+    return NULL;
+}
+
+static bool host_check_defs(qc_program_t *prog, const char *what, prog_section_def_t *defs, size_t count,
+                            prog_section_def_t *(*byname)(qc_program_t*, const char*),
+                            prog_section_def_t *(*byoffset)(qc_program_t*, qcint_t))
+{
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        const char *name = prog_getstring(prog, defs[i].name);
+        if (byname(prog, name) != host_search(prog, defs, count, name, 0) ||
+            byoffset(prog, defs[i].offset) != host_search(prog, defs, count, NULL, defs[i].offset))
+        {
+            printf("%s: wrong lookup of %s\n", what, name);
+            return false;
+        }
+    }
+    printf("%s: %s\n", what, (byname(prog, "nothing") || byoffset(prog, -1) || byoffset(prog, 0x7FFFFFFF))
+                                 ? "found what doesn't exist" : "ok");
+    return true;
+}
+
+/*
+ * tests/lookup.qc: the lookups by name and offset find the same def,
+ * field or function as a search from the start, also where several
+ * share an offset
+ */
+static bool host_test_index(qc_program_t *prog, const char *file) {
+    prog_section_def_t *def;
+    size_t              i;
+
+    if (!host_check_defs(prog, "defs",   prog->defs,   prog->defs_count,   prog_finddef,   prog_getdef) ||
+        !host_check_defs(prog, "fields", prog->fields, prog->fields_count, prog_findfield, prog_entfield))
+    {
+        return false;
+    }
+
+    for (i = 1; i < prog->functions_count; ++i) {
+        const char *name = prog_getstring(prog, prog->functions[i].name);
+        size_t      j;
+        for (j = 1; strcmp(prog_getstring(prog, prog->functions[j].name), name); ++j)
+            ;
+        if (prog_findfunction(prog, name) != prog->functions + j) {
+            printf("functions: wrong lookup of %s\n", name);
+            return false;
+        }
+    }
+    printf("functions: %s\n", prog_findfunction(prog, "nothing") ? "found what doesn't exist" : "ok");
+
+    /* the components of a vector share their offsets with it, the vector comes first */
+    def = prog_getdef(prog, prog_finddef(prog, "origin_x")->offset);
+    printf("global at the offset of origin_x: %s\n", prog_getstring(prog, def->name));
+    def = prog_entfield(prog, prog_findfield(prog, "velocity_x")->offset);
+    printf("field at the offset of velocity_x: %s\n", prog_getstring(prog, def->name));
+    (void)file;
+    return true;
+}
+
+const host_test_t host_tests[] = {
+    { "index", host_test_index },
+    { NULL, NULL }
+};
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing programs loaded with their sections mapped, see host.h */
+
+/* drops the terminator of the last string */
+static void host_patch_strings(char *data, prog_header_t *header, const void *arg) {
+    (void)data;
+    (void)arg;
+    header->strings.length--;
+}
+
+static bool host_greet(qc_program_t *prog, const char *who) {
+    prog_setparm_string(prog, 0, who);
+    return prog_call(prog, host_function(prog, "greet"), 1);
+}
+
+/*
+ * tests/embed.qc: the read-only sections are mapped from the file on
+ * little endian machines, each program loaded from it gets a mapping
+ * of its own, and files which can't be used as they are, like one with
+ * unterminated strings, are read instead
+ */
+static bool host_test_map(qc_program_t *prog, const char *file) {
+    qc_program_t *again;
+    qc_program_t *read;
+    char          copy[4096];
+
+    printf("first: %s\n", prog->map ? "mapped" : "read");
+    if (!(again = host_load(file)))
+        return false;
+    printf("second: %s\n", (again->map && again->map != prog->map) ? "mapped" : "read");
+
+    if (!host_greet(prog, "first") || !host_greet(again, "second"))
+        return false;
+    prog_delete(again);
+    if (!host_greet(prog, "first again"))
+        return false;
+
+    util_snprintf(copy, sizeof(copy), "%s.patched", file);
+    if (!host_copy(file, copy, host_patch_strings, NULL) || !(read = host_load(copy)))
+        return false;
+    printf("unterminated strings: %s\n", read->map ? "mapped" : "read");
+    if (!host_greet(read, "copy"))
+        return false;
+    prog_delete(read);
+    remove(copy);
+    return true;
+}
+
+const host_test_t host_tests[] = {
+    { "map", host_test_map },
+    { NULL, NULL }
+};
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing the allocator the library shares with the compiler, see host.h */
+
+/*
+ * blocks reallocated to be smaller keep what fits of their contents and
+ * nothing is copied past their end, which corrupted the heap before
+ */
+static bool host_test_shrink(qc_program_t *prog, const char *file) {
+    static const size_t sizes[] = { 1 << 20, 16, 4096, 1, 65536, 100 };
+    unsigned char      *block   = (unsigned char*)mem_a(1 << 20);
+    size_t              have    = 1 << 20;
+    size_t              i, k;
+
+    for (k = 0; k < have; ++k)
+        block[k] = (unsigned char)k;
+    for (i = 0; i < GMQCC_ARRAY_COUNT(sizes); ++i) {
+        unsigned char *other = (unsigned char*)mem_a(64);
+        size_t         kept  = have < sizes[i] ? have : sizes[i];
+
+        block = (unsigned char*)mem_r(block, sizes[i]);
+        for (k = 0; k < kept; ++k) {
+            if (block[k] != (unsigned char)k) {
+                printf("%u bytes: lost byte %u\n", (unsigned)sizes[i], (unsigned)k);
+                mem_d(block);
+                mem_d(other);
+                return false;
+            }
+        }
+        for (k = kept; k < sizes[i]; ++k)
+            block[k] = (unsigned char)k;
+        have = sizes[i];
+        memset(other, 0, 64);
+        mem_d(other);
+        printf("%u bytes: ok\n", (unsigned)sizes[i]);
+    }
+    mem_d(block);
+    (void)prog;
+    (void)file;
+    return true;
+}
+
+const host_test_t host_tests[] = {
+    { "shrink", host_test_shrink },
+    { NULL, NULL }
+};
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing calls specialized for a verified program, see host.h */
+
+/* the builtin #100 of the hosts, as an intrinsic */
+static void host_add_intrinsic(qcany_t *out, const qcany_t *a, const qcany_t *b) {
+    out->_float = a->_float + b->_float;
+}
+
+/* the dispatch engine the calls run with */
+static size_t host_xflags = VMXF_THREADED;
+
+static bool host_call(qc_program_t *prog, const char *name, size_t argc) {
+    prog->argc = (int)argc;
+    return prog_exec(prog, host_function(prog, name), host_xflags, VM_JUMPS_DEFAULT);
+}
+
+/*
+ * tests/embed.qc: the call of `add` goes straight to the function once
+ * the program verifies, and the call of `hostadd` to its intrinsic, but
+ * both still follow the host changing the global
+ */
+static bool host_test_retarget(qc_program_t *prog, const char *file) {
+    static const char  *targets[] = { "add", NULL, "sub", "add" };
+    prog_section_def_t *op        = prog_finddef(prog, "add");
+    size_t              i;
+
+    if (!op || !prog_verify(prog)) {
+        printf("retarget: doesn't verify\n");
+        return false;
+    }
+    for (i = 0; i < GMQCC_ARRAY_COUNT(targets); ++i) {
+        prog_getglobal(prog, op)->function = targets[i] ? host_function(prog, targets[i]) - prog->functions : 0;
+        prog_setparm_float(prog, 0, 5);
+        prog_setparm_float(prog, 1, 3);
+        if (host_call(prog, "apply", 2))
+            printf("%s: %g\n", targets[i] ? targets[i] : "null", prog_return(prog)->_float);
+        else
+            printf("%s: failed\n", targets[i] ? targets[i] : "null");
+    }
+
+    prog_intrinsic_set(prog, 100, host_add_intrinsic, 2);
+    for (i = 0; i < 2; ++i) {
+        prog_setparm_float(prog, 0, 4);
+        printf("twice: %s\n", host_call(prog, "twice", 1) ? "ok" : "failed");
+        prog_getglobal(prog, prog_finddef(prog, "hostadd"))->function = host_function(prog, "missing") - prog->functions;
+    }
+    (void)file;
+    return true;
+}
+
+/* the same with the closure engine, whose handlers fall back on their own */
+static bool host_test_retarget_closure(qc_program_t *prog, const char *file) {
+    host_xflags = VMXF_CLOSURE;
+    return host_test_retarget(prog, file);
+}
+
+const host_test_t host_tests[] = {
+    { "retarget",         host_test_retarget         },
+    { "retarget-closure", host_test_retarget_closure },
+    { NULL, NULL }
+};
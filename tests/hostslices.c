@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing calls run with a budget, suspended and resumed, see host.h */
+
+static const char *host_exec_result(int result) {
+    switch (result) {
+        case VMEXEC_DONE:      return "done";
+        case VMEXEC_SUSPENDED: return "suspended";
+        default:               return "error";
+    }
+}
+
+/* resumes the last suspended call with `budget` until it's done */
+static int host_finish(qc_program_t *prog, long budget, size_t *slices) {
+    int result = VMEXEC_SUSPENDED;
+    for (*slices = 1; result == VMEXEC_SUSPENDED; ++*slices)
+        result = prog_resume(prog, budget);
+    return result;
+}
+
+/* the dispatch engine the calls run with */
+static size_t host_xflags = VMXF_DEFAULT;
+
+static int host_count(qc_program_t *prog, float n, long maxjumps, long budget) {
+    prog_setparm_float(prog, 0, n);
+    return prog_exec_budget(prog, host_function(prog, "count"), host_xflags, maxjumps, budget);
+}
+
+/*
+ * tests/slices.qc: a call run a few instructions at a time, other calls
+ * and budgeted calls made while it is suspended, and suspended calls
+ * aborted
+ */
+static bool host_test_budget(qc_program_t *prog, const char *file) {
+    size_t slices;
+    int    result;
+
+    /* the runaway counter starts over in every slice */
+    printf("count: %s\n", host_exec_result(host_count(prog, 100, 30, 50)));
+    result = host_finish(prog, 50, &slices);
+    printf("count: %s, %g, %s\n", host_exec_result(result), prog_return(prog)->_float,
+           slices > 2 ? "in slices" : "at once");
+    printf("runaway: %s\n", host_exec_result(host_count(prog, 100, 30, 1000)));
+
+    /* suspended calls nest, the last one is resumed first */
+    printf("outer: %s\n", host_exec_result(host_count(prog, 100, VM_JUMPS_DEFAULT, 50)));
+    prog_setparm_float(prog, 0, 5);
+    if (!prog_call(prog, host_function(prog, "count"), 1))
+        return false;
+    printf("call: %g\n", prog_return(prog)->_float);
+    printf("inner: %s\n", host_exec_result(host_count(prog, 10, VM_JUMPS_DEFAULT, 20)));
+    result = host_finish(prog, 20, &slices);
+    printf("inner: %s, %g\n", host_exec_result(result), prog_return(prog)->_float);
+    result = host_finish(prog, 50, &slices);
+    printf("outer: %s, %g\n", host_exec_result(result), prog_return(prog)->_float);
+
+    /* aborted calls never finish, the ones below them still do */
+    prog_getglobal(prog, prog_finddef(prog, "counted"))->_float = 0;
+    printf("outer: %s\n", host_exec_result(host_count(prog, 100, VM_JUMPS_DEFAULT, 50)));
+    printf("inner: %s\n", host_exec_result(host_count(prog, 10, VM_JUMPS_DEFAULT, 20)));
+    printf("abort: %s\n", prog_abort(prog) ? "ok" : "failed");
+    result = host_finish(prog, 50, &slices);
+    printf("outer: %s, %g\n", host_exec_result(result), prog_return(prog)->_float);
+    printf("outer: %s\n", host_exec_result(host_count(prog, 100, VM_JUMPS_DEFAULT, 50)));
+    printf("abort: %s\n", prog_abort(prog) ? "ok" : "failed");
+    printf("abort: %s\n", prog_abort(prog) ? "ok" : "failed");
+    printf("resume: %s\n", host_exec_result(prog_resume(prog, 50)));
+    printf("counted: %g, stack: %u\n", host_global(prog, "counted"), (unsigned)vec_size(prog->stack));
+    (void)file;
+    return true;
+}
+
+/* the same with the closure engine */
+static bool host_test_budget_closure(qc_program_t *prog, const char *file) {
+    host_xflags = VMXF_CLOSURE;
+    return host_test_budget(prog, file);
+}
+
+const host_test_t host_tests[] = {
+    { "budget",         host_test_budget         },
+    { "budget-closure", host_test_budget_closure },
+    { NULL, NULL }
+};
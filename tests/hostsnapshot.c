@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing snapshots of the state of a program, see host.h */
+
+static bool host_run(qc_program_t *prog, const char *name, float arg) {
+    prog_setparm_float(prog, 0, arg);
+    return prog_call(prog, host_function(prog, name), 1);
+}
+
+static bool host_show(qc_program_t *prog, const char *what) {
+    printf("%s: ", what);
+    fflush(stdout);
+    return host_run(prog, "show", 0);
+}
+
+/*
+ * tests/snapshot.qc: restoring the last snapshot only copies what changed,
+ * a saved snapshot goes into another program, and a snapshot of another
+ * program with the same id as our last one is copied completely
+ */
+static bool host_test_snapshot(qc_program_t *prog, const char *file) {
+    char           name[1024];
+    qc_program_t  *other    = NULL;
+    qc_snapshot_t *snapshot = NULL;
+    qc_snapshot_t *loaded   = NULL;
+    bool           success  = false;
+
+    util_snprintf(name, sizeof(name), "%s.snap", file);
+    if (!host_run(prog, "setup", 0) || !(snapshot = prog_snapshot(prog)))
+        goto cleanup;
+    if (!host_run(prog, "hit", 10) || !host_run(prog, "hit", 20) || !host_show(prog, "hits"))
+        goto cleanup;
+    if (!prog_restore(prog, snapshot) || !host_show(prog, "restored"))
+        goto cleanup;
+
+    if (!host_run(prog, "hit", 5) || !prog_snapshot_update(prog, snapshot))
+        goto cleanup;
+    if (!host_run(prog, "hit", 7) || !prog_restore(prog, snapshot) || !host_show(prog, "updated"))
+        goto cleanup;
+
+    if (!prog_snapshot_save(prog, snapshot, name) || !(other = host_load(file)))
+        goto cleanup;
+    if (!(loaded = prog_snapshot_load(other, name)) || !prog_restore(other, loaded))
+        goto cleanup;
+    if (!host_show(other, "loaded"))
+        goto cleanup;
+
+    /* our snapshot has the same id as the loaded one of the other program */
+    prog_reset(prog);
+    if (!host_run(prog, "setup", 0) || !prog_snapshot_update(prog, snapshot))
+        goto cleanup;
+    if (!prog_restore(prog, loaded) || !host_show(prog, "other"))
+        goto cleanup;
+    success = true;
+
+cleanup:
+    if (snapshot) prog_snapshot_delete(snapshot);
+    if (loaded)   prog_snapshot_delete(loaded);
+    if (other)    prog_delete(other);
+    remove(name);
+    return success;
+}
+
+/* a damaged copy of a saved snapshot */
+typedef struct {
+    const char *what;
+    long        word;   /* the header word to set, -1 for the first block size, 0 for none */
+    uint32_t    value;
+    long        resize; /* bytes added to the end of the file, or taken off */
+} host_damage_t;
+
+static void host_word(unsigned char *data, size_t word, uint32_t value) {
+    size_t i;
+    for (i = 0; i < 4; ++i)
+        data[8 + word * 4 + i] = (unsigned char)(value >> (i * 8));
+}
+
+static uint32_t host_word_at(const unsigned char *data, size_t word) {
+    return (uint32_t)data[8 + word * 4]        | (uint32_t)data[9 + word * 4] << 8 |
+           (uint32_t)data[10 + word * 4] << 16 | (uint32_t)data[11 + word * 4] << 24;
+}
+
+/*
+ * tests/snapshot.qc: snapshot files whose header doesn't add up to what
+ * is in the file, because it's damaged or the file was cut short or
+ * appended to, are rejected without trusting the counts
+ */
+static bool host_test_damaged(qc_program_t *prog, const char *file) {
+    static const host_damage_t damages[] = {
+        { "intact",            0, 0,          0  },
+        { "truncated",         0, 0,          -1 },
+        { "appended",          0, 0,          1  },
+        { "entities",          4, 0x00100000, 0  },
+        { "free entities",     5, 0x7FFFFFFF, 0  },
+        { "tempstrings",       7, 0xFFFFFFFF, 0  },
+        { "tempstring block", -1, 0x7FFFFFFF, 0  }
+    };
+    char           name[1024];
+    char           copy[1024];
+    unsigned char *data     = NULL;
+    qc_snapshot_t *snapshot = NULL;
+    FILE          *fp;
+    long           size     = 0;
+    size_t         i;
+    bool           success  = false;
+
+    util_snprintf(name, sizeof(name), "%s.snap", file);
+    util_snprintf(copy, sizeof(copy), "%s.damaged", file);
+    if (!host_run(prog, "setup", 0) || !host_show(prog, "saved") || !(snapshot = prog_snapshot(prog)))
+        goto cleanup;
+    if (!prog_snapshot_save(prog, snapshot, name) || !(fp = fopen(name, "rb")))
+        goto cleanup;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = (unsigned char*)mem_a(size + 1);
+    if (fread(data, size, 1, fp) != 1) {
+        fclose(fp);
+        goto cleanup;
+    }
+    fclose(fp);
+    data[size] = 0;
+
+    for (i = 0; i < GMQCC_ARRAY_COUNT(damages); ++i) {
+        unsigned char *damaged = (unsigned char*)mem_a(size + 1);
+        qc_snapshot_t *loaded;
+        size_t         word    = damages[i].word;
+
+        memcpy(damaged, data, size + 1);
+        if (damages[i].word < 0) {
+            /* the block sizes follow the globals and the entities */
+            word = 11 + VM_TEMPSTRING_CLASSES + host_word_at(data, 3) + host_word_at(data, 4) +
+                   host_word_at(data, 5) + host_word_at(data, 4) * prog->entityfields;
+            if (!host_word_at(data, 6)) {
+                printf("%s: no tempstrings\n", damages[i].what);
+                mem_d(damaged);
+                goto cleanup;
+            }
+        }
+        if (damages[i].word)
+            host_word(damaged, word, damages[i].value);
+        if (!(fp = fopen(copy, "wb"))) {
+            mem_d(damaged);
+            goto cleanup;
+        }
+        fwrite(damaged, size + damages[i].resize, 1, fp);
+        fclose(fp);
+        mem_d(damaged);
+
+        loaded = prog_snapshot_load(prog, copy);
+        printf("%s: %s\n", damages[i].what, loaded ? "loaded" : "rejected");
+        if (loaded)
+            prog_snapshot_delete(loaded);
+    }
+    success = true;
+
+cleanup:
+    if (snapshot) prog_snapshot_delete(snapshot);
+    if (data)     mem_d(data);
+    remove(name);
+    remove(copy);
+    return success;
+}
+
+const host_test_t host_tests[] = {
+    { "snapshot", host_test_snapshot },
+    { "damaged",  host_test_damaged  },
+    { NULL, NULL }
+};
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Runs qcvm -disasm-func for the testsuite, `X: ./tests/layout.sh` in a
+# template, keeping only the instructions so the layout of a function can
+# be matched without its global numbers.
+
+./qcvm "$@" | sed -n -e 's/^ <> \([A-Z_0-9]*\).*/\1/p'
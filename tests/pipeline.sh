@@ -0,0 +1,19 @@
+#!/bin/sh
+# Compiles tests/pipeline/progs.src for the testsuite, `X: ./tests/pipeline.sh`
+# in a template: with -j4 its files are preprocessed ahead on other
+# threads. Prints which of them were taken over from there and a line more
+# when the diagnostics or progs aren't exactly those of -j1, then runs the
+# progs of -j1.
+
+cd tests/pipeline || exit 1
+
+../../gmqcc -std=fteqcc -j1 > j1.log 2>&1
+mv progs.dat j1.dat
+../../gmqcc -std=fteqcc -j4 > j4.log 2>&1
+cmp -s j1.log j4.log || echo "-j4: the diagnostics differ"
+cmp -s j1.dat progs.dat || echo "-j4: the progs differ"
+
+../../gmqcc -std=fteqcc -j4 -debug 2>&1 | sed -n -e 's/^\[COM\] reusing `\(.*\)` preprocessed$/reused \1/p'
+
+../../qcvm j1.dat
+rm -f progs.dat j1.dat j1.log j4.log
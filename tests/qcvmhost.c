@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2012, 2013, 2014
+ *     Wolfgang Bumiller
+ *     Dale Weiler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+
+/* a host testing the embedding API: calls, builtins and errors, see host.h */
+
+/* tests/embed.qc: calls from the host with parameters and results */
+static bool host_test_call(qc_program_t *prog, const char *file) {
+    static const qcfloat_t vec[3] = { 1, 2, 3 };
+    qcany_t *ret;
+
+    prog_setparm_float(prog, 0, 2);
+    prog_setparm_float(prog, 1, 3);
+    if (!prog_call(prog, host_function(prog, "add"), 2))
+        return false;
+    printf("add: %g\n", prog_return(prog)->_float);
+
+    prog_setparm_vector(prog, 0, vec);
+    prog_setparm_float(prog, 1, 2);
+    if (!prog_call(prog, host_function(prog, "scale"), 2))
+        return false;
+    ret = prog_return(prog);
+    printf("scale: '%g %g %g'\n", ret->vector[0], ret->vector[1], ret->vector[2]);
+
+    prog_setparm_string(prog, 0, "host");
+    if (!prog_call(prog, host_function(prog, "greet"), 1))
+        return false;
+
+    /* a QC function calling a builtin of the host, and the builtin itself */
+    prog_setparm_float(prog, 0, 4);
+    if (!prog_call(prog, host_function(prog, "twice"), 1))
+        return false;
+    printf("twice: %g\n", prog_return(prog)->_float);
+    prog_setparm_float(prog, 0, 5);
+    prog_setparm_float(prog, 1, 6);
+    if (!prog_call(prog, host_function(prog, "hostadd"), 2))
+        return false;
+    printf("hostadd: %g\n", prog_return(prog)->_float);
+
+    printf("calls: %g\n", host_global(prog, "calls"));
+    prog_reset(prog);
+    printf("calls after reset: %g\n", host_global(prog, "calls"));
+
+    /* errors go to the callback, the program stays usable */
+    printf("callmissing: %s\n", prog_call(prog, host_function(prog, "callmissing"), 0) ? "ok" : "failed");
+    prog_setparm_float(prog, 0, 1);
+    prog_setparm_float(prog, 1, 1);
+    if (!prog_call(prog, host_function(prog, "add"), 2))
+        return false;
+    printf("add: %g\n", prog_return(prog)->_float);
+    (void)file;
+    return true;
+}
+
+const host_test_t host_tests[] = {
+    { "call", host_test_call },
+    { NULL, NULL }
+};
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Runs a program with qcvm for the testsuite, `X: ./tests/report.sh` in a
+# template, with the times in its reports replaced by T so the rest of
+# them can be matched.
+
+./qcvm "$@" | sed -e 's/\("[a-z]*time"\): [0-9.e+-]*/\1: T/g'
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Compiles a source on one and on several threads for the testsuite:
+# `X: ./tests/threads.sh` and `E: source` in a template. Prints how many
+# warnings -j1 gave and a line more for every -j whose diagnostics or
+# progs aren't exactly those of -j1, then runs the progs of -j1.
+
+source="$1"
+for progs; do :; done
+work="${progs}.threads"
+
+./gmqcc -std=gmqcc -j1 tests/defs.qh "${source}" -o "${work}" > "${work}.j1" 2>&1
+mv "${work}" "${work}.dat"
+echo "$(grep -c 'warning:' "${work}.j1") warnings"
+
+for jobs in 2 4 8; do
+    ./gmqcc -std=gmqcc -j${jobs} tests/defs.qh "${source}" -o "${work}" > "${work}.jn" 2>&1
+    cmp -s "${work}.j1" "${work}.jn" || echo "-j${jobs}: the diagnostics differ"
+    cmp -s "${work}.dat" "${work}" || echo "-j${jobs}: the progs differ"
+done
+
+./qcvm "${work}.dat"
+rm -f "${work}" "${work}.dat" "${work}.j1" "${work}.jn"
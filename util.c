@@ -26,6 +26,10 @@
 
 #include "gmqcc.h"
 
+#ifndef _WIN32
+#   include <unistd.h> /* sysconf */
+#endif
+
 /*
  * Initially this was handled with a table in the gmqcc.h header, but
  * much to my surprise the contents of the table was duplicated for
@@ -201,6 +205,32 @@ uint16_t util_crc16(uint16_t current, const char *k, size_t len) {
         h = util_crc16_table[(h>>8)^((unsigned char)*k)]^(h<<8);
     return h;
 }
+/*
+ * FNV-1a, 64 bit. Start from UTIL_FNV64_INIT and pass the result on to
+ * hash data in pieces.
+ */
+uint64_t util_fnv64(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *k     = (const unsigned char*)data;
+    const uint64_t       prime = (((uint64_t)0x100) << 32) | 0x1B3;
+    for (; len; --len, ++k)
+        hash = (hash ^ *k) * prime;
+    return hash;
+}
+
+bool util_fnv64_file(uint64_t *hash, const char *filename) {
+    char    buffer[4096];
+    size_t  read;
+    FILE   *file;
+
+    if (!(file = fs_file_open(filename, "rb")))
+        return false;
+    while ((read = fs_file_read(buffer, 1, sizeof(buffer), file)))
+        *hash = util_fnv64(*hash, buffer, read);
+    read = !fs_file_error(file);
+    fs_file_close(file);
+    return !!read;
+}
+
 /* Reflective Varation (for reference) */
 #if 0
 uint16_t util_crc16(const char *k, int len, const short clamp) {
@@ -402,3 +432,87 @@ void util_seed(uint32_t value) {
 uint32_t util_rand() {
     return rand();
 }
+
+/*
+ * Thin wrappers around the platform threads. The thread function is
+ * passed through a small heap block since the entry point signatures
+ * differ between pthreads and win32.
+ */
+typedef struct {
+    void (*function)(void *);
+    void  *data;
+} util_thread_start_t;
+
+#ifdef _WIN32
+    static DWORD WINAPI util_thread_entry(LPVOID arg) {
+        util_thread_start_t start = *(util_thread_start_t*)arg;
+        mem_d(arg);
+        start.function(start.data);
+        return 0;
+    }
+
+    void util_mutex_lock(util_mutex_t *mutex) {
+        AcquireSRWLockExclusive(mutex);
+    }
+
+    void util_mutex_unlock(util_mutex_t *mutex) {
+        ReleaseSRWLockExclusive(mutex);
+    }
+
+    bool util_thread_create(util_thread_t *thread, void (*function)(void *), void *data) {
+        util_thread_start_t *start = (util_thread_start_t*)mem_a(sizeof(*start));
+        start->function = function;
+        start->data     = data;
+        if (!(*thread = CreateThread(NULL, 0, &util_thread_entry, start, 0, NULL))) {
+            mem_d(start);
+            return false;
+        }
+        return true;
+    }
+
+    void util_thread_join(util_thread_t thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+
+    size_t util_cpu_count(void) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors ? (size_t)info.dwNumberOfProcessors : 1;
+    }
+#else
+    static void *util_thread_entry(void *arg) {
+        util_thread_start_t start = *(util_thread_start_t*)arg;
+        mem_d(arg);
+        start.function(start.data);
+        return NULL;
+    }
+
+    void util_mutex_lock(util_mutex_t *mutex) {
+        pthread_mutex_lock(mutex);
+    }
+
+    void util_mutex_unlock(util_mutex_t *mutex) {
+        pthread_mutex_unlock(mutex);
+    }
+
+    bool util_thread_create(util_thread_t *thread, void (*function)(void *), void *data) {
+        util_thread_start_t *start = (util_thread_start_t*)mem_a(sizeof(*start));
+        start->function = function;
+        start->data     = data;
+        if (pthread_create(thread, NULL, &util_thread_entry, start)) {
+            mem_d(start);
+            return false;
+        }
+        return true;
+    }
+
+    void util_thread_join(util_thread_t thread) {
+        pthread_join(thread, NULL);
+    }
+
+    size_t util_cpu_count(void) {
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        return count > 0 ? (size_t)count : 1;
+    }
+#endif /*! _WIN32 */